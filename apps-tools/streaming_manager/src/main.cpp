@@ -21,6 +21,7 @@
 #include "redpitaya/version.h"
 #include "StreamingApplication.h"
 #include "StreamingManager.h"
+#include "MetricsServer.h"
 
 //extern "C" {
 //    #include "rpApp.h"
@@ -53,6 +54,10 @@ static pthread_mutex_t mutex;
 
 #define SS_8BIT		1
 #define SS_16BIT	2
+#define SS_14BIT	3	// 16 bit samples sent packed to 14 bit
+
+// Scrape with: curl --unix-socket /tmp/stream_manager_metrics.sock http://localhost/metrics
+#define METRICS_ENDPOINT "unix:/tmp/stream_manager_metrics.sock"
 //#define DEBUG_MODE
 
 
@@ -66,15 +71,35 @@ CIntParameter		ss_port(  			"SS_PORT_NUMBER", 		CBaseParameter::RW, 8900,0,	1,65
 CStringParameter    ss_ip_addr(			"SS_IP_ADDR",			CBaseParameter::RW, "",0);
 CIntParameter		ss_protocol(  		"SS_PROTOCOL", 			CBaseParameter::RW, 1 ,0,	1,2);
 CIntParameter		ss_channels(  		"SS_CHANNEL", 			CBaseParameter::RW, 1 ,0,	1,3);
-CIntParameter		ss_resolution(  	"SS_RESOLUTION", 		CBaseParameter::RW, 1 ,0,	1,2);
+CIntParameter		ss_resolution(  	"SS_RESOLUTION", 		CBaseParameter::RW, 1 ,0,	1,3);
 CIntParameter		ss_rate(  			"SS_RATE", 				CBaseParameter::RW, 1 ,0,	1,65536);
-CIntParameter		ss_format( 			"SS_FORMAT", 			CBaseParameter::RW, 0 ,0,	0,1);
+CIntParameter		ss_format( 			"SS_FORMAT", 			CBaseParameter::RW, 0 ,0,	0,2);
 CIntParameter		ss_status( 			"SS_STATUS", 			CBaseParameter::RWSA, 1 ,0,	0,100);
 CIntParameter		ss_acd_max(			"SS_ACD_MAX", 			CBaseParameter::RW, MAX_FREQ ,0,	0, MAX_FREQ);
+CIntParameter		ss_udp_size(		"SS_UDP_SIZE",			CBaseParameter::RW, UDP_BUFFER_LIMIT ,0,	UDP_MIN_BUFFER_LIMIT, UDP_MAX_DATAGRAM / 2);
+CIntParameter		ss_udp_retransmit(	"SS_UDP_RETRANSMIT",	CBaseParameter::RW, 0 ,0,	0, 5000);
+CBooleanParameter 	ss_realtime(		"SS_REALTIME", 	        CBaseParameter::RW, false,0);
+CIntParameter		ss_priority(		"SS_PRIORITY",			CBaseParameter::RW, OSC_THREAD_PRIORITY ,0,	1, 99);
+CIntParameter		ss_resample_up(		"SS_RESAMPLE_UP",		CBaseParameter::RW, 1 ,0,	1, DECIMATOR_MAX_UP);
+CIntParameter		ss_resample_down(	"SS_RESAMPLE_DOWN",		CBaseParameter::RW, 1 ,0,	1, 65536);
+CIntParameter		ss_trigger(			"SS_TRIGGER",			CBaseParameter::RW, 0 ,0,	0, 3);
+CIntParameter		ss_trigger_ch(		"SS_TRIGGER_CH",		CBaseParameter::RW, 1 ,0,	1, 2);
+CIntParameter		ss_trigger_level(	"SS_TRIGGER_LEVEL",		CBaseParameter::RW, 0 ,0,	-32768, 32767);
+CIntParameter		ss_trigger_hyst(	"SS_TRIGGER_HYST",		CBaseParameter::RW, 0 ,0,	0, 32767);
+CIntParameter		ss_trigger_pre(		"SS_TRIGGER_PRE",		CBaseParameter::RW, 1024 ,0,	0, osc_buf_size);
+CIntParameter		ss_trigger_post(	"SS_TRIGGER_POST",		CBaseParameter::RW, 3072 ,0,	1, osc_buf_size);
+CIntParameter		ss_blackbox(		"SS_BLACKBOX",			CBaseParameter::RW, 0 ,0,	0, 256);
+CIntParameter		ss_blackbox_post(	"SS_BLACKBOX_POST",		CBaseParameter::RW, 0 ,0,	0, 60000);
+CBooleanParameter 	ss_blackbox_dump(	"SS_BLACKBOX_DUMP", 	CBaseParameter::RW, false,0);
+CBooleanParameter 	ss_compress(		"SS_COMPRESS", 			CBaseParameter::RW, false,0);
+CIntParameter		ss_segment_mb(		"SS_SEGMENT_MB",		CBaseParameter::RW, 0 ,0,	0, 1024 * 1024);
+CIntParameter		ss_segment_sec(		"SS_SEGMENT_SEC",		CBaseParameter::RW, 0 ,0,	0, 24 * 3600);
 CStringParameter 	redpitaya_model(	"RP_MODEL_STR", 		CBaseParameter::ROSA, RP_MODEL, 10);
 
 CStreamingManager::Ptr s_manger;
 CStreamingApplication  *s_app;
+CMetrics::Ptr          s_metrics;
+CMetricsServer::Ptr    s_metricsServer;
 
 
 void PrintLogInFile(const char *message){
@@ -103,6 +128,9 @@ int rp_app_init(void)
 
 	ss_status.SendValue(0);
 	ss_acd_max.SendValue(MAX_FREQ);
+	// Counters live as long as the application, over all runs of the stream
+	s_metrics = CMetrics::Create();
+	s_metricsServer = CMetricsServer::Create(s_metrics, METRICS_ENDPOINT);
 	try {
 		CStreamingManager::MakeEmptyDir(FILE_PATH);
 	}catch (std::exception& e)
@@ -118,6 +146,7 @@ int rp_app_init(void)
 int rp_app_exit(void)
 {
 	StopServer(0);
+	s_metricsServer = nullptr;
 	fprintf(stderr, "Unloading stream server version %s-%s.\n", VERSION_STR, REVISION_STR);
 	PrintLogInFile("Unloading stream server version");
 
@@ -194,6 +223,107 @@ void UpdateParams(void)
 		ss_format.Update();
 	}
 
+	if (ss_udp_size.IsNewValue())
+	{
+		ss_udp_size.Update();
+	}
+
+	if (ss_udp_retransmit.IsNewValue())
+	{
+		ss_udp_retransmit.Update();
+	}
+
+	if (ss_realtime.IsNewValue())
+	{
+		ss_realtime.Update();
+	}
+
+	if (ss_priority.IsNewValue())
+	{
+		ss_priority.Update();
+	}
+
+	if (ss_resample_up.IsNewValue() || ss_resample_down.IsNewValue())
+	{
+		// Checked as a pair, an unsupported ratio keeps the previous one
+		if (CDecimator::Supported(ss_resample_up.NewValue(), ss_resample_down.NewValue())){
+			ss_resample_up.Update();
+			ss_resample_down.Update();
+		}else{
+			fprintf(stderr, "Error: UpdateParams() resample %d/%d is not supported, keeping %d/%d\n",
+				ss_resample_up.NewValue(), ss_resample_down.NewValue(), ss_resample_up.Value(), ss_resample_down.Value());
+			ss_resample_up.ClearNewValue();
+			ss_resample_down.ClearNewValue();
+			ss_resample_up.SendValue(ss_resample_up.Value());
+			ss_resample_down.SendValue(ss_resample_down.Value());
+		}
+	}
+
+	if (ss_trigger.IsNewValue())
+	{
+		ss_trigger.Update();
+	}
+
+	if (ss_trigger_ch.IsNewValue())
+	{
+		ss_trigger_ch.Update();
+	}
+
+	if (ss_trigger_level.IsNewValue())
+	{
+		ss_trigger_level.Update();
+	}
+
+	if (ss_trigger_hyst.IsNewValue())
+	{
+		ss_trigger_hyst.Update();
+	}
+
+	if (ss_trigger_pre.IsNewValue())
+	{
+		ss_trigger_pre.Update();
+	}
+
+	if (ss_trigger_post.IsNewValue())
+	{
+		ss_trigger_post.Update();
+	}
+
+	if (ss_blackbox.IsNewValue())
+	{
+		ss_blackbox.Update();
+	}
+
+	if (ss_blackbox_post.IsNewValue())
+	{
+		ss_blackbox_post.Update();
+	}
+
+	if (ss_compress.IsNewValue())
+	{
+		ss_compress.Update();
+	}
+
+	if (ss_segment_mb.IsNewValue())
+	{
+		ss_segment_mb.Update();
+	}
+
+	if (ss_segment_sec.IsNewValue())
+	{
+		ss_segment_sec.Update();
+	}
+
+	if (ss_blackbox_dump.IsNewValue())
+	{
+		ss_blackbox_dump.Update();
+		if (ss_blackbox_dump.Value() && s_app != nullptr){
+			PrintLogInFile("Dump black box");
+			s_app->triggerDump();
+		}
+		ss_blackbox_dump.SendValue(false);
+	}
+
 	if (ss_start.IsNewValue())
 	{
 		PrintLogInFile("command");
@@ -276,8 +406,11 @@ void StartServer(){
 				ip_addr_host,
 				std::to_string(sock_port).c_str(),
 				protocol == 1 ? asionet::Protocol::TCP : asionet::Protocol::UDP);
+		s_manger->setUdpBufferLimit(ss_udp_size.Value());
+		s_manger->setUdpRetransmitWindow(ss_udp_retransmit.Value());
 	}else{
-		s_manger = CStreamingManager::Create((format == 0 ? Stream_FileType::WAV_TYPE: Stream_FileType::TDMS_TYPE) , FILE_PATH);
+		s_manger = CStreamingManager::Create((format == 0 ? Stream_FileType::WAV_TYPE: (format == 2 ? Stream_FileType::RAW_TYPE : Stream_FileType::TDMS_TYPE)) , FILE_PATH);
+		s_manger->setFileRotation((uint64_t)ss_segment_mb.Value() * 1024 * 1024, ss_segment_sec.Value());
 		s_manger->notifyStop = [](int status)
 							{
 								StopNonBlocking(2);
@@ -285,12 +418,36 @@ void StartServer(){
 	}
 
 
+	s_manger->setCompression(ss_compress.Value());
+
 	if (s_app!= nullptr){
 		s_app->stop();
 		delete s_app;
 	}
-	int resolution_val = (resolution == 1 ? 8 : 16);
+	int resolution_val = (resolution == SS_8BIT ? 8 : (resolution == SS_14BIT ? 14 : 16));
 	s_app = new CStreamingApplication(s_manger, osc, resolution_val, rate, channel);
+	s_app->setSchedPolicy(ss_realtime.Value() ? CStreamingApplication::SchedPolicy::REALTIME : CStreamingApplication::SchedPolicy::NORMAL, ss_priority.Value());
+	s_app->setStartDelay(1000); // The delay is necessary for the web interface of the application to update
+	s_app->setMetrics(s_metrics);
+	if (!s_app->setDecimator(ss_resample_up.Value(), ss_resample_down.Value())){
+		fprintf(stderr, "Error: StartServer() resample %d/%d is not supported\n", ss_resample_up.Value(), ss_resample_down.Value());
+	}
+	if (ss_trigger.Value() != 0){
+		TriggerSettings trigger;
+		trigger.channel = ss_trigger_ch.Value();
+		trigger.level = ss_trigger_level.Value();
+		trigger.hysteresis = ss_trigger_hyst.Value();
+		trigger.edge = ss_trigger.Value() == 1 ? TriggerEdge::RISING : (ss_trigger.Value() == 2 ? TriggerEdge::FALLING : TriggerEdge::BOTH);
+		trigger.preSamples = ss_trigger_pre.Value();
+		trigger.postSamples = ss_trigger_post.Value();
+		if (!s_app->setTrigger(trigger)){
+			fprintf(stderr, "Error: StartServer() trigger window %u + %u is not supported\n", trigger.preSamples, trigger.postSamples);
+		}
+	}
+	if (use_file && ss_blackbox.Value() > 0){
+		// Size in MiB
+		s_app->setBlackBox(static_cast<size_t>(ss_blackbox.Value()) * 1024 * 1024, ss_blackbox_post.Value());
+	}
 	ss_status.SendValue(1);
 	PrintLogInFile("ss_status.SendValue(1)");
     s_app->runNonBlock();
@@ -9,18 +9,25 @@
 #include <chrono>
 #include "rpsa/server/core/AsioNet.h"
 #include "rpsa/server/core/StreamingManager.h"
+#include "rpsa/server/core/StreamReceiver.h"
 
 
 using namespace std;
 
+enum OutputType {
+    OUT_FILE, // TDMS or WAV through the streaming manager
+    OUT_RAW,  // Samples of each channel appended to one file
+    OUT_NONE  // Received and decoded only, for throughput checks
+};
+
 CStreamingManager::Ptr                g_manger;
 asionet::CAsioNet::Ptr                g_asionet;
-bool                                  g_terminate;
-uint64_t                              g_BytesCount;
-long long int                         g_timeBegin;
-uint64_t                              g_lostRate;
-uint64_t                              g_packCounter_ch1;
-uint64_t                              g_packCounter_ch2;
+CStreamReceiver::Ptr                  g_receiver;
+volatile bool                         g_terminate;
+OutputType                            g_output;
+FILE                                 *g_raw_ch1;
+FILE                                 *g_raw_ch2;
+bool                                  g_retransmit;
 
 char* getCmdOption(char ** begin, char ** end, const std::string & option)
 {
@@ -94,7 +101,11 @@ void UsingArgs(char const* progName){
     std::cout << "\t-h IP_ADDRESS:[port] (default value 8900)\n";
     std::cout << "\t-p Protocol (TCP or UDP required value)\n";
     std::cout << "\t-f Path to the directory where to save files\n";
-    std::cout << "\t-t Type of file (tdms or wav required value)\n";
+    std::cout << "\t-t Type of file (tdms, wav, bin, raw or none required value)\n";
+    std::cout << "\t   bin - interleaved samples with an index, raw - one file per channel\n";
+    std::cout << "\t-r Retransmit window in ms for UDP (optional, server must have it on)\n";
+    std::cout << "\t-c Credit window in packs for TCP (optional)\n";
+    std::cout << "\t-b Receive blocks buffered for the writer (optional, default " << RECEIVER_BLOCK_COUNT << ")\n";
 
 
 }
@@ -123,54 +134,55 @@ std::string time_point_to_string(std::chrono::system_clock::time_point &tp)
     return result;
 }
 
-void reciveData(std::error_code error,uint8_t *buff,size_t _size){
-     //std::cout << "Get data: " <<  _size << "\n";
-     g_BytesCount += _size;
-     uint8_t *ch1 = nullptr;
-     uint8_t *ch2 = nullptr;
-     size_t   size_ch1 = 0;
-     size_t   size_ch2 = 0;
-     uint64_t id = 0;
-     uint64_t lostRate = 0;
-     uint32_t oscRate = 0;
-     uint32_t resolution = 0;
-     asionet::CAsioNet::ExtractPack(buff,_size, id, lostRate,oscRate, resolution, ch1, size_ch1, ch2 , size_ch2);
-
-     g_packCounter_ch1 += size_ch1 / (resolution == 16 ? 2 : 1);
-     g_packCounter_ch2 += size_ch2 / (resolution == 16 ? 2 : 1);
-     g_lostRate += lostRate;
-
-
-     g_manger->passBuffers(lostRate, oscRate, ch1 , size_ch1 ,  ch2 , size_ch2 , resolution, id);
-
-
-//     std::cout << id << " ; " <<  _size  <<  " ; " << resolution << " ; " << size_ch1 << " ; " << size_ch2 << "\n";
-
-     delete [] ch1;
-     delete [] ch2;
-
-     std::chrono::system_clock::time_point timeNow = std::chrono::system_clock::now();
-     auto curTime = std::chrono::time_point_cast<std::chrono::milliseconds >(timeNow);
-     auto value = curTime.time_since_epoch();
-//     std::cout << value.count() << "\n";
-//     std::cout <<  g_timeBegin << "\n";
-     if ((value.count() - g_timeBegin) >= 5000) {
-
-         std::cout << time_point_to_string(timeNow) << " bandwidth: " << g_BytesCount / (1024 * 1024 * 5) << " MiB/s;\nData count ch1:\t" << g_packCounter_ch1
-                 << " ch2:\t" << g_packCounter_ch2 <<  " Lost: \t"<< g_lostRate << "\n\n";
-         g_BytesCount = 0;
-         g_lostRate = 0;
-         g_timeBegin = value.count();
-     }
-
+bool writeBlock(const CStreamReceiver::Block &_block){
+    switch (g_output) {
+        case OUT_FILE:
+            g_manger->passBuffers(_block.info, _block.ch1, _block.size_ch1, _block.ch2, _block.size_ch2);
+            return g_manger->isFileThreadWork();
+        case OUT_RAW:
+            if (_block.size_ch1 > 0 && fwrite(_block.ch1, 1, _block.size_ch1, g_raw_ch1) != _block.size_ch1)
+                return false;
+            if (_block.size_ch2 > 0 && fwrite(_block.ch2, 1, _block.size_ch2, g_raw_ch2) != _block.size_ch2)
+                return false;
+            return true;
+        default:
+            return true;
+    }
+}
 
+void printStats(std::chrono::system_clock::time_point &_timeNow, double _seconds){
+    auto stats = g_receiver->takeStats();
+    std::cout << time_point_to_string(_timeNow) << " bandwidth: " << stats.bytes / (1024 * 1024 * _seconds) << " MiB/s;\nData count ch1:\t" << stats.samples_ch1
+              << " ch2:\t" << stats.samples_ch2 <<  " Lost: \t"<< stats.lostRate << " Dropped samples: \t" << stats.lostSamples << " Bad packs: \t" << stats.badPacks;
+    if (stats.lostPacks > 0)
+        std::cout << " Lost packs: \t" << stats.lostPacks;
+    if (stats.overruns > 0)
+        std::cout << " Overruns: \t" << stats.overruns;
+    if (stats.records > 0)
+        std::cout << " Trigger records: \t" << stats.records;
+    if (stats.compressedPacks > 0 && stats.bytes > 0)
+        std::cout << " Compression: \t" << (double)stats.decodedBytes / stats.bytes;
+    std::cout << "\n\n";
+    if (g_retransmit) {
+        auto retransmit = g_asionet->GetRetransmitStats();
+        std::cout << "NACK: " << retransmit.nacks << " recovered: " << retransmit.retransmitted << " unrecoverable: " << retransmit.unrecoverable << "\n\n";
+    }
+}
 
+FILE *openRaw(const string &_filePath, const string &_time, const char *_channel){
+    string name = _filePath + "/data_file_" + _time + "_" + _channel + ".bin";
+    FILE *file = fopen(name.c_str(), "wb");
+    if (file == nullptr) {
+        std::cout << "Error: can not open " << name << "\n";
+        return nullptr;
+    }
+    setvbuf(file, nullptr, _IOFBF, 1024 * 1024);
+    std::cout << name << "\n";
+    return file;
 }
 
 
 void sigHandler (int sigNum){
-    g_manger->stop();
-    g_asionet->Stop();
     g_terminate = true;
 }
 
@@ -181,15 +193,12 @@ int main(int argc, char* argv[])
 //    {
 
         std::chrono::system_clock::time_point timeNow = std::chrono::system_clock::now();
-        auto curTime = std::chrono::time_point_cast<std::chrono::milliseconds >(timeNow);
-        auto value = curTime.time_since_epoch();
-        g_timeBegin = value.count();
-
-        g_packCounter_ch1 = 0;
-        g_packCounter_ch2 = 0;
-        g_lostRate = 0;
-        g_BytesCount = 0;
+        auto timeBegin = std::chrono::steady_clock::now();
+
+        g_retransmit = false;
         g_terminate = false;
+        g_raw_ch1 = nullptr;
+        g_raw_ch2 = nullptr;
         signal(SIGINT, sigHandler);
       //  signal(SIGKILL, sigHandler);
         asionet::Protocol protocol_val;
@@ -198,6 +207,9 @@ int main(int argc, char* argv[])
         char * ip_port   = getCmdOption(argv, argv + argc, "-h");
         char * protocol  = getCmdOption(argv, argv + argc, "-p");
         char * type_file = getCmdOption(argv, argv + argc, "-t");
+        char * retransmit = getCmdOption(argv, argv + argc, "-r");
+        char * credits = getCmdOption(argv, argv + argc, "-c");
+        char * blocks = getCmdOption(argv, argv + argc, "-b");
         bool checkParameters = false;
         checkParameters |= CheckMissing(ip_port,"IP address of server");
         checkParameters |= CheckMissing(protocol,"Protocol");
@@ -227,31 +239,69 @@ int main(int argc, char* argv[])
             return -1;
         }
 
+        if (strcmp(type_file,"tdms") == 0 || strcmp(type_file,"wav") == 0 || strcmp(type_file,"bin") == 0){
+            g_output = OUT_FILE;
+            g_manger = CStreamingManager::Create((strcmp(type_file,"wav") == 0 ? Stream_FileType::WAV_TYPE :
+                                                  (strcmp(type_file,"bin") == 0 ? Stream_FileType::RAW_TYPE : Stream_FileType::TDMS_TYPE)), filepath);
+            // Blocks wait in the receive pool while the disk is busy
+            g_manger->setFileBackpressure(true);
+            g_manger->run();
+        }else if (strcmp(type_file,"raw") == 0){
+            g_output = OUT_RAW;
+            string time = time_point_to_string(timeNow);
+            g_raw_ch1 = openRaw(filepath, time, "ch1");
+            g_raw_ch2 = openRaw(filepath, time, "ch2");
+            if (g_raw_ch1 == nullptr || g_raw_ch2 == nullptr)
+                return -1;
+        }else if (strcmp(type_file,"none") == 0){
+            g_output = OUT_NONE;
+        }else{
+            std::cout << "Error: Type of file has wrong format\n";
+            UsingArgs(argv[0]);
+            return -1;
+        }
 
-
-        g_manger = CStreamingManager::Create((strcmp(type_file,"wav") == 0 ?
-                                              Stream_FileType::WAV_TYPE : Stream_FileType::TDMS_TYPE)  , filepath);
-
-        g_manger->run();
-
+        size_t pool_blocks = blocks != nullptr && atoi(blocks) > 0 ? atoi(blocks) : RECEIVER_BLOCK_COUNT;
         g_asionet = asionet::CAsioNet::Create(asionet::Mode::CLIENT, protocol_val ,host , port);
+        g_receiver = CStreamReceiver::Create(g_asionet, CBufferPool::Create(RECEIVER_BLOCK_SIZE, pool_blocks));
         g_asionet->addCallClient_Connect([](std::string host) { std::cout << "Try connect " << host << '\n'; });
         g_asionet->addCallClient_Error([](std::error_code error)
                                        {
                                            std::cout << "Disconnect;" << '\n';
                                            sigHandler(0);
                                        });
-        g_asionet->addCallReceived(reciveData);
+        g_retransmit = (retransmit != nullptr && protocol_val == asionet::Protocol::UDP && atoi(retransmit) > 0);
+        if (g_retransmit)
+            g_asionet->SetRetransmitWindow(atoi(retransmit));
+        if (credits != nullptr && protocol_val == asionet::Protocol::TCP)
+            g_asionet->SetCreditWindow(atoi(credits));
         g_asionet->Start();
-        while(g_manger->isFileThreadWork() &&  !g_terminate){
-#ifdef _WIN32
-			Sleep(1000);			
-#else
-			sleep(1);
-#endif // _WIN32
-            
+
+        // Consumer: the io thread only decodes into pool blocks, writing happens here
+        bool work = true;
+        while(work && !g_terminate){
+            CStreamReceiver::Block block;
+            while (work && g_receiver->pop(block)) {
+                work = writeBlock(block);
+                g_receiver->release(block);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+            auto now = std::chrono::steady_clock::now();
+            double seconds = std::chrono::duration<double>(now - timeBegin).count();
+            if (seconds >= 5) {
+                timeNow = std::chrono::system_clock::now();
+                printStats(timeNow, seconds);
+                timeBegin = now;
+            }
         }
-        sigHandler(0);
+        g_asionet->Stop();
+        if (g_manger)
+            g_manger->stop(true);
+        if (g_raw_ch1 != nullptr)
+            fclose(g_raw_ch1);
+        if (g_raw_ch2 != nullptr)
+            fclose(g_raw_ch2);
 //    }
 //    catch (std::exception& e)
 //   {
@@ -27,6 +27,8 @@ namespace TDMS
 	private:
 		vector<shared_ptr<Metadata>> LoadMetadata(Reader &reader);
 		vector<shared_ptr<Segment>>  GetSegments(Reader &reader);
+		// Channels with the rpsa_codec property get their samples back (sample_codec.h)
+		bool                         DecodeSamples(shared_ptr<Metadata> metadata);
 
 	};
 }
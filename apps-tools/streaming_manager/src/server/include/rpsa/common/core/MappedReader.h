@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define TDMS_INDEX_SUFFIX  ".tdmsidx"
+#define TDMS_INDEX_MAGIC   0x49534454 // "TDSI"
+#define TDMS_INDEX_VERSION 1
+
+namespace TDMS
+{
+    // Read-only access to a TDMS file through mmap. Open() walks the lead-ins and object lists
+    // once and keeps one small record per chunk of every channel (file offset, first sample,
+    // sample count), the samples themselves are never copied into the heap. A range of a
+    // channel is then found by binary search and returned as views into the mapping.
+    //
+    // Segments written by FileQueueManager with the rpsa_codec property (sample_codec.h) can
+    // only be read(), they have no view. A file that is still being written is indexed up to
+    // its last complete chunk.
+    //
+    // When the file can not be mapped, e.g. a recording larger than the address space of a
+    // 32 bit system, it is read with pread instead: read() works the same, view() returns false.
+    class MappedReader
+    {
+    public:
+        using Ptr = std::shared_ptr<MappedReader>;
+
+        struct ChannelInfo{
+            std::string path;       // /'Group'/'ch1'
+            std::string name;       // ch1
+            uint32_t    dataType;   // Of the samples, compressed chunks decode to the same type
+            uint64_t    samples;
+            bool        compressed; // At least one chunk needs decoding
+        };
+
+        // Sample i of a run is at data + i * stride
+        template<typename T>
+        struct View{
+            const uint8_t *data;
+            uint64_t       count;
+            uint32_t       stride;
+
+            T operator[](uint64_t i) const { T value; memcpy(&value, data + i * stride, sizeof(T)); return value; }
+            // nullptr when the samples are interleaved with other channels
+            const T* contiguous() const { return stride == sizeof(T) ? (const T*)data : nullptr; }
+        };
+
+        // _cache - take the index from <file>.tdmsidx when it belongs to this file (size and
+        // modification time), build it and write it there otherwise.
+        // _map - false reads with pread from the start, as when the mapping fails.
+        // Returns an empty pointer when the file can not be opened or is not TDMS.
+        static Ptr Open(const std::string &_fileName, bool _cache = false, bool _map = true);
+
+        MappedReader(const MappedReader &) = delete;
+        MappedReader(MappedReader &&) = delete;
+        ~MappedReader();
+
+        const std::vector<ChannelInfo>& channels() const { return m_channels; }
+        // -1 when there is no such channel, _name is the channel name or the full path
+        int      findChannel(const std::string &_name) const;
+        uint64_t fileSize() const { return m_size; }
+        // False when the file is read with pread, there are no views then
+        bool     mapped() const { return m_data != nullptr; }
+        // Segments with samples of any channel
+        uint32_t segments() const { return m_segments; }
+        // Samples of _channel that are stored in _segment, for splitting the work by segment
+        bool     segmentRange(int _channel, uint32_t _segment, uint64_t &_first, uint64_t &_count) const;
+
+        // Zero copy: replaces _views by the runs that cover [_first, _first + _count) of _channel.
+        // False for a range past the end, a compressed chunk in the range, sizeof(T) that is
+        // not the size of the samples or a file that is not mapped.
+        template<typename T>
+        bool view(int _channel, uint64_t _first, uint64_t _count, std::vector<View<T>> &_views) const;
+        // Copies the samples of the range to _dst, compressed chunks are decoded. Thread safe.
+        bool read(int _channel, uint64_t _first, uint64_t _count, void *_dst) const;
+
+    private:
+        #pragma pack(push, 1)
+        struct Chunk{
+            uint64_t offset;     // Of the first sample or of the compressed stream in the file
+            uint64_t first;      // Index of the first sample in the channel
+            uint64_t count;
+            uint64_t bytes;      // Of the compressed stream
+            uint32_t segment;
+            uint16_t stride;
+            uint8_t  sampleSize;
+            uint8_t  compressed;
+        };
+        #pragma pack(pop)
+
+        MappedReader();
+        bool map(const std::string &_fileName, bool _map);
+        void unmap();
+        bool buildIndex();
+        bool loadIndex(const std::string &_indexName);
+        bool saveIndex(const std::string &_indexName) const;
+        // First chunk of _channel that holds _sample, -1 past the end
+        int64_t findChunk(int _channel, uint64_t _sample) const;
+        const uint8_t* data(const Chunk &_chunk) const { return m_data + _chunk.offset; }
+        // pread of a file that is not mapped
+        bool           readAt(uint64_t _offset, void *_dst, uint64_t _size) const;
+        // _size bytes from _offset: in the mapping or read into _buffer. nullptr on a read error.
+        const uint8_t* fetch(uint64_t _offset, uint64_t _size, std::vector<uint8_t> &_buffer) const;
+
+        const uint8_t*                  m_data;
+        uint64_t                        m_size;
+        int64_t                         m_mtime;
+        uint32_t                        m_segments;
+        std::vector<ChannelInfo>        m_channels;
+        std::vector<std::vector<Chunk>> m_chunks; // Per channel, ordered by first
+#ifdef _WIN32
+        void*                           m_file;
+        void*                           m_mapping;
+#else
+        int                             m_fd;     // Open when the file is not mapped
+#endif
+    };
+
+    template<typename T>
+    bool MappedReader::view(int _channel, uint64_t _first, uint64_t _count, std::vector<View<T>> &_views) const{
+        _views.clear();
+        if (!m_data || _channel < 0 || _channel >= (int)m_channels.size() || _first + _count > m_channels[_channel].samples)
+            return false;
+        auto &chunks = m_chunks[_channel];
+        for (int64_t i = findChunk(_channel, _first); _count > 0; ++i){
+            if (i < 0 || i >= (int64_t)chunks.size())
+                return false;
+            auto &chunk = chunks[i];
+            if (chunk.compressed || chunk.sampleSize != sizeof(T))
+                return false;
+            uint64_t skip = _first - chunk.first;
+            uint64_t count = std::min<uint64_t>(chunk.count - skip, _count);
+            _views.push_back({data(chunk) + skip * chunk.stride, count, chunk.stride});
+            _first += count;
+            _count -= count;
+        }
+        return true;
+    }
+}
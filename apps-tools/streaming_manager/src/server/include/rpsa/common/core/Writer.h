@@ -53,6 +53,49 @@ namespace TDMS
         void PopPPosition();
     };
 
+    // Serializes a segment with one group and fixed-type channels straight
+    // into caller memory, without building Metadata objects. The byte layout
+    // is the same as Writer::Write produces for such a segment.
+    class MemoryWriter {
+    public:
+        struct Channel {
+            const char *name;
+            uint32_t    dataType;
+            const void *data;
+            uint64_t    size; // bytes
+            const char *codec; // Compressed samples (sample_codec.h): written as property rpsa_codec, nullptr - none
+        };
+
+        static size_t HeaderSize(const char *groupName, const Channel *channels, int count);
+        static size_t WriteSegment(uint8_t *dst, size_t capacity, const char *groupName, const Channel *channels, int count);
+    };
+
+    // Stateful variant of MemoryWriter for continuous streams. The first
+    // segment carries the lead-in and the full object list, following
+    // segments with the same channel layout carry a lead-in and raw data
+    // only and reuse the previous object list. A segment that never reaches
+    // the file must be followed by Reset(), the next one then carries the
+    // object list again.
+    class StreamWriter {
+    public:
+        static const int MaxChannels = 4;
+
+        StreamWriter();
+        void   Reset();
+        size_t WriteSegment(uint8_t *dst, size_t capacity, const char *groupName, const MemoryWriter::Channel *channels, int count);
+        static size_t RawLeadInSize() { return 28; }
+
+    private:
+        bool IsSameLayout(const MemoryWriter::Channel *channels, int count);
+        void StoreLayout(const MemoryWriter::Channel *channels, int count);
+
+        bool     m_hasMetadata;
+        int      m_count;
+        char     m_names[MaxChannels][16];
+        uint32_t m_types[MaxChannels];
+        uint64_t m_sizes[MaxChannels];
+        bool     m_codecs[MaxChannels];
+    };
 
 }
 
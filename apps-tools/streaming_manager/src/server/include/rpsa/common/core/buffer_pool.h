@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include "spsc_ring.h"
+
+#define BUFFER_POOL_ALIGN 4096
+
+// Fixed-size, aligned blocks carved from one preallocated slab.
+// Blocks are borrowed by one thread (producer) and released by one other
+// thread (consumer), the free list is a lock-free SPSC ring.
+class CBufferPool
+{
+public:
+    using Ptr = std::shared_ptr<CBufferPool>;
+
+    static Ptr Create(size_t _blockSize, size_t _count, size_t _align = BUFFER_POOL_ALIGN);
+
+    CBufferPool(size_t _blockSize, size_t _count, size_t _align);
+    CBufferPool(const CBufferPool &) = delete;
+    CBufferPool(CBufferPool &&) = delete;
+    ~CBufferPool();
+
+    uint8_t *borrow();
+    void     release(uint8_t *_block);
+    // release() for blocks that may be returned from several threads
+    void     releaseShared(uint8_t *_block);
+
+    size_t blockSize() const { return m_blockSize; }
+    size_t count() const { return m_count; }
+    size_t available() const { return m_free.size(); }
+
+private:
+    uint8_t            *m_slab;
+    size_t              m_blockSize;
+    size_t              m_count;
+    SPSCRing<uint8_t *> m_free;
+    std::mutex          m_releaseLock;
+};
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// CRC32C (Castagnoli, reflected polynomial 0x82F63B78) as used by iSCSI and ext4.
+// Chain calls to cover data in several pieces:
+//     crc = crc32c(crc32c(0, a, size_a), b, size_b)
+uint32_t crc32c(uint32_t _crc, const void *_data, size_t _size);
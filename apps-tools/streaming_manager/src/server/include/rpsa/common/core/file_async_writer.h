@@ -1,22 +1,66 @@
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
 #include <thread>
 #include <vector>
 #include <list>
+#include <deque>
+#include <functional>
 #include <asio.hpp>
 #include <fstream>
 #include <iostream>
 #include "thread_cout.h"
 #include "types.h"
+#include "spsc_ring.h"
+#include "buffer_pool.h"
+#include "file_backend.h"
+#include "metrics.h"
+#include "raw_file.h"
+#include "Writer.h"
 
 
 #define USING_FREE_SPACE 1024 * 1024 * 30 // Left free on disk 30 Mb
+#define FILE_QUEUE_SIZE  4096             // Max blocks waiting for write
+#define FILE_POOL_BLOCKS 128              // Blocks in the file pool, about 400 ms of data at 40 MB/s
+#define FILE_QUEUE_SPIN  64               // Polls of an empty queue before the writer sleeps
+#define FILE_QUEUE_SLEEP 10               // ms, longest writer sleep, bounds a missed wake up
+#define FILE_BLOCK_HEADER 4096             // Space reserved in each block for TDMS/WAV framing
+#define WAV_CHECKPOINT_INTERVAL 1000       // ms between WAV header size updates
 
 
 enum Stream_FileType{
     TDMS_TYPE,
     WAV_TYPE,
+    RAW_TYPE,  // Interleaved samples without framing and a sidecar index, see raw_file.h
+};
+
+// Samples carried by a queued block, used for the metrics and the segment manifest
+struct FileBlockInfo{
+    uint64_t readyNs;     // metricsNowNs() when the samples were acquired, 0 - unknown
+    uint64_t sampleIndex; // First sample of the block
+    uint64_t samples;     // Samples per channel
+    uint64_t timestamp;   // CLOCK_REALTIME ns of the first sample, 0 - unknown
+};
+
+// Buffer descriptor passed from producer to writer thread
+struct QueueItem{
+    uint8_t      *buffer;
+    size_t        size;
+    uint32_t      segment; // File of a segmented recording the block belongs to
+    FileBlockInfo info;
+};
+
+// One file of a segmented recording. Samples [firstSample, endSample) are in it,
+// blocks that were dropped leave gaps that are reported in the .log file.
+struct FileSegment{
+    std::string file;
+    uint64_t    firstSample;
+    uint64_t    endSample;
+    uint64_t    firstTimestamp;
+    uint64_t    blocks;
+    uint64_t    bytes;
+    bool        complete; // Closed and flushed
 };
 
 class Queue
@@ -26,17 +70,22 @@ public:
 protected:
     Queue();
     ~Queue();
-    void pushQueue(std::iostream* buffer);
-    std::iostream* popQueue();
-    long long int  m_useMemory;    
+    bool pushQueue(uint8_t* buffer, size_t size, uint32_t segment, const FileBlockInfo &info);
+    bool popQueue(QueueItem &item);
+    // Consumer side. Spins a little on an empty queue, then sleeps until pushQueue or wakeQueue.
+    void waitQueue();
+    void wakeQueue();
 private:
-    std::list<std::iostream*> m_queue;
-    std::mutex mutex_;    
+    SPSCRing<QueueItem> m_queue;
+    std::mutex          m_wakeLock;
+    std::condition_variable m_wakeCond;
+    std::atomic<bool>   m_sleeping;
 };
 
 
 class FileQueueManager:public Queue{
-    std::fstream fs;
+    CFileBackend::Ptr  m_backend;
+    CFileBackend::Type m_backendType;
     std::thread *th;
     std::atomic_flag m_ThreadRun = ATOMIC_FLAG_INIT;
     bool m_threadWork;
@@ -47,20 +96,97 @@ class FileQueueManager:public Queue{
     bool m_firstSectionWrite; // Need for detect first section of wav file
     void Task();
    ulong m_freeSize;
-   ulong m_hasWriteSize;   
+   uint64_t m_hasWriteSize;
+    std::vector<uint8_t> m_wavHeader; // Copy of the WAV header, sizes are patched in memory
+    uint32_t m_wavCheckpointInterval;
+    int      m_cpu;
+    std::chrono::steady_clock::time_point m_wavCheckpoint;
 unsigned long long m_aviablePhyMemory; 
+    CBufferPool::Ptr m_pool;
+    uint8_t         *m_spareBlock; // Producer side block returned without write
+    TDMS::StreamWriter m_tdmsWriter;
+    CMetricCounter::Ptr   m_metricBytes;
+    CMetricCounter::Ptr   m_metricBlocks;
+    CMetricGauge::Ptr     m_metricPoolUsed;
+    CMetricGauge::Ptr     m_metricPoolSize;
+    CMetricHistogram::Ptr m_metricLatency;
+    std::string        m_fileName;          // Passed to OpenFile, segment names are made from it
+    uint64_t           m_segmentBytes;
+    uint32_t           m_segmentSeconds;
+    // Producer side of a segmented recording
+    uint32_t           m_producerSegment;
+    bool               m_segmentStart;      // The first block of m_producerSegment is not queued yet
+    uint64_t           m_producerSegmentSize;
+    uint64_t           m_producerSegmentTime;
+    // Writer side
+    uint32_t           m_writeSegment;
+    uint64_t           m_segmentWriteSize;  // Bytes of the current file, the WAV data size
+    FileSegment        m_activeSegment;
+    // Opens the next segment ahead of time and closes the finished ones, off the writer thread
+    std::thread       *m_segmentThread;
+    bool               m_segmentThreadRun;
+    std::mutex         m_segmentLock;
+    std::condition_variable m_segmentCond;
+    std::deque<std::function<void()>> m_segmentTasks;
+    CFileBackend::Ptr  m_nextBackend;
+    uint32_t           m_nextSegment;       // Segment m_nextBackend is opened for
+    std::vector<FileSegment> m_segments;    // Guarded by m_segmentLock
+    std::atomic<uint64_t> m_nextReserved;   // GetReserved() of m_nextBackend
+    void DiscardQueue();
+    uint64_t ReservedSize();
+    bool IsSegmented() { return m_segmentBytes > 0 || m_segmentSeconds > 0; }
+    std::string SegmentName(uint32_t _segment);
+    std::string ManifestName();
+    CFileBackend::Ptr OpenSegment(uint32_t _segment);
+    void PostSegmentTask(std::function<void()> _task);
+    void SegmentTask();
+    void OpenNextSegment();
+    void NextWriteSegment(uint32_t _segment);
+    void WriteManifest(const std::vector<FileSegment> &_segments);
+    // RAW_TYPE
+    std::mutex          m_rawLock;
+    RawIndexHeader      m_rawHeader;        // Set by the producer, guarded by m_rawLock
+    CRawIndexWriter::Ptr m_rawIndex;        // Of the file being written
 public:
     FileQueueManager();
     ~FileQueueManager();
     static ulong GetFreeSpaceDisk(std::string _filePath);
-    void StartWrite(Stream_FileType _fileType);
+    void StartWrite(Stream_FileType _fileType, size_t _blockSize);
     void StopWrite(bool waitAllWrite);
     bool IsWork() { return  m_threadWork && !m_hasErrorWrite;};
     int  WriteToFile();
-    bool AddBufferToWrite(std::iostream *buffer);
+    uint8_t *GetFreeBlock();
+    size_t   GetBlockSize();
+    bool AddBufferToWrite(uint8_t *buffer, size_t size, const FileBlockInfo &info = FileBlockInfo());
     void OpenFile(std::string FileName,bool append);
     void CloseFile();
+    // Segmented recording: a new file after _bytes of blocks or _seconds of samples, 0 - no limit,
+    // both 0 - a single file. Applied by the next OpenFile. Segments are FileName with _00000,
+    // _00001 ... before the extension and are listed in <name>.manifest.json, which is rewritten
+    // each time a segment is closed. The next segment is opened and preallocated in advance,
+    // finished ones are closed on a helper thread, so the writer thread only swaps files.
+    void SetRotation(uint64_t _bytes, uint32_t _seconds);
+    // Producer side. True until the first block of the current segment is queued,
+    // that block has to start with the file framing (TDMS metadata, WAV header).
+    bool IsSegmentStart() { return m_segmentStart; }
+    // Producer side. Starts a new segment when a block of about _size bytes with the first sample
+    // at _timestamp (CLOCK_REALTIME ns) does not fit the current one. Returns true if it did.
+    bool RotateIfNeeded(size_t _size, uint64_t _timestamp);
+    void SetBackendType(CFileBackend::Type _type) { m_backendType = _type; }
+    // 0 - update the WAV header only when writing stops
+    void SetWavCheckpointInterval(uint32_t _ms) { m_wavCheckpointInterval = _ms; }
+    // CPU the write thread is pinned to by the next StartWrite, -1 - no pinning
+    void SetCpuAffinity(int _cpu) { m_cpu = _cpu; }
+    // Written bytes and blocks, pool blocks in use and the acquisition to disk latency.
+    // Set before StartWrite, nullptr turns them off.
+    void SetMetrics(CMetrics::Ptr _metrics);
 static int  AvailableSpace(std::string dst, ulong* availableSize);
-    std::iostream *BuildTDMSStream(uint8_t* buffer_ch1,size_t size_ch1,uint8_t* buffer_ch2,size_t size_ch2,unsigned short resolution);
-    void updateWavFile(int _size);
+    // compressed - the buffers are sample_codec.h streams, written as bytes with the codec property
+    size_t BuildTDMSBlock(uint8_t* dst,const uint8_t* buffer_ch1,size_t size_ch1,const uint8_t* buffer_ch2,size_t size_ch2,unsigned short resolution,bool compressed = false);
+    // RAW_TYPE: the samples of both channels interleaved, 0 when they do not fit the block
+    size_t BuildRawBlock(uint8_t* dst,const uint8_t* buffer_ch1,size_t size_ch1,const uint8_t* buffer_ch2,size_t size_ch2,unsigned short resolution);
+    // RAW_TYPE, producer side: what the index of the next file describes, set before its first
+    // block is queued (IsSegmentStart)
+    void SetRawInfo(const RawIndexHeader &_header);
+    void updateWavFile();
 };
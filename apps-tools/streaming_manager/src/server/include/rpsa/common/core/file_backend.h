@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+#define FILE_CHUNK_SIZE       (1024 * 1024)      // Size of one asynchronous write
+#define FILE_CHUNK_COUNT      8                  // Writes that can be in flight
+#define FILE_PREALLOC_EXTENT  (64 * 1024 * 1024) // fallocate step
+#define FILE_DIRECT_ALIGN     4096               // O_DIRECT buffer and offset alignment
+
+// Sink used by FileQueueManager to put data on disk.
+// Write() appends and may return before the data reaches the disk,
+// the caller's buffer can be reused as soon as Write() returns.
+class CFileBackend
+{
+public:
+    using Ptr = std::shared_ptr<CFileBackend>;
+
+    enum Type{
+        STREAM, // std::fstream, page cache
+        DIRECT  // aligned chunks, O_DIRECT, io_uring or pwrite threads
+    };
+
+    static Ptr Create(Type _type);
+    static Type DefaultType();
+
+    virtual ~CFileBackend() {}
+    virtual bool Open(std::string _fileName, bool _append) = 0;
+    virtual void Close() = 0;
+    virtual bool Write(const void *_data, size_t _size) = 0;
+    virtual bool WriteAt(uint64_t _offset, const void *_data, size_t _size) = 0;
+    virtual bool ReadAt(uint64_t _offset, void *_data, size_t _size) = 0;
+    // Allocates disk space for the first _size bytes up front, the file size is not changed.
+    // Returns false when the backend or the file system can not do it.
+    virtual bool Reserve(uint64_t _size) { static_cast<void>(_size); return false; }
+    // Disk space held past GetSize() by Reserve() and the extents allocated ahead of the data
+    virtual uint64_t GetReserved() { return 0; }
+    virtual bool IsGood() = 0;
+    virtual uint64_t GetSize() = 0;
+    virtual std::string GetName() = 0;
+};
+
+class CStreamFileBackend : public CFileBackend
+{
+public:
+    CStreamFileBackend();
+    ~CStreamFileBackend();
+    bool Open(std::string _fileName, bool _append) override;
+    void Close() override;
+    bool Write(const void *_data, size_t _size) override;
+    bool WriteAt(uint64_t _offset, const void *_data, size_t _size) override;
+    bool ReadAt(uint64_t _offset, void *_data, size_t _size) override;
+    bool IsGood() override;
+    uint64_t GetSize() override;
+    std::string GetName() override { return "stream"; }
+
+private:
+    std::fstream fs;
+    uint64_t     m_size;
+};
+
+#ifndef _WIN32
+
+class CDirectFileBackend : public CFileBackend
+{
+public:
+    CDirectFileBackend();
+    ~CDirectFileBackend();
+    bool Open(std::string _fileName, bool _append) override;
+    void Close() override;
+    bool Write(const void *_data, size_t _size) override;
+    bool WriteAt(uint64_t _offset, const void *_data, size_t _size) override;
+    bool ReadAt(uint64_t _offset, void *_data, size_t _size) override;
+    bool Reserve(uint64_t _size) override;
+    uint64_t GetReserved() override;
+    bool IsGood() override { return !m_error; }
+    uint64_t GetSize() override { return m_size; }
+    std::string GetName() override;
+
+private:
+    struct Chunk{
+        uint8_t *data;
+        size_t   used;
+        uint64_t offset;
+        bool     busy;  // Submitted and not reaped yet
+        struct iovec iov;
+    };
+
+    class Engine;
+    class ThreadEngine;
+    class UringEngine;
+
+    bool StartEngine();
+    void StopEngine();
+    bool SubmitCurrent();
+    bool WaitFreeChunk();
+    bool WaitAll();
+    // Until no chunk in flight touches the pages of [_begin, _end)
+    bool WaitRange(uint64_t _begin, uint64_t _end);
+    void Preallocate(uint64_t _end);
+    void Complete(Chunk *_chunk, long _result);
+
+    int      m_fd;          // O_DIRECT when the file system supports it
+    int      m_fdBuffered;  // Unaligned tail, header patches and reads
+    bool     m_direct;
+    bool     m_error;
+    uint64_t m_size;        // Bytes appended by Write()
+    uint64_t m_allocated;   // End of the fallocate'd range, UINT64_MAX - not supported
+    uint8_t *m_staging;
+    std::vector<Chunk>    m_chunks;
+    std::vector<Chunk *>  m_free;
+    Chunk                *m_current;
+    size_t                m_inFlight;
+    Engine               *m_engine;
+};
+
+#endif
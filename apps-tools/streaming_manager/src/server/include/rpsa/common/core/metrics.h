@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "spsc_ring.h"
+
+#define METRICS_HISTOGRAM_BUCKETS 24 // 1 us .. 4.2 s in powers of two, plus +Inf
+
+// CLOCK_MONOTONIC in ns, the time base of all latency metrics
+uint64_t metricsNowNs();
+
+// Metric values are updated with relaxed atomics from the streaming threads and read by
+// CMetrics::render() from any thread. Each value has its own cache line, so threads updating
+// different metrics never share one.
+
+// Monotonic counter
+class CMetricCounter
+{
+public:
+    using Ptr = std::shared_ptr<CMetricCounter>;
+
+    CMetricCounter(): m_value(0) {}
+
+    void add(uint64_t _value = 1) { m_value.fetch_add(_value, std::memory_order_relaxed); }
+    uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> m_value;
+};
+
+// Current value plus the highest one set since the start, e.g. a queue depth
+class CMetricGauge
+{
+public:
+    using Ptr = std::shared_ptr<CMetricGauge>;
+
+    CMetricGauge(): m_value(0), m_max(0) {}
+
+    // One writer per gauge, so the high water mark needs no compare and swap
+    void set(uint64_t _value){
+        m_value.store(_value, std::memory_order_relaxed);
+        if (_value > m_max.load(std::memory_order_relaxed))
+            m_max.store(_value, std::memory_order_relaxed);
+    }
+    uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+    uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+
+private:
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> m_value;
+    std::atomic<uint64_t> m_max;
+};
+
+// Durations in ns, counted in buckets with power of two bounds from 1 us
+class CMetricHistogram
+{
+public:
+    using Ptr = std::shared_ptr<CMetricHistogram>;
+
+    CMetricHistogram();
+
+    void observe(uint64_t _ns){
+        uint64_t us = (_ns + 999) / 1000;
+        size_t   bucket = us <= 1 ? 0 : 64 - __builtin_clzll(us - 1);
+        if (bucket >= METRICS_HISTOGRAM_BUCKETS)
+            bucket = METRICS_HISTOGRAM_BUCKETS - 1;
+        m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(_ns, std::memory_order_relaxed);
+    }
+    // Upper bound of a bucket in seconds, the last one is +Inf
+    static double bound(size_t _bucket);
+    uint64_t bucket(size_t _bucket) const { return m_buckets[_bucket].load(std::memory_order_relaxed); }
+    uint64_t sum() const { return m_sum.load(std::memory_order_relaxed); }
+
+private:
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> m_buckets[METRICS_HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> m_sum;
+};
+
+// Registry of the metrics of one process, rendered in the Prometheus text format.
+// Metrics are created once when a component is set up; asking again for the same name
+// and labels returns the same metric, so counters survive a restart of the stream.
+class CMetrics
+{
+public:
+    using Ptr = std::shared_ptr<CMetrics>;
+
+    static Ptr Create();
+
+    CMetrics();
+    CMetrics(const CMetrics &) = delete;
+    CMetrics(CMetrics &&) = delete;
+
+    // _labels without braces, e.g. stage="file". Returns an empty pointer when the name is
+    // already used by a metric of another type.
+    CMetricCounter::Ptr   counter(const std::string &_name, const std::string &_labels, const std::string &_help);
+    // _highWater - the family gets <name>_high_water as well, off for constants like a capacity
+    CMetricGauge::Ptr     gauge(const std::string &_name, const std::string &_labels, const std::string &_help, bool _highWater = true);
+    CMetricHistogram::Ptr histogram(const std::string &_name, const std::string &_labels, const std::string &_help);
+
+    // Text exposition format 0.0.4
+    std::string render();
+
+private:
+    enum class Type {
+        COUNTER,
+        GAUGE,
+        HISTOGRAM
+    };
+
+    struct Entry {
+        std::string           labels;
+        CMetricCounter::Ptr   counter;
+        CMetricGauge::Ptr     gauge;
+        CMetricHistogram::Ptr histogram;
+    };
+
+    struct Family {
+        std::string        name;
+        std::string        help;
+        Type               type;
+        bool               highWater;
+        std::vector<Entry> entries;
+    };
+
+    Entry *find(const std::string &_name, const std::string &_labels, const std::string &_help, Type _type, bool _highWater = false);
+
+    std::mutex          m_mutex;
+    std::vector<Family> m_families;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+
+// RAW_TYPE recordings. The data file holds the samples of each block interleaved by channel
+// (ch1, ch2, ch1, ...) as little endian int8 or int16 with nothing in between, so sample k of
+// the file starts at byte k * bytes per frame and a reader can mmap the file and index it
+// directly. Next to it:
+//   <data>.idx  - RawIndexHeader followed by one RawIndexRecord per written block, appended while
+//                 recording. Dropped blocks show up as a jump of sampleIndex between two records.
+//   <data>.json - the same description for scripts, rewritten with the totals on close.
+
+#define RAW_INDEX_MAGIC   0x49525052 // "RPRI"
+#define RAW_INDEX_VERSION 1
+#define RAW_INDEX_FLUSH   64         // Records buffered before readers of a growing file see them
+
+#pragma pack(push, 1)
+struct RawIndexHeader{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerSize;
+    uint16_t recordSize;
+    uint8_t  resolution; // Bits of a stored sample, 8 or 16
+    uint8_t  channels;   // Mask of the stored channels, 1 - ch1, 2 - ch2, interleaved in this order
+    uint32_t reserved;
+    double   sampleRate; // Hz, 0 - unknown
+    double   gain[2];    // Volts = sample * gain + offset, per channel
+    double   offset[2];
+};
+
+struct RawIndexRecord{
+    uint64_t offset;      // Byte offset of the block in the data file
+    uint64_t sampleIndex; // Stream index of the first sample of the block
+    uint64_t samples;     // Samples per channel
+    uint64_t timestamp;   // CLOCK_REALTIME ns of the first sample, 0 - unknown
+};
+#pragma pack(pop)
+
+// Writes the .idx and .json of one data file, used by the writer thread of FileQueueManager
+class CRawIndexWriter
+{
+public:
+    using Ptr = std::shared_ptr<CRawIndexWriter>;
+
+    // _header.sampleRate, resolution, channels, gain and offset describe the data, the rest is
+    // filled in. Returns an empty pointer when the index can not be created.
+    static Ptr Create(const std::string &_dataFile, const RawIndexHeader &_header);
+
+    CRawIndexWriter(const std::string &_dataFile, const RawIndexHeader &_header);
+    CRawIndexWriter(const CRawIndexWriter &) = delete;
+    CRawIndexWriter(CRawIndexWriter &&) = delete;
+
+    void add(const RawIndexRecord &_record);
+    // Flushes the index and writes the .json with the totals, _bytes - size of the data file
+    void close(uint64_t _bytes);
+
+    static uint32_t frameSize(const RawIndexHeader &_header);
+
+private:
+    bool writeJson(bool _complete);
+
+    std::string    m_dataFile;
+    RawIndexHeader m_header;
+    std::ofstream  m_index;
+    uint64_t       m_blocks;
+    uint64_t       m_samples;
+    uint64_t       m_firstSample;
+    uint64_t       m_endSample;
+    uint64_t       m_firstTimestamp;
+    uint64_t       m_gaps;
+    uint64_t       m_bytes;
+};
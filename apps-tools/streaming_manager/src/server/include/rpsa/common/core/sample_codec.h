@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Lossless compression of 8 or 16 bit samples.
+//
+// Stream: 8 byte header (uint32 samples, uint8 resolution, uint8 version, 2 reserved bytes)
+// and a little endian bit stream of blocks of CODEC_BLOCK_SAMPLES samples. Every block picks
+// the predictor (none, x[n-1] or 2x[n-1] - x[n-2]) with the smallest residuals and stores the
+// zig-zag residuals either bit packed at the width of the largest one or Rice coded.
+// Block header, 8 bits: order (2), Rice (1), width or Rice parameter (5).
+// The predictor history runs over the whole stream and starts at 0.
+
+#define CODEC_NAME          "delta-rice-1" // TDMS channel property rpsa_codec
+#define CODEC_VERSION       1
+#define CODEC_HEADER_SIZE   8
+#define CODEC_BLOCK_SAMPLES 128
+
+// Worst case size of the stream
+size_t codecMaxSize(size_t _samples);
+// _resolution 8 or 16. Returns the stream size, 0 if it does not fit in _capacity.
+size_t codecEncode(const void *_src, size_t _samples, unsigned _resolution, uint8_t *_dst, size_t _capacity);
+// Reads the stream header
+bool codecInfo(const uint8_t *_src, size_t _size, size_t &_samples, unsigned &_resolution);
+// _capacity in bytes. False on a damaged stream or a short output buffer.
+bool codecDecode(const uint8_t *_src, size_t _size, void *_dst, size_t _capacity, size_t &_samples);
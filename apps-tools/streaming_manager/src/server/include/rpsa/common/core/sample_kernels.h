@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Copy and conversion kernels for sample buffers. Each kernel has a scalar version and, where
+// the compiler targets them, NEON (ARM) or SSE2 and AVX2 (x86) versions. NEON and SSE2 are
+// chosen at compile time, AVX2 at run time when the CPU has it. All versions take any count
+// and any alignment and give the same result as the scalar one.
+
+enum class KernelIsa {
+    SCALAR,
+    SSE2,
+    AVX2,
+    NEON
+};
+
+// Large copies between sample buffers, on x86 this is memcpy
+void kernelCopy(void *_dst, const void *_src, size_t _bytes);
+// High byte of every sample: 16 bit ADC samples at resolution 8
+void kernelHigh8(int8_t *_dst, const int16_t *_src, size_t _samples);
+// _dst = a0 b0 a1 b1 ...
+void kernelInterleave8(int8_t *_dst, const int8_t *_a, const int8_t *_b, size_t _samples);
+void kernelInterleave16(int16_t *_dst, const int16_t *_a, const int16_t *_b, size_t _samples);
+// _src = a0 b0 a1 b1 ...
+void kernelDeinterleave8(int8_t *_a, int8_t *_b, const int8_t *_src, size_t _samples);
+void kernelDeinterleave16(int16_t *_a, int16_t *_b, const int16_t *_src, size_t _samples);
+// _dst[i] = _src[i] * _gain + _offset
+void kernelToFloat8(float *_dst, const int8_t *_src, size_t _samples, float _gain, float _offset);
+void kernelToFloat16(float *_dst, const int16_t *_src, size_t _samples, float _gain, float _offset);
+
+KernelIsa   kernelIsa();
+const char* kernelIsaName(KernelIsa _isa);
+// Switches all kernels to _isa. False when it is not compiled in or the CPU does not have it.
+// For tests and benchmarks, not while other threads run kernels.
+bool        kernelSetIsa(KernelIsa _isa);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Dense 14 bit samples (resolution 14): 8 samples in 14 bytes. Sample i of a group takes
+// bits 14*i .. 14*i+13 of the little endian 112 bit group. A buffer may end in a partial
+// group, it is cut after the last byte that holds sample bits, so the byte count still
+// gives the sample count.
+
+#define PACK14_GROUP_SAMPLES 8
+#define PACK14_GROUP_BYTES   14
+#define PACK14_MIN          -8192
+#define PACK14_MAX           8191
+
+// Bytes of _samples samples at _resolution 8, 14 or 16
+size_t bytesForSamples(size_t _samples, unsigned _resolution);
+size_t samplesInBytes(size_t _bytes, unsigned _resolution);
+
+// Signed 16 bit samples are saturated to 14 bit
+void pack14(const int16_t *_src, size_t _samples, uint8_t *_dst);
+// Sign extends to 16 bit
+void unpack14(const uint8_t *_src, size_t _samples, int16_t *_dst);
@@ -0,0 +1,94 @@
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#ifndef PROJECT_SPSC_RING_H
+#define PROJECT_SPSC_RING_H
+
+#define CACHE_LINE_SIZE 64
+
+// Fixed-capacity single-producer/single-consumer ring.
+// One thread may call push(), one other thread may call pop().
+// size() and isEmpty() may be called from any thread and never lock.
+template <typename T>
+class SPSCRing
+{
+public:
+    explicit SPSCRing(size_t _capacity):
+        m_capacity(roundPow2(_capacity)),
+        m_mask(m_capacity - 1),
+        m_slots(new T[m_capacity])
+    {
+        m_head.index.store(0, std::memory_order_relaxed);
+        m_head.cache = 0;
+        m_tail.index.store(0, std::memory_order_relaxed);
+        m_tail.cache = 0;
+    }
+
+    ~SPSCRing(){
+        delete [] m_slots;
+    }
+
+    SPSCRing(const SPSCRing &) = delete;
+    SPSCRing(SPSCRing &&) = delete;
+
+    // Producer side. Returns false if the ring is full.
+    bool push(const T &_item){
+        const size_t tail = m_tail.index.load(std::memory_order_relaxed);
+        if (tail - m_tail.cache >= m_capacity){
+            m_tail.cache = m_head.index.load(std::memory_order_acquire);
+            if (tail - m_tail.cache >= m_capacity)
+                return false;
+        }
+        m_slots[tail & m_mask] = _item;
+        m_tail.index.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false if the ring is empty.
+    bool pop(T &_item){
+        const size_t head = m_head.index.load(std::memory_order_relaxed);
+        if (head == m_head.cache){
+            m_head.cache = m_tail.index.load(std::memory_order_acquire);
+            if (head == m_head.cache)
+                return false;
+        }
+        _item = m_slots[head & m_mask];
+        m_head.index.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const{
+        const size_t head = m_head.index.load(std::memory_order_acquire);
+        const size_t tail = m_tail.index.load(std::memory_order_acquire);
+        return tail - head;
+    }
+
+    bool   isEmpty() const { return size() == 0; }
+    size_t capacity() const { return m_capacity; }
+
+private:
+    // Position owned by one side plus a cached copy of the other side's position.
+    // The padding keeps producer and consumer data on different cache lines.
+    struct Side{
+        std::atomic<size_t> index;
+        size_t cache;
+        char   pad[CACHE_LINE_SIZE];
+    };
+
+    static size_t roundPow2(size_t _value){
+        size_t v = 1;
+        while (v < _value) v <<= 1;
+        return v;
+    }
+
+    char         m_padFront[CACHE_LINE_SIZE];
+    const size_t m_capacity;
+    const size_t m_mask;
+    T           *m_slots;
+    char         m_padSlots[CACHE_LINE_SIZE];
+    Side         m_head; // consumer
+    Side         m_tail; // producer
+};
+
+#endif //PROJECT_SPSC_RING_H
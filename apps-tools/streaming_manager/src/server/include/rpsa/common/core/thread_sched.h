@@ -0,0 +1,9 @@
+#pragma once
+
+// Scheduling of the calling thread.
+// Functions return false when the system does not support or refuses the request,
+// e.g. SCHED_FIFO without CAP_SYS_NICE. The thread keeps running as before then.
+
+bool pinCurrentThread(int _cpu);
+bool setCurrentThreadFifo(int _priority);
+bool setCurrentThreadNormal();
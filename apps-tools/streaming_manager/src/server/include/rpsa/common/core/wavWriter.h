@@ -28,12 +28,20 @@ enum class Endianness
 public:
 
     CWaveWriter();
-    void resetHeaderInit();
-    std::iostream *BuildWAVStream(uint8_t* buffer_ch1,size_t size_ch1,uint8_t* buffer_ch2,size_t size_ch2,unsigned short resolution);
+    // false - the next block continues a file and gets no header
+    void resetHeaderInit(bool _headerInit = true);
+    size_t BuildWAVBlock(uint8_t* dst,size_t capacity,const uint8_t* buffer_ch1,size_t size_ch1,const uint8_t* buffer_ch2,size_t size_ch2,unsigned short resolution);
+    // RIFF + JUNK(ds64 placeholder) + fmt + data chunk headers
+    static size_t headerSize() { return 80; }
+    // Rewrites the size fields of a header built by BuildWAVBlock.
+    // Switches the header to RF64 when the file no longer fits 32-bit sizes.
+    static void   UpdateHeaderSizes(uint8_t *header, uint64_t dataSize);
+    // BuildWAVBlock puts the samples per channel of the first block in the sample rate field
+    static void   UpdateSampleRate(uint8_t *header, uint32_t sampleRate);
 private:
-    void BuildHeader(std::stringstream *memory);
-    void addInt32ToFileData (std::stringstream *memory, int32_t i);
-    void addInt16ToFileData (std::stringstream *memory, int16_t i);
-    void addStringToFileData (std::stringstream *memory, std::string s);
+    void BuildHeader(uint8_t *&memory);
+    void addInt32ToFileData (uint8_t *&memory, int32_t i);
+    void addInt16ToFileData (uint8_t *&memory, int16_t i);
+    void addStringToFileData (uint8_t *&memory, std::string s);
     
 };
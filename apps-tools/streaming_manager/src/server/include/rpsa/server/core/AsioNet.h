@@ -8,14 +8,45 @@
 #include <cstdint>
 #include <memory>
 #include <deque>
+#include <array>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <map>
 
-#include "neon_asm.h"
 #include "asio.hpp"
 #include "EventHandlers.h"
+#include "buffer_pool.h"
 //#include "rpsa/common/messaging/message_factory.h"
 //#include "rpsa/common/io/basic_buffer.h"
 
 #define  SOCKET_BUFFER_SIZE 65536
+#define  UDP_MAX_DATAGRAM   8972  // Jumbo frame MTU 9000 without IPv4 and UDP headers
+#define  UDP_GSO_SEGMENTS   64    // Datagrams in one GSO send
+#define  UDP_GSO_MAX_SIZE   65507 // Bytes in one GSO send
+#define  UDP_CLIENT_RCVBUF  (8 * 1024 * 1024) // Requested socket receive queue, the kernel caps it at rmem_max
+#define  TCP_MAX_CLIENTS    8     // Subscribers served by one TCP server
+#define  TCP_CLIENT_QUEUE   16    // Packs waiting for one slow subscriber
+#define  TCP_CREDIT_ID      "CRED" // Client to server: "CRED" and uint32 packs granted
+#define  TCP_CREDIT_SIZE    8
+#define  TCP_DROP_HISTORY   256   // Dropped ranges kept per subscriber
+#define  PACK_HEADER_V1_SIZE 52
+#define  PACK_HEADER_V2_SIZE 88
+#define  PACK_VERSION       2     // Header version sent by default
+#define  PACK_FLAG_CRC32C   0x1   // v2: crc field covers channel 1 and channel 2 data
+#define  PACK_FLAG_CLOCK_SYNC 0x2 // v2: timestamp clock was synchronised (NTP/PTP)
+#define  PACK_FLAG_TRIGGERED  0x4 // v2: pack belongs to a trigger window record, gaps between records are not losses
+#define  PACK_FLAG_RECORD_START 0x8 // v2: first pack of a trigger window record
+#define  PACK_FLAG_COMPRESSED 0x10 // v2: channel data are sample_codec.h streams
+#define  TCP_PACK_SIZE      (PACK_HEADER_V2_SIZE + 65536) // Largest pack shared between subscribers
+#define  RUDP_RING_BYTES    16 * 1024 * 1024 // Copies of sent UDP packs kept for retransmission
+#define  RUDP_NACK_ID       "NACK"
+#define  RUDP_NACK_MAX_RANGES 96  // Ranges in one NACK datagram
+#define  RUDP_NACK_SIZE     (8 + RUDP_NACK_MAX_RANGES * 12)
+#define  RUDP_NACK_RETRY_MS 20    // Client repeats a NACK while the pack is missing
+#define  RUDP_NACK_CHECK_MS 2     // Client looks for NACKs to repeat or expire
+#define  RUDP_MAX_PENDING   1024  // Missing ranges tracked by a client
+#define  RUDP_MAX_HELD      1024  // Packs a client holds back until an earlier missing pack arrives
 #define  FIFO_BUFFER_SIZE  SOCKET_BUFFER_SIZE * 3
 
 using  namespace std;
@@ -33,9 +64,168 @@ namespace  asionet {
         NONE
     };
 
+    // Applied to whole blocks, the packs of one passBuffers() call
+    enum DropPolicy {
+        DROP_NEWEST, // Skip new blocks while the client queue is full
+        DROP_OLDEST, // Remove the oldest blocks that have not started sending
+        DISCONNECT   // Close the client
+    };
+
+    // Packs a subscriber did not get. Sample fields are filled from v2 headers.
+    struct DroppedRange {
+        uint64_t firstPack;
+        uint64_t packs;
+        uint64_t firstSample;
+        uint64_t samples;
+    };
+
+    // Fields of a pack header. Version 1 carries only id, lostRate, oscRate and resolution,
+    // ExtractPack fills the rest with zeros for it.
+    struct PackInfo {
+        uint32_t version;
+        uint64_t id;             // Pack counter
+        uint64_t lostRate;       // Non-zero when the buffer overflowed
+        uint32_t oscRate;        // Decimation
+        uint32_t resolution;     // 8 or 16 bits
+        uint64_t sampleIndex;    // Absolute index of the first sample since start
+        uint64_t timestamp;      // CLOCK_REALTIME of the first sample, ns since epoch
+        uint64_t droppedSamples; // Samples lost right before this pack
+        uint32_t channels;       // Bit 0 channel 1, bit 1 channel 2
+        uint32_t flags;          // PACK_FLAG_*
+        uint32_t crc;            // CRC32C of the payload when PACK_FLAG_CRC32C is set
+    };
+
+    // Reliable UDP counters. Server: NACK ranges received, packs sent again and
+    // packs that were no longer in the window. Client: NACK ranges sent, packs recovered and given up.
+    struct RetransmitStats {
+        uint64_t nacks;
+        uint64_t retransmitted;
+        uint64_t unrecoverable;
+    };
+
+    // Copies of the last UDP packs sent, keyed by pack id.
+    // Store() is called by the sending thread, Resend() by the io_service thread.
+    // Packs stay available for _window_ms or until their slot is reused, whichever comes first.
+    class CRetransmitRing {
+    public:
+        using Ptr = shared_ptr<CRetransmitRing>;
+        typedef std::function<void(const uint8_t *, size_t)> SendFunc;
+
+        static Ptr Create(uint32_t _window_ms, size_t _slot_size, size_t _bytes = RUDP_RING_BYTES);
+        CRetransmitRing(uint32_t _window_ms, size_t _slot_size, size_t _bytes);
+        CRetransmitRing(const CRetransmitRing &) = delete;
+        CRetransmitRing(CRetransmitRing &&) = delete;
+
+        void   Store(const std::array<asio::const_buffer, 3> &_pack);
+        // Calls _send for the packs of [_first, _first + _count) still in the window,
+        // returns how many were sent, _missing gets the rest
+        size_t Resend(uint64_t _first, uint64_t _count, const SendFunc &_send, uint64_t &_missing);
+
+    private:
+        struct Slot {
+            uint64_t id;
+            uint64_t time;
+            size_t   size;
+        };
+
+        uint64_t             m_window;    // ns
+        size_t               m_slot_size;
+        std::vector<Slot>    m_slots;
+        std::vector<uint8_t> m_data;
+        std::vector<uint8_t> m_scratch;   // Pack copied out of the ring while it is sent
+        uint64_t             m_newest;
+        bool                 m_empty;
+        std::mutex           m_mutex;
+    };
+
+    // One copy of a pack, shared by all TCP subscribers.
+    // The block goes back to the pool when the last subscriber has sent it.
+    class CSharedPack {
+    public:
+        using Ptr = shared_ptr<CSharedPack>;
+
+        CSharedPack(CBufferPool::Ptr _pool, uint8_t *_data, size_t _size, uint64_t _block);
+        ~CSharedPack();
+        CSharedPack(const CSharedPack &) = delete;
+        CSharedPack(CSharedPack &&) = delete;
+
+        const uint8_t *data() const { return m_data; }
+        size_t size() const { return m_size; }
+        uint64_t block() const { return m_block; }
+        uint64_t id() const { return m_id; }
+        uint64_t sampleIndex() const { return m_sampleIndex; }
+        uint64_t samples() const { return m_samples; }
+
+    private:
+        CBufferPool::Ptr m_pool;
+        uint8_t *m_data;
+        size_t   m_size;
+        uint64_t m_block;
+        uint64_t m_id;
+        uint64_t m_sampleIndex;
+        uint64_t m_samples;
+    };
+
+    typedef std::vector<CSharedPack::Ptr> SharedBlock;
+
+    // Connected TCP subscriber with its own bounded send queue.
+    // A client that sends credits gets only as many packs as it granted,
+    // other clients are limited by the socket only.
+    // All methods except Create are called on the io_service thread.
+    class CTcpSession : public std::enable_shared_from_this<CTcpSession> {
+    public:
+        using Ptr = shared_ptr<CTcpSession>;
+        typedef std::function<void(Ptr)> CloseHandler;
+
+        static Ptr Create(asio::io_service &io, DropPolicy _policy, size_t _max_queue, CloseHandler _on_close);
+        CTcpSession(asio::io_service &io, DropPolicy _policy, size_t _max_queue, CloseHandler _on_close);
+        CTcpSession(const CTcpSession &) = delete;
+        CTcpSession(CTcpSession &&) = delete;
+
+        asio::ip::tcp::socket &Socket() { return m_socket; }
+        string   Host() { return m_host; }
+        uint64_t Dropped() { return m_dropped; }
+        uint64_t DroppedBlocks() { return m_dropped_blocks; }
+        const std::vector<DroppedRange> &DroppedRanges() { return m_dropped_ranges; }
+        void     Start();
+        // Queues all packs of a block or none of them.
+        // Returns false when the client has to be disconnected
+        bool     Push(const SharedBlock &_block);
+        void     Close();
+        // _range of _block never reached the queue, e.g. the server had no buffer for it
+        void     RecordDrop(uint64_t _block, const DroppedRange &_range);
+
+    private:
+        void DoWrite();
+        void HandlerWrite(const asio::error_code &_error, size_t _bytesTransferred);
+        void ReadCredits();
+        void HandlerCredits(const asio::error_code &_error, size_t _bytesTransferred);
+        bool DropOldestBlock();
+        void RecordDrop(const CSharedPack::Ptr &_pack);
+
+        asio::ip::tcp::socket m_socket;
+        string                m_host;
+        DropPolicy            m_policy;
+        size_t                m_max_queue;
+        std::deque<CSharedPack::Ptr> m_queue;
+        bool                  m_writing;
+        bool                  m_closed;
+        bool                  m_has_sent;
+        uint64_t              m_sent_block;   // Block of the last pack given to async_write
+        bool                  m_credit_mode;
+        uint64_t              m_credits;
+        uint8_t               m_credit_msg[TCP_CREDIT_SIZE];
+        uint64_t              m_dropped;
+        uint64_t              m_dropped_blocks;
+        uint64_t              m_last_dropped_block;
+        std::vector<DroppedRange> m_dropped_ranges;
+        CloseHandler          m_on_close;
+    };
+
     class CAsioSocket {
     public:
         typedef uint8_t* send_buffer;
+        typedef std::array<asio::const_buffer, 3> pack_buffers; // header, channel 1, channel 2
         enum Events{
             CONNECT_SERVER,
             DISCONNECT_SERVER,
@@ -58,6 +248,26 @@ namespace  asionet {
         bool IsConnected();
         void SendBuffer(const void *_buffer, size_t _size);
         bool SendBuffer(bool async,send_buffer _buffer, size_t _size);
+        bool SendBuffers(const pack_buffers &_buffers);
+        // Sends _count packs, UDP packs go as batches of datagrams (sendmmsg, UDP GSO).
+        // TCP server: false when the packs were dropped for every subscriber (pool empty)
+        bool SendPacks(const pack_buffers *_packs, size_t _count);
+        // Applies to TCP subscribers accepted after the call
+        void SetDropPolicy(DropPolicy _policy, size_t _max_queue);
+        uint64_t GetDroppedPacks() { return m_fanout_dropped; }
+        // TCP server: packs dropped from the queues of slow subscribers, all subscribers together
+        uint64_t GetClientDroppedPacks() { return m_clients_dropped; }
+        // TCP server: packs held for the subscribers and the most that can be held
+        size_t GetQueuedPacks();
+        size_t GetQueueCapacity();
+        // Reliable UDP, 0 turns it off. With _max_pack_size > 0 (server) sent packs of up to
+        // that size are kept for _window_ms, otherwise (client) missing packs are asked for
+        // while they are in the window. Call before Start().
+        void SetRetransmitWindow(uint32_t _window_ms, size_t _max_pack_size);
+        RetransmitStats GetRetransmitStats();
+        // TCP client: grant the server _packs packs ahead and top up as packs are
+        // delivered, 0 leaves flow control to TCP. Call before Start().
+        void SetCreditWindow(uint32_t _packs) { m_credit_window = _packs; }
         void addHandler(Events _event, std::function<void(string host)> _func);
         void addHandler(Events _event, std::function<void(error_code error)> _func);
         void addHandler(Events _event, std::function<void(error_code error,size_t)> _func);
@@ -70,12 +280,27 @@ namespace  asionet {
 
 
         void WaitClient();
-        void HandlerReceiveFromClient(const asio::error_code &error);
-        void HandlerAcceptFromClient(const asio::error_code &_error);
+        void HandlerReceiveFromClient(const asio::error_code &error, size_t bytes_transferred);
+        void HandlerNack(const uint8_t *_buffer, size_t _size);
+        void TrackMissing(uint64_t _first, uint64_t _last);
+        bool TakeMissing(uint64_t _id);
+        void HoldPack(uint64_t _id, const uint8_t *_data, size_t _size);
+        void ReleaseHeld();
+        void GiveUpOldestGap();
+        void SendNacks(bool _force);
         void HandlerConnectToServer(const asio::error_code &_error, asio::ip::tcp::resolver::iterator endpoint_iterator);
         void HandlerSend(const asio::error_code &_error, size_t _bytesTransferred);
         void HandlerSend2(const asio::error_code &_error, size_t _bytesTransferred, uint8_t *buffer);
         void HandlerReceiveFromServer(const asio::error_code &ErrorCode, size_t bytes_transferred);
+        void ReceiveTcp(); // Client: next read goes to the free end of the FIFO
+        size_t SendPacksUdp(const pack_buffers *_packs, size_t _count, asio::error_code &_error);
+        bool SendPacksFanOut(const pack_buffers *_packs, size_t _count);
+        void FanOut(const SharedBlock &_block);
+        void FanOutDrop(uint64_t _block, const DroppedRange &_range);
+        void GrantCredits(uint32_t _packs);
+        void StartAccept();
+        void HandlerAcceptSession(CTcpSession::Ptr _session, const asio::error_code &_error);
+        void HandlerCloseSession(CTcpSession::Ptr _session);
 
         Mode m_mode;
         Protocol m_protocol;
@@ -90,12 +315,47 @@ namespace  asionet {
         asio::ip::tcp::endpoint m_tcp_endpoint;
 
         uint8_t *m_SocketReadBuffer;
-        char m_udp_recv_server_buffer[1];
+        uint8_t m_udp_recv_server_buffer[RUDP_NACK_SIZE];
         bool m_is_udp_connected;
         bool m_is_tcp_connected;
         uint8_t  *m_tcp_fifo_buffer;
         uint32_t  m_pos_last_in_fifo;
         uint64_t  m_last_pack_id;
+        bool      m_udp_gso;
+        struct    UdpBatch;
+        UdpBatch *m_udp_batch;
+        std::vector<asio::const_buffer> m_tcp_gather;
+        std::vector<CTcpSession::Ptr> m_sessions;
+        std::mutex            m_sessions_mutex;
+        DropPolicy            m_drop_policy;
+        size_t                m_client_queue;
+        CBufferPool::Ptr      m_fanout_pool;
+        std::atomic<uint64_t> m_fanout_dropped;
+        std::atomic<uint64_t> m_clients_dropped;
+        uint64_t              m_fanout_block;
+        std::vector<uint8_t*> m_fanout_blocks;
+        uint32_t              m_credit_window;
+        uint32_t              m_credit_consumed;
+
+        struct MissingRange {
+            uint64_t last;
+            uint64_t seen;    // ns, when the gap was found
+            uint64_t nacked;  // ns, last NACK for it
+        };
+
+        bool                  m_udp_has_pack;
+        uint32_t              m_rudp_window;  // ms
+        CRetransmitRing::Ptr  m_rudp_ring;    // Server
+        std::map<uint64_t, MissingRange> m_rudp_missing; // Client, by first id
+        uint64_t              m_rudp_next_id; // Client, next pack id handed out
+        std::map<uint64_t, std::vector<uint8_t>> m_rudp_held; // Client, packs after a gap, by id
+        std::vector<std::vector<uint8_t>> m_rudp_spare;     // Client, buffers of released packs
+        bool                  m_rudp_new_gap;
+        uint64_t              m_rudp_last_check;
+        std::vector<uint8_t>  m_rudp_nack;
+        std::atomic<uint64_t> m_rudp_nacks;
+        std::atomic<uint64_t> m_rudp_retransmitted;
+        std::atomic<uint64_t> m_rudp_unrecoverable;
 
 
         EventList<std::string> m_callback_Str;
@@ -128,9 +388,51 @@ namespace  asionet {
         void addCallReceived(function<void(error_code error,uint8_t*,size_t)> _func);
 
         bool SendData(bool async,CAsioSocket::send_buffer _buffer,size_t _size);
+        // Gather send of a header built by BuildPackHeader and the channel data in place.
+        // Returns after the socket has taken the data, the buffers can be reused.
+        bool SendPack(const uint8_t *_header, size_t _header_size, const void *_ch1, size_t _size_ch1, const void *_ch2, size_t _size_ch2);
+        bool SendPacks(const CAsioSocket::pack_buffers *_packs, size_t _count);
+        // TCP server: what to do with a subscriber that can not keep up
+        void SetDropPolicy(DropPolicy _policy, size_t _max_queue = TCP_CLIENT_QUEUE);
+        // TCP server: packs the subscribers did not get (CAsioSocket::GetDroppedPacks and
+        // GetClientDroppedPacks) and the packs waiting for them
+        uint64_t GetDroppedPacks();
+        size_t GetQueuedPacks();
+        size_t GetQueueCapacity();
+        // UDP: keep sent packs (server) or request missing ones (client) for _window_ms
+        void SetRetransmitWindow(uint32_t _window_ms, size_t _max_pack_size = UDP_MAX_DATAGRAM);
+        RetransmitStats GetRetransmitStats();
+        // TCP client: packs the server may send ahead of the consumer, 0 turns credits off
+        void SetCreditWindow(uint32_t _packs);
+        // Pins the io thread, -1 leaves it as is
+        void SetCpuAffinity(int _cpu);
     Protocol GetProtocol() { return  m_protocol;};
         bool IsConnected();
 
+        static size_t PackHeaderSize(uint32_t _version = PACK_VERSION);
+        // 1 or 2 for a valid pack ID, 0 otherwise. _buffer holds at least 16 bytes.
+        static uint32_t PackVersion(const uint8_t *_buffer);
+        // Total pack size from a header, 0 when _size bytes do not hold the header yet
+        static size_t PackSize(const uint8_t *_buffer, size_t _size);
+
+        // Version 2 header. The CRC is computed over _ch1 and _ch2 when _info.flags has PACK_FLAG_CRC32C.
+        static size_t BuildPackHeader(
+                uint8_t *_header ,
+                const PackInfo &_info ,
+                const void *_ch1 ,
+                size_t _size_ch1 ,
+                const void *_ch2 ,
+                size_t _size_ch2);
+
+        static size_t BuildPackHeader(
+                uint8_t *_header ,
+                uint64_t _id ,
+                uint64_t _lostRate ,
+                uint32_t _oscRate  ,
+                uint32_t _resolution ,
+                size_t _size_ch1 ,
+                size_t _size_ch2);
+
         static uint8_t *BuildPack(
                 uint64_t _id ,
                 uint64_t _lostRate ,
@@ -166,6 +468,28 @@ namespace  asionet {
                 CAsioSocket::send_buffer  &_ch2 ,
                 size_t &_size_ch2);
 
+        // Accepts version 1 and 2 packs. Returns false for an unknown ID,
+        // a truncated pack or a CRC mismatch.
+        // _ch1 and _ch2 point into _buffer, nothing is copied or allocated.
+        static bool     ParsePack(
+                const uint8_t *_buffer ,
+                size_t _size ,
+                PackInfo &_info ,
+                const uint8_t *&_ch1 ,
+                size_t &_size_ch1 ,
+                const uint8_t *&_ch2 ,
+                size_t &_size_ch2);
+
+        // ParsePack with copies of the channels, the caller deletes them with delete []
+        static bool     ExtractPack(
+                CAsioSocket::send_buffer _buffer ,
+                size_t _size ,
+                PackInfo &_info ,
+                CAsioSocket::send_buffer &_ch1 ,
+                size_t &_size_ch1 ,
+                CAsioSocket::send_buffer  &_ch2 ,
+                size_t &_size_ch2);
+
     private:
 
         CAsioNet(const CAsioNet &) = delete;
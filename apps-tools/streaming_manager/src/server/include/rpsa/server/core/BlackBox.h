@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "AsioNet.h"
+
+// RAM ring of the most recent stream buffers, the oldest records are overwritten when it is full.
+// Records keep their size, so decimated or gated streams use only the memory they need.
+// Written by one thread; forEach must not run concurrently with push.
+class CBlackBox
+{
+public:
+    using Ptr = std::shared_ptr<CBlackBox>;
+    typedef std::function<void(const asionet::PackInfo &_info, const void *_buffer_ch1, size_t _size_ch1, const void *_buffer_ch2, size_t _size_ch2)> Callback;
+
+    static Ptr Create(size_t _bytes);
+
+    CBlackBox(size_t _bytes);
+    CBlackBox(const CBlackBox &) = delete;
+    CBlackBox(CBlackBox &&) = delete;
+
+    // False if the record is larger than the whole ring
+    bool push(const asionet::PackInfo &_info, const void *_buffer_ch1, size_t _size_ch1, const void *_buffer_ch2, size_t _size_ch2);
+    void clear();
+    // Oldest record first
+    void forEach(const Callback &_func) const;
+
+    size_t capacity() const { return m_buffer.size(); }
+    size_t records() const { return m_count; }
+    // Bytes held by the records, headers included
+    size_t used() const;
+
+private:
+    struct RecordHeader {
+        uint32_t size;      // Header and data, rounded up to 8 bytes
+        uint32_t size_ch1;
+        uint32_t size_ch2;
+        uint32_t reserved;
+        asionet::PackInfo info;
+    };
+
+    std::vector<uint8_t> m_buffer;
+    size_t m_head;      // Next record is written here
+    size_t m_tail;      // Oldest record
+    size_t m_wrap;      // End of the records above m_head when wrapped
+    bool   m_wrapped;   // Records are [m_tail, m_wrap) and [0, m_head)
+    size_t m_count;
+
+    void evict();
+};
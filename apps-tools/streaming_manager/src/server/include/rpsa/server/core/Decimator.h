@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#define DECIMATOR_MAX_UP          64     // Largest interpolation factor of a rational rate
+#define DECIMATOR_MAX_TAPS        4096   // Filter length limit, all phases together
+#define DECIMATOR_MAX_FIR_FACTOR  225    // Largest up or down left to a designed FIR, DECIMATOR_MAX_TAPS bound
+#define DECIMATOR_ATTENUATION     60.0   // Stop band of designed filters, dB
+#define DECIMATOR_CIC_MIN_FACTOR  32     // Designed filters put a CIC in front from this factor
+#define DECIMATOR_CIC_ORDER       4
+
+// Software sample rate converter for one channel: output rate = input rate * up / down, up <= down.
+// A polyphase FIR does the conversion, only the output samples are computed. Without user taps
+// a Kaiser windowed sinc is designed for a pass band up to 0.4 of the output rate; large factors
+// first go through a CIC (order DECIMATOR_CIC_ORDER) that leaves the FIR a small factor, the FIR
+// also compensates the CIC droop.
+// State is kept between calls, so consecutive buffers are filtered as one stream.
+class CDecimator
+{
+public:
+    using Ptr = std::shared_ptr<CDecimator>;
+
+    // Returns an empty pointer when the ratio or the taps are not supported.
+    // _taps are the prototype filter at the input rate times _up, DC gain 1 (normalized here).
+    static Ptr Create(uint32_t _up, uint32_t _down, const std::vector<float> &_taps = std::vector<float>());
+    // True when Create() can design the filter for the ratio, otherwise prints why. Factors that
+    // no CIC can take, e.g. a prime down above DECIMATOR_MAX_FIR_FACTOR, need too many taps.
+    static bool Supported(uint32_t _up, uint32_t _down);
+    // Kaiser windowed low pass for Create(). _cicFactor > 1 adds the droop compensation
+    // for a CIC of that factor in front of the filter.
+    static std::vector<float> DesignLowpass(uint32_t _up, uint32_t _down, double _attenuation = DECIMATOR_ATTENUATION, uint32_t _cicFactor = 1);
+
+    CDecimator(uint32_t _up, uint32_t _down, uint32_t _cicFactor, const std::vector<float> &_taps, int _shift);
+    CDecimator(const CDecimator &) = delete;
+    CDecimator(CDecimator &&) = delete;
+
+    void   reset();
+    // Output sample count for _count more input samples, at most
+    size_t maxOutput(size_t _count) const;
+    // _out may be the same buffer as _in. Returns the number of output samples.
+    size_t process(const int16_t *_in, size_t _count, int16_t *_out);
+    size_t process(const int8_t *_in, size_t _count, int8_t *_out);
+
+    uint32_t up() const { return m_up; }
+    uint32_t down() const { return m_down; }
+    // Group delay in input samples
+    double   delay() const;
+
+private:
+    uint32_t m_up;
+    uint32_t m_down;
+    uint32_t m_firDown;     // FIR part of the factor
+    uint32_t m_cicFactor;   // 1 - no CIC
+    uint32_t m_tapsPerPhase;
+    int      m_shift;       // Fixed point position of the coefficients
+    size_t   m_firLength;
+    std::vector<int16_t> m_coeffs;   // Phases one after another, reversed and padded to m_tapsPerPhase
+    std::vector<int16_t> m_work;     // History followed by the current input
+    std::vector<int16_t> m_scratch;  // CIC output
+    std::vector<int16_t> m_wide;     // 8 bit input as 16 bit
+    uint64_t m_position;    // Next output in units of 1/m_up input samples, relative to the current input
+
+    uint64_t m_cicInt[DECIMATOR_CIC_ORDER];   // Wrap around is intended
+    uint64_t m_cicComb[DECIMATOR_CIC_ORDER];
+    uint32_t m_cicCount;
+    double   m_cicGain;
+
+    size_t cic(const int16_t *_in, size_t _count, int16_t *_out);
+    size_t fir(const int16_t *_in, size_t _count, int16_t *_out);
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <asio.hpp>
+#include "metrics.h"
+
+#define METRICS_REQUEST_SIZE 4096 // Longer requests are cut, only the request line is used
+#define METRICS_IDLE_TIMEOUT 5000 // ms a client has to send its request and take the answer
+
+// Serves CMetrics::render() over HTTP/1.0 for scrapers: GET /metrics (or /) returns the
+// text format, any other path 404. Requests are answered on a thread of the server,
+// the streaming threads are never involved.
+class CMetricsServer
+{
+public:
+    using Ptr = std::shared_ptr<CMetricsServer>;
+
+    // _endpoint "unix:/path/to/socket" or "host:port", e.g. "127.0.0.1:9101".
+    // Returns an empty pointer when the endpoint can not be bound.
+    static Ptr Create(CMetrics::Ptr _metrics, const std::string &_endpoint);
+
+    CMetricsServer(CMetrics::Ptr _metrics);
+    CMetricsServer(const CMetricsServer &) = delete;
+    CMetricsServer(CMetricsServer &&) = delete;
+    ~CMetricsServer();
+
+    void stop();
+
+private:
+    bool listenUnix(const std::string &_path);
+    bool listenTcp(const std::string &_host, const std::string &_port);
+    template <typename Acceptor>
+    void accept(Acceptor &_acceptor);
+    template <typename Session>
+    void read(std::shared_ptr<Session> _session);
+    std::string response(const std::string &_request);
+
+    CMetrics::Ptr    m_metrics;
+    asio::io_service m_io;
+    std::unique_ptr<asio::local::stream_protocol::acceptor> m_unixAcceptor;
+    std::unique_ptr<asio::ip::tcp::acceptor>                m_tcpAcceptor;
+    std::string      m_unixPath;
+    std::thread      m_thread;
+};
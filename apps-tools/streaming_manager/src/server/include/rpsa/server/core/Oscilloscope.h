@@ -4,6 +4,7 @@
 #include <memory>
 
 #include <UioParser.h>
+#include <SampleSource.h>
 
 constexpr uint32_t osc0_event_id = 2;
 constexpr uint32_t osc1_event_id = 3;
@@ -45,7 +46,7 @@ struct OscilloscopeMapT
     uint32_t calib_gain;            // 104 - offset
 };
 
-class COscilloscope
+class COscilloscope : public CSampleSource
 {
 public:
     using Ptr = std::shared_ptr<COscilloscope>;
@@ -57,10 +58,10 @@ public:
     COscilloscope(COscilloscope &&) = delete;
     ~COscilloscope();
 
-    void prepare();
-    bool next(uint8_t *&_buffer1,uint8_t *&_buffer2, size_t &_size,bool &_overFlow1 , bool &_overFlow2);
-    bool changeBuffers();
-    void stop();
+    void prepare() override;
+    bool next(uint8_t *&_buffer1,uint8_t *&_buffer2, size_t &_size,bool &_overFlow1 , bool &_overFlow2) override;
+    bool changeBuffers() override;
+    void stop() override;
 
 private:
     void setReg(volatile OscilloscopeMapT *_OscMap ,unsigned int _Channel);
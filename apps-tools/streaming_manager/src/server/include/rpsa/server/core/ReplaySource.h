@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include "SampleSource.h"
+
+// Plays recorded 16 bit samples back: one little endian int16 file per channel, as
+// rpsa_client -t raw writes them for 16 bit streams. Both files start over at their end.
+class CReplaySource : public CTimedSource
+{
+public:
+    using Ptr = std::shared_ptr<CReplaySource>;
+
+    // An empty path disables the channel. Returns an empty pointer if a file can't be
+    // opened or holds no sample.
+    static Ptr Create(const std::string &_fileCh1, const std::string &_fileCh2, double _sampleRate);
+
+    CReplaySource(FILE *_ch1, uint64_t _samplesCh1, FILE *_ch2, uint64_t _samplesCh2, double _sampleRate);
+    CReplaySource(const CReplaySource &) = delete;
+    CReplaySource(CReplaySource &&) = delete;
+    ~CReplaySource();
+
+    void prepare() override;
+
+protected:
+    void fill(int16_t *_ch1, int16_t *_ch2, size_t _samples, uint64_t _firstSample) override;
+
+private:
+    void read(int _channel, int16_t *_dst, size_t _samples, uint64_t _firstSample);
+
+    FILE    *m_file[2];
+    uint64_t m_samples[2];
+    uint64_t m_position; // Next sample when the files are read on without a gap
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Where CStreamingApplication takes its samples from. A source hands out buffers of
+// 16 bit ADC words per channel, as the oscilloscope DMA writes them, one pair per next().
+// Buffers hold at most osc_buf_size bytes (Oscilloscope.h).
+class CSampleSource
+{
+public:
+    using Ptr = std::shared_ptr<CSampleSource>;
+
+    virtual ~CSampleSource() {}
+
+    // Called by the worker thread before the first next()
+    virtual void prepare() = 0;
+    // Blocks until the next buffers are ready. A disabled channel gets nullptr, _size is in bytes.
+    // The overflow flags tell that buffers were lost before these ones.
+    virtual bool next(uint8_t *&_buffer1, uint8_t *&_buffer2, size_t &_size, bool &_overFlow1, bool &_overFlow2) = 0;
+    // The buffers of the last next() are no longer used
+    virtual bool changeBuffers() = 0;
+    virtual void stop() = 0;
+};
+
+// Source without hardware: buffers are produced at a fixed sample rate, as the DMA would.
+// next() sleeps until the next buffer is complete. A worker that comes back more than
+// one buffer late loses the buffers it missed, like the DMA overwriting them, and sees the
+// overflow flags. Derived classes fill the buffers.
+class CTimedSource : public CSampleSource
+{
+public:
+    // _sampleRate per channel, 0 - a new buffer whenever the worker asks for one
+    CTimedSource(bool _channel1Enable, bool _channel2Enable, double _sampleRate, size_t _bufferSamples);
+
+    void prepare() override;
+    bool next(uint8_t *&_buffer1, uint8_t *&_buffer2, size_t &_size, bool &_overFlow1, bool &_overFlow2) override;
+    bool changeBuffers() override { return true; }
+    void stop() override {}
+
+    // Buffers lost because the worker was late or by simulateOverflow()
+    uint64_t lostBuffers() const { return m_lostBuffers; }
+
+protected:
+    // Samples _firstSample .. _firstSample + _samples - 1, a disabled channel gets nullptr
+    virtual void fill(int16_t *_ch1, int16_t *_ch2, size_t _samples, uint64_t _firstSample) = 0;
+    // Lose the next _buffers buffers
+    void simulateOverflow(uint32_t _buffers) { m_skipBuffers += _buffers; }
+
+private:
+    bool     m_Channel1;
+    bool     m_Channel2;
+    double   m_periodNs;
+    size_t   m_bufferSamples;
+    std::vector<int16_t> m_buffer[2][2]; // Double buffer per channel
+    unsigned m_bufferNumber;
+    uint64_t m_start;       // CLOCK_MONOTONIC ns of prepare()
+    uint64_t m_nextBuffer;  // Index of the next buffer since prepare()
+    std::atomic<uint64_t> m_lostBuffers;
+    uint32_t m_skipBuffers;
+};
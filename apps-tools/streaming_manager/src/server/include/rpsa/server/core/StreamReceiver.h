@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "AsioNet.h"
+#include "buffer_pool.h"
+#include "spsc_ring.h"
+
+#define RECEIVER_BLOCK_SIZE  (2 * 65536) // Both channels of a pack after decoding, half a block each
+#define RECEIVER_BLOCK_COUNT 256         // Blocks of a pool made by the receiver
+
+// Client end of a stream. Takes the packs a CAsioNet client reassembles, decodes compressed
+// (sample_codec.h) and 14 bit packed (sample_pack.h) channels and hands out 8 or 16 bit
+// samples without allocating per pack. Gaps are detected from pack ids and, for v2 packs,
+// from sample indexes. Blocks are handed out in the order the socket delivers the packs,
+// which for reliable UDP is id order: retransmitted packs fill their gaps, not the end.
+//
+// With a pool every pack is copied into one pool block and queued for a consumer thread,
+// which takes it with pop() and gives it back with release(). When the consumer falls
+// behind and the pool runs dry the pack is dropped and counted in Stats::overruns.
+// Without a pool the callback gets the samples on the io thread, straight from the
+// socket buffer when no decoding is needed, valid during the call only.
+class CStreamReceiver
+{
+public:
+    using Ptr = std::shared_ptr<CStreamReceiver>;
+
+    struct Block {
+        asionet::PackInfo info;     // resolution 8 or 16, PACK_FLAG_COMPRESSED cleared
+        uint8_t          *data;     // Pool block, nullptr for callback blocks
+        const uint8_t    *ch1;
+        size_t            size_ch1;
+        const uint8_t    *ch2;
+        size_t            size_ch2;
+        uint64_t          lostPacks;   // Pack ids missing right before this pack
+        uint64_t          lostSamples; // Samples missing right before this pack, on the board and in the network
+    };
+
+    struct Stats {
+        uint64_t packs;
+        uint64_t bytes;          // As received
+        uint64_t decodedBytes;   // Channel data after decoding
+        uint64_t compressedPacks;
+        uint64_t samples_ch1;
+        uint64_t samples_ch2;
+        uint64_t lostRate;       // Sum of the pack lostRate fields
+        uint64_t lostPacks;      // Including bad packs and overruns, less recovered packs
+        uint64_t lostSamples;    // Less the samples of recovered packs
+        uint64_t recoveredPacks; // Arrived after a later pack, the socket reorders UDP retransmissions
+        uint64_t badPacks;       // Damaged or not decodable
+        uint64_t overruns;       // Packs dropped because the pool was empty
+        uint64_t records;        // Trigger window records
+    };
+
+    typedef std::function<void(const Block &_block)> Callback;
+
+    // _net is a client that is not started yet. _pool may be empty, its blocks must hold
+    // RECEIVER_BLOCK_SIZE bytes.
+    static Ptr Create(asionet::CAsioNet::Ptr _net, CBufferPool::Ptr _pool);
+
+    CStreamReceiver(asionet::CAsioNet::Ptr _net, CBufferPool::Ptr _pool);
+    CStreamReceiver(const CStreamReceiver &) = delete;
+    CStreamReceiver(CStreamReceiver &&) = delete;
+
+    // Pool mode: called on the io thread after a block was queued, e.g. to wake the consumer.
+    // Callback mode: gets the samples. Set before the client starts.
+    void setCallback(Callback _callback) { m_callback = _callback; }
+
+    // Consumer side of the pool mode
+    bool pop(Block &_block);
+    void release(const Block &_block);
+    size_t queued() const { return m_queue.size(); }
+
+    Stats getStats() const;
+    // Counters since the previous call, for rates
+    Stats takeStats();
+
+    // Decodes one pack. ch1/ch2 point into _pack or into _dst, which holds RECEIVER_BLOCK_SIZE
+    // bytes; with _copy the samples are always in _dst. False for a damaged pack.
+    // _compressed tells whether the pack was compressed. Gap fields are left as they are.
+    static bool decodePack(const uint8_t *_pack, size_t _size, uint8_t *_dst, bool _copy, Block &_block, bool *_compressed = nullptr);
+
+private:
+    void received(const uint8_t *_pack, size_t _size);
+    // _recovered gets the lost packs and samples a late pack takes back
+    void countGap(Block &_block, Stats &_delta, Stats &_recovered);
+
+    asionet::CAsioNet::Ptr m_net;
+    CBufferPool::Ptr       m_pool;
+    SPSCRing<Block>        m_queue;
+    Callback               m_callback;
+    std::vector<uint8_t>   m_scratch;   // Callback mode decoding
+    uint8_t               *m_spare;     // Block borrowed for a bad pack, used for the next one
+    bool                   m_hasPack;
+    uint64_t               m_nextId;
+    uint64_t               m_nextSampleIndex;
+    Stats                  m_total;
+    Stats                  m_taken;     // m_total at the last takeStats()
+    mutable std::mutex     m_statsLock;
+};
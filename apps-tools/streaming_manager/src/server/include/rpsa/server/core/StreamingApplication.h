@@ -9,21 +9,76 @@
 
 #include <Oscilloscope.h>
 #include <StreamingManager.h>
+#include <Decimator.h>
+#include <TriggerGate.h>
+#include <BlackBox.h>
 
 //#define DISABLE_OSC
 
+#define OSC_THREAD_PRIORITY 50
+#define OSC_THREAD_CPU      1
+#define IO_THREAD_CPU       0
+
 class CStreamingApplication
 {
 public:
-    CStreamingApplication(CStreamingManager::Ptr _StreamingManager, COscilloscope::Ptr _osc_ch,unsigned short _resolution,int _oscRate, int _channels);
+    enum class SchedPolicy {
+        NORMAL,   // Default scheduler, no pinning
+        REALTIME  // SCHED_FIFO worker on its own CPU, network and file threads on the other one
+    };
+
+    // Counted on CLOCK_MONOTONIC by the worker, times in ns
+    struct Stats {
+        uint64_t buffers;         // Buffers passed to the streaming manager
+        uint64_t overflows;       // Buffers with the DMA overflow flag
+        uint64_t droppedSamples;
+        uint64_t lastProcessNs;   // Interrupt to the end of passBuffers
+        uint64_t maxProcessNs;
+        uint64_t avgProcessNs;
+        uint64_t maxPeriodNs;     // Longest time between two interrupts
+        uint64_t records;         // Trigger window records sent
+        uint64_t discardedRecords;
+        uint64_t dumps;           // Black box dumps written
+    };
+
+    // _resolution 8, 16 or 14 - 16 bit samples sent packed, 8 samples in 14 bytes.
+    // _osc_ch is the oscilloscope or a source without hardware (SyntheticSource.h, ReplaySource.h),
+    // _oscRate its decimation: sample times are counted at ADC_SAMPLE_RATE / _oscRate.
+    CStreamingApplication(CStreamingManager::Ptr _StreamingManager, CSampleSource::Ptr _osc_ch,unsigned short _resolution,int _oscRate, int _channels);
     ~CStreamingApplication();
     void run();
     void runNonBlock();
     bool stop();
+    // Applied by the next run(). SCHED_FIFO needs CAP_SYS_NICE, without it the worker
+    // stays on the default scheduler.
+    void setSchedPolicy(SchedPolicy _policy, int _priority = OSC_THREAD_PRIORITY);
+    void setCpuAffinity(int _oscCpu, int _ioCpu);
+    // Software rate conversion after the FPGA decimation: output rate = oscilloscope rate * _up / _down.
+    // Empty _taps - designed anti-aliasing filter. _up == _down turns it off. Applied by the next run().
+    bool setDecimator(uint32_t _up, uint32_t _down, const std::vector<float> &_taps = std::vector<float>());
+    // Sends only windows around triggers instead of the continuous stream, applied by the next run().
+    // The level is in stream units (after resolution and decimation).
+    bool setTrigger(const TriggerSettings &_settings);
+    void clearTrigger() { m_trigger = nullptr; }
+    // Black box: the stream fills a RAM ring of _bytes and nothing is written or sent until
+    // triggerDump(). _postMs later the ring is frozen and written out through the streaming
+    // manager, a new file per dump in file mode; the stream is not recorded while it is written.
+    // 0 bytes turns it off. Applied by the next run().
+    bool setBlackBox(size_t _bytes, uint32_t _postMs = 0);
+    // Safe from any thread and from a signal handler
+    void triggerDump() { m_dumpRequest = true; }
+    bool isDumping() { return m_dumpState != DUMP_IDLE; }
+    // Delay before the acquisition starts
+    void setStartDelay(uint32_t _ms) { m_startDelay = _ms; }
+    Stats getStats();
+    void resetStats();
+    // Acquisition throughput, overflows and processing time, passed on to the streaming manager
+    // for the send or file stage. Call before run(), nullptr turns them off.
+    void setMetrics(CMetrics::Ptr _metrics);
 private:
     int m_PerformanceCounterPeriod = 10;
 
-    COscilloscope::Ptr m_Osc_ch;
+    CSampleSource::Ptr m_Osc_ch;
     CStreamingManager::Ptr m_StreamingManager;
     std::thread m_OscThread;
     std::thread m_SocketThread;
@@ -39,6 +94,8 @@ private:
 
     void *m_WriteBuffer_ch1;
     void *m_WriteBuffer_ch2;
+    void *m_PackBuffer_ch1;     // Resolution 14: the samples packed for the network
+    void *m_PackBuffer_ch2;
     size_t m_size_ch1;
     size_t m_size_ch2;
 
@@ -49,9 +106,50 @@ private:
     asio::steady_timer m_Timer;
     uintmax_t m_BytesCount;
 
+    SchedPolicy      m_policy;
+    int              m_priority;
+    int              m_oscCpu;
+    int              m_ioCpu;
+    uint32_t         m_startDelay;
+    uint64_t         m_wakeTime;
+    CDecimator::Ptr  m_decimator_ch1;
+    CDecimator::Ptr  m_decimator_ch2;
+    CTriggerGate::Ptr m_trigger;
+
+    enum DumpState {
+        DUMP_IDLE,
+        DUMP_POST,      // Recording the post trigger time
+        DUMP_WRITING
+    };
+    CBlackBox::Ptr   m_blackBox;
+    uint32_t         m_blackBoxPost;
+    std::atomic<bool> m_dumpRequest;
+    std::atomic<int> m_dumpState;
+    std::thread      m_dumpThread;
+    std::atomic<uint64_t> m_statDumps;
+
+    std::atomic<uint64_t> m_statBuffers;
+    std::atomic<uint64_t> m_statOverflows;
+    std::atomic<uint64_t> m_statDropped;
+    std::atomic<uint64_t> m_statLastProcess;
+    std::atomic<uint64_t> m_statMaxProcess;
+    std::atomic<uint64_t> m_statSumProcess;
+    std::atomic<uint64_t> m_statMaxPeriod;
+
+    CMetricCounter::Ptr   m_metricBytes;
+    CMetricCounter::Ptr   m_metricBuffers;
+    CMetricCounter::Ptr   m_metricOverflows;
+    CMetricCounter::Ptr   m_metricDropped;
+    CMetricHistogram::Ptr m_metricProcess;
+
+    void applySchedPolicy();
+    void dumpWorker();
+    void passOn(const asionet::PackInfo &_info, const void *_buffer_ch1, size_t _size_ch1, const void *_buffer_ch2, size_t _size_ch2);
+
     void oscWorker();
     bool passCh(size_t &_size1,size_t &_size2);
-    int  oscNotify(uint64_t _lostRate, uint32_t _oscRate,const void *_buffer_ch1, size_t _size_ch1,const void *_buffer_ch2, size_t _size_ch2);
+    size_t decimate(CDecimator::Ptr &_decimator, void *_buffer, size_t _size);
+    int  oscNotify(const asionet::PackInfo &_info, const void *_buffer_ch1, size_t _size_ch1,const void *_buffer_ch2, size_t _size_ch2, uint64_t _readyNs);
     void performanceCounterHandler(const asio::error_code &_error);
     void signalHandler(const asio::error_code &_error, int _signalNumber);
 };
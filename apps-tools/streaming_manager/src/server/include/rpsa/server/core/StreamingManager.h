@@ -8,10 +8,11 @@
 #include <asio.hpp>
 #include <Oscilloscope.h>
 #include <file_async_writer.h>
+#include <buffer_pool.h>
 #include <wavWriter.h>
 #include "AsioNet.h"
 #include "FileLogger.h"
-#include "neon_asm.h"
+#include "metrics.h"
 #include "shared_buffer.h"
 
 
@@ -22,7 +23,17 @@
 #define FILE_PATH "/tmp/stream_files"
 
 #define UDP_BUFFER_LIMIT 512
+#define UDP_MIN_BUFFER_LIMIT 64
 #define TCP_BUFFER_LIMIT 65536/2
+#define PACK_HEADER_STRIDE 128 // Headers of one buffer are kept 8 byte aligned in one pool block
+#define PACK_HEADER_POOL 2    // Pack headers, payload is sent from the caller's buffers
+
+#ifdef Z20
+#define ADC_SAMPLE_RATE 122.880e6
+#else
+#define ADC_SAMPLE_RATE 125e6
+#endif
+
 #define MIN(X,Y) ((X < Y) ? X: Y)
 #define MAX(X,Y) ((X > Y) ? X: Y)
 
@@ -50,9 +61,55 @@ public:
     
 
     void run();
-    void stop();
+    // _waitAllWrite - the file thread writes out its queue before it stops
+    void stop(bool _waitAllWrite = false);
     bool isFileThreadWork();
+    // Data bytes per channel in one UDP datagram, applied by the next run()
+    void setUdpBufferLimit(uint32_t _size);
+    static uint32_t maxUdpBufferLimit();
+    // Reliable UDP: sent packs are kept for _window_ms and sent again on NACK, 0 turns it off.
+    // Applied by the next run()
+    void setUdpRetransmitWindow(uint32_t _window_ms);
+    uint32_t getUdpRetransmitWindow() { return m_retransmitWindow; }
+    asionet::RetransmitStats getRetransmitStats();
+    // TCP subscribers that can not keep up, applied by the next run()
+    void setTcpDropPolicy(asionet::DropPolicy _policy, size_t _max_queue = TCP_CLIENT_QUEUE);
+    // Header version (1 or 2) and payload CRC32C for network packs, applied by the next run()
+    void setPackVersion(uint32_t _version);
+    void setPackCrc(bool _enable);
+    // File mode: passBuffers waits for the file thread instead of dropping buffers. For writers
+    // that are not fed by the acquisition, e.g. the black box dump.
+    void setFileBackpressure(bool _enable) { m_fileBackpressure = _enable; }
+    // CPU for the network or file thread, -1 - no pinning. Applied by the next run()
+    void setCpuAffinity(int _cpu) { m_cpu = _cpu; }
+    bool isLocalFile() { return m_use_local_file; }
+    // File mode: the file of the last run() and the buffers since then that could not be queued for it
+    std::string getFileName() { return m_file_out; }
+    uint64_t getFileDropped() { return m_fileDropped; }
+    // File mode: split the recording into files of _bytes or _seconds each, 0 - no limit, both 0 - one
+    // file. getFileName() is then the name the segments and the manifest are derived from, see
+    // FileQueueManager::SetRotation. Applied by the next run()
+    void setFileRotation(uint64_t _bytes, uint32_t _seconds) { m_segmentBytes = _bytes; m_segmentSeconds = _seconds; }
+    // Volts = sample * _gain + _offset for _channel 1 or 2, stored in the index of RAW_TYPE files.
+    // Default 1 and 0, the samples as they are.
+    void setCalibration(int _channel, double _gain, double _offset);
+    // Exact sample rate of the buffers in Hz for the file index, 0 - ADC_SAMPLE_RATE / oscRate.
+    // The oscRate field of rate converted buffers is rounded to an integer.
+    void setSampleRate(double _rate) { m_sampleRate = _rate; }
+    // Lossless compression (sample_codec.h) of 8 and 16 bit samples in v2 network packs and
+    // TDMS files. Buffers that do not get smaller are sent or written as they are.
+    void setCompression(bool _enable) { m_compress = _enable; }
+    bool getCompression() { return m_compress; }
+    // Throughput, drops, queue use and latency of the send or file stage, applied by the next run().
+    // nullptr turns them off.
+    void setMetrics(CMetrics::Ptr _metrics) { m_metrics = _metrics; }
+    // _resolution 8, 16 or 14 (packed, see sample_pack.h). Files store 14 bit buffers as 16 bit.
+    // Sample index and timestamp are counted here, no samples are reported as dropped
     int passBuffers(uint64_t _lostRate, uint32_t _oscRate,const void *_buffer_ch1, uint32_t _size_ch1,const void *_buffer_ch2, uint32_t _size_ch2, unsigned short _resolution ,uint64_t _id);
+    // _info.sampleIndex, timestamp and droppedSamples describe the first sample of the buffers,
+    // _info.id is used only for the file log. _readyNs - metricsNowNs() when the buffers were
+    // acquired, the send and disk latency metrics skip buffers with 0.
+    int passBuffers(const asionet::PackInfo &_info, const void *_buffer_ch1, uint32_t _size_ch1, const void *_buffer_ch2, uint32_t _size_ch2, uint64_t _readyNs = 0);
     CStreamingManager::Callback notifyPassData;
     CStreamingManager::Callback notifyStop;
     CStreamingManager::CallbackVoid notifyPassDataReset;
@@ -68,13 +125,46 @@ private:
     std::string       m_filePath;
     asionet::Protocol m_protocol;
     asionet::CAsioNet *m_asionet;
+    CBufferPool::Ptr  m_headerPool;
+    std::vector<asionet::CAsioSocket::pack_buffers> m_packs;
+    uint32_t          m_udpBufferLimit;
+    uint32_t          m_retransmitWindow;
+    asionet::DropPolicy m_dropPolicy;
+    size_t            m_clientQueue;
     uint64_t          m_index_of_message;
+    uint32_t          m_packVersion;
+    bool              m_packCrc;
+    uint64_t          m_sampleIndex;
+    int               m_cpu;
+    bool              m_fileBackpressure;
     std::string       m_file_out;
+    std::atomic<uint64_t> m_fileDropped;
+    uint64_t          m_segmentBytes;
+    uint32_t          m_segmentSeconds;
+    double            m_gain[2];
+    double            m_offset[2];
+    double            m_sampleRate;
+    std::vector<int16_t> m_unpack_ch1;
+    std::vector<int16_t> m_unpack_ch2;
+    bool              m_compress;
+    std::vector<uint8_t> m_codec_ch1;
+    std::vector<uint8_t> m_codec_ch2;
+    CMetrics::Ptr     m_metrics;
+    CMetricCounter::Ptr   m_metricBytes;
+    CMetricCounter::Ptr   m_metricBuffers;
+    CMetricCounter::Ptr   m_metricDropped;     // Buffers not queued for the file or not sent
+    CMetricCounter::Ptr   m_metricDroppedPacks;
+    CMetricGauge::Ptr     m_metricQueueUsed;
+    CMetricGauge::Ptr     m_metricQueueSize;
+    CMetricHistogram::Ptr m_metricLatency;
+    uint64_t          m_droppedPacks;      // Last CAsioNet::GetDroppedPacks()
 
     bool m_use_local_file;
     Stream_FileType m_fileType;
     void startServer();
     void stopServer();
+    void setupMetrics();
+    int  sendBuffers(const asionet::PackInfo &_info, const void *_buffer_ch1, uint32_t _size_ch1, const void *_buffer_ch2, uint32_t _size_ch2, uint64_t _readyNs);
 
     
 };
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "SampleSource.h"
+
+enum class SyntheticWave {
+    SINE,
+    NOISE,
+    SINE_NOISE
+};
+
+struct SyntheticSettings {
+    bool          channel1;
+    bool          channel2;
+    double        sampleRate;      // Per channel, 0 - as fast as the worker takes buffers
+    SyntheticWave wave;
+    double        frequency;       // Hz, rounded to whole periods in the signal table
+    int16_t       amplitude;       // Sine peak in ADC words
+    int16_t       noise;           // Noise peak in ADC words
+    uint32_t      overflowEvery;   // Simulated DMA overflow every n buffers, 0 - off
+    uint32_t      overflowBuffers; // Buffers lost in one simulated overflow
+};
+
+// Generated test signal. Channel 2 is channel 1 a quarter of a sine period later.
+// The signal is computed once into a table that holds whole sine periods, next() copies from it.
+class CSyntheticSource : public CTimedSource
+{
+public:
+    using Ptr = std::shared_ptr<CSyntheticSource>;
+
+    // Returns an empty pointer for a negative rate or frequency, or a frequency above half the rate
+    static Ptr Create(const SyntheticSettings &_settings);
+
+    CSyntheticSource(const SyntheticSettings &_settings);
+    CSyntheticSource(const CSyntheticSource &) = delete;
+    CSyntheticSource(CSyntheticSource &&) = delete;
+
+    static SyntheticSettings defaultSettings();
+
+protected:
+    void fill(int16_t *_ch1, int16_t *_ch2, size_t _samples, uint64_t _firstSample) override;
+
+private:
+    void copyFrom(int16_t *_dst, size_t _samples, uint64_t _position) const;
+
+    SyntheticSettings    m_settings;
+    std::vector<int16_t> m_table;
+    size_t               m_quarter;  // Channel 2 offset in the table
+    uint64_t             m_buffers;
+};
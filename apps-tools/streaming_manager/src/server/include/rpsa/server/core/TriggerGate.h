@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "AsioNet.h"
+
+enum class TriggerEdge {
+    RISING,
+    FALLING,
+    BOTH
+};
+
+struct TriggerSettings {
+    int         channel;     // 1 or 2
+    int32_t     level;       // In stream units: signed 8 or 16 bit samples
+    int32_t     hysteresis;  // The signal must go this far back across the level to arm again
+    TriggerEdge edge;
+    uint32_t    preSamples;  // Before the trigger sample
+    uint32_t    postSamples; // From the trigger sample on
+};
+
+// Cuts windows around level/edge triggers out of the continuous stream.
+// Every window is passed on as one record: the buffers of both channels plus a PackInfo with
+// the sample index and timestamp of the first sample and PACK_FLAG_TRIGGERED | PACK_FLAG_RECORD_START.
+// The next trigger is searched for after the end of a window only. A record that a gap in the
+// stream (dropped samples) runs into is discarded.
+class CTriggerGate
+{
+public:
+    using Ptr = std::shared_ptr<CTriggerGate>;
+    typedef std::function<void(const asionet::PackInfo &_info, const void *_buffer_ch1, size_t _size_ch1, const void *_buffer_ch2, size_t _size_ch2)> Callback;
+
+    // Returns an empty pointer for a bad channel or a window larger than _maxBytes per channel
+    static Ptr Create(const TriggerSettings &_settings, unsigned short _resolution, size_t _maxBytes);
+
+    CTriggerGate(const TriggerSettings &_settings, unsigned short _resolution);
+    CTriggerGate(const CTriggerGate &) = delete;
+    CTriggerGate(CTriggerGate &&) = delete;
+
+    void reset();
+    // One block of the stream, _info describes its first sample. _emit is called for every record
+    // completed in the block, the record buffers are valid during the call only.
+    void process(const asionet::PackInfo &_info, double _sampleNs, const void *_buffer_ch1, size_t _size_ch1, const void *_buffer_ch2, size_t _size_ch2, const Callback &_emit);
+
+    uint64_t records() const { return m_records; }
+    uint64_t discarded() const { return m_discarded; }
+
+private:
+    TriggerSettings m_settings;
+    size_t          m_bytesPerSample;
+    std::vector<uint8_t> m_history[2];   // Last preSamples of the stream
+    size_t          m_historySamples;    // Valid samples at the end of m_history
+    std::vector<uint8_t> m_record[2];
+    bool            m_recordChannel[2];
+    size_t          m_recordFill;        // Samples in m_record
+    size_t          m_remaining;         // Samples still to capture, 0 - searching
+    uint64_t        m_recordIndex;
+    uint64_t        m_recordTimestamp;
+    uint32_t        m_recordFlags;
+    bool            m_armedRise;
+    bool            m_armedFall;
+    uint64_t        m_records;
+    uint64_t        m_discarded;
+
+    template<typename T>
+    size_t find(const T *_samples, size_t _from, size_t _to);
+    void   updateHistory(const uint8_t *_buffers[2], size_t _samples);
+};
@@ -1,4 +1,5 @@
 #include "rpsa/common/core/File.h"
+#include "rpsa/common/core/sample_codec.h"
 
 namespace TDMS
 {
@@ -90,8 +91,28 @@ namespace TDMS
 		vector<shared_ptr<Segment>> segments = GetSegments(reader);
 		vector<shared_ptr<Metadata>> metadataRet;
 		map<string, map<string, shared_ptr<Metadata>>> prevMetaDataLookup;
+		vector<shared_ptr<Metadata>> prevSegmentObjects;
 		for (auto &segment : segments)
 		{
+			if (!segment->TableOfContents.HasMetaData && segment->TableOfContents.HasRawData)
+			{
+				// Raw data only: the previous object list is reused
+				long offset = segment->Offset + segment->Length;
+				for (auto &prev : prevSegmentObjects)
+				{
+					if (prev->RawData.Count == 0 || prev->Path.size() < 2)
+						continue;
+					shared_ptr<Metadata> metadata = make_shared<Metadata>(*prev);
+					metadata->TableOfContents = segment->TableOfContents;
+					metadata->RawData.Offset = offset;
+					auto raw = reader.ReadRawData(metadata->RawData);
+					metadata->RawData.DataType.InitDataType(metadata->RawData.DataType.GetDataType(), raw);
+					offset += metadata->RawData.Size;
+					metadataRet.push_back(metadata);
+				}
+				continue;
+			}
+
 			if (!(segment->TableOfContents.ContainsNewObjects ||
 				segment->TableOfContents.HasDaqMxData ||
 				segment->TableOfContents.HasMetaData ||
@@ -201,9 +222,54 @@ namespace TDMS
                 }
                 metadataRet.push_back(metadata);
             }
+            prevSegmentObjects = metadatas;
+		}
+
+		// Decoded only once all segments are read: a raw data only segment copies the metadata
+		// of the previous segment, and that copy must still carry the rpsa_codec property.
+		// Chunks that do not decode are dropped rather than returned as bytes typed as samples.
+		vector<shared_ptr<Metadata>> decoded;
+		for (auto &metadata : metadataRet)
+		{
+			if (DecodeSamples(metadata))
+				decoded.push_back(metadata);
 		}
+		return decoded;
+	}
 
-		return metadataRet;
+	bool File::DecodeSamples(shared_ptr<Metadata> metadata) {
+		auto codec = metadata->Properties.find("rpsa_codec");
+		if (codec == metadata->Properties.end())
+			return true;
+		if (codec->second.GetDataString() != CODEC_NAME) {
+			cout << "[Error] " << metadata->PathStr << ": unknown codec " << codec->second.GetDataString() << endl;
+			return false;
+		}
+		auto rawVector = metadata->RawData.DataType.GetRawVector();
+		if (rawVector.size() != 1)
+			return false;
+
+		size_t samples = 0;
+		unsigned resolution = 0;
+		const uint8_t *src = rawVector[0]->data;
+		size_t size = rawVector[0]->size;
+		if (!codecInfo(src, size, samples, resolution)) {
+			cout << "[Error] " << metadata->PathStr << ": damaged compressed data" << endl;
+			return false;
+		}
+		shared_ptr<DataType::Raw> raw = make_shared<DataType::Raw>();
+		raw->size = samples * (resolution / 8);
+		raw->data = new uint8_t[raw->size];
+		if (!codecDecode(src, size, raw->data, raw->size, samples)) {
+			cout << "[Error] " << metadata->PathStr << ": damaged compressed data" << endl;
+			return false;
+		}
+		uint32_t type = resolution == 8 ? DataType::Integer8 : DataType::Integer16;
+		metadata->RawData.DataType.InitDataType(type, vector<shared_ptr<DataType::Raw>>{raw});
+		metadata->RawData.Count = samples;
+		metadata->RawData.Size = raw->size;
+		metadata->Properties.erase(codec);
+		return true;
 	}
 
 
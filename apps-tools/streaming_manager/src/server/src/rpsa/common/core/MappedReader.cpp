@@ -0,0 +1,576 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include "rpsa/common/core/MappedReader.h"
+#include "rpsa/common/core/DataType.h"
+#include "rpsa/common/core/sample_codec.h"
+
+namespace TDMS
+{
+    namespace {
+        const uint32_t TocMetaData    = 1 << 1;
+        const uint32_t TocNewObjList  = 1 << 2;
+        const uint32_t TocRawData     = 1 << 3;
+        const uint32_t TocInterleaved = 1 << 5;
+        const uint32_t TocBigEndian   = 1 << 6;
+        const uint32_t TocDaqMx       = 1 << 7;
+        const uint32_t NoRawData      = 0xFFFFFFFF;
+        const uint32_t SameRawData    = 0;
+        const uint64_t LeadInSize     = 28;
+        const char     CodecProperty[] = "rpsa_codec";
+
+        // Bounds checked little endian reads of the metadata
+        class Cursor{
+        public:
+            Cursor(const uint8_t *_pos, const uint8_t *_end): m_pos(_pos), m_end(_end), m_good(_pos <= _end) {}
+
+            template<typename T>
+            T get(){
+                T value = T();
+                if (skip(sizeof(T)))
+                    memcpy(&value, m_pos - sizeof(T), sizeof(T));
+                return value;
+            }
+
+            std::string string(){
+                auto length = get<uint32_t>();
+                if (!skip(length))
+                    return std::string();
+                return std::string((const char*)m_pos - length, length);
+            }
+
+            bool skip(uint64_t _size){
+                if (!m_good || _size > (uint64_t)(m_end - m_pos)) {
+                    m_good = false;
+                    return false;
+                }
+                m_pos += _size;
+                return true;
+            }
+
+            bool good() const { return m_good; }
+
+        private:
+            const uint8_t *m_pos;
+            const uint8_t *m_end;
+            bool           m_good;
+        };
+
+        // Object of the file while the segments are walked
+        struct Object{
+            uint32_t dataType;
+            uint64_t count;   // Values per chunk
+            uint64_t bytes;   // Per chunk
+            bool     codec;
+            int      channel; // -1 - no samples of a fixed size type
+        };
+
+        std::string channelName(const std::string &_path){
+            auto begin = _path.rfind("/'");
+            if (begin == std::string::npos)
+                return _path;
+            auto name = _path.substr(begin + 2);
+            if (!name.empty() && name.back() == '\'')
+                name.pop_back();
+            return name;
+        }
+
+        bool isFixedType(uint32_t _type){
+            switch (_type) {
+                case DataType::Integer8: case DataType::Integer16: case DataType::Integer32: case DataType::Integer64:
+                case DataType::UnsignedInteger8: case DataType::UnsignedInteger16: case DataType::UnsignedInteger32:
+                case DataType::UnsignedInteger64: case DataType::SingleFloat: case DataType::SingleFloatWithUnit:
+                case DataType::DoubleFloat: case DataType::DoubleFloatWithUnit: case DataType::Boolean:
+                case DataType::TimeStamp:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+    }
+
+    MappedReader::Ptr MappedReader::Open(const std::string &_fileName, bool _cache, bool _map){
+        Ptr reader(new MappedReader());
+        if (!reader->map(_fileName, _map))
+            return Ptr();
+        auto indexName = _fileName + TDMS_INDEX_SUFFIX;
+        if (_cache && reader->loadIndex(indexName))
+            return reader;
+        if (!reader->buildIndex())
+            return Ptr();
+        if (_cache && !reader->saveIndex(indexName))
+            std::cerr << "Error: MappedReader::Open() can't write " << indexName << "\n";
+        return reader;
+    }
+
+    MappedReader::MappedReader():
+        m_data(nullptr),
+        m_size(0),
+        m_mtime(0),
+        m_segments(0)
+#ifdef _WIN32
+        ,m_file(INVALID_HANDLE_VALUE),
+        m_mapping(nullptr)
+#else
+        ,m_fd(-1)
+#endif
+    {
+    }
+
+    MappedReader::~MappedReader(){
+        unmap();
+    }
+
+#ifdef _WIN32
+    bool MappedReader::map(const std::string &_fileName, bool _map){
+        if (!_map) {
+            std::cerr << "Error: MappedReader::Open() reading without a mapping is not supported on Windows\n";
+            return false;
+        }
+        m_file = CreateFileA(_fileName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        LARGE_INTEGER size;
+        struct stat info;
+        if (m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &size) || stat(_fileName.c_str(), &info) != 0) {
+            std::cerr << "Error: MappedReader::Open() can't open " << _fileName << "\n";
+            return false;
+        }
+        m_size = size.QuadPart;
+        m_mtime = info.st_mtime;
+        if (m_size == 0)
+            return true;
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (m_mapping != nullptr)
+            m_data = (const uint8_t*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+        if (m_data == nullptr) {
+            std::cerr << "Error: MappedReader::Open() can't map " << _fileName << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    void MappedReader::unmap(){
+        if (m_data)
+            UnmapViewOfFile(m_data);
+        if (m_mapping)
+            CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE)
+            CloseHandle(m_file);
+        m_data = nullptr;
+        m_mapping = nullptr;
+        m_file = INVALID_HANDLE_VALUE;
+    }
+
+    bool MappedReader::readAt(uint64_t, void *, uint64_t) const{
+        return false;
+    }
+#else
+    bool MappedReader::map(const std::string &_fileName, bool _map){
+        int fd = open(_fileName.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0) {
+            std::cerr << "Error: MappedReader::Open() can't open " << _fileName << "\n";
+            if (fd >= 0)
+                close(fd);
+            return false;
+        }
+        m_size = info.st_size;
+        m_mtime = info.st_mtime;
+        // A size_t length can not hold the whole file on 32 bit systems
+        if (_map && m_size > 0 && m_size <= SIZE_MAX) {
+            void *data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (data != MAP_FAILED)
+                m_data = (const uint8_t*)data;
+        }
+        if (m_data != nullptr || m_size == 0) {
+            close(fd);
+            return true;
+        }
+        // Out of address space, read with pread
+        m_fd = fd;
+        return true;
+    }
+
+    void MappedReader::unmap(){
+        if (m_data)
+            munmap((void*)m_data, m_size);
+        if (m_fd >= 0)
+            close(m_fd);
+        m_data = nullptr;
+        m_fd = -1;
+    }
+
+    bool MappedReader::readAt(uint64_t _offset, void *_dst, uint64_t _size) const{
+        auto dst = (uint8_t*)_dst;
+        while (_size > 0) {
+            ssize_t done = pread(m_fd, dst, _size, _offset);
+            if (done <= 0)
+                return false;
+            dst += done;
+            _offset += done;
+            _size -= done;
+        }
+        return true;
+    }
+#endif
+
+    const uint8_t* MappedReader::fetch(uint64_t _offset, uint64_t _size, std::vector<uint8_t> &_buffer) const{
+        if (m_data)
+            return m_data + _offset;
+        _buffer.resize(std::max<uint64_t>(_size, 1));
+        return readAt(_offset, _buffer.data(), _size) ? _buffer.data() : nullptr;
+    }
+
+    bool MappedReader::buildIndex(){
+        std::map<std::string, Object> objects;
+        std::vector<Object*> active; // Objects with raw data in the order of the chunk
+        std::vector<uint8_t> leadInBuffer, metaBuffer, codecBuffer;
+        uint64_t offset = 0;
+
+        while (offset + LeadInSize <= m_size) {
+            auto leadInData = fetch(offset, LeadInSize, leadInBuffer);
+            if (leadInData == nullptr) {
+                std::cerr << "Error: MappedReader::Open() can't read at " << offset << "\n";
+                return false;
+            }
+            Cursor leadIn(leadInData, leadInData + LeadInSize);
+            if (memcmp(leadInData, "TDSm", 4) != 0) {
+                if (offset == 0) {
+                    std::cerr << "Error: MappedReader::Open() not a TDMS file\n";
+                    return false;
+                }
+                // Garbage after the last segment, the samples before it are good
+                break;
+            }
+            leadIn.skip(4);
+            auto toc = leadIn.get<uint32_t>();
+            leadIn.get<uint32_t>();
+            auto next = leadIn.get<uint64_t>();
+            auto rawOffset = leadIn.get<uint64_t>();
+            if (toc & (TocBigEndian | TocDaqMx)) {
+                std::cerr << "Error: MappedReader::Open() big endian and DAQmx segments are not supported\n";
+                return false;
+            }
+
+            uint64_t begin = offset + LeadInSize;
+            bool last = next == UINT64_MAX || next > m_size - begin;
+            uint64_t end = last ? m_size : begin + next;
+            uint64_t rawBegin = begin + rawOffset;
+            if (rawOffset > m_size - begin)
+                break;
+
+            if (toc & TocMetaData) {
+                if (toc & TocNewObjList)
+                    active.clear();
+                auto metaData = fetch(begin, rawOffset, metaBuffer);
+                if (metaData == nullptr) {
+                    std::cerr << "Error: MappedReader::Open() can't read at " << begin << "\n";
+                    return false;
+                }
+                Cursor meta(metaData, metaData + rawOffset);
+                auto count = meta.get<uint32_t>();
+                for (uint32_t i = 0; i < count && meta.good(); ++i) {
+                    auto path = meta.string();
+                    auto found = objects.find(path);
+                    if (found == objects.end())
+                        found = objects.insert(std::make_pair(path, Object{0, 0, 0, false, -1})).first;
+                    auto &object = found->second;
+                    auto listed = std::find(active.begin(), active.end(), &object);
+
+                    auto index = meta.get<uint32_t>();
+                    if (index == NoRawData) {
+                        if (listed != active.end())
+                            active.erase(listed);
+                    } else {
+                        if (index != SameRawData) {
+                            object.dataType = meta.get<uint32_t>();
+                            meta.get<uint32_t>();
+                            object.count = meta.get<uint64_t>();
+                            if (object.dataType == DataType::String) {
+                                object.bytes = meta.get<uint64_t>();
+                            } else if (isFixedType(object.dataType)) {
+                                object.bytes = object.count * DataType::GetLength(object.dataType);
+                            } else {
+                                std::cerr << "Error: MappedReader::Open() unknown data type " << object.dataType << " of " << path << "\n";
+                                return false;
+                            }
+                            // The codec applies to the segments that carry it
+                            object.codec = false;
+                        }
+                        if (listed == active.end())
+                            active.push_back(&object);
+                        if (object.channel < 0 && isFixedType(object.dataType)) {
+                            object.channel = m_channels.size();
+                            m_channels.push_back({path, channelName(path), object.dataType, 0, false});
+                            m_chunks.emplace_back();
+                        }
+                    }
+
+                    auto properties = meta.get<uint32_t>();
+                    for (uint32_t p = 0; p < properties && meta.good(); ++p) {
+                        auto name = meta.string();
+                        auto type = meta.get<uint32_t>();
+                        if (type == DataType::String) {
+                            auto value = meta.string();
+                            if (name == CodecProperty) {
+                                if (value != CODEC_NAME) {
+                                    std::cerr << "Error: MappedReader::Open() unknown codec " << value << " of " << path << "\n";
+                                    return false;
+                                }
+                                object.codec = true;
+                            }
+                        } else if (isFixedType(type)) {
+                            meta.skip(DataType::GetLength(type));
+                        } else {
+                            std::cerr << "Error: MappedReader::Open() unknown property type " << type << " of " << path << "\n";
+                            return false;
+                        }
+                    }
+                }
+                if (!meta.good()) {
+                    if (last)
+                        break;
+                    std::cerr << "Error: MappedReader::Open() damaged metadata at " << offset << "\n";
+                    return false;
+                }
+            }
+
+            if ((toc & TocRawData) && !active.empty()) {
+                bool interleaved = toc & TocInterleaved;
+                uint64_t stride = 0;
+                uint64_t chunkSize = 0;
+                for (auto object : active) {
+                    if (interleaved && object->dataType == DataType::String) {
+                        std::cerr << "Error: MappedReader::Open() interleaved strings are not supported\n";
+                        return false;
+                    }
+                    stride += interleaved ? DataType::GetLength(object->dataType) : 0;
+                    chunkSize += object->bytes;
+                }
+                uint64_t chunks = chunkSize > 0 && end > rawBegin ? (end - rawBegin) / chunkSize : 0;
+                bool added = false;
+                for (uint64_t c = 0; c < chunks; ++c) {
+                    uint64_t position = rawBegin + c * chunkSize;
+                    for (auto object : active) {
+                        if (object->channel >= 0 && object->count > 0) {
+                            auto &info = m_channels[object->channel];
+                            Chunk chunk = {};
+                            chunk.offset = position;
+                            chunk.first = info.samples;
+                            chunk.count = object->count;
+                            chunk.bytes = object->bytes;
+                            chunk.segment = m_segments;
+                            chunk.sampleSize = DataType::GetLength(object->dataType);
+                            chunk.stride = interleaved ? stride : chunk.sampleSize;
+                            if (object->codec) {
+                                size_t samples = 0;
+                                unsigned resolution = 0;
+                                // Only the stream header is read
+                                auto header = fetch(chunk.offset, std::min<uint64_t>(chunk.bytes, CODEC_HEADER_SIZE), codecBuffer);
+                                if (header == nullptr || !codecInfo(header, chunk.bytes, samples, resolution)) {
+                                    std::cerr << "Error: MappedReader::Open() damaged compressed data of " << info.path << "\n";
+                                    return false;
+                                }
+                                chunk.count = samples;
+                                chunk.sampleSize = resolution / 8;
+                                chunk.stride = chunk.sampleSize;
+                                chunk.compressed = 1;
+                                if (!info.compressed && info.samples == 0)
+                                    info.dataType = resolution == 8 ? DataType::Integer8 : DataType::Integer16;
+                                info.compressed = true;
+                            }
+                            if (chunk.sampleSize != DataType::GetLength(info.dataType)) {
+                                std::cerr << "Error: MappedReader::Open() " << info.path << " changes its sample size\n";
+                                return false;
+                            }
+                            info.samples += chunk.count;
+                            m_chunks[object->channel].push_back(chunk);
+                            added = true;
+                        }
+                        position += interleaved ? DataType::GetLength(object->dataType) : object->bytes;
+                    }
+                }
+                if (added)
+                    ++m_segments;
+            }
+
+            if (last)
+                break;
+            offset = end;
+        }
+        return true;
+    }
+
+    bool MappedReader::loadIndex(const std::string &_indexName){
+        std::ifstream in(_indexName, std::ios::binary);
+        if (!in.good())
+            return false;
+        uint32_t magic = 0, version = 0, segments = 0, channels = 0;
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        in.read((char*)&magic, sizeof(magic));
+        in.read((char*)&version, sizeof(version));
+        in.read((char*)&size, sizeof(size));
+        in.read((char*)&mtime, sizeof(mtime));
+        in.read((char*)&segments, sizeof(segments));
+        in.read((char*)&channels, sizeof(channels));
+        if (!in.good() || magic != TDMS_INDEX_MAGIC || version != TDMS_INDEX_VERSION || size != m_size || mtime != m_mtime)
+            return false;
+
+        std::vector<ChannelInfo> infos(channels);
+        std::vector<std::vector<Chunk>> chunks(channels);
+        for (uint32_t i = 0; i < channels && in.good(); ++i) {
+            uint32_t length = 0;
+            uint64_t count = 0;
+            in.read((char*)&length, sizeof(length));
+            if (!in.good() || length > 4096)
+                return false;
+            infos[i].path.resize(length);
+            in.read(&infos[i].path[0], length);
+            in.read((char*)&infos[i].dataType, sizeof(infos[i].dataType));
+            in.read((char*)&infos[i].compressed, sizeof(infos[i].compressed));
+            in.read((char*)&count, sizeof(count));
+            if (!in.good() || count > m_size)
+                return false;
+            infos[i].name = channelName(infos[i].path);
+            chunks[i].resize(count);
+            in.read((char*)chunks[i].data(), count * sizeof(Chunk));
+            infos[i].samples = count > 0 ? chunks[i].back().first + chunks[i].back().count : 0;
+            for (auto &chunk : chunks[i]) {
+                uint64_t bytes = chunk.compressed ? chunk.bytes : (chunk.count > 0 ? chunk.stride * (chunk.count - 1) + chunk.sampleSize : 0);
+                if (chunk.offset > m_size || bytes > m_size - chunk.offset)
+                    return false;
+            }
+        }
+        if (!in.good())
+            return false;
+        m_segments = segments;
+        m_channels.swap(infos);
+        m_chunks.swap(chunks);
+        return true;
+    }
+
+    bool MappedReader::saveIndex(const std::string &_indexName) const{
+        auto temp = _indexName + ".tmp";
+        {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+            uint32_t magic = TDMS_INDEX_MAGIC;
+            uint32_t version = TDMS_INDEX_VERSION;
+            uint32_t channels = m_channels.size();
+            out.write((const char*)&magic, sizeof(magic));
+            out.write((const char*)&version, sizeof(version));
+            out.write((const char*)&m_size, sizeof(m_size));
+            out.write((const char*)&m_mtime, sizeof(m_mtime));
+            out.write((const char*)&m_segments, sizeof(m_segments));
+            out.write((const char*)&channels, sizeof(channels));
+            for (uint32_t i = 0; i < channels; ++i) {
+                uint32_t length = m_channels[i].path.size();
+                uint64_t count = m_chunks[i].size();
+                out.write((const char*)&length, sizeof(length));
+                out.write(m_channels[i].path.data(), length);
+                out.write((const char*)&m_channels[i].dataType, sizeof(m_channels[i].dataType));
+                out.write((const char*)&m_channels[i].compressed, sizeof(m_channels[i].compressed));
+                out.write((const char*)&count, sizeof(count));
+                out.write((const char*)m_chunks[i].data(), count * sizeof(Chunk));
+            }
+            if (!out.good())
+                return false;
+        }
+#ifdef _WIN32
+        std::remove(_indexName.c_str());
+#endif
+        return std::rename(temp.c_str(), _indexName.c_str()) == 0;
+    }
+
+    int MappedReader::findChannel(const std::string &_name) const{
+        for (size_t i = 0; i < m_channels.size(); ++i) {
+            if (m_channels[i].name == _name || m_channels[i].path == _name)
+                return i;
+        }
+        return -1;
+    }
+
+    int64_t MappedReader::findChunk(int _channel, uint64_t _sample) const{
+        auto &chunks = m_chunks[_channel];
+        auto found = std::upper_bound(chunks.begin(), chunks.end(), _sample,
+                                      [](uint64_t _value, const Chunk &_chunk){ return _value < _chunk.first; });
+        if (found == chunks.begin())
+            return -1;
+        --found;
+        if (_sample >= found->first + found->count)
+            return -1;
+        return found - chunks.begin();
+    }
+
+    bool MappedReader::segmentRange(int _channel, uint32_t _segment, uint64_t &_first, uint64_t &_count) const{
+        if (_channel < 0 || _channel >= (int)m_channels.size())
+            return false;
+        auto &chunks = m_chunks[_channel];
+        auto begin = std::lower_bound(chunks.begin(), chunks.end(), _segment,
+                                      [](const Chunk &_chunk, uint32_t _value){ return _chunk.segment < _value; });
+        auto end = std::upper_bound(begin, chunks.end(), _segment,
+                                    [](uint32_t _value, const Chunk &_chunk){ return _value < _chunk.segment; });
+        if (begin == end)
+            return false;
+        _first = begin->first;
+        _count = (end - 1)->first + (end - 1)->count - _first;
+        return true;
+    }
+
+    bool MappedReader::read(int _channel, uint64_t _first, uint64_t _count, void *_dst) const{
+        if (_channel < 0 || _channel >= (int)m_channels.size() || _first + _count > m_channels[_channel].samples)
+            return false;
+        // Decoded chunk for a range that starts or ends inside it
+        thread_local std::vector<uint8_t> decoded;
+        // File bytes of a chunk when the file is not mapped
+        thread_local std::vector<uint8_t> buffer;
+        auto &chunks = m_chunks[_channel];
+        auto dst = (uint8_t*)_dst;
+        for (int64_t i = findChunk(_channel, _first); _count > 0; ++i) {
+            if (i < 0 || i >= (int64_t)chunks.size())
+                return false;
+            auto &chunk = chunks[i];
+            uint64_t skip = _first - chunk.first;
+            uint64_t count = std::min<uint64_t>(chunk.count - skip, _count);
+            size_t bytes = count * chunk.sampleSize;
+            if (chunk.compressed) {
+                size_t samples = 0;
+                auto stream = fetch(chunk.offset, chunk.bytes, buffer);
+                if (stream == nullptr)
+                    return false;
+                if (skip == 0 && count == chunk.count) {
+                    if (!codecDecode(stream, chunk.bytes, dst, bytes, samples))
+                        return false;
+                } else {
+                    decoded.resize(chunk.count * chunk.sampleSize);
+                    if (!codecDecode(stream, chunk.bytes, decoded.data(), decoded.size(), samples))
+                        return false;
+                    memcpy(dst, decoded.data() + skip * chunk.sampleSize, bytes);
+                }
+            } else if (chunk.stride == chunk.sampleSize) {
+                if (m_data)
+                    memcpy(dst, data(chunk) + skip * chunk.stride, bytes);
+                else if (!readAt(chunk.offset + skip * chunk.stride, dst, bytes))
+                    return false;
+            } else {
+                auto src = fetch(chunk.offset + skip * chunk.stride, chunk.stride * (count - 1) + chunk.sampleSize, buffer);
+                if (src == nullptr)
+                    return false;
+                for (uint64_t s = 0; s < count; ++s)
+                    memcpy(dst + s * chunk.sampleSize, src + s * chunk.stride, chunk.sampleSize);
+            }
+            dst += bytes;
+            _first += count;
+            _count -= count;
+        }
+        return true;
+    }
+}
@@ -2,6 +2,7 @@
 // Created by user on 15.11.18.
 //
 #include <iostream>
+#include <cstdio>
 #include "rpsa/common/core/Writer.h"
 
 #define  OFFSET_NEXT_SEGMENT    12
@@ -271,4 +272,175 @@ namespace TDMS {
         m_fileStream->seekp(pos);
         m_stek_pos_p.pop_back();
     }
-}
\ No newline at end of file
+
+    namespace {
+        // Table of contents flags
+        const int32_t TocMetaData   = 1 << 1;
+        const int32_t TocNewObjList = 1 << 2;
+        const int32_t TocRawData    = 1 << 3;
+
+        template<typename T>
+        void put(uint8_t *&_pos, T _value){
+            memcpy(_pos, &_value, sizeof(T));
+            _pos += sizeof(T);
+        }
+
+        void putString(uint8_t *&_pos, const char *_str, int32_t _len){
+            put<int32_t>(_pos, _len);
+            memcpy(_pos, _str, _len);
+            _pos += _len;
+        }
+
+        void putLeadIn(uint8_t *&_pos, int32_t _toc, int64_t _nextSegment, int64_t _rawOffset){
+            memcpy(_pos, "TDSm", 4);
+            _pos += 4;
+            put<int32_t>(_pos, _toc);
+            put<int32_t>(_pos, 4713);
+            put<int64_t>(_pos, _nextSegment);
+            put<int64_t>(_pos, _rawOffset);
+        }
+
+        void putRaw(uint8_t *&_pos, const MemoryWriter::Channel *_channels, int _count){
+            for (int i = 0; i < _count; ++i){
+                memcpy(_pos, _channels[i].data, _channels[i].size);
+                _pos += _channels[i].size;
+            }
+        }
+
+        uint64_t rawSize(const MemoryWriter::Channel *_channels, int _count){
+            uint64_t size = 0;
+            for (int i = 0; i < _count; ++i)
+                size += _channels[i].size;
+            return size;
+        }
+
+        int groupPath(char *_buf, size_t _size, const char *_group){
+            return snprintf(_buf, _size, "/'%s'", _group);
+        }
+
+        int channelPath(char *_buf, size_t _size, const char *_group, const char *_channel){
+            return snprintf(_buf, _size, "/'%s'/'%s'", _group, _channel);
+        }
+
+        const char CodecProperty[] = "rpsa_codec";
+
+        size_t propertiesSize(const MemoryWriter::Channel &_channel){
+            size_t size = sizeof(int32_t);
+            if (_channel.codec)
+                size += sizeof(int32_t) + strlen(CodecProperty) + sizeof(uint32_t) + sizeof(int32_t) + strlen(_channel.codec);
+            return size;
+        }
+
+        void putProperties(uint8_t *&_pos, const MemoryWriter::Channel &_channel){
+            if (!_channel.codec) {
+                put<int32_t>(_pos, 0);
+                return;
+            }
+            put<int32_t>(_pos, 1);
+            putString(_pos, CodecProperty, strlen(CodecProperty));
+            put<uint32_t>(_pos, DataType::String);
+            putString(_pos, _channel.codec, strlen(_channel.codec));
+        }
+
+        size_t writeMetadataSegment(uint8_t *dst, size_t capacity, const char *groupName, const MemoryWriter::Channel *channels, int count, int32_t toc){
+            char path[128];
+            uint64_t raw = rawSize(channels, count);
+            size_t headerSize = MemoryWriter::HeaderSize(groupName, channels, count);
+            if (headerSize + raw > capacity)
+                return 0;
+
+            uint8_t *pos = dst;
+            putLeadIn(pos, toc, headerSize + raw - 28, headerSize - 28);
+
+            put<int32_t>(pos, count + 1);
+            putString(pos, path, groupPath(path, sizeof(path), groupName));
+            put<int32_t>(pos, -1);
+            put<int32_t>(pos, 0);
+
+            for (int i = 0; i < count; ++i){
+                putString(pos, path, channelPath(path, sizeof(path), groupName, channels[i].name));
+                put<int32_t>(pos, 20);
+                put<int32_t>(pos, channels[i].dataType);
+                put<int32_t>(pos, 1);
+                put<uint64_t>(pos, channels[i].size / DataType::GetLength(channels[i].dataType));
+                putProperties(pos, channels[i]);
+            }
+
+            putRaw(pos, channels, count);
+            return pos - dst;
+        }
+    }
+
+    size_t MemoryWriter::HeaderSize(const char *groupName, const Channel *channels, int count){
+        char path[128];
+        size_t size = 28 + sizeof(int32_t);
+        // Group: path, raw index (-1), property count
+        size += sizeof(int32_t) + groupPath(path, sizeof(path), groupName) + sizeof(int32_t) * 2;
+        for (int i = 0; i < count; ++i){
+            // Channel: path, raw index, type, dimension, count, properties
+            size += sizeof(int32_t) + channelPath(path, sizeof(path), groupName, channels[i].name);
+            size += sizeof(int32_t) * 3 + sizeof(uint64_t) + propertiesSize(channels[i]);
+        }
+        return size;
+    }
+
+    size_t MemoryWriter::WriteSegment(uint8_t *dst, size_t capacity, const char *groupName, const Channel *channels, int count){
+        return writeMetadataSegment(dst, capacity, groupName, channels, count, TocMetaData | TocRawData);
+    }
+
+    StreamWriter::StreamWriter(){
+        Reset();
+    }
+
+    void StreamWriter::Reset(){
+        m_hasMetadata = false;
+        m_count = 0;
+    }
+
+    bool StreamWriter::IsSameLayout(const MemoryWriter::Channel *channels, int count){
+        if (!m_hasMetadata || count != m_count)
+            return false;
+        for (int i = 0; i < count; ++i){
+            if (strncmp(m_names[i], channels[i].name, sizeof(m_names[i])) != 0 ||
+                m_types[i] != channels[i].dataType ||
+                m_sizes[i] != channels[i].size ||
+                m_codecs[i] != (channels[i].codec != nullptr))
+                return false;
+        }
+        return true;
+    }
+
+    void StreamWriter::StoreLayout(const MemoryWriter::Channel *channels, int count){
+        m_count = count;
+        for (int i = 0; i < count; ++i){
+            strncpy(m_names[i], channels[i].name, sizeof(m_names[i]) - 1);
+            m_names[i][sizeof(m_names[i]) - 1] = 0;
+            m_types[i] = channels[i].dataType;
+            m_sizes[i] = channels[i].size;
+            m_codecs[i] = channels[i].codec != nullptr;
+        }
+        m_hasMetadata = true;
+    }
+
+    size_t StreamWriter::WriteSegment(uint8_t *dst, size_t capacity, const char *groupName, const MemoryWriter::Channel *channels, int count){
+        if (count > MaxChannels)
+            return 0;
+
+        if (!IsSameLayout(channels, count)){
+            // New or changed object list: full metadata
+            size_t size = writeMetadataSegment(dst, capacity, groupName, channels, count, TocMetaData | TocNewObjList | TocRawData);
+            if (size > 0)
+                StoreLayout(channels, count);
+            return size;
+        }
+
+        uint64_t raw = rawSize(channels, count);
+        if (RawLeadInSize() + raw > capacity)
+            return 0;
+
+        uint8_t *pos = dst;
+        putLeadIn(pos, TocRawData, raw, 0);
+        putRaw(pos, channels, count);
+        return pos - dst;
+    }
+}
@@ -0,0 +1,68 @@
+#include <cstdlib>
+#include <new>
+#include "rpsa/common/core/buffer_pool.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace {
+    void *slab_alloc(size_t _align, size_t _size){
+#ifdef _WIN32
+        return _aligned_malloc(_size, _align);
+#else
+        void *ptr = nullptr;
+        if (posix_memalign(&ptr, _align, _size) != 0)
+            return nullptr;
+        return ptr;
+#endif
+    }
+
+    void slab_free(void *_ptr){
+#ifdef _WIN32
+        _aligned_free(_ptr);
+#else
+        free(_ptr);
+#endif
+    }
+}
+
+CBufferPool::Ptr CBufferPool::Create(size_t _blockSize, size_t _count, size_t _align){
+    return std::make_shared<CBufferPool>(_blockSize, _count, _align);
+}
+
+CBufferPool::CBufferPool(size_t _blockSize, size_t _count, size_t _align):
+    m_slab(nullptr),
+    m_blockSize((_blockSize + _align - 1) & ~(_align - 1)),
+    m_count(_count),
+    m_free(_count)
+{
+    m_slab = static_cast<uint8_t *>(slab_alloc(_align, m_blockSize * m_count));
+    if (m_slab == nullptr)
+        throw std::bad_alloc();
+
+    for (size_t i = 0; i < m_count; ++i){
+        m_free.push(m_slab + i * m_blockSize);
+    }
+}
+
+CBufferPool::~CBufferPool(){
+    slab_free(m_slab);
+}
+
+uint8_t *CBufferPool::borrow(){
+    uint8_t *block = nullptr;
+    if (!m_free.pop(block))
+        return nullptr;
+    return block;
+}
+
+void CBufferPool::release(uint8_t *_block){
+    if (_block != nullptr)
+        m_free.push(_block);
+}
+
+void CBufferPool::releaseShared(uint8_t *_block){
+    std::lock_guard<std::mutex> lock(m_releaseLock);
+    release(_block);
+}
@@ -0,0 +1,61 @@
+#include "rpsa/common/core/crc32c.h"
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY 0x82F63B78u
+
+namespace {
+
+    // Slicing-by-8 tables, table[0] is the classic byte-wise table
+    struct Crc32cTable{
+        uint32_t table[8][256];
+
+        Crc32cTable(){
+            for (uint32_t i = 0; i < 256; i++){
+                uint32_t crc = i;
+                for (int j = 0; j < 8; j++)
+                    crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1u)));
+                table[0][i] = crc;
+            }
+            for (uint32_t i = 0; i < 256; i++){
+                for (int k = 1; k < 8; k++)
+                    table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+            }
+        }
+    };
+
+    const Crc32cTable g_table;
+}
+
+uint32_t crc32c(uint32_t _crc, const void *_data, size_t _size){
+    auto p = static_cast<const uint8_t*>(_data);
+    uint32_t crc = ~_crc;
+
+    while (_size > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0){
+        crc = (crc >> 8) ^ g_table.table[0][(crc ^ *p++) & 0xFF];
+        _size--;
+    }
+
+#if defined(__SSE4_2__) && defined(__x86_64__)
+    uint64_t crc64 = crc;
+    for (; _size >= 8; _size -= 8, p += 8)
+        crc64 = _mm_crc32_u64(crc64, *reinterpret_cast<const uint64_t*>(p));
+    crc = static_cast<uint32_t>(crc64);
+#else
+    const auto &t = g_table.table;
+    for (; _size >= 8; _size -= 8, p += 8){
+        // Little endian: the low word is the first four bytes
+        uint32_t lo = *reinterpret_cast<const uint32_t*>(p) ^ crc;
+        uint32_t hi = *reinterpret_cast<const uint32_t*>(p + 4);
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+    }
+#endif
+
+    while (_size-- > 0)
+        crc = (crc >> 8) ^ g_table.table[0][(crc ^ *p++) & 0xFF];
+
+    return ~crc;
+}
@@ -8,7 +8,14 @@
 
 #include "rpsa/common/core/file_async_writer.h"
 #include "rpsa/common/core/File.h"
+#include "rpsa/common/core/wavWriter.h"
+#include "rpsa/common/core/thread_sched.h"
+#include "rpsa/common/core/sample_codec.h"
+#include "rpsa/common/core/sample_kernels.h"
 #include <ctime>
+#include <cstdio>
+#include <iomanip>
+#include <sstream>
 
 #ifndef _WIN32
 #include <sys/statvfs.h>
@@ -28,13 +35,36 @@ std::string DirNameOf(const std::string& fname)
 }
 
 FileQueueManager::FileQueueManager():Queue(){
+    th = nullptr;
+    m_backend = nullptr;
+    m_backendType = CFileBackend::DefaultType();
     m_threadWork = false;
     m_waitAllWrite = false;    
     m_hasErrorWrite = false;
+    m_aviablePhyMemory = 0;
+    m_wavCheckpointInterval = WAV_CHECKPOINT_INTERVAL;
+    m_cpu = -1;
+    m_pool = nullptr;
+    m_spareBlock = nullptr;
+    m_segmentBytes = 0;
+    m_segmentSeconds = 0;
+    m_producerSegment = 0;
+    m_segmentStart = true;
+    m_producerSegmentSize = 0;
+    m_producerSegmentTime = 0;
+    m_writeSegment = 0;
+    m_segmentWriteSize = 0;
+    m_activeSegment = FileSegment();
+    m_segmentThread = nullptr;
+    m_segmentThreadRun = false;
+    m_nextSegment = 0;
+    m_nextReserved = 0;
+    m_rawHeader = RawIndexHeader();
 }
 
 FileQueueManager::~FileQueueManager(){
     this->StopWrite(false);
+    CloseFile();
 }
 
 unsigned long long getTotalSystemMemory()
@@ -81,17 +111,57 @@ int FileQueueManager::AvailableSpace(std::string dst, ulong* availableSize) {
 #endif
 }
 
-bool FileQueueManager::AddBufferToWrite(std::iostream *buffer){
+uint8_t *FileQueueManager::GetFreeBlock(){
+    if (!m_threadWork || !m_pool)
+        return nullptr;
+    if (m_spareBlock != nullptr){
+        auto block = m_spareBlock;
+        m_spareBlock = nullptr;
+        return block;
+    }
+    return m_pool->borrow();
+}
+
+size_t FileQueueManager::GetBlockSize(){
+    return m_pool ? m_pool->blockSize() : 0;
+}
 
- //   acout() << m_useMemory  << "\n";
-    if (m_threadWork && (m_useMemory < m_aviablePhyMemory)){
-        pushQueue(buffer);
-        return true;
+void FileQueueManager::SetMetrics(CMetrics::Ptr _metrics){
+    if (!_metrics){
+        m_metricBytes = nullptr;
+        m_metricBlocks = nullptr;
+        m_metricPoolUsed = nullptr;
+        m_metricPoolSize = nullptr;
+        m_metricLatency = nullptr;
+        return;
     }
-    else{
-        delete buffer;
-        return false;
+    m_metricBytes = _metrics->counter("rpsa_stage_bytes_total", "stage=\"disk\"", "Bytes that passed a stage of the stream");
+    m_metricBlocks = _metrics->counter("rpsa_stage_buffers_total", "stage=\"disk\"", "Buffers that passed a stage of the stream");
+    m_metricPoolUsed = _metrics->gauge("rpsa_queue_used", "queue=\"file\"", "Blocks held in a queue between two stages");
+    m_metricPoolSize = _metrics->gauge("rpsa_queue_size", "queue=\"file\"", "Capacity of a queue between two stages", false);
+    m_metricLatency = _metrics->histogram("rpsa_dma_to_disk_seconds", "", "Time from the end of the acquisition of a buffer until it is written to the file");
+}
+
+bool FileQueueManager::AddBufferToWrite(uint8_t *buffer, size_t size, const FileBlockInfo &info){
+    if (m_threadWork && size > 0){
+        if (pushQueue(buffer, size, m_producerSegment, info)){
+            if (m_metricPoolUsed)
+                m_metricPoolUsed->set(m_pool->count() - m_pool->available());
+            if (m_segmentStart){
+                m_segmentStart = false;
+                m_producerSegmentSize = 0;
+                m_producerSegmentTime = info.timestamp;
+            }
+            m_producerSegmentSize += size;
+            return true;
+        }
     }
+    // Keep the block on the producer side, it is handed out again by GetFreeBlock
+    m_spareBlock = buffer;
+    // The block may have carried the object list of a new layout that never reaches the file,
+    // the next TDMS block must bring its own
+    m_tdmsWriter.Reset();
+    return false;
 }
 
 ulong FileQueueManager::GetFreeSpaceDisk(std::string _filePath){
@@ -119,48 +189,293 @@ ulong FileQueueManager::GetFreeSpaceDisk(std::string _filePath){
     return  m_freeSize;
 }
 
-void FileQueueManager::OpenFile(std::string FileName,bool Append){
-    fs.open(FileName, std::ios::binary | std::ofstream::out| std::ofstream::in | (Append? std::ofstream::binary  : std::ofstream::trunc));
-    if (fs.fail()) {
-        fs.open(FileName, std::ios::binary | std::ofstream::out| std::ofstream::in |  std::ofstream::trunc);
-        if (fs.fail()) {
-            std::cout << "File " << FileName << " not exist" << std::endl;
+void FileQueueManager::SetRotation(uint64_t _bytes, uint32_t _seconds){
+    m_segmentBytes = _bytes;
+    m_segmentSeconds = _seconds;
+}
+
+bool FileQueueManager::RotateIfNeeded(size_t _size, uint64_t _timestamp){
+    if (!IsSegmented() || m_segmentStart)
+        return false;
+    bool full = m_segmentBytes > 0 && m_producerSegmentSize + _size > m_segmentBytes;
+    bool late = m_segmentSeconds > 0 && _timestamp >= m_producerSegmentTime + m_segmentSeconds * 1000000000ull;
+    if (!full && !late)
+        return false;
+    // Every segment has at least one block, so the writer sees the indices one after another
+    ++m_producerSegment;
+    m_segmentStart = true;
+    return true;
+}
+
+std::string FileQueueManager::SegmentName(uint32_t _segment){
+    auto slash = m_fileName.find_last_of("\\/");
+    auto dot = m_fileName.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        dot = m_fileName.size();
+    std::ostringstream name;
+    name << m_fileName.substr(0, dot) << "_" << std::setw(5) << std::setfill('0') << _segment << m_fileName.substr(dot);
+    return name.str();
+}
+
+std::string FileQueueManager::ManifestName(){
+    auto slash = m_fileName.find_last_of("\\/");
+    auto dot = m_fileName.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        dot = m_fileName.size();
+    return m_fileName.substr(0, dot) + ".manifest.json";
+}
+
+CFileBackend::Ptr FileQueueManager::OpenSegment(uint32_t _segment){
+    auto backend = CFileBackend::Create(m_backendType);
+    if (!backend->Open(SegmentName(_segment), false))
+        return nullptr;
+    // A block may pass the limit by its framing
+    if (m_segmentBytes > 0)
+        backend->Reserve(m_segmentBytes + FILE_BLOCK_HEADER);
+    return backend;
+}
+
+void FileQueueManager::PostSegmentTask(std::function<void()> _task){
+    std::lock_guard<std::mutex> lock(m_segmentLock);
+    m_segmentTasks.push_back(_task);
+    m_segmentCond.notify_all();
+}
+
+void FileQueueManager::SegmentTask(){
+    std::unique_lock<std::mutex> lock(m_segmentLock);
+    while (true){
+        m_segmentCond.wait(lock, [this]{ return !m_segmentTasks.empty() || !m_segmentThreadRun; });
+        // Posted tasks are finished before the thread exits
+        if (m_segmentTasks.empty())
+            break;
+        auto task = m_segmentTasks.front();
+        m_segmentTasks.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
+
+void FileQueueManager::OpenNextSegment(){
+    uint32_t segment = m_writeSegment + 1;
+    PostSegmentTask([this, segment](){
+        auto backend = OpenSegment(segment);
+        std::lock_guard<std::mutex> lock(m_segmentLock);
+        m_nextReserved = backend ? backend->GetReserved() : 0;
+        m_nextBackend = backend;
+        m_nextSegment = segment;
+        m_segmentCond.notify_all();
+    });
+}
+
+// Writer thread: the first block of _segment is next
+void FileQueueManager::NextWriteSegment(uint32_t _segment){
+    if (m_fileType == Stream_FileType::WAV_TYPE && m_firstSectionWrite){
+        updateWavFile();
+    }
+    CFileBackend::Ptr next;
+    {
+        std::unique_lock<std::mutex> lock(m_segmentLock);
+        m_activeSegment.bytes = m_segmentWriteSize;
+        m_segments[m_writeSegment] = m_activeSegment;
+        // Opened long ago unless segments are shorter than opening a file
+        m_segmentCond.wait(lock, [this, _segment]{ return m_nextSegment == _segment; });
+        next = m_nextBackend;
+        m_nextBackend = nullptr;
+        m_nextReserved = 0;
+        m_segments.push_back(FileSegment());
+        m_segments.back().file = SegmentName(_segment);
+    }
+
+    auto done = m_backend;
+    auto doneSegment = m_writeSegment;
+    auto doneIndex = m_rawIndex;
+    m_rawIndex = nullptr;
+    PostSegmentTask([this, done, doneSegment, doneIndex](){
+        done->Close();
+        if (doneIndex)
+            doneIndex->close(done->GetSize());
+        std::vector<FileSegment> segments;
+        {
+            std::lock_guard<std::mutex> lock(m_segmentLock);
+            m_segments[doneSegment].bytes = done->GetSize();
+            m_segments[doneSegment].complete = done->IsGood();
+            segments = m_segments;
+        }
+        WriteManifest(segments);
+    });
+
+    m_backend = next;
+    m_writeSegment = _segment;
+    m_segmentWriteSize = 0;
+    m_firstSectionWrite = false;
+    m_activeSegment = FileSegment();
+    m_activeSegment.file = SegmentName(_segment);
+    OpenNextSegment();
+}
+
+void FileQueueManager::WriteManifest(const std::vector<FileSegment> &_segments){
+    auto name = ManifestName();
+    auto temp = name + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::trunc);
+        out << "{\n"
+            << "  \"version\": 1,\n"
+            << "  \"type\": \"" << (m_fileType == Stream_FileType::WAV_TYPE ? "wav" : (m_fileType == Stream_FileType::RAW_TYPE ? "raw" : "tdms")) << "\",\n"
+            << "  \"segmentBytes\": " << m_segmentBytes << ",\n"
+            << "  \"segmentSeconds\": " << m_segmentSeconds << ",\n"
+            << "  \"segments\": [";
+        for (size_t i = 0; i < _segments.size(); ++i){
+            auto &segment = _segments[i];
+            auto slash = segment.file.find_last_of("\\/");
+            out << (i ? ",\n" : "\n")
+                << "    {\"index\": " << i
+                << ", \"file\": \"" << (slash == std::string::npos ? segment.file : segment.file.substr(slash + 1)) << "\""
+                << ", \"firstSample\": " << segment.firstSample
+                << ", \"endSample\": " << segment.endSample
+                << ", \"firstTimestamp\": " << segment.firstTimestamp
+                << ", \"blocks\": " << segment.blocks
+                << ", \"bytes\": " << segment.bytes
+                << ", \"complete\": " << (segment.complete ? "true" : "false") << "}";
+        }
+        out << "\n  ]\n}\n";
+        if (!out.good()){
+            acout() << "Can't write " << temp << "\n";
             return;
         }
     }
+    // Readers never see a partly written manifest
+#ifdef _WIN32
+    std::remove(name.c_str());
+#endif
+    std::rename(temp.c_str(), name.c_str());
+}
+
+void FileQueueManager::OpenFile(std::string FileName,bool Append){
+    CloseFile();
+    m_fileName = FileName;
 
     auto dirName = DirNameOf(FileName);
     if (dirName == "") {
         dirName = ".";
     }
-
+    // Before the files are opened, the extents they reserve are counted in ReservedSize()
     m_freeSize = GetFreeSpaceDisk(dirName);
+    m_nextReserved = 0;
+    m_producerSegment = 0;
+    m_writeSegment = 0;
+    m_segmentWriteSize = 0;
+    m_activeSegment = FileSegment();
+    if (IsSegmented()){
+        m_backend = OpenSegment(0);
+        if (!m_backend) {
+            return;
+        }
+        m_activeSegment.file = SegmentName(0);
+        m_segments.assign(1, m_activeSegment);
+        m_nextBackend = nullptr;
+        m_nextSegment = 0;
+        m_segmentThreadRun = true;
+        m_segmentThread = new std::thread(&FileQueueManager::SegmentTask, this);
+        OpenNextSegment();
+        std::cout << "File segments: " << m_segmentBytes << " bytes, " << m_segmentSeconds << " s, " << ManifestName() << "\n";
+    }else{
+        m_backend = CFileBackend::Create(m_backendType);
+        if (!m_backend->Open(FileName, Append)) {
+            return;
+        }
+    }
+    std::cout << "File write backend: " << m_backend->GetName() << "\n";
+
     m_aviablePhyMemory = getTotalSystemMemory();
     std::cout << "Available physical memory: " << m_aviablePhyMemory / (1024 * 1024) << "Mb\n";
-    m_aviablePhyMemory /= 2;
+    // The block pool is recycled in FIFO order and becomes fully resident, small boards get a
+    // shorter queue
+    m_aviablePhyMemory /= 16;
     std::cout << "Used physical memory: " << m_aviablePhyMemory / (1024 * 1024) << "Mb\n";
     m_hasWriteSize = 0;
 }
 
 void FileQueueManager::CloseFile(){
-    if (fs.is_open())
-        fs.close();
+    if (m_segmentThread == nullptr){
+        if (m_backend)
+            m_backend->Close();
+        if (m_rawIndex && m_backend)
+            m_rawIndex->close(m_backend->GetSize());
+        m_rawIndex = nullptr;
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_segmentLock);
+        m_segmentThreadRun = false;
+        m_segmentCond.notify_all();
+    }
+    if (m_segmentThread->joinable())
+        m_segmentThread->join();
+    delete m_segmentThread;
+    m_segmentThread = nullptr;
+
+    // Opened ahead for a segment that never came
+    if (m_nextBackend){
+        m_nextBackend->Close();
+        m_nextBackend = nullptr;
+    }
+    if (m_nextSegment > m_writeSegment)
+        std::remove(SegmentName(m_nextSegment).c_str());
+
+    m_activeSegment.bytes = m_segmentWriteSize;
+    m_activeSegment.complete = false;
+    if (m_backend){
+        m_backend->Close();
+        m_activeSegment.bytes = m_backend->GetSize();
+        m_activeSegment.complete = m_backend->IsGood();
+    }
+    if (m_rawIndex)
+        m_rawIndex->close(m_activeSegment.bytes);
+    m_rawIndex = nullptr;
+    m_segments[m_writeSegment] = m_activeSegment;
+    WriteManifest(m_segments);
+    m_backend = nullptr;
+}
+
+// Writer thread. Disk space taken by preallocation ahead of the written data
+uint64_t FileQueueManager::ReservedSize(){
+    return (m_backend ? m_backend->GetReserved() : 0) + m_nextReserved;
 }
 
-void FileQueueManager::StartWrite(Stream_FileType _fileType){
+void FileQueueManager::DiscardQueue(){
+    QueueItem item;
+    while(popQueue(item)){
+        m_pool->release(item.buffer);
+    }
+}
+
+void FileQueueManager::StartWrite(Stream_FileType _fileType, size_t _blockSize){
     m_ThreadRun.test_and_set();
     m_threadWork = true;
     m_fileType = _fileType;
     m_firstSectionWrite = false;
     m_waitAllWrite = true;
     m_hasErrorWrite = false;
+    m_tdmsWriter.Reset();
+    m_segmentStart = true;
     
     // Clean before start
-    auto bstream_clean = popQueue();
-    while(bstream_clean){
-        delete bstream_clean;
-        bstream_clean = popQueue();
+    if (m_pool){
+        DiscardQueue();
     }
+    if (!m_pool || m_pool->blockSize() < _blockSize){
+        m_spareBlock = nullptr;
+        m_pool = nullptr;
+        size_t count = m_aviablePhyMemory / _blockSize;
+        if (count > FILE_POOL_BLOCKS) count = FILE_POOL_BLOCKS;
+        if (count < 2) count = 2;
+        m_pool = CBufferPool::Create(_blockSize, count);
+        std::cout << "File buffer pool: " << count << " blocks of " << m_pool->blockSize() << " bytes\n";
+    }
+    if (m_metricPoolSize)
+        m_metricPoolSize->set(m_pool->count());
 
     th = new std::thread(&FileQueueManager::Task,this);
 }
@@ -171,6 +486,7 @@ void FileQueueManager::StopWrite(bool waitAllWrite){
         m_waitAllWrite = waitAllWrite;
         m_waitLock.unlock();
         m_ThreadRun.clear();
+        wakeQueue();
     }
     if (th != nullptr) {
         if (th->joinable())
@@ -181,144 +497,157 @@ void FileQueueManager::StopWrite(bool waitAllWrite){
 }
 
 void FileQueueManager::Task(){
+    if (m_cpu >= 0 && !pinCurrentThread(m_cpu)) {
+        std::cerr << "Warning: can't pin the file thread to CPU " << m_cpu << "\n";
+    }
     while (m_ThreadRun.test_and_set()){
-        WriteToFile();
+        if (WriteToFile() < 0)
+            waitQueue();
     }
     m_waitLock.lock();
     if (this->m_waitAllWrite) {
         while (WriteToFile() == 0);
     }else{
-        auto bstream = popQueue();
-        while(bstream){
-            delete bstream;
-            bstream = popQueue();
-        }
+        DiscardQueue();
     }
+    if (m_fileType == Stream_FileType::WAV_TYPE && m_firstSectionWrite){
+        updateWavFile();
+    }
+    // Push the staged tail to disk before reporting the thread as stopped
+    CloseFile();
     m_threadWork = false;
     m_waitLock.unlock();
 }
 
 
 int FileQueueManager::WriteToFile(){
-    auto bstream = popQueue();
-        
-    if (bstream == nullptr)
+    QueueItem item;
+    if (!popQueue(item))
         return -1;
 
     if (m_hasErrorWrite) {
-        delete bstream;
+        m_pool->release(item.buffer);
         return 1;
     }
 
-    if (fs.good() && m_hasWriteSize < m_freeSize) {
+    if (item.segment != m_writeSegment && m_segmentThread != nullptr) {
+        NextWriteSegment(item.segment);
+    }
+
+    // A block the backend did not take is not counted anywhere, it takes the error branch
+    if (m_backend && m_backend->IsGood() && m_hasWriteSize + ReservedSize() < m_freeSize && m_backend->Write(item.buffer, item.size)) {
         
-        fs << bstream->rdbuf();
-        fs.flush();
-        bstream->seekg(0, std::ios::end);
-        auto Length = bstream->tellg();
+        auto Length = item.size;
         m_hasWriteSize += Length;
-
-        if (m_fileType == Stream_FileType::WAV_TYPE){
-            if (m_firstSectionWrite){
-                updateWavFile(Length);
+        m_segmentWriteSize += Length;
+        if (m_activeSegment.blocks++ == 0){
+            m_activeSegment.firstSample = item.info.sampleIndex;
+            m_activeSegment.firstTimestamp = item.info.timestamp;
+        }
+        m_activeSegment.endSample = item.info.sampleIndex + item.info.samples;
+        if (m_fileType == Stream_FileType::RAW_TYPE){
+            if (m_activeSegment.blocks == 1){
+                std::lock_guard<std::mutex> lock(m_rawLock);
+                m_rawIndex = CRawIndexWriter::Create(IsSegmented() ? SegmentName(m_writeSegment) : m_fileName, m_rawHeader);
             }
+            if (m_rawIndex)
+                m_rawIndex->add({m_segmentWriteSize - Length, item.info.sampleIndex, item.info.samples, item.info.timestamp});
+        }
+        if (m_metricBytes){
+            m_metricBytes->add(Length);
+            m_metricBlocks->add();
+            if (item.info.readyNs != 0)
+                m_metricLatency->observe(metricsNowNs() - item.info.readyNs);
+        }
 
+        if (m_fileType == Stream_FileType::WAV_TYPE){
             if (m_firstSectionWrite == false){
+                // The first block starts with the header, sizes are kept up to date in this copy
+                m_wavHeader.assign(item.buffer, item.buffer + CWaveWriter::headerSize());
+                m_wavCheckpoint = std::chrono::steady_clock::now();
                 m_firstSectionWrite = true;
+            }else if (m_wavCheckpointInterval > 0){
+                auto now = std::chrono::steady_clock::now();
+                if (now - m_wavCheckpoint >= std::chrono::milliseconds(m_wavCheckpointInterval)){
+                    updateWavFile();
+                    m_wavCheckpoint = now;
+                }
             }
         }
 
     } else{
 
         m_hasErrorWrite = true;
-        if (!(m_hasWriteSize < m_freeSize)){
+        if (!(m_hasWriteSize + ReservedSize() < m_freeSize)){
             acout() << "The disc has reached the write limit\n";
         }else {
             acout() << "Disk is full or error state\n";
         }
+        m_pool->release(item.buffer);
         return 1;
     }
-    delete bstream;
+    m_pool->release(item.buffer);
 
     return 0;    
 }
 
-void FileQueueManager::updateWavFile(int _size){
-    int offset1 = 4;
-    int offset2 = 40;
-   
-    auto cur_p = fs.tellp();
-    auto cur_g = fs.tellg();
-
-    int32_t size1 = 0;
-    int32_t size2 = 0;
-    fs.seekg(offset1, fs.beg);
-    fs.read ((char*)&size1, sizeof(size1));
-    size1 += _size;
-    fs.seekp(offset1, fs.beg);
-    fs.write((char*)&size1, sizeof(size1));
-    fs.seekg(offset2, fs.beg);
-    fs.read ((char*)&size2, sizeof(size2));
-    size2 += _size;
-    fs.seekp(offset2, fs.beg);
-    fs.write((char*)&size2, sizeof(size2));
-
- 
-    fs.seekp(cur_p);
-    fs.seekg(cur_g);
-}
-
-std::iostream *FileQueueManager::BuildTDMSStream(uint8_t* buffer_ch1,size_t size_ch1,uint8_t* buffer_ch2,size_t size_ch2, unsigned short resolution){
-    TDMS::File outFile;
-    TDMS::WriterSegment segment;
-    vector<shared_ptr<TDMS::Metadata>> data;
-//    std::time_t tim_sec = std::time(0);
- //   std::time_t local = std::mktime(std::localtime(&tim_sec));
- //   std::time_t gmt = std::mktime(std::gmtime(&tim_sec));
- //   auto timezone = static_cast<long> (local - gmt);
-
-    auto root = segment.GenerateRoot();
-    root->TableOfContents.HasMetaData = true;
-    root->TableOfContents.HasRawData = true;
-    data.push_back(root);
-    auto group = segment.GenerateGroup("Group");
-    data.push_back(group);
-
-//    auto *time = TDMS::DataType::GetRawTimeValue(tim_sec + timezone);
-//    TDMS::DataType dataprop;
-//    dataprop.InitDataType(TDMS::DataType::TimeStamp,time);
-//    segment.AddProperties(root,"time_stamp_now",dataprop);
+size_t FileQueueManager::BuildRawBlock(uint8_t* dst,const uint8_t* buffer_ch1,size_t size_ch1,const uint8_t* buffer_ch2,size_t size_ch2, unsigned short resolution){
+    if (size_ch1 + size_ch2 > GetBlockSize())
+        return 0;
+    if (size_ch1 == 0 || size_ch2 == 0){
+        memcpy(dst, size_ch1 ? buffer_ch1 : buffer_ch2, size_ch1 + size_ch2);
+        return size_ch1 + size_ch2;
+    }
+    if (resolution == 8){
+        kernelInterleave8((int8_t*)dst, (const int8_t*)buffer_ch1, (const int8_t*)buffer_ch2, size_ch1);
+    }else{
+        kernelInterleave16((int16_t*)dst, (const int16_t*)buffer_ch1, (const int16_t*)buffer_ch2, size_ch1 / 2);
+    }
+    return size_ch1 + size_ch2;
+}
+
+void FileQueueManager::SetRawInfo(const RawIndexHeader &_header){
+    std::lock_guard<std::mutex> lock(m_rawLock);
+    m_rawHeader = _header;
+}
+
+void FileQueueManager::updateWavFile(){
+    CWaveWriter::UpdateHeaderSizes(m_wavHeader.data(), m_segmentWriteSize - m_wavHeader.size());
+    m_backend->WriteAt(0, m_wavHeader.data(), m_wavHeader.size());
+}
 
+size_t FileQueueManager::BuildTDMSBlock(uint8_t* dst,const uint8_t* buffer_ch1,size_t size_ch1,const uint8_t* buffer_ch2,size_t size_ch2, unsigned short resolution, bool compressed){
+    TDMS::MemoryWriter::Channel channels[2];
+    int count = 0;
+    auto type = (resolution == 8 ? TDMS::DataType::Integer8 : TDMS::DataType::Integer16);
+    const char *codec = nullptr;
+    if (compressed) {
+        type = TDMS::DataType::UnsignedInteger8;
+        codec = CODEC_NAME;
+    }
 
     if (size_ch1 != 0)
-    {       
-        if (resolution == 16)
-            size_ch1 /= 2;
-        auto channel = segment.GenerateChannel("Group", "ch1");
-        data.push_back(channel);
-        segment.AddRaw(channel, (resolution == 8 ? TDMS::DataType::Integer8 : TDMS::DataType::Integer16), size_ch1 , buffer_ch1);
+    {
+        channels[count++] = {"ch1", type, buffer_ch1, size_ch1, codec};
     }
 
     if (size_ch2 != 0)
-    {       
-        if (resolution == 16)
-            size_ch2 /= 2;
-        auto channel = segment.GenerateChannel("Group", "ch2");
-        data.push_back(channel);
-        segment.AddRaw(channel, (resolution == 8 ? TDMS::DataType::Integer8 : TDMS::DataType::Integer16), size_ch2 , buffer_ch2);
+    {
+        channels[count++] = {"ch2", type, buffer_ch2, size_ch2, codec};
     }
 
-    segment.LoadMetadata(data);
-    stringstream *memory = new stringstream(ios_base::in | ios_base::out | ios_base::binary);
-    outFile.WriteMemory(*memory,segment);
-    return memory;
+    // The first block of a file carries the whole metadata
+    if (m_segmentStart)
+        m_tdmsWriter.Reset();
+    return m_tdmsWriter.WriteSegment(dst, GetBlockSize(), "Group", channels, count);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
 Queue::Queue():
-m_useMemory(0)
+m_queue(FILE_QUEUE_SIZE),
+m_sleeping(false)
 {
 
 }
@@ -329,39 +658,48 @@ Queue::~Queue(){
 
 
 
-
-void Queue::pushQueue(std::iostream* buffer){
-    mutex_.lock();
-    m_queue.push_back(buffer);
-    buffer->seekg(0, std::ios::end);
-    auto Length = buffer->tellg();
-    m_useMemory += Length;
-    mutex_.unlock();
+// Called only from the producer thread
+bool Queue::pushQueue(uint8_t* buffer, size_t size, uint32_t segment, const FileBlockInfo &info){
+    QueueItem item;
+    item.buffer = buffer;
+    item.size = size;
+    item.segment = segment;
+    item.info = info;
+    if (!m_queue.push(item))
+        return false;
+    // Pairs with the fence in waitQueue, either the writer sees the block or we see it asleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping.load(std::memory_order_relaxed))
+        wakeQueue();
+    return true;
 }
 
 
+// Called only from the writer thread
+bool Queue::popQueue(QueueItem &item){
+    return m_queue.pop(item);
+}
 
-std::iostream* Queue::popQueue(){
-    mutex_.lock();
-    std::iostream* buffer = m_queue.front();
-    if (buffer != nullptr){
-        m_queue.pop_front();
-        buffer->seekg(0, std::ios::end);
-        auto Length = buffer->tellg();
-        m_useMemory -= Length;
-        buffer->seekg(0, std::ios::beg);
+// Called only from the writer thread
+void Queue::waitQueue(){
+    for (int i = 0; i < FILE_QUEUE_SPIN; ++i) {
+        if (!m_queue.isEmpty())
+            return;
+        std::this_thread::yield();
     }
-    mutex_.unlock();
+    std::unique_lock<std::mutex> lock(m_wakeLock);
+    m_sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_queue.isEmpty())
+        m_wakeCond.wait_for(lock, std::chrono::milliseconds(FILE_QUEUE_SLEEP));
+    m_sleeping.store(false, std::memory_order_relaxed);
+}
 
-    return buffer;
+void Queue::wakeQueue(){
+    std::lock_guard<std::mutex> lock(m_wakeLock);
+    m_wakeCond.notify_one();
 }
 
 long Queue::queueSize(){
-    mutex_.lock();
-    long size = m_queue.size();
-    mutex_.unlock();
-    return size;
+    return m_queue.size();
 }
-
-
-
@@ -0,0 +1,605 @@
+#include <cstring>
+#include <iostream>
+#include "rpsa/common/core/file_backend.h"
+
+#ifndef _WIN32
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING
+#endif
+#endif
+#endif
+
+CFileBackend::Ptr CFileBackend::Create(CFileBackend::Type _type){
+#ifndef _WIN32
+    if (_type == Type::DIRECT)
+        return std::make_shared<CDirectFileBackend>();
+#endif
+    static_cast<void>(_type);
+    return std::make_shared<CStreamFileBackend>();
+}
+
+CFileBackend::Type CFileBackend::DefaultType(){
+#ifndef _WIN32
+    return Type::DIRECT;
+#else
+    return Type::STREAM;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+CStreamFileBackend::CStreamFileBackend():
+    m_size(0)
+{
+}
+
+CStreamFileBackend::~CStreamFileBackend(){
+    Close();
+}
+
+bool CStreamFileBackend::Open(std::string _fileName, bool _append){
+    fs.open(_fileName, std::ios::binary | std::ofstream::out| std::ofstream::in | (_append? std::ofstream::binary  : std::ofstream::trunc));
+    if (fs.fail()) {
+        fs.open(_fileName, std::ios::binary | std::ofstream::out| std::ofstream::in |  std::ofstream::trunc);
+        if (fs.fail()) {
+            std::cout << "File " << _fileName << " not exist" << std::endl;
+            return false;
+        }
+    }
+    fs.seekp(0, std::ios::end);
+    m_size = fs.tellp();
+    return true;
+}
+
+void CStreamFileBackend::Close(){
+    if (fs.is_open())
+        fs.close();
+}
+
+bool CStreamFileBackend::Write(const void *_data, size_t _size){
+    fs.write((const char*)_data, _size);
+    m_size += _size;
+    return fs.good();
+}
+
+bool CStreamFileBackend::WriteAt(uint64_t _offset, const void *_data, size_t _size){
+    auto cur_p = fs.tellp();
+    fs.seekp(_offset, fs.beg);
+    fs.write((const char*)_data, _size);
+    fs.seekp(cur_p);
+    return fs.good();
+}
+
+bool CStreamFileBackend::ReadAt(uint64_t _offset, void *_data, size_t _size){
+    fs.flush();
+    auto cur_g = fs.tellg();
+    fs.seekg(_offset, fs.beg);
+    fs.read((char*)_data, _size);
+    fs.seekg(cur_g);
+    return fs.good();
+}
+
+bool CStreamFileBackend::IsGood(){
+    return fs.is_open() && fs.good();
+}
+
+uint64_t CStreamFileBackend::GetSize(){
+    return m_size;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _WIN32
+
+class CDirectFileBackend::Engine
+{
+public:
+    virtual ~Engine() {}
+    virtual bool  Start(int _fd, unsigned _depth) = 0;
+    virtual bool  Submit(Chunk *_chunk) = 0;
+    // Blocks until one submitted chunk is complete
+    virtual Chunk *Reap(long &_result) = 0;
+    virtual std::string Name() = 0;
+};
+
+// Portable engine: a few threads doing blocking pwrite()
+class CDirectFileBackend::ThreadEngine : public CDirectFileBackend::Engine
+{
+public:
+    ThreadEngine():
+        m_fd(-1),
+        m_stop(false)
+    {
+    }
+
+    ~ThreadEngine(){
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_stop = true;
+        }
+        m_cvSubmit.notify_all();
+        for (auto &th : m_threads)
+            th.join();
+    }
+
+    bool Start(int _fd, unsigned _depth) override{
+        m_fd = _fd;
+        unsigned threads = _depth < 2 ? 1 : 2;
+        for (unsigned i = 0; i < threads; ++i)
+            m_threads.push_back(std::thread(&ThreadEngine::Worker, this));
+        return true;
+    }
+
+    bool Submit(Chunk *_chunk) override{
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_pending.push_back(_chunk);
+        }
+        m_cvSubmit.notify_one();
+        return true;
+    }
+
+    Chunk *Reap(long &_result) override{
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_cvDone.wait(lock, [this]{ return !m_done.empty(); });
+        auto done = m_done.front();
+        m_done.pop_front();
+        _result = done.second;
+        return done.first;
+    }
+
+    std::string Name() override { return "pwrite"; }
+
+private:
+    void Worker(){
+        while (true){
+            Chunk *chunk = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(m_mtx);
+                m_cvSubmit.wait(lock, [this]{ return m_stop || !m_pending.empty(); });
+                if (m_pending.empty())
+                    return;
+                chunk = m_pending.front();
+                m_pending.pop_front();
+            }
+
+            long written = 0;
+            while ((size_t)written < chunk->iov.iov_len){
+                ssize_t res = pwrite(m_fd, (uint8_t*)chunk->iov.iov_base + written, chunk->iov.iov_len - written, chunk->offset + written);
+                if (res < 0 && errno == EINTR)
+                    continue;
+                if (res <= 0){
+                    written = res < 0 ? -errno : written;
+                    break;
+                }
+                written += res;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                m_done.push_back(std::make_pair(chunk, written));
+            }
+            m_cvDone.notify_one();
+        }
+    }
+
+    int                                    m_fd;
+    bool                                   m_stop;
+    std::vector<std::thread>               m_threads;
+    std::mutex                             m_mtx;
+    std::condition_variable                m_cvSubmit;
+    std::condition_variable                m_cvDone;
+    std::deque<Chunk *>                    m_pending;
+    std::deque<std::pair<Chunk *, long>>   m_done;
+};
+
+#ifdef HAVE_IO_URING
+
+// io_uring through raw system calls, no liburing needed
+class CDirectFileBackend::UringEngine : public CDirectFileBackend::Engine
+{
+public:
+    UringEngine():
+        m_ring(-1),
+        m_fd(-1),
+        m_sqPtr(MAP_FAILED),
+        m_cqPtr(MAP_FAILED),
+        m_sqes((io_uring_sqe*)MAP_FAILED)
+    {
+    }
+
+    ~UringEngine(){
+        if (m_sqes != MAP_FAILED) munmap(m_sqes, m_sqesLen);
+        if (m_cqPtr != MAP_FAILED) munmap(m_cqPtr, m_cqLen);
+        if (m_sqPtr != MAP_FAILED) munmap(m_sqPtr, m_sqLen);
+        if (m_ring >= 0) close(m_ring);
+    }
+
+    bool Start(int _fd, unsigned _depth) override{
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        m_ring = syscall(__NR_io_uring_setup, _depth, &params);
+        if (m_ring < 0)
+            return false;
+        m_fd = _fd;
+
+        m_sqLen = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_sqPtr = mmap(nullptr, m_sqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQ_RING);
+        m_cqLen = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        m_cqPtr = mmap(nullptr, m_cqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_CQ_RING);
+        m_sqesLen = params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = (io_uring_sqe*)mmap(nullptr, m_sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQES);
+        if (m_sqPtr == MAP_FAILED || m_cqPtr == MAP_FAILED || m_sqes == MAP_FAILED)
+            return false;
+
+        uint8_t *sq = (uint8_t*)m_sqPtr;
+        m_sqTail  = (unsigned*)(sq + params.sq_off.tail);
+        m_sqMask  = (unsigned*)(sq + params.sq_off.ring_mask);
+        m_sqArray = (unsigned*)(sq + params.sq_off.array);
+        uint8_t *cq = (uint8_t*)m_cqPtr;
+        m_cqHead  = (unsigned*)(cq + params.cq_off.head);
+        m_cqTail  = (unsigned*)(cq + params.cq_off.tail);
+        m_cqMask  = (unsigned*)(cq + params.cq_off.ring_mask);
+        m_cqes    = (io_uring_cqe*)(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    bool Submit(Chunk *_chunk) override{
+        unsigned tail = *m_sqTail;
+        unsigned index = tail & *m_sqMask;
+        io_uring_sqe *sqe = &m_sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = m_fd;
+        sqe->addr = (uint64_t)(uintptr_t)&_chunk->iov;
+        sqe->len = 1;
+        sqe->off = _chunk->offset;
+        sqe->user_data = (uint64_t)(uintptr_t)_chunk;
+        m_sqArray[index] = index;
+        __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+
+        int res;
+        do {
+            res = syscall(__NR_io_uring_enter, m_ring, 1, 0, 0, nullptr, 0);
+        } while (res < 0 && errno == EINTR);
+        return res >= 0;
+    }
+
+    Chunk *Reap(long &_result) override{
+        while (true){
+            unsigned head = *m_cqHead;
+            if (head != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)){
+                io_uring_cqe *cqe = &m_cqes[head & *m_cqMask];
+                Chunk *chunk = (Chunk*)(uintptr_t)cqe->user_data;
+                _result = cqe->res;
+                __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+                return chunk;
+            }
+            int res = syscall(__NR_io_uring_enter, m_ring, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (res < 0 && errno != EINTR){
+                _result = -errno;
+                return nullptr;
+            }
+        }
+    }
+
+    std::string Name() override { return "io_uring"; }
+
+private:
+    int           m_ring;
+    int           m_fd;
+    void         *m_sqPtr;
+    size_t        m_sqLen;
+    void         *m_cqPtr;
+    size_t        m_cqLen;
+    io_uring_sqe *m_sqes;
+    size_t        m_sqesLen;
+    unsigned     *m_sqTail;
+    unsigned     *m_sqMask;
+    unsigned     *m_sqArray;
+    unsigned     *m_cqHead;
+    unsigned     *m_cqTail;
+    unsigned     *m_cqMask;
+    io_uring_cqe *m_cqes;
+};
+
+#endif // HAVE_IO_URING
+
+CDirectFileBackend::CDirectFileBackend():
+    m_fd(-1),
+    m_fdBuffered(-1),
+    m_direct(false),
+    m_error(false),
+    m_size(0),
+    m_allocated(0),
+    m_staging(nullptr),
+    m_current(nullptr),
+    m_inFlight(0),
+    m_engine(nullptr)
+{
+    if (posix_memalign((void**)&m_staging, FILE_DIRECT_ALIGN, (size_t)FILE_CHUNK_SIZE * FILE_CHUNK_COUNT) != 0)
+        throw std::bad_alloc();
+    m_chunks.resize(FILE_CHUNK_COUNT);
+    for (size_t i = 0; i < m_chunks.size(); ++i){
+        m_chunks[i].data = m_staging + i * FILE_CHUNK_SIZE;
+        m_chunks[i].used = 0;
+        m_chunks[i].offset = 0;
+        m_chunks[i].busy = false;
+    }
+}
+
+CDirectFileBackend::~CDirectFileBackend(){
+    Close();
+    free(m_staging);
+}
+
+std::string CDirectFileBackend::GetName(){
+    return std::string(m_direct ? "direct/" : "buffered/") + (m_engine ? m_engine->Name() : "none");
+}
+
+bool CDirectFileBackend::StartEngine(){
+#ifdef HAVE_IO_URING
+    m_engine = new UringEngine();
+    if (m_engine->Start(m_fd, FILE_CHUNK_COUNT))
+        return true;
+    delete m_engine;
+#endif
+    m_engine = new ThreadEngine();
+    return m_engine->Start(m_fd, FILE_CHUNK_COUNT);
+}
+
+void CDirectFileBackend::StopEngine(){
+    delete m_engine;
+    m_engine = nullptr;
+}
+
+bool CDirectFileBackend::Open(std::string _fileName, bool _append){
+    Close();
+    m_error = false;
+    int flags = O_WRONLY | O_CREAT | (_append ? 0 : O_TRUNC);
+#ifdef O_DIRECT
+    m_fd = open(_fileName.c_str(), flags | O_DIRECT, 0644);
+    m_direct = m_fd >= 0;
+#endif
+    if (m_fd < 0){
+        // File system without O_DIRECT support (tmpfs, some FUSE)
+        m_fd = open(_fileName.c_str(), flags, 0644);
+    }
+    if (m_fd < 0){
+        std::cout << "File " << _fileName << " not exist" << std::endl;
+        m_error = true;
+        return false;
+    }
+    m_fdBuffered = open(_fileName.c_str(), O_RDWR);
+
+    struct stat st;
+    m_size = (fstat(m_fd, &st) == 0) ? st.st_size : 0;
+    if (m_direct && (m_size % FILE_DIRECT_ALIGN) != 0){
+        // Unaligned append position, keep the file in the page cache path
+        close(m_fd);
+        m_fd = open(_fileName.c_str(), O_WRONLY);
+        m_direct = false;
+    }
+
+    m_allocated = m_size;
+    m_error = m_fdBuffered < 0 || m_fd < 0;
+    m_free.clear();
+    for (auto &chunk : m_chunks){
+        chunk.busy = false;
+        m_free.push_back(&chunk);
+    }
+    m_current = nullptr;
+    m_inFlight = 0;
+    if (!StartEngine())
+        m_error = true;
+    return !m_error;
+}
+
+void CDirectFileBackend::Close(){
+    if (m_fd < 0)
+        return;
+
+    WaitAll();
+    if (m_current != nullptr && m_current->used > 0){
+        // The tail is not a multiple of the O_DIRECT alignment
+        if (pwrite(m_fdBuffered, m_current->data, m_current->used, m_current->offset) != (ssize_t)m_current->used)
+            m_error = true;
+    }
+    m_current = nullptr;
+    StopEngine();
+
+    // Give back the part of the last extent that was not used
+    if (ftruncate(m_fd, m_size) != 0)
+        m_error = true;
+    close(m_fd);
+    m_fd = -1;
+    if (m_fdBuffered >= 0)
+        close(m_fdBuffered);
+    m_fdBuffered = -1;
+}
+
+bool CDirectFileBackend::Reserve(uint64_t _size){
+#ifdef __linux__
+    if (m_fd < 0)
+        return false;
+    Preallocate(_size);
+    return m_allocated != UINT64_MAX && !m_error;
+#else
+    static_cast<void>(_size);
+    return false;
+#endif
+}
+
+uint64_t CDirectFileBackend::GetReserved(){
+    if (m_allocated == UINT64_MAX || m_allocated <= m_size)
+        return 0;
+    return m_allocated - m_size;
+}
+
+void CDirectFileBackend::Preallocate(uint64_t _end){
+#ifdef __linux__
+    if (_end <= m_allocated)
+        return;
+    uint64_t length = ((_end - m_allocated + FILE_PREALLOC_EXTENT - 1) / FILE_PREALLOC_EXTENT) * (uint64_t)FILE_PREALLOC_EXTENT;
+    if (fallocate(m_fd, FALLOC_FL_KEEP_SIZE, m_allocated, length) == 0){
+        m_allocated += length;
+    }else if (errno == ENOSPC){
+        // The disk is full, the data would not fit either
+        std::cout << "No space left on the disk for " << length << " bytes" << std::endl;
+        m_error = true;
+    }else{
+        // Not supported by the file system, do not try again
+        m_allocated = UINT64_MAX;
+    }
+#else
+    static_cast<void>(_end);
+#endif
+}
+
+void CDirectFileBackend::Complete(Chunk *_chunk, long _result){
+    if (_chunk == nullptr){
+        m_error = true;
+        return;
+    }
+    if (_result != (long)_chunk->iov.iov_len){
+        m_error = true;
+    }
+    _chunk->used = 0;
+    _chunk->busy = false;
+    m_free.push_back(_chunk);
+    m_inFlight--;
+}
+
+bool CDirectFileBackend::WaitFreeChunk(){
+    while (m_free.empty() && !m_error){
+        long result = 0;
+        // Reap must run before result is read
+        auto chunk = m_engine->Reap(result);
+        Complete(chunk, result);
+    }
+    return !m_free.empty();
+}
+
+bool CDirectFileBackend::WaitAll(){
+    while (m_inFlight > 0 && m_engine){
+        long result = 0;
+        auto chunk = m_engine->Reap(result);
+        Complete(chunk, result);
+        if (chunk == nullptr)
+            break;
+    }
+    return !m_error;
+}
+
+bool CDirectFileBackend::WaitRange(uint64_t _begin, uint64_t _end){
+    // Whole pages, the buffered descriptor reads and writes the page cache in pages
+    _begin -= _begin % FILE_DIRECT_ALIGN;
+    _end += (FILE_DIRECT_ALIGN - _end % FILE_DIRECT_ALIGN) % FILE_DIRECT_ALIGN;
+    auto overlaps = [&](){
+        for (auto &chunk : m_chunks){
+            if (chunk.busy && chunk.offset < _end && chunk.offset + chunk.iov.iov_len > _begin)
+                return true;
+        }
+        return false;
+    };
+    while (m_engine && !m_error && overlaps()){
+        long result = 0;
+        auto chunk = m_engine->Reap(result);
+        Complete(chunk, result);
+    }
+    return !m_error;
+}
+
+bool CDirectFileBackend::SubmitCurrent(){
+    Chunk *chunk = m_current;
+    m_current = nullptr;
+    Preallocate(chunk->offset + chunk->used);
+    chunk->iov.iov_base = chunk->data;
+    chunk->iov.iov_len = chunk->used;
+    if (!m_engine->Submit(chunk)){
+        m_error = true;
+        chunk->used = 0;
+        m_free.push_back(chunk);
+        return false;
+    }
+    chunk->busy = true;
+    m_inFlight++;
+    return true;
+}
+
+bool CDirectFileBackend::Write(const void *_data, size_t _size){
+    const uint8_t *src = (const uint8_t*)_data;
+    while (_size > 0 && !m_error){
+        if (m_current == nullptr){
+            if (!WaitFreeChunk())
+                return false;
+            m_current = m_free.back();
+            m_free.pop_back();
+            m_current->used = 0;
+            m_current->offset = m_size;
+        }
+        size_t part = FILE_CHUNK_SIZE - m_current->used;
+        if (part > _size)
+            part = _size;
+        memcpy(m_current->data + m_current->used, src, part);
+        m_current->used += part;
+        m_size += part;
+        src += part;
+        _size -= part;
+        if (m_current->used == FILE_CHUNK_SIZE)
+            SubmitCurrent();
+    }
+    return !m_error;
+}
+
+bool CDirectFileBackend::WriteAt(uint64_t _offset, const void *_data, size_t _size){
+    if (_offset + _size > m_size)
+        return false;
+    const uint8_t *src = (const uint8_t*)_data;
+    uint64_t staged = m_current ? m_current->offset : m_size;
+    if (_offset + _size > staged){
+        uint64_t begin = _offset > staged ? _offset : staged;
+        memcpy(m_current->data + (begin - staged), src + (begin - _offset), _offset + _size - begin);
+    }
+    if (_offset < staged){
+        size_t part = (staged - _offset) < _size ? staged - _offset : _size;
+        WaitRange(_offset, _offset + part);
+        if (pwrite(m_fdBuffered, src, part, _offset) != (ssize_t)part)
+            m_error = true;
+    }
+    return !m_error;
+}
+
+bool CDirectFileBackend::ReadAt(uint64_t _offset, void *_data, size_t _size){
+    if (_offset + _size > m_size)
+        return false;
+    uint8_t *dst = (uint8_t*)_data;
+    uint64_t staged = m_current ? m_current->offset : m_size;
+    if (_offset + _size > staged){
+        uint64_t begin = _offset > staged ? _offset : staged;
+        memcpy(dst + (begin - _offset), m_current->data + (begin - staged), _offset + _size - begin);
+    }
+    if (_offset < staged){
+        size_t part = (staged - _offset) < _size ? staged - _offset : _size;
+        WaitRange(_offset, _offset + part);
+        if (pread(m_fdBuffered, dst, part, _offset) != (ssize_t)part)
+            m_error = true;
+    }
+    return !m_error;
+}
+
+#endif // _WIN32
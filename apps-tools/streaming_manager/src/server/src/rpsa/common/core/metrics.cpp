@@ -0,0 +1,142 @@
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <time.h>
+#include "rpsa/common/core/metrics.h"
+
+uint64_t metricsNowNs(){
+#ifdef _WIN32
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+CMetricHistogram::CMetricHistogram():
+    m_sum(0)
+{
+    for (auto &bucket : m_buckets)
+        bucket.store(0, std::memory_order_relaxed);
+}
+
+double CMetricHistogram::bound(size_t _bucket){
+    if (_bucket + 1 >= METRICS_HISTOGRAM_BUCKETS)
+        return INFINITY;
+    return std::ldexp(1e-6, (int)_bucket);
+}
+
+CMetrics::Ptr CMetrics::Create(){
+    return std::make_shared<CMetrics>();
+}
+
+CMetrics::CMetrics()
+{
+}
+
+CMetrics::Entry *CMetrics::find(const std::string &_name, const std::string &_labels, const std::string &_help, Type _type, bool _highWater){
+    for (auto &family : m_families) {
+        if (family.name != _name)
+            continue;
+        if (family.type != _type)
+            return nullptr;
+        for (auto &entry : family.entries) {
+            if (entry.labels == _labels)
+                return &entry;
+        }
+        family.entries.push_back({_labels, nullptr, nullptr, nullptr});
+        return &family.entries.back();
+    }
+    m_families.push_back({_name, _help, _type, _highWater, {}});
+    m_families.back().entries.push_back({_labels, nullptr, nullptr, nullptr});
+    return &m_families.back().entries.back();
+}
+
+CMetricCounter::Ptr CMetrics::counter(const std::string &_name, const std::string &_labels, const std::string &_help){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto entry = find(_name, _labels, _help, Type::COUNTER);
+    if (entry == nullptr)
+        return nullptr;
+    if (!entry->counter)
+        entry->counter = std::make_shared<CMetricCounter>();
+    return entry->counter;
+}
+
+CMetricGauge::Ptr CMetrics::gauge(const std::string &_name, const std::string &_labels, const std::string &_help, bool _highWater){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto entry = find(_name, _labels, _help, Type::GAUGE, _highWater);
+    if (entry == nullptr)
+        return nullptr;
+    if (!entry->gauge)
+        entry->gauge = std::make_shared<CMetricGauge>();
+    return entry->gauge;
+}
+
+CMetricHistogram::Ptr CMetrics::histogram(const std::string &_name, const std::string &_labels, const std::string &_help){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto entry = find(_name, _labels, _help, Type::HISTOGRAM);
+    if (entry == nullptr)
+        return nullptr;
+    if (!entry->histogram)
+        entry->histogram = std::make_shared<CMetricHistogram>();
+    return entry->histogram;
+}
+
+namespace {
+    std::string series(const std::string &_name, const std::string &_labels, const std::string &_extra = std::string()){
+        std::string labels = _labels;
+        if (!_extra.empty())
+            labels += (labels.empty() ? "" : ",") + _extra;
+        return labels.empty() ? _name : _name + "{" + labels + "}";
+    }
+}
+
+std::string CMetrics::render(){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::ostringstream out;
+    out << std::setprecision(10);
+    for (auto &family : m_families) {
+        out << "# HELP " << family.name << " " << family.help << "\n";
+        switch (family.type) {
+            case Type::COUNTER:
+                out << "# TYPE " << family.name << " counter\n";
+                for (auto &entry : family.entries)
+                    out << series(family.name, entry.labels) << " " << entry.counter->value() << "\n";
+                break;
+
+            case Type::GAUGE:
+                out << "# TYPE " << family.name << " gauge\n";
+                for (auto &entry : family.entries)
+                    out << series(family.name, entry.labels) << " " << entry.gauge->value() << "\n";
+                if (!family.highWater)
+                    break;
+                out << "# HELP " << family.name << "_high_water " << family.help << ", highest value\n";
+                out << "# TYPE " << family.name << "_high_water gauge\n";
+                for (auto &entry : family.entries)
+                    out << series(family.name + "_high_water", entry.labels) << " " << entry.gauge->max() << "\n";
+                break;
+
+            case Type::HISTOGRAM:
+                out << "# TYPE " << family.name << " histogram\n";
+                for (auto &entry : family.entries) {
+                    uint64_t count = 0;
+                    for (size_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; ++i) {
+                        count += entry.histogram->bucket(i);
+                        std::ostringstream le;
+                        le << std::setprecision(10);
+                        if (i + 1 < METRICS_HISTOGRAM_BUCKETS)
+                            le << "le=\"" << CMetricHistogram::bound(i) << "\"";
+                        else
+                            le << "le=\"+Inf\"";
+                        out << series(family.name + "_bucket", entry.labels, le.str()) << " " << count << "\n";
+                    }
+                    out << series(family.name + "_sum", entry.labels) << " " << entry.histogram->sum() / 1e9 << "\n";
+                    out << series(family.name + "_count", entry.labels) << " " << count << "\n";
+                }
+                break;
+        }
+    }
+    return out.str();
+}
@@ -0,0 +1,123 @@
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include "rpsa/common/core/raw_file.h"
+#include "rpsa/common/core/thread_cout.h"
+
+static_assert(sizeof(RawIndexHeader) == 56, "RawIndexHeader is part of the file format");
+static_assert(sizeof(RawIndexRecord) == 32, "RawIndexRecord is part of the file format");
+
+namespace {
+    std::string baseName(const std::string &_path){
+        auto slash = _path.find_last_of("\\/");
+        return slash == std::string::npos ? _path : _path.substr(slash + 1);
+    }
+}
+
+CRawIndexWriter::Ptr CRawIndexWriter::Create(const std::string &_dataFile, const RawIndexHeader &_header){
+    auto writer = std::make_shared<CRawIndexWriter>(_dataFile, _header);
+    if (!writer->m_index.good() || !writer->writeJson(false)) {
+        std::cerr << "Error: CRawIndexWriter::Create() can't write the index of " << _dataFile << "\n";
+        return Ptr();
+    }
+    return writer;
+}
+
+CRawIndexWriter::CRawIndexWriter(const std::string &_dataFile, const RawIndexHeader &_header):
+    m_dataFile(_dataFile),
+    m_header(_header),
+    m_index(_dataFile + ".idx", std::ios::binary | std::ios::trunc),
+    m_blocks(0),
+    m_samples(0),
+    m_firstSample(0),
+    m_endSample(0),
+    m_firstTimestamp(0),
+    m_gaps(0),
+    m_bytes(0)
+{
+    m_header.magic = RAW_INDEX_MAGIC;
+    m_header.version = RAW_INDEX_VERSION;
+    m_header.headerSize = sizeof(RawIndexHeader);
+    m_header.recordSize = sizeof(RawIndexRecord);
+    m_header.reserved = 0;
+    m_index.write((const char*)&m_header, sizeof(m_header));
+    m_index.flush();
+}
+
+uint32_t CRawIndexWriter::frameSize(const RawIndexHeader &_header){
+    uint32_t channels = (_header.channels & 1 ? 1 : 0) + (_header.channels & 2 ? 1 : 0);
+    return channels * (_header.resolution == 8 ? 1 : 2);
+}
+
+void CRawIndexWriter::add(const RawIndexRecord &_record){
+    m_index.write((const char*)&_record, sizeof(_record));
+    if (m_blocks == 0) {
+        m_firstSample = _record.sampleIndex;
+        m_firstTimestamp = _record.timestamp;
+    } else if (_record.sampleIndex != m_endSample) {
+        ++m_gaps;
+    }
+    m_endSample = _record.sampleIndex + _record.samples;
+    m_samples += _record.samples;
+    m_bytes = _record.offset + _record.samples * frameSize(m_header);
+    if (++m_blocks % RAW_INDEX_FLUSH == 0)
+        m_index.flush();
+}
+
+void CRawIndexWriter::close(uint64_t _bytes){
+    m_index.flush();
+    if (!m_index.good())
+        acout() << "Can't write " << m_dataFile << ".idx\n";
+    m_index.close();
+    m_bytes = _bytes;
+    writeJson(true);
+}
+
+bool CRawIndexWriter::writeJson(bool _complete){
+    auto name = m_dataFile + ".json";
+    auto temp = name + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::trunc);
+        out << std::setprecision(17)
+            << "{\n"
+            << "  \"version\": " << RAW_INDEX_VERSION << ",\n"
+            << "  \"data\": \"" << baseName(m_dataFile) << "\",\n"
+            << "  \"index\": \"" << baseName(m_dataFile) << ".idx\",\n"
+            << "  \"layout\": \"interleaved\",\n"
+            << "  \"byteOrder\": \"little\",\n"
+            << "  \"sampleType\": \"" << (m_header.resolution == 8 ? "int8" : "int16") << "\",\n"
+            << "  \"resolution\": " << (int)m_header.resolution << ",\n"
+            << "  \"frameSize\": " << frameSize(m_header) << ",\n"
+            << "  \"sampleRate\": " << m_header.sampleRate << ",\n"
+            << "  \"channels\": [";
+        bool first = true;
+        for (int ch = 0; ch < 2; ++ch) {
+            if (!(m_header.channels & (1 << ch)))
+                continue;
+            out << (first ? "\n" : ",\n")
+                << "    {\"name\": \"ch" << ch + 1 << "\", \"gain\": " << m_header.gain[ch] << ", \"offset\": " << m_header.offset[ch] << "}";
+            first = false;
+        }
+        out << "\n  ],\n"
+            << "  \"indexHeaderSize\": " << sizeof(RawIndexHeader) << ",\n"
+            << "  \"indexRecord\": [\"offset\", \"sampleIndex\", \"samples\", \"timestamp\"],\n"
+            << "  \"blocks\": " << m_blocks << ",\n"
+            << "  \"samples\": " << m_samples << ",\n"
+            << "  \"firstSample\": " << m_firstSample << ",\n"
+            << "  \"endSample\": " << m_endSample << ",\n"
+            << "  \"gaps\": " << m_gaps << ",\n"
+            << "  \"firstTimestamp\": " << m_firstTimestamp << ",\n"
+            << "  \"bytes\": " << m_bytes << ",\n"
+            << "  \"complete\": " << (_complete ? "true" : "false") << "\n"
+            << "}\n";
+        if (!out.good()) {
+            acout() << "Can't write " << temp << "\n";
+            return false;
+        }
+    }
+#ifdef _WIN32
+    std::remove(name.c_str());
+#endif
+    return std::rename(temp.c_str(), name.c_str()) == 0;
+}
@@ -0,0 +1,333 @@
+#include <cstring>
+#include "rpsa/common/core/sample_codec.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CODEC_NEON
+#endif
+
+#define CODEC_ORDERS      3
+#define CODEC_MAX_BITS    18  // Zig-zag of a second order residual of 16 bit samples
+#define CODEC_RICE_ESCAPE 24  // Unary prefix of a residual stored with CODEC_MAX_BITS bits
+
+namespace {
+
+    struct BitWriter {
+        uint8_t *pos;
+        uint8_t *end;
+        uint64_t acc;
+        unsigned bits;
+        bool     overflow;
+
+        BitWriter(uint8_t *_dst, uint8_t *_end) : pos(_dst), end(_end), acc(0), bits(0), overflow(false) {}
+
+        // _value must fit in _bits <= 32
+        inline void put(uint32_t _value, unsigned _bits){
+            acc |= static_cast<uint64_t>(_value) << bits;
+            bits += _bits;
+            if (bits >= 32) {
+                if (end - pos < 4) {
+                    overflow = true;
+                    bits = 0;
+                    return;
+                }
+                uint32_t word = static_cast<uint32_t>(acc);
+                for (int i = 0; i < 4; ++i)
+                    pos[i] = static_cast<uint8_t>(word >> (8 * i));
+                pos += 4;
+                acc >>= 32;
+                bits -= 32;
+            }
+        }
+
+        void flush(){
+            while (bits > 0 && !overflow) {
+                if (pos == end) {
+                    overflow = true;
+                    break;
+                }
+                *pos++ = static_cast<uint8_t>(acc);
+                acc >>= 8;
+                bits = bits > 8 ? bits - 8 : 0;
+            }
+        }
+    };
+
+    struct BitReader {
+        const uint8_t *pos;
+        const uint8_t *end;
+        uint64_t acc;
+        unsigned bits;
+
+        BitReader(const uint8_t *_src, const uint8_t *_end) : pos(_src), end(_end), acc(0), bits(0) {}
+
+        // At least 56 bits afterwards unless the stream ends
+        inline void refill(){
+            if (end - pos >= 8) {
+                uint64_t word = 0;
+                for (int i = 0; i < 8; ++i)
+                    word |= static_cast<uint64_t>(pos[i]) << (8 * i);
+                acc |= word << bits;
+                pos += (63 - bits) >> 3;
+                bits |= 56;
+                return;
+            }
+            while (bits <= 56 && pos < end) {
+                acc |= static_cast<uint64_t>(*pos++) << bits;
+                bits += 8;
+            }
+        }
+
+        inline bool get(unsigned _bits, uint32_t &_value){
+            if (bits < _bits) {
+                refill();
+                if (bits < _bits)
+                    return false;
+            }
+            _value = static_cast<uint32_t>(acc & ((1ull << _bits) - 1));
+            acc >>= _bits;
+            bits -= _bits;
+            return true;
+        }
+    };
+
+    inline unsigned bitWidth(uint32_t _value){
+        return _value == 0 ? 0 : 32 - __builtin_clz(_value);
+    }
+
+    inline uint32_t zigzag(int32_t _value){
+        return (static_cast<uint32_t>(_value) << 1) ^ static_cast<uint32_t>(_value >> 31);
+    }
+
+    inline int32_t unzigzag(uint32_t _value){
+        return static_cast<int32_t>(_value >> 1) ^ -static_cast<int32_t>(_value & 1);
+    }
+
+    // _x[-2] and _x[-1] hold the history. Zig-zag residuals of the three predictors with
+    // their sums and the OR of all residuals, which has the bit width of the largest one.
+    void residuals(const int32_t *_x, size_t _n, uint32_t _u[CODEC_ORDERS][CODEC_BLOCK_SAMPLES], uint32_t _sum[CODEC_ORDERS], uint32_t _max[CODEC_ORDERS]){
+        size_t i = 0;
+#ifdef CODEC_NEON
+        uint32x4_t sum[CODEC_ORDERS];
+        uint32x4_t max[CODEC_ORDERS];
+        for (int o = 0; o < CODEC_ORDERS; ++o) {
+            sum[o] = vdupq_n_u32(0);
+            max[o] = vdupq_n_u32(0);
+        }
+        for (; i + 4 <= _n; i += 4) {
+            int32x4_t x0 = vld1q_s32(_x + i);
+            int32x4_t x1 = vld1q_s32(_x + i - 1);
+            int32x4_t x2 = vld1q_s32(_x + i - 2);
+            int32x4_t r[CODEC_ORDERS];
+            r[0] = x0;
+            r[1] = vsubq_s32(x0, x1);
+            r[2] = vsubq_s32(r[1], vsubq_s32(x1, x2));
+            for (int o = 0; o < CODEC_ORDERS; ++o) {
+                uint32x4_t u = vreinterpretq_u32_s32(veorq_s32(vshlq_n_s32(r[o], 1), vshrq_n_s32(r[o], 31)));
+                vst1q_u32(_u[o] + i, u);
+                sum[o] = vaddq_u32(sum[o], u);
+                max[o] = vorrq_u32(max[o], u);
+            }
+        }
+        for (int o = 0; o < CODEC_ORDERS; ++o) {
+            uint32_t s[4];
+            uint32_t m[4];
+            vst1q_u32(s, sum[o]);
+            vst1q_u32(m, max[o]);
+            _sum[o] = s[0] + s[1] + s[2] + s[3];
+            _max[o] = m[0] | m[1] | m[2] | m[3];
+        }
+#else
+        for (int o = 0; o < CODEC_ORDERS; ++o) {
+            _sum[o] = 0;
+            _max[o] = 0;
+        }
+#endif
+        for (; i < _n; ++i) {
+            int32_t r1 = _x[i] - _x[i - 1];
+            uint32_t u[CODEC_ORDERS] = {zigzag(_x[i]), zigzag(r1), zigzag(r1 - (_x[i - 1] - _x[i - 2]))};
+            for (int o = 0; o < CODEC_ORDERS; ++o) {
+                _u[o][i] = u[o];
+                _sum[o] += u[o];
+                _max[o] |= u[o];
+            }
+        }
+    }
+
+    void loadBlock(const void *_src, size_t _offset, size_t _n, unsigned _resolution, int32_t *_x){
+        if (_resolution == 8) {
+            auto s = static_cast<const int8_t*>(_src) + _offset;
+            for (size_t i = 0; i < _n; ++i)
+                _x[i] = s[i];
+            return;
+        }
+        auto s = static_cast<const int16_t*>(_src) + _offset;
+        size_t i = 0;
+#ifdef CODEC_NEON
+        for (; i + 8 <= _n; i += 8) {
+            int16x8_t v = vld1q_s16(s + i);
+            vst1q_s32(_x + i, vmovl_s16(vget_low_s16(v)));
+            vst1q_s32(_x + i + 4, vmovl_s16(vget_high_s16(v)));
+        }
+#endif
+        for (; i < _n; ++i)
+            _x[i] = s[i];
+    }
+
+    inline unsigned riceCost(uint32_t _u, unsigned _k){
+        uint32_t q = _u >> _k;
+        return q < CODEC_RICE_ESCAPE ? q + 1 + _k : CODEC_RICE_ESCAPE + CODEC_MAX_BITS;
+    }
+}
+
+size_t codecMaxSize(size_t _samples){
+    size_t blocks = (_samples + CODEC_BLOCK_SAMPLES - 1) / CODEC_BLOCK_SAMPLES;
+    return CODEC_HEADER_SIZE + (_samples * CODEC_MAX_BITS + blocks * 8 + 7) / 8 + 4;
+}
+
+size_t codecEncode(const void *_src, size_t _samples, unsigned _resolution, uint8_t *_dst, size_t _capacity){
+    if ((_resolution != 8 && _resolution != 16) || _capacity < CODEC_HEADER_SIZE || _samples > UINT32_MAX)
+        return 0;
+    uint32_t samples = static_cast<uint32_t>(_samples);
+    memcpy(_dst, &samples, sizeof(samples));
+    _dst[4] = static_cast<uint8_t>(_resolution);
+    _dst[5] = CODEC_VERSION;
+    _dst[6] = 0;
+    _dst[7] = 0;
+
+    BitWriter writer(_dst + CODEC_HEADER_SIZE, _dst + _capacity);
+    int32_t  work[2 + CODEC_BLOCK_SAMPLES] __attribute__((aligned(16))) = {0, 0};
+    uint32_t u[CODEC_ORDERS][CODEC_BLOCK_SAMPLES] __attribute__((aligned(16)));
+    uint32_t sum[CODEC_ORDERS];
+    uint32_t max[CODEC_ORDERS];
+    int32_t *x = work + 2;
+
+    for (size_t offset = 0; offset < _samples && !writer.overflow; offset += CODEC_BLOCK_SAMPLES) {
+        size_t n = _samples - offset < CODEC_BLOCK_SAMPLES ? _samples - offset : CODEC_BLOCK_SAMPLES;
+        loadBlock(_src, offset, n, _resolution, x);
+        residuals(x, n, u, sum, max);
+
+        unsigned order = 0;
+        for (unsigned o = 1; o < CODEC_ORDERS; ++o) {
+            if (sum[o] < sum[order])
+                order = o;
+        }
+        const uint32_t *r = u[order];
+        unsigned width = bitWidth(max[order]);
+        uint32_t mean = sum[order] / n;
+        unsigned k = mean > 0 ? bitWidth(mean) - 1 : 0;
+        size_t riceBits = 0;
+        for (size_t i = 0; i < n; ++i)
+            riceBits += riceCost(r[i], k);
+
+        if (riceBits < n * width) {
+            writer.put(order | 4 | k << 3, 8);
+            for (size_t i = 0; i < n; ++i) {
+                uint32_t q = r[i] >> k;
+                if (q < CODEC_RICE_ESCAPE) {
+                    writer.put((1u << q) - 1, q + 1);
+                    if (k > 0)
+                        writer.put(r[i] & ((1u << k) - 1), k);
+                } else {
+                    writer.put((1u << CODEC_RICE_ESCAPE) - 1, CODEC_RICE_ESCAPE);
+                    writer.put(r[i], CODEC_MAX_BITS);
+                }
+            }
+        } else {
+            writer.put(order | width << 3, 8);
+            if (width > 0) {
+                for (size_t i = 0; i < n; ++i)
+                    writer.put(r[i], width);
+            }
+        }
+        // History for the next block
+        int32_t previous = n >= 2 ? x[n - 2] : x[-1];
+        work[1] = x[n - 1];
+        work[0] = previous;
+    }
+    writer.flush();
+    if (writer.overflow)
+        return 0;
+    return writer.pos - _dst;
+}
+
+bool codecInfo(const uint8_t *_src, size_t _size, size_t &_samples, unsigned &_resolution){
+    if (_size < CODEC_HEADER_SIZE || _src[5] != CODEC_VERSION || (_src[4] != 8 && _src[4] != 16))
+        return false;
+    uint32_t samples;
+    memcpy(&samples, _src, sizeof(samples));
+    // Every block takes at least its header byte
+    if (samples / CODEC_BLOCK_SAMPLES > _size - CODEC_HEADER_SIZE)
+        return false;
+    _samples = samples;
+    _resolution = _src[4];
+    return true;
+}
+
+bool codecDecode(const uint8_t *_src, size_t _size, void *_dst, size_t _capacity, size_t &_samples){
+    unsigned resolution = 0;
+    if (!codecInfo(_src, _size, _samples, resolution))
+        return false;
+    // Division, the product overflows size_t on 32 bit targets
+    if (_samples > _capacity / (resolution / 8))
+        return false;
+
+    BitReader reader(_src + CODEC_HEADER_SIZE, _src + _size);
+    // History in uint32, a damaged stream must not overflow signed arithmetic
+    uint32_t h1 = 0;
+    uint32_t h2 = 0;
+    uint32_t half = 1u << (resolution - 1);
+    auto out8  = static_cast<int8_t*>(_dst);
+    auto out16 = static_cast<int16_t*>(_dst);
+
+    for (size_t offset = 0; offset < _samples; offset += CODEC_BLOCK_SAMPLES) {
+        size_t n = _samples - offset < CODEC_BLOCK_SAMPLES ? _samples - offset : CODEC_BLOCK_SAMPLES;
+        uint32_t header;
+        if (!reader.get(8, header))
+            return false;
+        unsigned order = header & 3;
+        bool     rice = (header & 4) != 0;
+        unsigned param = header >> 3;
+        if (order >= CODEC_ORDERS || param > CODEC_MAX_BITS)
+            return false;
+
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t u = 0;
+            if (rice) {
+                reader.refill();
+                unsigned q = __builtin_ctzll(~reader.acc);
+                if (q >= CODEC_RICE_ESCAPE) {
+                    if (reader.bits < CODEC_RICE_ESCAPE + CODEC_MAX_BITS)
+                        return false;
+                    reader.acc >>= CODEC_RICE_ESCAPE;
+                    reader.bits -= CODEC_RICE_ESCAPE;
+                    reader.get(CODEC_MAX_BITS, u);
+                } else {
+                    if (reader.bits < q + 1 + param)
+                        return false;
+                    reader.acc >>= q + 1;
+                    reader.bits -= q + 1;
+                    uint32_t low = 0;
+                    if (param > 0)
+                        reader.get(param, low);
+                    u = q << param | low;
+                }
+            } else if (param > 0 && !reader.get(param, u)) {
+                return false;
+            }
+
+            uint32_t r = static_cast<uint32_t>(unzigzag(u));
+            uint32_t x = order == 0 ? r : (order == 1 ? r + h1 : r + 2 * h1 - h2);
+            // Outside the sample range only in a damaged stream
+            if (x + half >= 2 * half)
+                return false;
+            h2 = h1;
+            h1 = x;
+            if (resolution == 8)
+                out8[offset + i] = static_cast<int8_t>(x);
+            else
+                out16[offset + i] = static_cast<int16_t>(x);
+        }
+    }
+    return true;
+}
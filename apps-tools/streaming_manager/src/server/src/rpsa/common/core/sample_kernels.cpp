@@ -0,0 +1,484 @@
+#include <atomic>
+#include <cstring>
+#include <initializer_list>
+#include "rpsa/common/core/sample_kernels.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define KERNELS_NEON
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define KERNELS_SSE2
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define KERNELS_AVX2
+#define KERNELS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace {
+
+    struct KernelTable{
+        KernelIsa isa;
+        void (*copy)(void*, const void*, size_t);
+        void (*high8)(int8_t*, const int16_t*, size_t);
+        void (*interleave8)(int8_t*, const int8_t*, const int8_t*, size_t);
+        void (*interleave16)(int16_t*, const int16_t*, const int16_t*, size_t);
+        void (*deinterleave8)(int8_t*, int8_t*, const int8_t*, size_t);
+        void (*deinterleave16)(int16_t*, int16_t*, const int16_t*, size_t);
+        void (*toFloat8)(float*, const int8_t*, size_t, float, float);
+        void (*toFloat16)(float*, const int16_t*, size_t, float, float);
+    };
+
+    // Scalar versions, also the tails of the vector ones
+
+    void copyScalar(void *_dst, const void *_src, size_t _bytes){
+        memcpy(_dst, _src, _bytes);
+    }
+
+    void high8Scalar(int8_t *_dst, const int16_t *_src, size_t _samples){
+        for (size_t i = 0; i < _samples; ++i)
+            _dst[i] = static_cast<int8_t>(_src[i] >> 8);
+    }
+
+    template<typename T>
+    void interleaveScalar(T *_dst, const T *_a, const T *_b, size_t _samples){
+        for (size_t i = 0; i < _samples; ++i) {
+            _dst[i * 2] = _a[i];
+            _dst[i * 2 + 1] = _b[i];
+        }
+    }
+
+    template<typename T>
+    void deinterleaveScalar(T *_a, T *_b, const T *_src, size_t _samples){
+        for (size_t i = 0; i < _samples; ++i) {
+            _a[i] = _src[i * 2];
+            _b[i] = _src[i * 2 + 1];
+        }
+    }
+
+    template<typename T>
+    void toFloatScalar(float *_dst, const T *_src, size_t _samples, float _gain, float _offset){
+        for (size_t i = 0; i < _samples; ++i)
+            _dst[i] = static_cast<float>(_src[i]) * _gain + _offset;
+    }
+
+    const KernelTable g_scalar = {
+        KernelIsa::SCALAR, copyScalar, high8Scalar,
+        interleaveScalar<int8_t>, interleaveScalar<int16_t>,
+        deinterleaveScalar<int8_t>, deinterleaveScalar<int16_t>,
+        toFloatScalar<int8_t>, toFloatScalar<int16_t>
+    };
+
+#ifdef KERNELS_SSE2
+
+    void high8Sse2(int8_t *_dst, const int16_t *_src, size_t _samples){
+        size_t i = 0;
+        for (; i + 16 <= _samples; i += 16) {
+            __m128i a = _mm_srai_epi16(_mm_loadu_si128((const __m128i*)(_src + i)), 8);
+            __m128i b = _mm_srai_epi16(_mm_loadu_si128((const __m128i*)(_src + i + 8)), 8);
+            _mm_storeu_si128((__m128i*)(_dst + i), _mm_packs_epi16(a, b));
+        }
+        high8Scalar(_dst + i, _src + i, _samples - i);
+    }
+
+    void interleave8Sse2(int8_t *_dst, const int8_t *_a, const int8_t *_b, size_t _samples){
+        size_t i = 0;
+        for (; i + 16 <= _samples; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(_a + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(_b + i));
+            _mm_storeu_si128((__m128i*)(_dst + i * 2), _mm_unpacklo_epi8(a, b));
+            _mm_storeu_si128((__m128i*)(_dst + i * 2 + 16), _mm_unpackhi_epi8(a, b));
+        }
+        interleaveScalar(_dst + i * 2, _a + i, _b + i, _samples - i);
+    }
+
+    void interleave16Sse2(int16_t *_dst, const int16_t *_a, const int16_t *_b, size_t _samples){
+        size_t i = 0;
+        for (; i + 8 <= _samples; i += 8) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(_a + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(_b + i));
+            _mm_storeu_si128((__m128i*)(_dst + i * 2), _mm_unpacklo_epi16(a, b));
+            _mm_storeu_si128((__m128i*)(_dst + i * 2 + 8), _mm_unpackhi_epi16(a, b));
+        }
+        interleaveScalar(_dst + i * 2, _a + i, _b + i, _samples - i);
+    }
+
+    void deinterleave8Sse2(int8_t *_a, int8_t *_b, const int8_t *_src, size_t _samples){
+        const __m128i low = _mm_set1_epi16(0x00FF);
+        size_t i = 0;
+        for (; i + 16 <= _samples; i += 16) {
+            __m128i x0 = _mm_loadu_si128((const __m128i*)(_src + i * 2));
+            __m128i x1 = _mm_loadu_si128((const __m128i*)(_src + i * 2 + 16));
+            _mm_storeu_si128((__m128i*)(_a + i), _mm_packus_epi16(_mm_and_si128(x0, low), _mm_and_si128(x1, low)));
+            _mm_storeu_si128((__m128i*)(_b + i), _mm_packus_epi16(_mm_srli_epi16(x0, 8), _mm_srli_epi16(x1, 8)));
+        }
+        deinterleaveScalar(_a + i, _b + i, _src + i * 2, _samples - i);
+    }
+
+    void deinterleave16Sse2(int16_t *_a, int16_t *_b, const int16_t *_src, size_t _samples){
+        size_t i = 0;
+        for (; i + 8 <= _samples; i += 8) {
+            __m128i x0 = _mm_loadu_si128((const __m128i*)(_src + i * 2));
+            __m128i x1 = _mm_loadu_si128((const __m128i*)(_src + i * 2 + 8));
+            // Sign extended even and odd samples, packed back without saturating
+            __m128i a0 = _mm_srai_epi32(_mm_slli_epi32(x0, 16), 16);
+            __m128i a1 = _mm_srai_epi32(_mm_slli_epi32(x1, 16), 16);
+            _mm_storeu_si128((__m128i*)(_a + i), _mm_packs_epi32(a0, a1));
+            _mm_storeu_si128((__m128i*)(_b + i), _mm_packs_epi32(_mm_srai_epi32(x0, 16), _mm_srai_epi32(x1, 16)));
+        }
+        deinterleaveScalar(_a + i, _b + i, _src + i * 2, _samples - i);
+    }
+
+    inline void storeFloatsSse2(float *_dst, __m128i _v32, __m128 _gain, __m128 _offset){
+        _mm_storeu_ps(_dst, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_v32), _gain), _offset));
+    }
+
+    void toFloat8Sse2(float *_dst, const int8_t *_src, size_t _samples, float _gain, float _offset){
+        const __m128 gain = _mm_set1_ps(_gain);
+        const __m128 offset = _mm_set1_ps(_offset);
+        size_t i = 0;
+        for (; i + 16 <= _samples; i += 16) {
+            __m128i x = _mm_loadu_si128((const __m128i*)(_src + i));
+            __m128i lo = _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8);
+            __m128i hi = _mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8);
+            storeFloatsSse2(_dst + i, _mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16), gain, offset);
+            storeFloatsSse2(_dst + i + 4, _mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16), gain, offset);
+            storeFloatsSse2(_dst + i + 8, _mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16), gain, offset);
+            storeFloatsSse2(_dst + i + 12, _mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16), gain, offset);
+        }
+        toFloatScalar(_dst + i, _src + i, _samples - i, _gain, _offset);
+    }
+
+    void toFloat16Sse2(float *_dst, const int16_t *_src, size_t _samples, float _gain, float _offset){
+        const __m128 gain = _mm_set1_ps(_gain);
+        const __m128 offset = _mm_set1_ps(_offset);
+        size_t i = 0;
+        for (; i + 8 <= _samples; i += 8) {
+            __m128i x = _mm_loadu_si128((const __m128i*)(_src + i));
+            storeFloatsSse2(_dst + i, _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16), gain, offset);
+            storeFloatsSse2(_dst + i + 4, _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16), gain, offset);
+        }
+        toFloatScalar(_dst + i, _src + i, _samples - i, _gain, _offset);
+    }
+
+    // memcpy of the C library already picks the best copy for the CPU
+    const KernelTable g_sse2 = {
+        KernelIsa::SSE2, copyScalar, high8Sse2,
+        interleave8Sse2, interleave16Sse2,
+        deinterleave8Sse2, deinterleave16Sse2,
+        toFloat8Sse2, toFloat16Sse2
+    };
+
+#endif // KERNELS_SSE2
+
+#ifdef KERNELS_AVX2
+
+    // 128 bit lanes of packs and unpacks back into sample order
+    KERNELS_TARGET_AVX2 inline __m256i orderLanes(__m256i _v){
+        return _mm256_permute4x64_epi64(_v, 0xD8);
+    }
+
+    KERNELS_TARGET_AVX2 void high8Avx2(int8_t *_dst, const int16_t *_src, size_t _samples){
+        size_t i = 0;
+        for (; i + 32 <= _samples; i += 32) {
+            __m256i a = _mm256_srai_epi16(_mm256_loadu_si256((const __m256i*)(_src + i)), 8);
+            __m256i b = _mm256_srai_epi16(_mm256_loadu_si256((const __m256i*)(_src + i + 16)), 8);
+            _mm256_storeu_si256((__m256i*)(_dst + i), orderLanes(_mm256_packs_epi16(a, b)));
+        }
+        high8Scalar(_dst + i, _src + i, _samples - i);
+    }
+
+    KERNELS_TARGET_AVX2 void interleave8Avx2(int8_t *_dst, const int8_t *_a, const int8_t *_b, size_t _samples){
+        size_t i = 0;
+        for (; i + 32 <= _samples; i += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i*)(_a + i));
+            __m256i b = _mm256_loadu_si256((const __m256i*)(_b + i));
+            __m256i lo = _mm256_unpacklo_epi8(a, b);
+            __m256i hi = _mm256_unpackhi_epi8(a, b);
+            _mm256_storeu_si256((__m256i*)(_dst + i * 2), _mm256_permute2x128_si256(lo, hi, 0x20));
+            _mm256_storeu_si256((__m256i*)(_dst + i * 2 + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+        }
+        interleaveScalar(_dst + i * 2, _a + i, _b + i, _samples - i);
+    }
+
+    KERNELS_TARGET_AVX2 void interleave16Avx2(int16_t *_dst, const int16_t *_a, const int16_t *_b, size_t _samples){
+        size_t i = 0;
+        for (; i + 16 <= _samples; i += 16) {
+            __m256i a = _mm256_loadu_si256((const __m256i*)(_a + i));
+            __m256i b = _mm256_loadu_si256((const __m256i*)(_b + i));
+            __m256i lo = _mm256_unpacklo_epi16(a, b);
+            __m256i hi = _mm256_unpackhi_epi16(a, b);
+            _mm256_storeu_si256((__m256i*)(_dst + i * 2), _mm256_permute2x128_si256(lo, hi, 0x20));
+            _mm256_storeu_si256((__m256i*)(_dst + i * 2 + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+        }
+        interleaveScalar(_dst + i * 2, _a + i, _b + i, _samples - i);
+    }
+
+    KERNELS_TARGET_AVX2 void deinterleave8Avx2(int8_t *_a, int8_t *_b, const int8_t *_src, size_t _samples){
+        const __m256i low = _mm256_set1_epi16(0x00FF);
+        size_t i = 0;
+        for (; i + 32 <= _samples; i += 32) {
+            __m256i x0 = _mm256_loadu_si256((const __m256i*)(_src + i * 2));
+            __m256i x1 = _mm256_loadu_si256((const __m256i*)(_src + i * 2 + 32));
+            __m256i a = _mm256_packus_epi16(_mm256_and_si256(x0, low), _mm256_and_si256(x1, low));
+            __m256i b = _mm256_packus_epi16(_mm256_srli_epi16(x0, 8), _mm256_srli_epi16(x1, 8));
+            _mm256_storeu_si256((__m256i*)(_a + i), orderLanes(a));
+            _mm256_storeu_si256((__m256i*)(_b + i), orderLanes(b));
+        }
+        deinterleaveScalar(_a + i, _b + i, _src + i * 2, _samples - i);
+    }
+
+    KERNELS_TARGET_AVX2 void deinterleave16Avx2(int16_t *_a, int16_t *_b, const int16_t *_src, size_t _samples){
+        size_t i = 0;
+        for (; i + 16 <= _samples; i += 16) {
+            __m256i x0 = _mm256_loadu_si256((const __m256i*)(_src + i * 2));
+            __m256i x1 = _mm256_loadu_si256((const __m256i*)(_src + i * 2 + 16));
+            __m256i a0 = _mm256_srai_epi32(_mm256_slli_epi32(x0, 16), 16);
+            __m256i a1 = _mm256_srai_epi32(_mm256_slli_epi32(x1, 16), 16);
+            __m256i b = _mm256_packs_epi32(_mm256_srai_epi32(x0, 16), _mm256_srai_epi32(x1, 16));
+            _mm256_storeu_si256((__m256i*)(_a + i), orderLanes(_mm256_packs_epi32(a0, a1)));
+            _mm256_storeu_si256((__m256i*)(_b + i), orderLanes(b));
+        }
+        deinterleaveScalar(_a + i, _b + i, _src + i * 2, _samples - i);
+    }
+
+    KERNELS_TARGET_AVX2 void toFloat8Avx2(float *_dst, const int8_t *_src, size_t _samples, float _gain, float _offset){
+        const __m256 gain = _mm256_set1_ps(_gain);
+        const __m256 offset = _mm256_set1_ps(_offset);
+        size_t i = 0;
+        for (; i + 8 <= _samples; i += 8) {
+            __m256i x = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(_src + i)));
+            _mm256_storeu_ps(_dst + i, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(x), gain), offset));
+        }
+        toFloatScalar(_dst + i, _src + i, _samples - i, _gain, _offset);
+    }
+
+    KERNELS_TARGET_AVX2 void toFloat16Avx2(float *_dst, const int16_t *_src, size_t _samples, float _gain, float _offset){
+        const __m256 gain = _mm256_set1_ps(_gain);
+        const __m256 offset = _mm256_set1_ps(_offset);
+        size_t i = 0;
+        for (; i + 8 <= _samples; i += 8) {
+            __m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(_src + i)));
+            _mm256_storeu_ps(_dst + i, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(x), gain), offset));
+        }
+        toFloatScalar(_dst + i, _src + i, _samples - i, _gain, _offset);
+    }
+
+    const KernelTable g_avx2 = {
+        KernelIsa::AVX2, copyScalar, high8Avx2,
+        interleave8Avx2, interleave16Avx2,
+        deinterleave8Avx2, deinterleave16Avx2,
+        toFloat8Avx2, toFloat16Avx2
+    };
+
+    bool hasAvx2(){
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+
+#endif // KERNELS_AVX2
+
+#ifdef KERNELS_NEON
+
+    void copyNeon(void *_dst, const void *_src, size_t _bytes){
+        auto dst = static_cast<uint8_t*>(_dst);
+        auto src = static_cast<const uint8_t*>(_src);
+        size_t i = 0;
+        for (; i + 64 <= _bytes; i += 64) {
+            __builtin_prefetch(src + i + 192);
+            uint8x16_t a = vld1q_u8(src + i);
+            uint8x16_t b = vld1q_u8(src + i + 16);
+            uint8x16_t c = vld1q_u8(src + i + 32);
+            uint8x16_t d = vld1q_u8(src + i + 48);
+            vst1q_u8(dst + i, a);
+            vst1q_u8(dst + i + 16, b);
+            vst1q_u8(dst + i + 32, c);
+            vst1q_u8(dst + i + 48, d);
+        }
+        memcpy(dst + i, src + i, _bytes - i);
+    }
+
+    void high8Neon(int8_t *_dst, const int16_t *_src, size_t _samples){
+        size_t i = 0;
+        for (; i + 16 <= _samples; i += 16) {
+            __builtin_prefetch(_src + i + 96);
+            // Odd bytes of the little endian samples
+            int8x16x2_t x = vld2q_s8(reinterpret_cast<const int8_t*>(_src + i));
+            vst1q_s8(_dst + i, x.val[1]);
+        }
+        high8Scalar(_dst + i, _src + i, _samples - i);
+    }
+
+    void interleave8Neon(int8_t *_dst, const int8_t *_a, const int8_t *_b, size_t _samples){
+        size_t i = 0;
+        for (; i + 16 <= _samples; i += 16) {
+            int8x16x2_t x = {{vld1q_s8(_a + i), vld1q_s8(_b + i)}};
+            vst2q_s8(_dst + i * 2, x);
+        }
+        interleaveScalar(_dst + i * 2, _a + i, _b + i, _samples - i);
+    }
+
+    void interleave16Neon(int16_t *_dst, const int16_t *_a, const int16_t *_b, size_t _samples){
+        size_t i = 0;
+        for (; i + 8 <= _samples; i += 8) {
+            int16x8x2_t x = {{vld1q_s16(_a + i), vld1q_s16(_b + i)}};
+            vst2q_s16(_dst + i * 2, x);
+        }
+        interleaveScalar(_dst + i * 2, _a + i, _b + i, _samples - i);
+    }
+
+    void deinterleave8Neon(int8_t *_a, int8_t *_b, const int8_t *_src, size_t _samples){
+        size_t i = 0;
+        for (; i + 16 <= _samples; i += 16) {
+            int8x16x2_t x = vld2q_s8(_src + i * 2);
+            vst1q_s8(_a + i, x.val[0]);
+            vst1q_s8(_b + i, x.val[1]);
+        }
+        deinterleaveScalar(_a + i, _b + i, _src + i * 2, _samples - i);
+    }
+
+    void deinterleave16Neon(int16_t *_a, int16_t *_b, const int16_t *_src, size_t _samples){
+        size_t i = 0;
+        for (; i + 8 <= _samples; i += 8) {
+            int16x8x2_t x = vld2q_s16(_src + i * 2);
+            vst1q_s16(_a + i, x.val[0]);
+            vst1q_s16(_b + i, x.val[1]);
+        }
+        deinterleaveScalar(_a + i, _b + i, _src + i * 2, _samples - i);
+    }
+
+    // Multiply and add apart, as in the scalar version
+    inline void storeFloatsNeon(float *_dst, int16x4_t _v, float32x4_t _gain, float32x4_t _offset){
+        vst1q_f32(_dst, vaddq_f32(vmulq_f32(vcvtq_f32_s32(vmovl_s16(_v)), _gain), _offset));
+    }
+
+    void toFloat8Neon(float *_dst, const int8_t *_src, size_t _samples, float _gain, float _offset){
+        const float32x4_t gain = vdupq_n_f32(_gain);
+        const float32x4_t offset = vdupq_n_f32(_offset);
+        size_t i = 0;
+        for (; i + 8 <= _samples; i += 8) {
+            int16x8_t x = vmovl_s8(vld1_s8(_src + i));
+            storeFloatsNeon(_dst + i, vget_low_s16(x), gain, offset);
+            storeFloatsNeon(_dst + i + 4, vget_high_s16(x), gain, offset);
+        }
+        toFloatScalar(_dst + i, _src + i, _samples - i, _gain, _offset);
+    }
+
+    void toFloat16Neon(float *_dst, const int16_t *_src, size_t _samples, float _gain, float _offset){
+        const float32x4_t gain = vdupq_n_f32(_gain);
+        const float32x4_t offset = vdupq_n_f32(_offset);
+        size_t i = 0;
+        for (; i + 8 <= _samples; i += 8) {
+            int16x8_t x = vld1q_s16(_src + i);
+            storeFloatsNeon(_dst + i, vget_low_s16(x), gain, offset);
+            storeFloatsNeon(_dst + i + 4, vget_high_s16(x), gain, offset);
+        }
+        toFloatScalar(_dst + i, _src + i, _samples - i, _gain, _offset);
+    }
+
+    const KernelTable g_neon = {
+        KernelIsa::NEON, copyNeon, high8Neon,
+        interleave8Neon, interleave16Neon,
+        deinterleave8Neon, deinterleave16Neon,
+        toFloat8Neon, toFloat16Neon
+    };
+
+#endif // KERNELS_NEON
+
+    // Null when _isa is not compiled in or the CPU does not have it
+    const KernelTable* tableFor(KernelIsa _isa){
+        switch (_isa) {
+            case KernelIsa::SCALAR:
+                return &g_scalar;
+#ifdef KERNELS_SSE2
+            case KernelIsa::SSE2:
+                return &g_sse2;
+#endif
+#ifdef KERNELS_AVX2
+            case KernelIsa::AVX2:
+                return hasAvx2() ? &g_avx2 : nullptr;
+#endif
+#ifdef KERNELS_NEON
+            case KernelIsa::NEON:
+                return &g_neon;
+#endif
+            default:
+                return nullptr;
+        }
+    }
+
+    const KernelTable* bestTable(){
+        for (auto isa : {KernelIsa::AVX2, KernelIsa::NEON, KernelIsa::SSE2}) {
+            auto table = tableFor(isa);
+            if (table)
+                return table;
+        }
+        return &g_scalar;
+    }
+
+    std::atomic<const KernelTable*>& current(){
+        static std::atomic<const KernelTable*> table(bestTable());
+        return table;
+    }
+
+    inline const KernelTable& kernels(){
+        return *current().load(std::memory_order_relaxed);
+    }
+}
+
+void kernelCopy(void *_dst, const void *_src, size_t _bytes){
+    kernels().copy(_dst, _src, _bytes);
+}
+
+void kernelHigh8(int8_t *_dst, const int16_t *_src, size_t _samples){
+    kernels().high8(_dst, _src, _samples);
+}
+
+void kernelInterleave8(int8_t *_dst, const int8_t *_a, const int8_t *_b, size_t _samples){
+    kernels().interleave8(_dst, _a, _b, _samples);
+}
+
+void kernelInterleave16(int16_t *_dst, const int16_t *_a, const int16_t *_b, size_t _samples){
+    kernels().interleave16(_dst, _a, _b, _samples);
+}
+
+void kernelDeinterleave8(int8_t *_a, int8_t *_b, const int8_t *_src, size_t _samples){
+    kernels().deinterleave8(_a, _b, _src, _samples);
+}
+
+void kernelDeinterleave16(int16_t *_a, int16_t *_b, const int16_t *_src, size_t _samples){
+    kernels().deinterleave16(_a, _b, _src, _samples);
+}
+
+void kernelToFloat8(float *_dst, const int8_t *_src, size_t _samples, float _gain, float _offset){
+    kernels().toFloat8(_dst, _src, _samples, _gain, _offset);
+}
+
+void kernelToFloat16(float *_dst, const int16_t *_src, size_t _samples, float _gain, float _offset){
+    kernels().toFloat16(_dst, _src, _samples, _gain, _offset);
+}
+
+KernelIsa kernelIsa(){
+    return kernels().isa;
+}
+
+const char* kernelIsaName(KernelIsa _isa){
+    switch (_isa) {
+        case KernelIsa::SSE2: return "sse2";
+        case KernelIsa::AVX2: return "avx2";
+        case KernelIsa::NEON: return "neon";
+        default:              return "scalar";
+    }
+}
+
+bool kernelSetIsa(KernelIsa _isa){
+    auto table = tableFor(_isa);
+    if (!table)
+        return false;
+    current().store(table, std::memory_order_relaxed);
+    return true;
+}
@@ -0,0 +1,135 @@
+#include <cstring>
+#include "rpsa/common/core/sample_pack.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PACK14_NEON
+#endif
+
+size_t bytesForSamples(size_t _samples, unsigned _resolution){
+    switch (_resolution) {
+        case 8:  return _samples;
+        case 14: return (_samples * 14 + 7) / 8;
+        default: return _samples * 2;
+    }
+}
+
+size_t samplesInBytes(size_t _bytes, unsigned _resolution){
+    switch (_resolution) {
+        case 8:  return _bytes;
+        case 14: return _bytes * 8 / 14;
+        default: return _bytes / 2;
+    }
+}
+
+static inline uint64_t sample14(int16_t _value){
+    int v = _value < PACK14_MIN ? PACK14_MIN : (_value > PACK14_MAX ? PACK14_MAX : _value);
+    return static_cast<uint64_t>(v) & 0x3FFF;
+}
+
+static inline int16_t extend14(uint64_t _bits){
+    return static_cast<int16_t>(static_cast<int16_t>((_bits & 0x3FFF) << 2) >> 2);
+}
+
+// Little endian 64 bit load and store of _bytes <= 8 bytes
+static inline uint64_t loadBytes(const uint8_t *_src, size_t _bytes){
+    uint64_t v = 0;
+    for (size_t i = 0; i < _bytes; ++i)
+        v |= static_cast<uint64_t>(_src[i]) << (8 * i);
+    return v;
+}
+
+static inline void storeBytes(uint8_t *_dst, uint64_t _v, size_t _bytes){
+    for (size_t i = 0; i < _bytes; ++i)
+        _dst[i] = static_cast<uint8_t>(_v >> (8 * i));
+}
+
+// Up to one group, the first 4 samples go to the low 56 bits, the rest to the next 56
+static void packTail(const int16_t *_src, size_t _samples, uint8_t *_dst){
+    uint64_t half[2] = {0, 0};
+    for (size_t i = 0; i < _samples; ++i)
+        half[i / 4] |= sample14(_src[i]) << (14 * (i % 4));
+    size_t bytes = bytesForSamples(_samples, 14);
+    storeBytes(_dst, half[0], bytes < 7 ? bytes : 7);
+    if (bytes > 7)
+        storeBytes(_dst + 7, half[1], bytes - 7);
+}
+
+static void unpackTail(const uint8_t *_src, size_t _samples, int16_t *_dst){
+    size_t bytes = bytesForSamples(_samples, 14);
+    uint64_t half[2];
+    half[0] = loadBytes(_src, bytes < 7 ? bytes : 7);
+    half[1] = bytes > 7 ? loadBytes(_src + 7, bytes - 7) : 0;
+    for (size_t i = 0; i < _samples; ++i)
+        _dst[i] = extend14(half[i / 4] >> (14 * (i % 4)));
+}
+
+void pack14(const int16_t *_src, size_t _samples, uint8_t *_dst){
+    size_t groups = _samples / PACK14_GROUP_SAMPLES;
+    size_t g = 0;
+#ifdef PACK14_NEON
+    // Each group is stored as two 8 byte writes, the second one overlaps the next group,
+    // so the last full group goes through the scalar path.
+    const int16x8_t lo = vdupq_n_s16(PACK14_MIN);
+    const int16x8_t hi = vdupq_n_s16(PACK14_MAX);
+    const uint16x8_t mask = vdupq_n_u16(0x3FFF);
+    for (; g + 1 < groups; ++g) {
+        int16x8_t s = vld1q_s16(_src + g * PACK14_GROUP_SAMPLES);
+        uint16x8_t v = vandq_u16(vreinterpretq_u16_s16(vminq_s16(vmaxq_s16(s, lo), hi)), mask);
+        // 14 bit pairs to 28 bit in 32 bit lanes, then 28 bit pairs to 56 bit in 64 bit lanes
+        uint32x4_t w = vreinterpretq_u32_u16(v);
+        w = vsliq_n_u32(w, vshrq_n_u32(w, 16), 14);
+        uint64x2_t d = vreinterpretq_u64_u32(w);
+        d = vsliq_n_u64(vandq_u64(d, vdupq_n_u64(0xFFFFFFF)), vshrq_n_u64(d, 32), 28);
+        uint8_t *out = _dst + g * PACK14_GROUP_BYTES;
+        vst1_u8(out, vreinterpret_u8_u64(vget_low_u64(d)));
+        vst1_u8(out + 7, vreinterpret_u8_u64(vget_high_u64(d)));
+    }
+#endif
+    for (; g < groups; ++g) {
+        const int16_t *s = _src + g * PACK14_GROUP_SAMPLES;
+        uint64_t a = sample14(s[0]) | sample14(s[1]) << 14 | sample14(s[2]) << 28 | sample14(s[3]) << 42 | sample14(s[4]) << 56;
+        uint64_t b = sample14(s[4]) >> 8 | sample14(s[5]) << 6 | sample14(s[6]) << 20 | sample14(s[7]) << 34;
+        uint8_t *out = _dst + g * PACK14_GROUP_BYTES;
+        storeBytes(out, a, 8);
+        storeBytes(out + 8, b, 6);
+    }
+    size_t rest = _samples - groups * PACK14_GROUP_SAMPLES;
+    if (rest)
+        packTail(_src + groups * PACK14_GROUP_SAMPLES, rest, _dst + groups * PACK14_GROUP_BYTES);
+}
+
+void unpack14(const uint8_t *_src, size_t _samples, int16_t *_dst){
+    size_t groups = _samples / PACK14_GROUP_SAMPLES;
+    size_t g = 0;
+#ifdef PACK14_NEON
+    // Reads 2 bytes past the group, the last full group goes through the scalar path
+    for (; g + 1 < groups; ++g) {
+        const uint8_t *in = _src + g * PACK14_GROUP_BYTES;
+        uint64x2_t d = vcombine_u64(vreinterpret_u64_u8(vld1_u8(in)), vreinterpret_u64_u8(vld1_u8(in + 7)));
+        d = vsliq_n_u64(vandq_u64(d, vdupq_n_u64(0xFFFFFFF)), vshrq_n_u64(d, 28), 32);
+        uint32x4_t w = vreinterpretq_u32_u64(d);
+        w = vsliq_n_u32(vandq_u32(w, vdupq_n_u32(0x3FFF)), vshrq_n_u32(w, 14), 16);
+        int16x8_t s = vreinterpretq_s16_u32(w);
+        s = vshrq_n_s16(vshlq_n_s16(s, 2), 2);
+        vst1q_s16(_dst + g * PACK14_GROUP_SAMPLES, s);
+    }
+#endif
+    for (; g < groups; ++g) {
+        const uint8_t *in = _src + g * PACK14_GROUP_BYTES;
+        uint64_t a = loadBytes(in, 8);
+        uint64_t b = loadBytes(in + 8, 6);
+        int16_t *d = _dst + g * PACK14_GROUP_SAMPLES;
+        d[0] = extend14(a);
+        d[1] = extend14(a >> 14);
+        d[2] = extend14(a >> 28);
+        d[3] = extend14(a >> 42);
+        d[4] = extend14(a >> 56 | b << 8);
+        d[5] = extend14(b >> 6);
+        d[6] = extend14(b >> 20);
+        d[7] = extend14(b >> 34);
+    }
+    size_t rest = _samples - groups * PACK14_GROUP_SAMPLES;
+    if (rest)
+        unpackTail(_src + groups * PACK14_GROUP_BYTES, rest, _dst + groups * PACK14_GROUP_SAMPLES);
+}
@@ -0,0 +1,42 @@
+#include "rpsa/common/core/thread_sched.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+bool pinCurrentThread(int _cpu){
+#ifdef __linux__
+    if (_cpu < 0 || _cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(_cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    static_cast<void>(_cpu);
+    return false;
+#endif
+}
+
+bool setCurrentThreadFifo(int _priority){
+#ifdef __linux__
+    int min = sched_get_priority_min(SCHED_FIFO);
+    int max = sched_get_priority_max(SCHED_FIFO);
+    struct sched_param param = {};
+    param.sched_priority = _priority < min ? min : (_priority > max ? max : _priority);
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+#else
+    static_cast<void>(_priority);
+    return false;
+#endif
+}
+
+bool setCurrentThreadNormal(){
+#ifdef __linux__
+    struct sched_param param = {};
+    return pthread_setschedparam(pthread_self(), SCHED_OTHER, &param) == 0;
+#else
+    return false;
+#endif
+}
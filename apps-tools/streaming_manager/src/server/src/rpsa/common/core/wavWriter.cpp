@@ -1,5 +1,19 @@
 #include "rpsa/common/core/wavWriter.h"
-
+#include "rpsa/common/core/sample_kernels.h"
+
+#define WAV_RIFF_SIZE_OFFSET 4
+#define WAV_DS64_OFFSET      12
+#define WAV_SAMPLE_RATE_OFFSET 60
+#define WAV_BYTE_RATE_OFFSET   64
+#define WAV_BLOCK_ALIGN_OFFSET 68
+#define WAV_DATA_SIZE_OFFSET 76
+
+namespace {
+    void putLE(uint8_t *memory, uint64_t value, int bytes){
+        for (int i = 0; i < bytes; i++)
+            memory[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
 
 CWaveWriter::CWaveWriter(){
     resetHeaderInit();
@@ -12,11 +26,11 @@ CWaveWriter::CWaveWriter(){
 //         fileData.push_back ((uint8_t) s[i]);
 // }
 
-void CWaveWriter::resetHeaderInit(){
-    m_headerInit = true;
+void CWaveWriter::resetHeaderInit(bool _headerInit){
+    m_headerInit = _headerInit;
 }
 
-std::iostream *CWaveWriter::BuildWAVStream(uint8_t* buffer_ch1,size_t size_ch1,uint8_t* buffer_ch2,size_t size_ch2,unsigned short resolution){
+size_t CWaveWriter::BuildWAVBlock(uint8_t* dst,size_t capacity,const uint8_t* buffer_ch1,size_t size_ch1,const uint8_t* buffer_ch2,size_t size_ch2,unsigned short resolution){
 
     if (size_ch1!=0 && size_ch2 != 0)
         assert(size_ch1 == size_ch2);
@@ -38,100 +52,75 @@ std::iostream *CWaveWriter::BuildWAVStream(uint8_t* buffer_ch1,size_t size_ch1,u
         m_samplesPerChannel = size_ch2 / (m_bitDepth==8 ? 1 : 2);
     //////////////////
 
-    std::stringstream *memory = new std::stringstream(std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+    if ((m_headerInit ? headerSize() : 0) + size_ch1 + size_ch2 > capacity)
+        return 0;
+
+    uint8_t *memory = dst;
     if (m_headerInit)
     {
         BuildHeader(memory);
         m_headerInit = false;
     }
 
-    
-
     if (m_bitDepth == 8)
     {
-        if ((size_ch1 + size_ch2) > 0){
-        uint8_t* cross_buff = new uint8_t[size_ch1 + size_ch2];
-
+        uint8_t* cross_buff = memory;
         if (size_ch2 > 0 && size_ch1 > 0){
-            for (int i = 0; i < m_samplesPerChannel; i++)
-            {
-                cross_buff[i*2] = buffer_ch1[i];
-            }
-
-            for (int i = 0; i < m_samplesPerChannel; i++)
-            {
-                cross_buff[i*2 + 1] = buffer_ch2[i];                            
-            }
+            kernelInterleave8((int8_t*)cross_buff, (const int8_t*)buffer_ch1, (const int8_t*)buffer_ch2, m_samplesPerChannel);
         }
         else {
             if (size_ch1 > 0){
-                for (int i = 0; i < m_samplesPerChannel; i++) {
-                    cross_buff[i] = buffer_ch1[i];
-                }
+                memcpy(cross_buff, buffer_ch1, size_ch1);
             }
 
             if (size_ch2 > 0) {
-                for (int i = 0; i < m_samplesPerChannel; i++) {
-                    cross_buff[i] = buffer_ch2[i];
-                }
+                memcpy(cross_buff, buffer_ch2, size_ch2);
             }
         }
-        memory->write((const char*)cross_buff, size_ch1 + size_ch2);
-        delete [] cross_buff;
-        }
+        memory += size_ch1 + size_ch2;
     }
 
     if (m_bitDepth == 16)
     {
         int Bufflen = (size_ch1 > 0 ? m_samplesPerChannel : 0) + (size_ch2 > 0 ? m_samplesPerChannel : 0);
         if (Bufflen > 0){
-            uint16_t* cross_buff = new uint16_t[Bufflen];
-
-
+            uint16_t* cross_buff = (uint16_t*)memory;
             if (size_ch2 > 0 && size_ch1 > 0){
-                for (int i = 0; i < m_samplesPerChannel; i++)
-                {
-                    cross_buff[i*2] = ((uint16_t*)buffer_ch1)[i];
-                }
-
-                for (int i = 0; i < m_samplesPerChannel; i++)
-                {
-                    cross_buff[i*2 + 1] = ((uint16_t*)buffer_ch2)[i];                            
-                }
+                kernelInterleave16((int16_t*)cross_buff, (const int16_t*)buffer_ch1, (const int16_t*)buffer_ch2, m_samplesPerChannel);
             }
             else {
                 if (size_ch1 > 0){
-                    for (int i = 0; i < m_samplesPerChannel; i++)
-                    {
-                        cross_buff[i] = ((uint16_t *) buffer_ch1)[i];
-                    }
+                    memcpy(cross_buff, buffer_ch1, size_ch1);
                 }
 
                 if (size_ch2 > 0) {
-                    for (int i = 0; i < m_samplesPerChannel; i++) {
-                        cross_buff[i] = ((uint16_t *) buffer_ch2)[i];
-                    }
+                    memcpy(cross_buff, buffer_ch2, size_ch2);
                 }
             }
-        memory->write((const char*)cross_buff, sizeof(uint16_t)* (Bufflen));
-        delete [] cross_buff;
+            memory += sizeof(uint16_t) * Bufflen;
         }
     }
 
-    return memory;
+    return memory - dst;
 }
 
-void CWaveWriter::BuildHeader(std::stringstream *memory){
+void CWaveWriter::BuildHeader(uint8_t *&memory){
 
     int sampleRate = 44100;
     int32_t dataChunkSize = m_samplesPerChannel * m_numChannels * (m_bitDepth==8 ? 1 : 2);
    
     addStringToFileData(memory,"RIFF");
     
-    int32_t fileSizeInBytes = 4 + 24 + 8 + dataChunkSize;
+    int32_t fileSizeInBytes = headerSize() - 8 + dataChunkSize;
     addInt32ToFileData (memory, fileSizeInBytes);
     addStringToFileData(memory,"WAVE");
-    
+
+    // -----------------------------------------------------------
+    // Room for the RF64 ds64 chunk, skipped by readers until it is renamed
+    addStringToFileData(memory,"JUNK");
+    addInt32ToFileData (memory, 28);
+    memset(memory, 0, 28);
+    memory += 28;
 
     // -----------------------------------------------------------
     // FORMAT CHUNK
@@ -150,19 +139,48 @@ void CWaveWriter::BuildHeader(std::stringstream *memory){
     addInt16ToFileData (memory, (int16_t)m_bitDepth);
     
     // -----------------------------------------------------------
-    memory->write("data",4);
+    addStringToFileData(memory,"data");
     addInt32ToFileData (memory, dataChunkSize);
 //    std::cout << "BuildHeader: dataChunkSize " << dataChunkSize << "\n";
 }
 
 
-void CWaveWriter::addStringToFileData (std::stringstream *memory, std::string s)
+void CWaveWriter::UpdateHeaderSizes(uint8_t *header, uint64_t dataSize){
+    uint64_t riffSize = headerSize() - 8 + dataSize;
+    if (riffSize <= UINT32_MAX){
+        putLE(header + WAV_RIFF_SIZE_OFFSET, riffSize, 4);
+        putLE(header + WAV_DATA_SIZE_OFFSET, dataSize, 4);
+        return;
+    }
+
+    // RF64 (EBU Tech 3306): 32-bit sizes are -1, real sizes are in ds64
+    uint16_t blockAlign = header[WAV_BLOCK_ALIGN_OFFSET] | (header[WAV_BLOCK_ALIGN_OFFSET + 1] << 8);
+    memcpy(header, "RF64", 4);
+    putLE(header + WAV_RIFF_SIZE_OFFSET, UINT32_MAX, 4);
+    uint8_t *ds64 = header + WAV_DS64_OFFSET;
+    memcpy(ds64, "ds64", 4);
+    putLE(ds64 + 4, 28, 4);
+    putLE(ds64 + 8, riffSize, 8);
+    putLE(ds64 + 16, dataSize, 8);
+    putLE(ds64 + 24, blockAlign ? dataSize / blockAlign : 0, 8);
+    putLE(ds64 + 32, 0, 4); // table length
+    putLE(header + WAV_DATA_SIZE_OFFSET, UINT32_MAX, 4);
+}
+
+void CWaveWriter::UpdateSampleRate(uint8_t *header, uint32_t sampleRate){
+    uint16_t blockAlign = header[WAV_BLOCK_ALIGN_OFFSET] | (header[WAV_BLOCK_ALIGN_OFFSET + 1] << 8);
+    putLE(header + WAV_SAMPLE_RATE_OFFSET, sampleRate, 4);
+    putLE(header + WAV_BYTE_RATE_OFFSET, (uint64_t)sampleRate * blockAlign, 4);
+}
+
+void CWaveWriter::addStringToFileData (uint8_t *&memory, std::string s)
 {
-    memory->write(s.data(),s.size());
+    memcpy(memory, s.data(), s.size());
+    memory += s.size();
 }
 
 
-void CWaveWriter::addInt32ToFileData (std::stringstream *memory, int32_t i)
+void CWaveWriter::addInt32ToFileData (uint8_t *&memory, int32_t i)
 {
     char bytes[4];
     
@@ -180,11 +198,12 @@ void CWaveWriter::addInt32ToFileData (std::stringstream *memory, int32_t i)
         bytes[2] = (i >> 8) & 0xFF;
         bytes[3] = i & 0xFF;
     }
-    memory->write(bytes,4);
+    memcpy(memory, bytes, 4);
+    memory += 4;
     
 }
 
-void CWaveWriter::addInt16ToFileData (std::stringstream *memory, int16_t i)
+void CWaveWriter::addInt16ToFileData (uint8_t *&memory, int16_t i)
 {
     char bytes[2];
     
@@ -199,6 +218,7 @@ void CWaveWriter::addInt16ToFileData (std::stringstream *memory, int16_t i)
         bytes[1] = i & 0xFF;
     }
     
-    memory->write(bytes,2);
+    memcpy(memory, bytes, 2);
+    memory += 2;
 }
 
@@ -1,51 +1,452 @@
 #include <fstream>
+#include <chrono>
 #include "asio.hpp"
 #include "rpsa/server/core/AsioNet.h"
+#include "rpsa/common/core/crc32c.h"
+#include "rpsa/common/core/sample_kernels.h"
+#include "rpsa/common/core/sample_pack.h"
+#include "rpsa/common/core/thread_sched.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#endif
 
 #define ID_PACK "STREAMpackIDv1.0"
+#define ID_PACK_V2 "STREAMpackIDv2.0"
+#define ID_PACK_PREFIX_SIZE 13 // "STREAMpackIDv", common to all versions
 
 namespace  asionet {
 
-    uint8_t *CAsioNet::BuildPack(
-            uint64_t _id ,
-            uint64_t _lostRate ,
-            uint32_t _oscRate  ,
-            uint32_t _resolution ,
-            const void *_ch1 ,
-            size_t _size_ch1 ,
-            const void *_ch2 ,
-            size_t _size_ch2 ,
-            size_t &_buffer_size ){
+#ifdef __linux__
+    // Scratch space for sendmmsg, kept between calls
+    struct CAsioSocket::UdpBatch{
+        std::vector<struct mmsghdr> msgs;
+        std::vector<struct iovec>   iovs;
+        std::vector<uint8_t>        control;
+        std::vector<size_t>         packs; // Packs carried by each message
+    };
+#else
+    struct CAsioSocket::UdpBatch{};
+#endif
+
+namespace {
+    // Received headers are not aligned in the TCP FIFO
+    inline uint32_t get32(const uint8_t *_header, size_t _offset){
+        uint32_t value;
+        memcpy(&value, _header + _offset, sizeof(value));
+        return value;
+    }
+
+    inline uint64_t get64(const uint8_t *_header, size_t _offset){
+        uint64_t value;
+        memcpy(&value, _header + _offset, sizeof(value));
+        return value;
+    }
+
+    // Id and sample range of a pack from its header, no sample range for v1 and compressed packs
+    inline DroppedRange packRange(const uint8_t *_data, size_t _size){
+        DroppedRange range = { 0, 1, 0, 0 };
+        auto version = _size >= 16 ? CAsioNet::PackVersion(_data) : 0;
+        if (version != 0 && _size >= CAsioNet::PackHeaderSize(version)){
+            range.firstPack = get64(_data, 16);
+            // Compressed channel sizes say nothing about the samples
+            if (version == 2 && !(get32(_data, 80) & PACK_FLAG_COMPRESSED)){
+                range.firstSample = get64(_data, 32);
+                range.samples = samplesInBytes(std::max(get32(_data, 64), get32(_data, 68)), get32(_data, 72));
+            }
+        }
+        return range;
+    }
+
+    inline uint64_t steadyNs(){
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+    CRetransmitRing::Ptr CRetransmitRing::Create(uint32_t _window_ms, size_t _slot_size, size_t _bytes){
+        return std::make_shared<CRetransmitRing>(_window_ms, _slot_size, _bytes);
+    }
+
+    CRetransmitRing::CRetransmitRing(uint32_t _window_ms, size_t _slot_size, size_t _bytes):
+            m_window((uint64_t)_window_ms * 1000000),
+            m_slot_size(_slot_size),
+            m_slots(std::max<size_t>(_bytes / _slot_size, 1)),
+            m_data(m_slots.size() * _slot_size),
+            m_scratch(_slot_size),
+            m_newest(0),
+            m_empty(true),
+            m_mutex()
+    {
+        for (auto &slot : m_slots){
+            slot.id = UINT64_MAX;
+            slot.time = 0;
+            slot.size = 0;
+        }
+    }
+
+    void CRetransmitRing::Store(const std::array<asio::const_buffer, 3> &_pack){
+        size_t size = asio::buffer_size(_pack);
+        if (_pack[0].size() < 24 || size > m_slot_size)
+            return;
+        uint64_t id = get64(static_cast<const uint8_t*>(_pack[0].data()), 16);
+        size_t index = id % m_slots.size();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto &slot = m_slots[index];
+        uint8_t *data = &m_data[index * m_slot_size];
+        for (const auto &buffer : _pack){
+            memcpy(data, buffer.data(), buffer.size());
+            data += buffer.size();
+        }
+        slot.id = id;
+        slot.time = steadyNs();
+        slot.size = size;
+        if (m_empty || id > m_newest)
+            m_newest = id;
+        m_empty = false;
+    }
+
+    size_t CRetransmitRing::Resend(uint64_t _first, uint64_t _count, const SendFunc &_send, uint64_t &_missing){
+        size_t sent = 0;
+        _missing = 0;
+        uint64_t last = _first + _count - 1;
+        if (_count == 0 || last < _first)
+            return 0;
+
+        uint64_t oldest;
+        uint64_t newest;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_empty){
+                _missing = _count;
+                return 0;
+            }
+            newest = m_newest;
+            oldest = newest >= m_slots.size() ? newest - m_slots.size() + 1 : 0;
+        }
+        // Ids that can not be in the ring any more, or were never sent
+        if (_first < oldest){
+            _missing += std::min(last, oldest - 1) - _first + 1;
+            _first = oldest;
+        }
+        if (last > newest){
+            _missing += last - std::max(_first, newest + 1) + 1;
+            last = newest;
+        }
+
+        for (uint64_t id = _first; id <= last && _first <= last; ++id){
+            size_t size = 0;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                size_t index = id % m_slots.size();
+                auto &slot = m_slots[index];
+                if (slot.id == id && steadyNs() - slot.time <= m_window){
+                    size = slot.size;
+                    memcpy(m_scratch.data(), &m_data[index * m_slot_size], size);
+                }
+            }
+            if (size > 0){
+                _send(m_scratch.data(), size);
+                sent++;
+            } else {
+                _missing++;
+            }
+        }
+        return sent;
+    }
+
+    CSharedPack::CSharedPack(CBufferPool::Ptr _pool, uint8_t *_data, size_t _size, uint64_t _block):
+            m_pool(_pool),
+            m_data(_data),
+            m_size(_size),
+            m_block(_block),
+            m_id(0),
+            m_sampleIndex(0),
+            m_samples(0)
+    {
+        auto range = packRange(_data, _size);
+        m_id = range.firstPack;
+        m_sampleIndex = range.firstSample;
+        m_samples = range.samples;
+    }
 
+    CSharedPack::~CSharedPack(){
+        // Last reference can be dropped on the io thread or on the producer thread
+        m_pool->releaseShared(m_data);
+    }
+
+    CTcpSession::Ptr CTcpSession::Create(asio::io_service &io, DropPolicy _policy, size_t _max_queue, CloseHandler _on_close){
+        return std::make_shared<CTcpSession>(io, _policy, _max_queue, _on_close);
+    }
+
+    CTcpSession::CTcpSession(asio::io_service &io, DropPolicy _policy, size_t _max_queue, CloseHandler _on_close):
+            m_socket(io),
+            m_host(""),
+            m_policy(_policy),
+            m_max_queue(_max_queue),
+            m_writing(false),
+            m_closed(false),
+            m_has_sent(false),
+            m_sent_block(0),
+            m_credit_mode(false),
+            m_credits(0),
+            m_dropped(0),
+            m_dropped_blocks(0),
+            m_last_dropped_block(0),
+            m_on_close(_on_close)
+    {
+    }
+
+    void CTcpSession::Start(){
+        asio::error_code error;
+        auto endpoint = m_socket.remote_endpoint(error);
+        if (!error)
+            m_host = endpoint.address().to_string();
+        m_socket.set_option(asio::ip::tcp::no_delay(true), error);
+        ReadCredits();
+    }
+
+    void CTcpSession::ReadCredits(){
+        auto self = shared_from_this();
+        asio::async_read(m_socket, asio::buffer(m_credit_msg, TCP_CREDIT_SIZE),
+                         [self](const asio::error_code &_error, size_t _bytesTransferred){
+                             self->HandlerCredits(_error, _bytesTransferred);
+                         });
+    }
+
+    void CTcpSession::HandlerCredits(const asio::error_code &_error, size_t){
+        if (_error || m_closed){
+            // The client has gone, a pending write fails as well
+            if (_error != asio::error::operation_aborted)
+                Close();
+            return;
+        }
+        if (memcmp(m_credit_msg, TCP_CREDIT_ID, 4) == 0){
+            m_credit_mode = true;
+            m_credits += get32(m_credit_msg, 4);
+            if (!m_writing && !m_queue.empty())
+                DoWrite();
+        }
+        ReadCredits();
+    }
+
+    void CTcpSession::RecordDrop(const CSharedPack::Ptr &_pack){
+        RecordDrop(_pack->block(), { _pack->id(), 1, _pack->sampleIndex(), _pack->samples() });
+    }
+
+    void CTcpSession::RecordDrop(uint64_t _block, const DroppedRange &_range){
+        m_dropped += _range.packs;
+        if (m_dropped_blocks == 0 || _block != m_last_dropped_block){
+            m_dropped_blocks++;
+            m_last_dropped_block = _block;
+        }
+        if (!m_dropped_ranges.empty()){
+            auto &last = m_dropped_ranges.back();
+            if (last.firstPack + last.packs == _range.firstPack && (last.samples == 0 || last.firstSample + last.samples == _range.firstSample)){
+                last.packs += _range.packs;
+                last.samples += _range.samples;
+                return;
+            }
+        }
+        if (m_dropped_ranges.size() >= TCP_DROP_HISTORY)
+            m_dropped_ranges.erase(m_dropped_ranges.begin());
+        m_dropped_ranges.push_back(_range);
+    }
+
+    bool CTcpSession::DropOldestBlock(){
+        // Packs of the block being written stay, the client gets that block complete
+        auto first = m_queue.begin();
+        while (first != m_queue.end() && m_has_sent && (*first)->block() == m_sent_block)
+            ++first;
+        if (first == m_queue.end())
+            return false;
+        auto last = first;
+        while (last != m_queue.end() && (*last)->block() == (*first)->block()){
+            RecordDrop(*last);
+            ++last;
+        }
+        m_queue.erase(first, last);
+        return true;
+    }
+
+    bool CTcpSession::Push(const SharedBlock &_block){
+        if (m_closed || _block.empty())
+            return true;
+        while (m_queue.size() + _block.size() > m_max_queue){
+            bool dropNew = _block.size() > m_max_queue;
+            switch (m_policy) {
+                case DropPolicy::DROP_NEWEST:
+                    dropNew = true;
+                    break;
+                case DropPolicy::DROP_OLDEST:
+                    dropNew = dropNew || !DropOldestBlock();
+                    break;
+                case DropPolicy::DISCONNECT:
+                    return false;
+            }
+            if (dropNew){
+                for (auto &pack : _block)
+                    RecordDrop(pack);
+                return true;
+            }
+        }
+        m_queue.insert(m_queue.end(), _block.begin(), _block.end());
+        if (!m_writing)
+            DoWrite();
+        return true;
+    }
+
+    void CTcpSession::DoWrite(){
+        if (m_queue.empty() || (m_credit_mode && m_credits == 0))
+            return;
+        if (m_credit_mode)
+            m_credits--;
+        m_writing = true;
+        auto self = shared_from_this();
+        auto pack = m_queue.front();
+        m_has_sent = true;
+        m_sent_block = pack->block();
+        asio::async_write(m_socket, asio::buffer(pack->data(), pack->size()),
+                          [self](const asio::error_code &_error, size_t _bytesTransferred){
+                              self->HandlerWrite(_error, _bytesTransferred);
+                          });
+    }
+
+    void CTcpSession::HandlerWrite(const asio::error_code &_error, size_t){
+        m_writing = false;
+        if (_error || m_closed){
+            m_queue.clear();
+            Close();
+            return;
+        }
+        m_queue.pop_front();
+        DoWrite();
+    }
+
+    void CTcpSession::Close(){
+        if (m_closed)
+            return;
+        m_closed = true;
+        asio::error_code error;
+        m_socket.close(error);
+        // Keep the pack of a pending write until its handler has run
+        while (m_queue.size() > (m_writing ? 1u : 0u))
+            m_queue.pop_back();
+        if (m_on_close)
+            m_on_close(shared_from_this());
+    }
+
+    size_t CAsioNet::PackHeaderSize(uint32_t _version){
         size_t  prefix_lenght = sizeof(int8_t) * 16; // ID of pack (16 byte)
         prefix_lenght += sizeof(uint64_t);    // Index (8 byte)
         prefix_lenght += sizeof(uint64_t);    // lostRate  (8 byte)
+        if (_version >= 2) {
+            prefix_lenght += sizeof(uint64_t);    // first sample index (8 byte)
+            prefix_lenght += sizeof(uint64_t);    // timestamp (8 byte)
+            prefix_lenght += sizeof(uint64_t);    // dropped samples (8 byte)
+        }
         prefix_lenght += sizeof(int32_t);     // _oscRate  (4 byte)
         prefix_lenght += sizeof(int32_t);     // pack size (4 byte)
         prefix_lenght += sizeof(int32_t) * 2; // size of channel1 and channel2 (8 byte)
         prefix_lenght += sizeof(int32_t);     // resolution (4 byte)
-        size_t  buffer_size = prefix_lenght + _size_ch1 + _size_ch2;
-        auto buffer = new uint8_t[buffer_size];
-        memcpy(buffer,ID_PACK,16);
-        ((uint64_t*)buffer)[2] = _id;
-        ((uint64_t*)buffer)[3] = _lostRate;
-        ((uint32_t*)buffer)[8] = _oscRate;
-        ((uint32_t*)buffer)[9] = (uint32_t)buffer_size;
-        ((uint32_t*)buffer)[10] = (uint32_t)_size_ch1;
-        ((uint32_t*)buffer)[11] = (uint32_t)_size_ch2;
-        ((uint32_t*)buffer)[12] = _resolution;
+        if (_version >= 2) {
+            prefix_lenght += sizeof(int32_t);     // channel mask (4 byte)
+            prefix_lenght += sizeof(int32_t);     // flags (4 byte)
+            prefix_lenght += sizeof(int32_t);     // crc32c (4 byte)
+        }
+        return prefix_lenght;
+    }
 
-        if (_size_ch1>0){
+    uint32_t CAsioNet::PackVersion(const uint8_t *_buffer){
+        if (strncmp((const char*)_buffer, ID_PACK_V2, 16) == 0)
+            return 2;
+        if (strncmp((const char*)_buffer, ID_PACK, 16) == 0)
+            return 1;
+        return 0;
+    }
 
-            memcpy_neon((&(*buffer)+prefix_lenght), _ch1, _size_ch1);
-        }
+    size_t CAsioNet::PackSize(const uint8_t *_buffer, size_t _size){
+        if (_size < 16)
+            return 0;
+        auto version = PackVersion(_buffer);
+        if (version == 0 || _size < PackHeaderSize(version))
+            return 0;
+        return get32(_buffer, version == 2 ? 60 : 36);
+    }
 
-        if (_size_ch2>0){
+    size_t CAsioNet::BuildPackHeader(
+            uint8_t *_header ,
+            const PackInfo &_info ,
+            const void *_ch1 ,
+            size_t _size_ch1 ,
+            const void *_ch2 ,
+            size_t _size_ch2){
 
-            memcpy_neon((&(*buffer)+prefix_lenght + _size_ch1), _ch2, _size_ch2);
+        size_t  prefix_lenght = PackHeaderSize(2);
+        size_t  buffer_size = prefix_lenght + _size_ch1 + _size_ch2;
+        uint32_t crc = 0;
+        if (_info.flags & PACK_FLAG_CRC32C) {
+            if (_size_ch1 > 0)
+                crc = crc32c(crc, _ch1, _size_ch1);
+            if (_size_ch2 > 0)
+                crc = crc32c(crc, _ch2, _size_ch2);
         }
+        memcpy(_header,ID_PACK_V2,16);
+        ((uint64_t*)_header)[2] = _info.id;
+        ((uint64_t*)_header)[3] = _info.lostRate;
+        ((uint64_t*)_header)[4] = _info.sampleIndex;
+        ((uint64_t*)_header)[5] = _info.timestamp;
+        ((uint64_t*)_header)[6] = _info.droppedSamples;
+        ((uint32_t*)_header)[14] = _info.oscRate;
+        ((uint32_t*)_header)[15] = (uint32_t)buffer_size;
+        ((uint32_t*)_header)[16] = (uint32_t)_size_ch1;
+        ((uint32_t*)_header)[17] = (uint32_t)_size_ch2;
+        ((uint32_t*)_header)[18] = _info.resolution;
+        ((uint32_t*)_header)[19] = _info.channels;
+        ((uint32_t*)_header)[20] = _info.flags;
+        ((uint32_t*)_header)[21] = crc;
+        return prefix_lenght;
+    }
 
-        _buffer_size = buffer_size;
+    size_t CAsioNet::BuildPackHeader(
+            uint8_t *_header ,
+            uint64_t _id ,
+            uint64_t _lostRate ,
+            uint32_t _oscRate  ,
+            uint32_t _resolution ,
+            size_t _size_ch1 ,
+            size_t _size_ch2){
+
+        size_t  prefix_lenght = PackHeaderSize(1);
+        size_t  buffer_size = prefix_lenght + _size_ch1 + _size_ch2;
+        memcpy(_header,ID_PACK,16);
+        ((uint64_t*)_header)[2] = _id;
+        ((uint64_t*)_header)[3] = _lostRate;
+        ((uint32_t*)_header)[8] = _oscRate;
+        ((uint32_t*)_header)[9] = (uint32_t)buffer_size;
+        ((uint32_t*)_header)[10] = (uint32_t)_size_ch1;
+        ((uint32_t*)_header)[11] = (uint32_t)_size_ch2;
+        ((uint32_t*)_header)[12] = _resolution;
+        return prefix_lenght;
+    }
+
+    uint8_t *CAsioNet::BuildPack(
+            uint64_t _id ,
+            uint64_t _lostRate ,
+            uint32_t _oscRate  ,
+            uint32_t _resolution ,
+            const void *_ch1 ,
+            size_t _size_ch1 ,
+            const void *_ch2 ,
+            size_t _size_ch2 ,
+            size_t &_buffer_size ){
+
+        auto buffer = new uint8_t[PackHeaderSize(1) + _size_ch1 + _size_ch2];
+        BuildPack(buffer, _id, _lostRate, _oscRate, _resolution, _ch1, _size_ch1, _ch2, _size_ch2, _buffer_size);
         return buffer;
     }
 
@@ -60,34 +461,20 @@ namespace  asionet {
             const void  *_ch2 ,
             size_t _size_ch2 ,
             size_t &_buffer_size){
-        size_t  prefix_lenght = sizeof(int8_t) * 16; // ID of pack (16 byte)
-        prefix_lenght += sizeof(uint64_t);    // Index (8 byte)
-        prefix_lenght += sizeof(uint64_t);    // lostRate  (8 byte)
-        prefix_lenght += sizeof(int32_t);     // _oscRate  (4 byte)
-        prefix_lenght += sizeof(int32_t);     // pack size (4 byte)
-        prefix_lenght += sizeof(int32_t) * 2; // size of channel1 and channel2 (8 byte)
-        prefix_lenght += sizeof(int32_t);     // resolution (4 byte)
-        size_t  buffer_size = prefix_lenght + _size_ch1 + _size_ch2;
-        memcpy(buffer,ID_PACK,16);
-        ((uint64_t*)buffer)[2] = _id;
-        ((uint64_t*)buffer)[3] = _lostRate;
-        ((uint32_t*)buffer)[8] = _oscRate;
-        ((uint32_t*)buffer)[9] = (uint32_t)buffer_size;
-        ((uint32_t*)buffer)[10] = (uint32_t)_size_ch1;
-        ((uint32_t*)buffer)[11] = (uint32_t)_size_ch2;
-        ((uint32_t*)buffer)[12] = _resolution;
+
+        size_t  prefix_lenght = BuildPackHeader(buffer, _id, _lostRate, _oscRate, _resolution, _size_ch1, _size_ch2);
 
         if (_size_ch1>0){
 
-            memcpy_neon((&(*buffer)+prefix_lenght), _ch1, _size_ch1);
+            kernelCopy((&(*buffer)+prefix_lenght), _ch1, _size_ch1);
         }
 
         if (_size_ch2>0){
 
-            memcpy_neon((&(*buffer)+prefix_lenght + _size_ch1), _ch2, _size_ch2);
+            kernelCopy((&(*buffer)+prefix_lenght + _size_ch1), _ch2, _size_ch2);
         }
 
-        _buffer_size = buffer_size;
+        _buffer_size = prefix_lenght + _size_ch1 + _size_ch2;
 
     }
 
@@ -102,32 +489,101 @@ namespace  asionet {
                     size_t &_size_ch1 ,
                     CAsioSocket::send_buffer  &_ch2 ,
                     size_t &_size_ch2){
-        if (strncmp((const char*)_buffer,ID_PACK,16) == 0){
-            _id = ((uint64_t*)_buffer)[2];
-            _lostRate = ((uint64_t*)_buffer)[3];
-            _oscRate  = ((uint32_t*)_buffer)[8];
-            ASIO_ASSERT(_size == ((uint32_t*)_buffer)[9]);
-            _size_ch1 = ((uint32_t*)_buffer)[10];
-            _size_ch2 = ((uint32_t*)_buffer)[11];
-            _resolution = ((uint32_t*)_buffer)[12];
-            uint16_t prefix = 52;
-
-            if (_size_ch1 > 0) {
-                _ch1 = new uint8_t[_size_ch1];
-                memcpy_neon(_ch1,_buffer + prefix,_size_ch1);
-            }else{
-                _ch1 = nullptr;
-            }
+        PackInfo info;
+        if (!ExtractPack(_buffer, _size, info, _ch1, _size_ch1, _ch2, _size_ch2))
+            return false;
+        _id = info.id;
+        _lostRate = info.lostRate;
+        _oscRate = info.oscRate;
+        _resolution = info.resolution;
+        return true;
+    }
 
-            if (_size_ch2 > 0) {
-                _ch2 = new uint8_t[_size_ch2];
-                memcpy_neon(_ch2,_buffer + prefix + _size_ch1,_size_ch2);
-            }else{
-                _ch2 = nullptr;
-            }
-            return true;
+    bool CAsioNet::ParsePack(
+                    const uint8_t *_buffer ,
+                    size_t _size ,
+                    PackInfo &_info ,
+                    const uint8_t *&_ch1 ,
+                    size_t &_size_ch1 ,
+                    const uint8_t *&_ch2 ,
+                    size_t &_size_ch2){
+        _ch1 = nullptr;
+        _ch2 = nullptr;
+        _size_ch1 = 0;
+        _size_ch2 = 0;
+        memset(&_info, 0, sizeof(_info));
+
+        size_t pack_size = PackSize(_buffer, _size);
+        if (pack_size == 0 || pack_size > _size)
+            return false;
+
+        _info.version = PackVersion(_buffer);
+        _info.id = get64(_buffer, 16);
+        _info.lostRate = get64(_buffer, 24);
+        size_t prefix = PackHeaderSize(_info.version);
+        size_t size_ch1 = 0;
+        size_t size_ch2 = 0;
+        if (_info.version == 2) {
+            _info.sampleIndex = get64(_buffer, 32);
+            _info.timestamp = get64(_buffer, 40);
+            _info.droppedSamples = get64(_buffer, 48);
+            _info.oscRate = get32(_buffer, 56);
+            size_ch1 = get32(_buffer, 64);
+            size_ch2 = get32(_buffer, 68);
+            _info.resolution = get32(_buffer, 72);
+            _info.channels = get32(_buffer, 76);
+            _info.flags = get32(_buffer, 80);
+            _info.crc = get32(_buffer, 84);
+        } else {
+            _info.oscRate = get32(_buffer, 32);
+            size_ch1 = get32(_buffer, 40);
+            size_ch2 = get32(_buffer, 44);
+            _info.resolution = get32(_buffer, 48);
+            _info.channels = (size_ch1 > 0 ? 1 : 0) | (size_ch2 > 0 ? 2 : 0);
         }
-        return false;
+
+        if (prefix + size_ch1 + size_ch2 > pack_size)
+            return false;
+
+        if (_info.flags & PACK_FLAG_CRC32C) {
+            if (crc32c(0, _buffer + prefix, size_ch1 + size_ch2) != _info.crc)
+                return false;
+        }
+
+        _size_ch1 = size_ch1;
+        _size_ch2 = size_ch2;
+        if (_size_ch1 > 0)
+            _ch1 = _buffer + prefix;
+        if (_size_ch2 > 0)
+            _ch2 = _buffer + prefix + _size_ch1;
+        return true;
+    }
+
+    bool CAsioNet::ExtractPack(
+                    CAsioSocket::send_buffer _buffer ,
+                    size_t _size ,
+                    PackInfo &_info ,
+                    CAsioSocket::send_buffer &_ch1 ,
+                    size_t &_size_ch1 ,
+                    CAsioSocket::send_buffer  &_ch2 ,
+                    size_t &_size_ch2){
+        const uint8_t *ch1 = nullptr;
+        const uint8_t *ch2 = nullptr;
+        _ch1 = nullptr;
+        _ch2 = nullptr;
+        if (!ParsePack(_buffer, _size, _info, ch1, _size_ch1, ch2, _size_ch2))
+            return false;
+
+        if (_size_ch1 > 0) {
+            _ch1 = new uint8_t[_size_ch1];
+            kernelCopy(_ch1,ch1,_size_ch1);
+        }
+
+        if (_size_ch2 > 0) {
+            _ch2 = new uint8_t[_size_ch2];
+            kernelCopy(_ch2,ch2,_size_ch2);
+        }
+        return true;
     }
 
     CAsioNet::Ptr CAsioNet::Create(asionet::Mode _mode,asionet::Protocol _protocol,std::string _host , std::string _port) {
@@ -238,6 +694,68 @@ namespace  asionet {
         return false;
     }
 
+    bool CAsioNet::SendPack(const uint8_t *_header, size_t _header_size, const void *_ch1, size_t _size_ch1, const void *_ch2, size_t _size_ch2){
+        if (m_server){
+            CAsioSocket::pack_buffers buffers = {{
+                asio::buffer(_header, _header_size),
+                asio::buffer(_ch1, _size_ch1),
+                asio::buffer(_ch2, _size_ch2)
+            }};
+            return m_server->SendBuffers(buffers);
+        }
+        return false;
+    }
+
+    bool CAsioNet::SendPacks(const CAsioSocket::pack_buffers *_packs, size_t _count){
+        if (m_server){
+            return m_server->SendPacks(_packs, _count);
+        }
+        return false;
+    }
+
+    void CAsioNet::SetDropPolicy(DropPolicy _policy, size_t _max_queue){
+        if (m_server)
+            m_server->SetDropPolicy(_policy, _max_queue);
+    }
+
+    uint64_t CAsioNet::GetDroppedPacks(){
+        return m_server ? m_server->GetDroppedPacks() + m_server->GetClientDroppedPacks() : 0;
+    }
+
+    size_t CAsioNet::GetQueuedPacks(){
+        return m_server ? m_server->GetQueuedPacks() : 0;
+    }
+
+    size_t CAsioNet::GetQueueCapacity(){
+        return m_server ? m_server->GetQueueCapacity() : 0;
+    }
+
+    void CAsioNet::SetRetransmitWindow(uint32_t _window_ms, size_t _max_pack_size){
+        if (m_server && m_protocol == Protocol::UDP)
+            m_server->SetRetransmitWindow(_window_ms, m_mode == Mode::SERVER ? _max_pack_size : 0);
+    }
+
+    void CAsioNet::SetCreditWindow(uint32_t _packs){
+        if (m_server && m_protocol == Protocol::TCP && m_mode == Mode::CLIENT)
+            m_server->SetCreditWindow(_packs);
+    }
+
+    void CAsioNet::SetCpuAffinity(int _cpu){
+        if (_cpu < 0)
+            return;
+        // Runs on the io thread itself
+        m_Ios.post([_cpu](){
+            if (!pinCurrentThread(_cpu))
+                std::cerr << "Warning: can't pin the network thread to CPU " << _cpu << "\n";
+        });
+    }
+
+    RetransmitStats CAsioNet::GetRetransmitStats(){
+        if (m_server)
+            return m_server->GetRetransmitStats();
+        return RetransmitStats();
+    }
+
 
     CAsioSocket::Ptr
     CAsioSocket::Create(asio::io_service &io, asionet::Protocol _protocol, std::string host, std::string port) {
@@ -256,16 +774,41 @@ namespace  asionet {
             m_tcp_socket(0),
             m_tcp_acceptor(0),
             m_udp_endpoint(),
-            m_last_pack_id(0)
+            m_last_pack_id(0),
+            m_udp_gso(false),
+            m_drop_policy(DropPolicy::DROP_OLDEST),
+            m_client_queue(TCP_CLIENT_QUEUE),
+            m_fanout_pool(nullptr),
+            m_fanout_dropped(0),
+            m_clients_dropped(0),
+            m_fanout_block(0),
+            m_fanout_blocks(),
+            m_credit_window(0),
+            m_credit_consumed(0),
+            m_udp_has_pack(false),
+            m_rudp_window(0),
+            m_rudp_ring(nullptr),
+            m_rudp_missing(),
+            m_rudp_next_id(0),
+            m_rudp_held(),
+            m_rudp_spare(),
+            m_rudp_new_gap(false),
+            m_rudp_last_check(0),
+            m_rudp_nack(RUDP_NACK_SIZE),
+            m_rudp_nacks(0),
+            m_rudp_retransmitted(0),
+            m_rudp_unrecoverable(0)
     {
         m_SocketReadBuffer = new uint8_t[SOCKET_BUFFER_SIZE];
         m_tcp_fifo_buffer = new uint8_t[FIFO_BUFFER_SIZE];
+        m_udp_batch = new UdpBatch();
     }
 
     CAsioSocket::~CAsioSocket() {
         CloseSocket();
         delete [] m_SocketReadBuffer;
         delete [] m_tcp_fifo_buffer;
+        delete m_udp_batch;
 
     }
 
@@ -277,22 +820,34 @@ namespace  asionet {
         m_is_udp_connected = false;
         m_is_tcp_connected = false;
         m_last_pack_id = 0;
+        m_rudp_nacks = 0;
+        m_rudp_retransmitted = 0;
+        m_rudp_unrecoverable = 0;
         if (m_protocol == asionet::Protocol::UDP) {
             m_udp_socket = std::make_shared<asio::ip::udp::udp::socket>(m_io_service, asio::ip::udp::udp::endpoint(asio::ip::udp::udp::v4(), std::stoi(m_port)));
             m_udp_socket->set_option(asio::ip::udp::socket::reuse_address(true));
+#if defined(__linux__) && defined(UDP_SEGMENT)
+            int gso = 0;
+            socklen_t gso_len = sizeof(gso);
+            m_udp_gso = getsockopt(m_udp_socket->native_handle(), SOL_UDP, UDP_SEGMENT, &gso, &gso_len) == 0;
+#endif
             WaitClient();
         }
 
         if (m_protocol == asionet::Protocol::TCP) {
 
-            m_tcp_socket = std::make_shared<asio::ip::tcp::socket>(m_io_service);
+            // Every subscriber holds at most m_client_queue packs and one in flight
+            if (!m_fanout_pool)
+                m_fanout_pool = CBufferPool::Create(TCP_PACK_SIZE, (m_client_queue + 1) * TCP_MAX_CLIENTS, CACHE_LINE_SIZE);
+            m_fanout_dropped = 0;
+            m_clients_dropped = 0;
             m_tcp_acceptor = std::make_shared<asio::ip::tcp::acceptor>(m_io_service);
             asio::ip::tcp::endpoint endpoint(asio::ip::tcp::v4(), std::stoi(m_port));
             m_tcp_acceptor->open(endpoint.protocol());
             m_tcp_acceptor->set_option(asio::ip::tcp::acceptor::reuse_address(true));
             m_tcp_acceptor->bind(endpoint);
             m_tcp_acceptor->listen();
-            m_tcp_acceptor->async_accept(*m_tcp_socket,m_tcp_endpoint, std::bind(&CAsioSocket::HandlerAcceptFromClient, this, std::placeholders::_1));
+            StartAccept();
         }
         m_mode = Mode::SERVER;
     }
@@ -301,15 +856,39 @@ namespace  asionet {
 
         if (m_is_udp_connected)
             m_callback_Str.emitEvent(Events::DISCONNECT_SERVER, m_udp_endpoint.address().to_string());
-        if (m_is_tcp_connected)
+        if (m_is_tcp_connected && m_mode != Mode::SERVER)
             m_callback_Str.emitEvent(Events::DISCONNECT_SERVER, m_tcp_endpoint.address().to_string());
 
+        if (m_mode == Mode::SERVER && m_protocol == Protocol::TCP){
+            // Acceptor and sessions belong to the io thread, close them there while it runs
+            auto acceptor = m_tcp_acceptor;
+            auto close = [this, acceptor](){
+                asio::error_code error;
+                if (acceptor)
+                    acceptor->close(error);
+                std::vector<CTcpSession::Ptr> sessions;
+                {
+                    std::lock_guard<std::mutex> lock(m_sessions_mutex);
+                    sessions.swap(m_sessions);
+                }
+                for (auto &session : sessions)
+                    session->Close();
+            };
+            m_is_tcp_connected = false;
+            if (m_io_service.stopped())
+                close();
+            else
+                m_io_service.post(close);
+        }
+
+        // The io thread may close the socket at the same time after a receive error
+        asio::error_code error;
         if (m_tcp_socket && (*m_tcp_socket).is_open()){
-            (*m_tcp_socket).close();
+            (*m_tcp_socket).close(error);
             m_is_tcp_connected = false;
         }
         if (m_udp_socket && (*m_udp_socket).is_open()) {
-            (*m_udp_socket).close();
+            (*m_udp_socket).close(error);
             m_is_udp_connected = false;
         }
     }
@@ -317,99 +896,278 @@ namespace  asionet {
     void CAsioSocket::WaitClient() {
         if (m_protocol == asionet::Protocol::UDP) {
             m_udp_socket->async_receive_from(
-                    asio::buffer(m_udp_recv_server_buffer, 1), m_udp_endpoint,
+                    asio::buffer(m_udp_recv_server_buffer, RUDP_NACK_SIZE), m_udp_endpoint,
                     std::bind(&CAsioSocket::HandlerReceiveFromClient, this,
-                              std::placeholders::_1));
+                              std::placeholders::_1, std::placeholders::_2));
         }
     }
 
-    void CAsioSocket::HandlerReceiveFromClient(const asio::error_code &error) {
+    void CAsioSocket::HandlerReceiveFromClient(const asio::error_code &error, size_t bytes_transferred) {
         if (!error) {
-            m_is_udp_connected = (bool) m_udp_recv_server_buffer[0];
-            if (m_is_udp_connected){
-                m_callback_Str.emitEvent(Events::CONNECT_SERVER,m_udp_endpoint.address().to_string());
-            }
-            else {
-                m_callback_Str.emitEvent(Events::DISCONNECT_SERVER,m_udp_endpoint.address().to_string());
+            if (bytes_transferred >= 8 && memcmp(m_udp_recv_server_buffer, RUDP_NACK_ID, 4) == 0) {
+                HandlerNack(m_udp_recv_server_buffer, bytes_transferred);
+            } else {
+                m_is_udp_connected = bytes_transferred > 0 && (bool) m_udp_recv_server_buffer[0];
+                if (m_is_udp_connected){
+                    m_callback_Str.emitEvent(Events::CONNECT_SERVER,m_udp_endpoint.address().to_string());
+                }
+                else {
+                    m_callback_Str.emitEvent(Events::DISCONNECT_SERVER,m_udp_endpoint.address().to_string());
+                }
             }
         } else {
             m_callback_Str.emitEvent(Events::DISCONNECT_SERVER,m_udp_endpoint.address().to_string());
             m_is_udp_connected = false;
         }
         m_udp_socket->async_receive_from(
-                asio::buffer(m_udp_recv_server_buffer, 1), m_udp_endpoint,
+                asio::buffer(m_udp_recv_server_buffer, RUDP_NACK_SIZE), m_udp_endpoint,
                 std::bind(&CAsioSocket::HandlerReceiveFromClient, this,
-                          std::placeholders::_1));
+                          std::placeholders::_1, std::placeholders::_2));
+    }
+
+    void CAsioSocket::SetRetransmitWindow(uint32_t _window_ms, size_t _max_pack_size){
+        m_rudp_window = _window_ms;
+        m_rudp_ring = (_window_ms > 0 && _max_pack_size > 0 ? CRetransmitRing::Create(_window_ms, _max_pack_size) : nullptr);
+    }
+
+    RetransmitStats CAsioSocket::GetRetransmitStats(){
+        RetransmitStats stats;
+        stats.nacks = m_rudp_nacks;
+        stats.retransmitted = m_rudp_retransmitted;
+        stats.unrecoverable = m_rudp_unrecoverable;
+        return stats;
+    }
+
+    // NACK datagram: "NACK", uint16 range count, 2 reserved bytes,
+    // then per range uint64 first pack id and uint32 pack count
+    void CAsioSocket::HandlerNack(const uint8_t *_buffer, size_t _size){
+        uint16_t count = 0;
+        memcpy(&count, _buffer + 4, sizeof(count));
+        auto send = [this](const uint8_t *_data, size_t _data_size){
+            asio::error_code error;
+            m_udp_socket->send_to(asio::buffer(_data, _data_size), m_udp_endpoint, 0, error);
+        };
+        for (size_t i = 0; i < count && 8 + (i + 1) * 12 <= _size; ++i){
+            uint64_t first = get64(_buffer, 8 + i * 12);
+            uint32_t packs = get32(_buffer, 16 + i * 12);
+            m_rudp_nacks++;
+            if (!m_rudp_ring){
+                m_rudp_unrecoverable += packs;
+                continue;
+            }
+            uint64_t missing = 0;
+            m_rudp_retransmitted += m_rudp_ring->Resend(first, packs, send, missing);
+            m_rudp_unrecoverable += missing;
+        }
+    }
+
+    void CAsioSocket::TrackMissing(uint64_t _first, uint64_t _last){
+        while (m_rudp_missing.size() >= RUDP_MAX_PENDING)
+            GiveUpOldestGap();
+        m_rudp_missing[_first] = { _last, steadyNs(), 0 };
+        m_rudp_new_gap = true;
+    }
+
+    bool CAsioSocket::TakeMissing(uint64_t _id){
+        auto it = m_rudp_missing.upper_bound(_id);
+        if (it == m_rudp_missing.begin())
+            return false;
+        --it;
+        if (_id > it->second.last)
+            return false;
+        uint64_t first = it->first;
+        MissingRange range = it->second;
+        m_rudp_missing.erase(it);
+        if (first < _id)
+            m_rudp_missing[first] = { _id - 1, range.seen, range.nacked };
+        if (_id < range.last)
+            m_rudp_missing[_id + 1] = { range.last, range.seen, range.nacked };
+        return true;
+    }
+
+    void CAsioSocket::HoldPack(uint64_t _id, const uint8_t *_data, size_t _size){
+        if (m_rudp_held.count(_id))
+            return;
+        std::vector<uint8_t> buffer;
+        if (!m_rudp_spare.empty()){
+            buffer.swap(m_rudp_spare.back());
+            m_rudp_spare.pop_back();
+        }
+        buffer.assign(_data, _data + _size);
+        m_rudp_held[_id].swap(buffer);
+    }
+
+    // Hands out the held packs that are next in order. Ids before the first missing one
+    // that are neither held nor missing any more were given up.
+    void CAsioSocket::ReleaseHeld(){
+        while (true){
+            uint64_t next = m_last_pack_id + 1;
+            if (!m_rudp_missing.empty())
+                next = std::min(next, m_rudp_missing.begin()->first);
+            if (!m_rudp_held.empty())
+                next = std::min(next, m_rudp_held.begin()->first);
+            if (next > m_rudp_next_id)
+                m_rudp_next_id = next;
+            if (m_rudp_held.empty() || m_rudp_held.begin()->first != m_rudp_next_id)
+                break;
+            auto &buffer = m_rudp_held.begin()->second;
+            m_callbackErrorUInt8Int.emitEvent(Events::RECIVED_DATA_FROM_SERVER, asio::error_code(),
+                                              buffer.data(), (uint32_t) buffer.size());
+            m_rudp_spare.emplace_back();
+            m_rudp_spare.back().swap(buffer);
+            m_rudp_held.erase(m_rudp_held.begin());
+            m_rudp_next_id++;
+        }
+    }
+
+    void CAsioSocket::GiveUpOldestGap(){
+        if (m_rudp_missing.empty())
+            return;
+        auto oldest = m_rudp_missing.begin();
+        m_rudp_unrecoverable += oldest->second.last - oldest->first + 1;
+        m_rudp_missing.erase(oldest);
+        ReleaseHeld();
+    }
+
+    void CAsioSocket::SendNacks(bool _force){
+        uint64_t now = steadyNs();
+        if (!_force && now - m_rudp_last_check < RUDP_NACK_CHECK_MS * 1000000ull)
+            return;
+        m_rudp_last_check = now;
+
+        uint64_t window = (uint64_t)m_rudp_window * 1000000;
+        uint64_t retry = RUDP_NACK_RETRY_MS * 1000000ull;
+        uint16_t count = 0;
+        auto flush = [&](){
+            if (count == 0)
+                return;
+            memcpy(m_rudp_nack.data(), RUDP_NACK_ID, 4);
+            memcpy(m_rudp_nack.data() + 4, &count, sizeof(count));
+            memset(m_rudp_nack.data() + 6, 0, 2);
+            asio::error_code error;
+            m_udp_socket->send_to(asio::buffer(m_rudp_nack.data(), 8 + count * 12), m_udp_endpoint, 0, error);
+            m_rudp_nacks += count;
+            count = 0;
+        };
+
+        bool expired = false;
+        for (auto it = m_rudp_missing.begin(); it != m_rudp_missing.end();){
+            auto &range = it->second;
+            if (now - range.seen > window){
+                m_rudp_unrecoverable += range.last - it->first + 1;
+                it = m_rudp_missing.erase(it);
+                expired = true;
+                continue;
+            }
+            if (range.nacked == 0 || now - range.nacked >= retry){
+                uint64_t first = it->first;
+                uint32_t packs = (uint32_t)std::min<uint64_t>(range.last - first + 1, UINT32_MAX);
+                memcpy(m_rudp_nack.data() + 8 + count * 12, &first, sizeof(first));
+                memcpy(m_rudp_nack.data() + 16 + count * 12, &packs, sizeof(packs));
+                range.nacked = now;
+                if (++count == RUDP_NACK_MAX_RANGES)
+                    flush();
+            }
+            ++it;
+        }
+        flush();
+        m_rudp_new_gap = false;
+        // Packs held behind an expired gap go out now
+        if (expired)
+            ReleaseHeld();
     }
 
     void CAsioSocket::HandlerReceiveFromServer(const asio::error_code &ErrorCode, size_t bytes_transferred){
         if (!ErrorCode) {
         //    std::cout << "Byte received: " << bytes_transferred << "\n";
             if (m_protocol == Protocol::TCP) {
-
-                if (bytes_transferred + m_pos_last_in_fifo > FIFO_BUFFER_SIZE) {
-                    std::cerr  << "[rspa] TCP received buffer overflow\n";
-                    exit(5);
-                }
-
-                memcpy(m_tcp_fifo_buffer + m_pos_last_in_fifo,m_SocketReadBuffer,bytes_transferred);
+                // Data are received straight into the FIFO. All complete packs are handed out
+                // from a read position and the incomplete tail is moved to the front once.
                 m_pos_last_in_fifo += bytes_transferred;
-
-                char *id_str = ID_PACK;
-                uint8_t  size_id = sizeof(ID_PACK) - 1;
-                bool find_all_flag = false;
-//                cout << "Buff size " << m_pos_last_in_fifo << "\n";
-                do{
-
-                for (int i = 0; i < m_pos_last_in_fifo - size_id; ++i) {
-                    bool find_flag = false;
-                    for (int j = 0; j < size_id; ++j) {
-                        if (m_tcp_fifo_buffer[i + j] == id_str[j]) {
-                            find_flag = true;
-                        } else {
-                            find_flag = false;
-                            break;
-                        }
+                size_t pos = 0;
+                while (m_pos_last_in_fifo - pos >= ID_PACK_PREFIX_SIZE) {
+                    uint8_t *pack = m_tcp_fifo_buffer + pos;
+                    size_t   available = m_pos_last_in_fifo - pos;
+                    bool     valid = memcmp(pack, ID_PACK, ID_PACK_PREFIX_SIZE) == 0;
+                    if (valid && available >= 16 && CAsioNet::PackVersion(pack) == 0)
+                        valid = false; // Unknown version, keep looking
+                    size_t pack_size = valid ? CAsioNet::PackSize(pack, available) : 0;
+                    if (valid && available >= 16 && pack_size > 0 &&
+                        (pack_size < CAsioNet::PackHeaderSize(CAsioNet::PackVersion(pack)) || pack_size > FIFO_BUFFER_SIZE))
+                        valid = false; // Broken size field, it would never complete
+                    if (!valid) {
+                        auto next = static_cast<uint8_t*>(memchr(pack + 1, ID_PACK[0], available - 1));
+                        pos = next != nullptr ? next - m_tcp_fifo_buffer : m_pos_last_in_fifo;
+                        continue;
                     }
- //                   std::cout << i << " pos " <<  m_pos_last_in_fifo << "\n";
-
-                    if (find_flag) {
-                        uint32_t pack_size = ((uint32_t *) (m_tcp_fifo_buffer + i))[9];
-                        if ((pack_size + i) <= m_pos_last_in_fifo) {
-                            m_callbackErrorUInt8Int.emitEvent(Events::RECIVED_DATA_FROM_SERVER, ErrorCode,
-                                                              m_tcp_fifo_buffer + i,
-                                                              (uint32_t) pack_size);
-
-                            memcpy(m_tcp_fifo_buffer, m_tcp_fifo_buffer + i + pack_size,
-                                   m_pos_last_in_fifo - pack_size - i);
-                            m_pos_last_in_fifo = m_pos_last_in_fifo - pack_size - i;
-                            find_all_flag = true;
-                        }
-                        else{
-                            find_all_flag = false;
-//                            std::cout << "Header persent " << i << " size " << m_pos_last_in_fifo <<" \n";
-                        }
+                    if (pack_size == 0 || pack_size > available)
                         break;
-                    } else{
-                        find_all_flag = false;
+                    m_callbackErrorUInt8Int.emitEvent(Events::RECIVED_DATA_FROM_SERVER, ErrorCode, pack, (uint32_t) pack_size);
+                    // The pack is consumed, let the server send the next ones
+                    if (m_credit_window > 0 && ++m_credit_consumed >= (m_credit_window + 1) / 2){
+                        GrantCredits(m_credit_consumed);
+                        m_credit_consumed = 0;
                     }
+                    pos += pack_size;
+                }
+                if (pos > 0) {
+                    memmove(m_tcp_fifo_buffer, m_tcp_fifo_buffer + pos, m_pos_last_in_fifo - pos);
+                    m_pos_last_in_fifo -= pos;
+                }
+                if (m_pos_last_in_fifo == FIFO_BUFFER_SIZE) {
+                    std::cerr  << "[rspa] TCP received buffer overflow\n";
+                    exit(5);
                 }
-                if (m_pos_last_in_fifo <= size_id)
-                    break;
-                } while (find_all_flag);
             }
 
             if (m_protocol == Protocol::UDP) {
-                if (strncmp((const char*)m_SocketReadBuffer,ID_PACK,16) == 0) {
-                    uint64_t id_pack = ((uint64_t *) (m_SocketReadBuffer))[2];
-                    if (id_pack > m_last_pack_id)
+                if (bytes_transferred >= 24 && CAsioNet::PackVersion(m_SocketReadBuffer) != 0) {
+                    uint64_t id_pack = get64(m_SocketReadBuffer, 16);
+                    if (m_rudp_window == 0)
                     {
-                        m_callbackErrorUInt8Int.emitEvent(Events::RECIVED_DATA_FROM_SERVER, ErrorCode,
-                                                          m_SocketReadBuffer,
-                                                          (uint32_t) bytes_transferred);
-                        m_last_pack_id = id_pack;
+                        if (!m_udp_has_pack || id_pack > m_last_pack_id)
+                        {
+                            m_callbackErrorUInt8Int.emitEvent(Events::RECIVED_DATA_FROM_SERVER, ErrorCode,
+                                                              m_SocketReadBuffer,
+                                                              (uint32_t) bytes_transferred);
+                            m_last_pack_id = id_pack;
+                            m_udp_has_pack = true;
+                        }
+                    }
+                    else if (!m_udp_has_pack || id_pack >= m_rudp_next_id)
+                    {
+                        // Packs are handed out in id order. A pack after a gap is held until the
+                        // gap is retransmitted or given up, then the held packs follow.
+                        bool take = true;
+                        if (!m_udp_has_pack) {
+                            m_last_pack_id = id_pack;
+                            m_rudp_next_id = id_pack;
+                            m_udp_has_pack = true;
+                        } else if (id_pack > m_last_pack_id) {
+                            if (id_pack > m_last_pack_id + 1)
+                                TrackMissing(m_last_pack_id + 1, id_pack - 1);
+                            m_last_pack_id = id_pack;
+                        } else if (TakeMissing(id_pack)) {
+                            m_rudp_retransmitted++;
+                        } else {
+                            take = false; // Held already or given up
+                        }
+                        if (take && id_pack == m_rudp_next_id) {
+                            m_callbackErrorUInt8Int.emitEvent(Events::RECIVED_DATA_FROM_SERVER, ErrorCode,
+                                                              m_SocketReadBuffer,
+                                                              (uint32_t) bytes_transferred);
+                            m_rudp_next_id++;
+                            ReleaseHeld();
+                        } else if (take) {
+                            HoldPack(id_pack, m_SocketReadBuffer, bytes_transferred);
+                            // Too many packs wait, the oldest gaps are given up
+                            while (m_rudp_held.size() > RUDP_MAX_HELD && !m_rudp_missing.empty())
+                                GiveUpOldestGap();
+                        }
                     }
                 }
+                if (m_rudp_window > 0)
+                    SendNacks(m_rudp_new_gap);
             }
 
 
@@ -420,9 +1178,7 @@ namespace  asionet {
                                   std::placeholders::_1, std::placeholders::_2));
             }
             if (m_protocol == Protocol::TCP) {
-                m_tcp_socket->async_receive(asio::buffer(m_SocketReadBuffer, SOCKET_BUFFER_SIZE),
-                                            std::bind(&CAsioSocket::HandlerReceiveFromServer, this,
-                                                      std::placeholders::_1, std::placeholders::_2));
+                ReceiveTcp();
             }
         }else{
             m_callback_Error.emitEvent(Events::ERROR_CLIENT,ErrorCode);
@@ -430,24 +1186,185 @@ namespace  asionet {
         }
     }
 
+    void CAsioSocket::ReceiveTcp(){
+        m_tcp_socket->async_receive(asio::buffer(m_tcp_fifo_buffer + m_pos_last_in_fifo, FIFO_BUFFER_SIZE - m_pos_last_in_fifo),
+                                    std::bind(&CAsioSocket::HandlerReceiveFromServer, this,
+                                              std::placeholders::_1, std::placeholders::_2));
+    }
+
     bool CAsioSocket::IsConnected(){
         return m_is_tcp_connected || m_is_udp_connected;
     }
 
-    void CAsioSocket::HandlerAcceptFromClient(const asio::error_code &_error)
+    void CAsioSocket::SetDropPolicy(DropPolicy _policy, size_t _max_queue){
+        m_drop_policy = _policy;
+        if (m_client_queue != _max_queue){
+            m_client_queue = _max_queue;
+            m_fanout_pool = nullptr; // Sized again by the next InitServer
+        }
+    }
+
+    size_t CAsioSocket::GetQueuedPacks(){
+        auto pool = m_fanout_pool;
+        return pool ? pool->count() - pool->available() : 0;
+    }
+
+    size_t CAsioSocket::GetQueueCapacity(){
+        auto pool = m_fanout_pool;
+        return pool ? pool->count() : 0;
+    }
+
+    void CAsioSocket::StartAccept(){
+        auto session = CTcpSession::Create(m_io_service, m_drop_policy, m_client_queue,
+                                           std::bind(&CAsioSocket::HandlerCloseSession, this, std::placeholders::_1));
+        m_tcp_acceptor->async_accept(session->Socket(), m_tcp_endpoint,
+                                     std::bind(&CAsioSocket::HandlerAcceptSession, this, session, std::placeholders::_1));
+    }
+
+    void CAsioSocket::HandlerAcceptSession(CTcpSession::Ptr _session, const asio::error_code &_error)
     {
+        if (_error == asio::error::operation_aborted)
+            return; // Server is closed
+
         if (!_error)
         {
-
-            m_callback_Str.emitEvent(Events::CONNECT_SERVER,m_tcp_endpoint.address().to_string());
-            m_is_tcp_connected = true;
+            bool accepted = false;
+            {
+                std::lock_guard<std::mutex> lock(m_sessions_mutex);
+                if (m_sessions.size() < TCP_MAX_CLIENTS){
+                    _session->Start();
+                    m_sessions.push_back(_session);
+                    m_is_tcp_connected = true;
+                    accepted = true;
+                }
+            }
+            if (accepted){
+                m_callback_Str.emitEvent(Events::CONNECT_SERVER, _session->Host());
+            }else{
+                std::cerr << "[rpsa] Too many clients, connection refused\n";
+                asio::error_code error;
+                _session->Socket().close(error);
+            }
         }
-        else if (_error.value() != 1) // Already open connection
+        else
         {
             m_callback_Error.emitEvent(Events::ERROR_SERVER,_error);
-            m_tcp_acceptor->async_accept(*m_tcp_socket, m_tcp_endpoint, std::bind(&CAsioSocket::HandlerAcceptFromClient, this, std::placeholders::_1));
-            m_is_tcp_connected = false;
         }
+
+        if (m_tcp_acceptor && m_tcp_acceptor->is_open())
+            StartAccept();
+    }
+
+    void CAsioSocket::HandlerCloseSession(CTcpSession::Ptr _session){
+        bool found = false;
+        {
+            std::lock_guard<std::mutex> lock(m_sessions_mutex);
+            for (auto it = m_sessions.begin(); it != m_sessions.end(); ++it){
+                if (*it == _session){
+                    m_sessions.erase(it);
+                    found = true;
+                    break;
+                }
+            }
+            if (found)
+                m_is_tcp_connected = !m_sessions.empty();
+        }
+        if (_session->Dropped() > 0){
+            std::cerr << "[rpsa] Client " << _session->Host() << " dropped " << _session->Dropped() << " packs in "
+                      << _session->DroppedBlocks() << " blocks\n";
+            for (const auto &range : _session->DroppedRanges()){
+                std::cerr << "[rpsa]   packs " << range.firstPack << " - " << range.firstPack + range.packs - 1;
+                if (range.samples > 0)
+                    std::cerr << ", samples " << range.firstSample << " - " << range.firstSample + range.samples - 1;
+                std::cerr << "\n";
+            }
+        }
+        m_callback_Str.emitEvent(Events::DISCONNECT_SERVER, _session->Host());
+    }
+
+    void CAsioSocket::FanOut(const SharedBlock &_block){
+        std::vector<CTcpSession::Ptr> slow;
+        {
+            std::lock_guard<std::mutex> lock(m_sessions_mutex);
+            for (auto &session : m_sessions){
+                uint64_t dropped = session->Dropped();
+                if (!session->Push(_block))
+                    slow.push_back(session);
+                m_clients_dropped += session->Dropped() - dropped;
+            }
+        }
+        for (auto &session : slow){
+            std::cerr << "[rpsa] Client " << session->Host() << " is too slow, disconnect\n";
+            session->Close();
+        }
+    }
+
+    void CAsioSocket::FanOutDrop(uint64_t _block, const DroppedRange &_range){
+        std::lock_guard<std::mutex> lock(m_sessions_mutex);
+        for (auto &session : m_sessions)
+            session->RecordDrop(_block, _range);
+    }
+
+    bool CAsioSocket::SendPacksFanOut(const pack_buffers *_packs, size_t _count){
+        // Take pool blocks for the whole block of packs first, the ADC path never waits:
+        // when any of them is missing the block is dropped for every client
+        m_fanout_blocks.clear();
+        for (size_t i = 0; i < _count; ++i){
+            uint8_t *block = asio::buffer_size(_packs[i]) <= m_fanout_pool->blockSize() ? m_fanout_pool->borrow() : nullptr;
+            if (block == nullptr)
+                break;
+            m_fanout_blocks.push_back(block);
+        }
+        if (m_fanout_blocks.size() < _count){
+            for (auto block : m_fanout_blocks)
+                m_fanout_pool->releaseShared(block);
+            m_fanout_dropped += _count;
+            // Every subscriber misses the block, it goes into their drop history
+            DroppedRange range = { 0, 0, 0, 0 };
+            bool hasSamples = true;
+            for (size_t i = 0; i < _count; ++i){
+                auto header = _packs[i][0];
+                auto pack = packRange(asio::buffer_cast<const uint8_t*>(header), asio::buffer_size(header));
+                if (i == 0){
+                    range.firstPack = pack.firstPack;
+                    range.firstSample = pack.firstSample;
+                }
+                range.packs++;
+                range.samples += pack.samples;
+                hasSamples = hasSamples && pack.samples > 0;
+            }
+            if (!hasSamples)
+                range.samples = 0;
+            uint64_t id = m_fanout_block++;
+            m_io_service.post([this, id, range](){ FanOutDrop(id, range); });
+            // Completed like a failed send, the caller counts the block as dropped
+            for (size_t i = 0; i < _count; ++i){
+                m_callback_ErrorInt.emitEvent(Events::SEND_DATA, asio::error::no_buffer_space, 0);
+            }
+            return false;
+        }
+
+        auto shared = std::make_shared<SharedBlock>();
+        shared->reserve(_count);
+        uint64_t id = m_fanout_block++;
+        for (size_t i = 0; i < _count; ++i){
+            size_t size = asio::buffer_size(_packs[i]);
+            asio::buffer_copy(asio::buffer(m_fanout_blocks[i], size), _packs[i]);
+            shared->push_back(std::make_shared<CSharedPack>(m_fanout_pool, m_fanout_blocks[i], size, id));
+        }
+        m_io_service.post([this, shared](){ FanOut(*shared); });
+        for (size_t i = 0; i < _count; ++i){
+            m_callback_ErrorInt.emitEvent(Events::SEND_DATA, asio::error_code(), asio::buffer_size(_packs[i]));
+        }
+        return true;
+    }
+
+    void CAsioSocket::GrantCredits(uint32_t _packs){
+        uint8_t msg[TCP_CREDIT_SIZE];
+        memcpy(msg, TCP_CREDIT_ID, 4);
+        memcpy(msg + 4, &_packs, sizeof(_packs));
+        asio::error_code error;
+        asio::write(*m_tcp_socket, asio::buffer(msg, TCP_CREDIT_SIZE), error);
     }
 
     void CAsioSocket::HandlerConnectToServer(const asio::error_code &_error, asio::ip::tcp::resolver::iterator endpoint_iterator)
@@ -457,9 +1374,10 @@ namespace  asionet {
 			{
 				m_callback_Str.emitEvent(Events::CONNECT_CLIENT, m_tcp_endpoint.address().to_string());
 				m_is_tcp_connected = true;
-				m_tcp_socket->async_receive(asio::buffer(m_SocketReadBuffer, SOCKET_BUFFER_SIZE),
-					std::bind(&CAsioSocket::HandlerReceiveFromServer, this,
-						std::placeholders::_1, std::placeholders::_2));
+				m_credit_consumed = 0;
+				if (m_credit_window > 0)
+					GrantCredits(m_credit_window);
+				ReceiveTcp();
 			}
 			else if (endpoint_iterator != asio::ip::tcp::resolver::iterator()) {
 				m_tcp_socket->close();
@@ -485,11 +1403,22 @@ namespace  asionet {
         m_is_udp_connected = false;
         m_is_tcp_connected = false;
         m_pos_last_in_fifo = 0;
+        m_last_pack_id = 0;
+        m_udp_has_pack = false;
+        m_rudp_missing.clear();
+        m_rudp_next_id = 0;
+        m_rudp_held.clear();
+        m_rudp_nacks = 0;
+        m_rudp_retransmitted = 0;
+        m_rudp_unrecoverable = 0;
         if (m_protocol == asionet::Protocol::UDP) {
             asio::ip::udp::udp::resolver resolver(m_io_service);
             asio::ip::udp::udp::resolver::query query(asio::ip::udp::udp::v4(), m_host, m_port);
             asio::ip::udp::udp::resolver::iterator iter = resolver.resolve(query);
             m_udp_socket = std::make_shared<asio::ip::udp::udp::socket>(m_io_service, asio::ip::udp::udp::endpoint(asio::ip::udp::udp::v4(), 0));
+            // A whole buffer arrives as one burst of datagrams, the default queue holds only part of it
+            asio::error_code ignored;
+            m_udp_socket->set_option(asio::socket_base::receive_buffer_size(UDP_CLIENT_RCVBUF), ignored);
             m_udp_endpoint = *iter;
             m_udp_socket->send_to(asio::buffer("\x01",1),m_udp_endpoint);
             m_callback_Str.emitEvent(Events::CONNECT_CLIENT,m_udp_endpoint.address().to_string());
@@ -535,7 +1464,7 @@ namespace  asionet {
 					m_udp_socket->send_to(asio::buffer(_buffer, _size), m_udp_endpoint);
 			}
 			if (m_protocol == Protocol::TCP) {
-				if (m_tcp_socket->is_open())
+				if (m_tcp_socket && m_tcp_socket->is_open())
 					m_tcp_socket->send(asio::buffer(_buffer, _size));
 			}
 		}
@@ -562,6 +1491,16 @@ namespace  asionet {
                 return  true;
             }
         }
+        if (m_protocol == Protocol::TCP && m_mode == Mode::SERVER){
+            if (m_is_tcp_connected) {
+                pack_buffers buffers = {{ asio::buffer(_buffer, _size), asio::const_buffer(), asio::const_buffer() }};
+                bool sent = SendPacksFanOut(&buffers, 1);
+                if (async)
+                    delete [] _buffer;
+                return  sent;
+            }
+            return false;
+        }
         if (m_protocol == Protocol::TCP){
             if (m_is_tcp_connected  && m_tcp_socket->is_open()) {
                 if (!async) {
@@ -579,9 +1518,176 @@ namespace  asionet {
         return false;
     }
 
+    bool CAsioSocket::SendBuffers(const pack_buffers &_buffers){
+
+        asio::error_code _error;
+        size_t size = asio::buffer_size(_buffers);
+
+        if (m_protocol == Protocol::UDP){
+            if (m_is_udp_connected && m_udp_socket->is_open()) {
+                if (m_rudp_ring)
+                    m_rudp_ring->Store(_buffers);
+                // One datagram, sendmsg() with three iovecs
+                m_udp_socket->send_to(_buffers, m_udp_endpoint, 0, _error);
+                this->HandlerSend(_error,size);
+                return  true;
+            }
+        }
+        if (m_protocol == Protocol::TCP && m_mode == Mode::SERVER){
+            return m_is_tcp_connected && SendPacksFanOut(&_buffers, 1);
+        }
+        if (m_protocol == Protocol::TCP){
+            if (m_is_tcp_connected  && m_tcp_socket->is_open()) {
+                // writev() until everything is in the socket buffer
+                size = asio::write(*m_tcp_socket, _buffers, _error);
+                this->HandlerSend(_error,size);
+                return  true;
+            }
+        }
+
+        return false;
+    }
+
+    bool CAsioSocket::SendPacks(const pack_buffers *_packs, size_t _count){
+
+        asio::error_code _error;
+
+        if (m_protocol == Protocol::UDP){
+            if (m_is_udp_connected && m_udp_socket->is_open()) {
+                // Keep a copy before sending, a NACK may come back before SendPacksUdp returns
+                if (m_rudp_ring){
+                    for (size_t i = 0; i < _count; ++i)
+                        m_rudp_ring->Store(_packs[i]);
+                }
+                size_t sent = SendPacksUdp(_packs, _count, _error);
+                for (size_t i = 0; i < sent; ++i){
+                    this->HandlerSend(asio::error_code(), asio::buffer_size(_packs[i]));
+                }
+                if (_error)
+                    this->HandlerSend(_error, 0);
+                return sent > 0;
+            }
+        }
+        if (m_protocol == Protocol::TCP && m_mode == Mode::SERVER){
+            return m_is_tcp_connected && SendPacksFanOut(_packs, _count);
+        }
+        if (m_protocol == Protocol::TCP){
+            if (m_is_tcp_connected  && m_tcp_socket->is_open()) {
+                m_tcp_gather.clear();
+                for (size_t i = 0; i < _count; ++i){
+                    m_tcp_gather.insert(m_tcp_gather.end(), _packs[i].begin(), _packs[i].end());
+                }
+                size_t size = asio::write(*m_tcp_socket, m_tcp_gather, _error);
+                if (!_error){
+                    for (size_t i = 0; i < _count; ++i){
+                        this->HandlerSend(_error, asio::buffer_size(_packs[i]));
+                    }
+                }else{
+                    this->HandlerSend(_error, size);
+                }
+                return  true;
+            }
+        }
+
+        return false;
+    }
+
+#ifdef __linux__
+    size_t CAsioSocket::SendPacksUdp(const pack_buffers *_packs, size_t _count, asio::error_code &_error){
+        const size_t control_size = CMSG_SPACE(sizeof(uint16_t));
+        auto &batch = *m_udp_batch;
+        batch.msgs.resize(_count);
+        batch.iovs.resize(_count * 3);
+        batch.control.resize(_count * control_size);
+        batch.packs.resize(_count);
+
+        // One message per datagram, or per run of equal datagrams when GSO is on
+        size_t nmsg = 0;
+        for (size_t i = 0; i < _count;){
+            size_t size = asio::buffer_size(_packs[i]);
+            size_t n = 1;
+            if (m_udp_gso){
+                while (i + n < _count && n < UDP_GSO_SEGMENTS && (n + 1) * size <= UDP_GSO_MAX_SIZE && asio::buffer_size(_packs[i + n]) == size)
+                    n++;
+            }
+
+            struct mmsghdr &msg = batch.msgs[nmsg];
+            memset(&msg, 0, sizeof(msg));
+            struct iovec *iov = &batch.iovs[i * 3];
+            size_t iovcnt = 0;
+            for (size_t k = i; k < i + n; ++k){
+                for (const auto &buffer : _packs[k]){
+                    if (buffer.size() == 0)
+                        continue;
+                    iov[iovcnt].iov_base = const_cast<void*>(buffer.data());
+                    iov[iovcnt].iov_len = buffer.size();
+                    iovcnt++;
+                }
+            }
+            msg.msg_hdr.msg_name = m_udp_endpoint.data();
+            msg.msg_hdr.msg_namelen = m_udp_endpoint.size();
+            msg.msg_hdr.msg_iov = iov;
+            msg.msg_hdr.msg_iovlen = iovcnt;
+#ifdef UDP_SEGMENT
+            if (n > 1){
+                struct cmsghdr *cmsg = (struct cmsghdr *)&batch.control[nmsg * control_size];
+                msg.msg_hdr.msg_control = cmsg;
+                msg.msg_hdr.msg_controllen = control_size;
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t segment = size;
+                memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+            }
+#endif
+            batch.packs[nmsg++] = n;
+            i += n;
+        }
+
+        int fd = m_udp_socket->native_handle();
+        size_t done_msgs = 0;
+        size_t done_packs = 0;
+        while (done_msgs < nmsg){
+            int res = sendmmsg(fd, &batch.msgs[done_msgs], nmsg - done_msgs, 0);
+            if (res < 0){
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK){
+                    // The socket is non-blocking while an async receive is pending
+                    struct pollfd pfd = {fd, POLLOUT, 0};
+                    poll(&pfd, 1, -1);
+                    continue;
+                }
+                if (errno == EIO && m_udp_gso){
+                    // The device can not segment, send single datagrams from now on
+                    m_udp_gso = false;
+                    return done_packs + SendPacksUdp(_packs + done_packs, _count - done_packs, _error);
+                }
+                _error = asio::error_code(errno, asio::error::get_system_category());
+                break;
+            }
+            for (int i = 0; i < res; ++i){
+                done_packs += batch.packs[done_msgs + i];
+            }
+            done_msgs += res;
+        }
+        return done_packs;
+    }
+#else
+    size_t CAsioSocket::SendPacksUdp(const pack_buffers *_packs, size_t _count, asio::error_code &_error){
+        size_t i = 0;
+        for (; i < _count; ++i){
+            m_udp_socket->send_to(_packs[i], m_udp_endpoint, 0, _error);
+            if (_error)
+                break;
+        }
+        return i;
+    }
+#endif
+
     void CAsioSocket::HandlerSend2(const asio::error_code &_error, size_t _bytesTransferred, uint8_t *buffer){
         HandlerSend(_error,_bytesTransferred);
-        delete buffer;
+        delete [] buffer;
     }
     void CAsioSocket::HandlerSend(const asio::error_code &_error, size_t _bytesTransferred){
 
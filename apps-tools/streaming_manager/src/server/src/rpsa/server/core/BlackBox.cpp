@@ -0,0 +1,99 @@
+#include <cstring>
+#include "rpsa/server/core/BlackBox.h"
+
+CBlackBox::Ptr CBlackBox::Create(size_t _bytes){
+    return std::make_shared<CBlackBox>(_bytes);
+}
+
+CBlackBox::CBlackBox(size_t _bytes) :
+    m_buffer(_bytes & ~static_cast<size_t>(7), 0), // Touch all pages now, not in the acquisition loop
+    m_head(0),
+    m_tail(0),
+    m_wrap(0),
+    m_wrapped(false),
+    m_count(0)
+{
+}
+
+void CBlackBox::clear(){
+    m_head = 0;
+    m_tail = 0;
+    m_wrap = 0;
+    m_wrapped = false;
+    m_count = 0;
+}
+
+size_t CBlackBox::used() const{
+    if (m_count == 0)
+        return 0;
+    return m_wrapped ? (m_wrap - m_tail) + m_head : m_head - m_tail;
+}
+
+void CBlackBox::evict(){
+    auto header = reinterpret_cast<const RecordHeader*>(m_buffer.data() + m_tail);
+    m_tail += header->size;
+    if (--m_count == 0) {
+        clear();
+        return;
+    }
+    if (m_wrapped && m_tail == m_wrap) {
+        m_tail = 0;
+        m_wrapped = false;
+    }
+}
+
+bool CBlackBox::push(const asionet::PackInfo &_info, const void *_buffer_ch1, size_t _size_ch1, const void *_buffer_ch2, size_t _size_ch2){
+    size_t need = (sizeof(RecordHeader) + _size_ch1 + _size_ch2 + 7) & ~static_cast<size_t>(7);
+    if (need > m_buffer.size())
+        return false;
+
+    while (true) {
+        if (!m_wrapped) {
+            if (m_head + need <= m_buffer.size())
+                break;
+            if (m_count == 0) {
+                clear();
+                continue;
+            }
+            m_wrap = m_head;
+            m_head = 0;
+            m_wrapped = true;
+        }
+        if (m_head + need <= m_tail)
+            break;
+        evict();
+    }
+
+    uint8_t *record = m_buffer.data() + m_head;
+    auto header = reinterpret_cast<RecordHeader*>(record);
+    header->size = static_cast<uint32_t>(need);
+    header->size_ch1 = static_cast<uint32_t>(_size_ch1);
+    header->size_ch2 = static_cast<uint32_t>(_size_ch2);
+    header->reserved = 0;
+    header->info = _info;
+    if (_size_ch1 > 0)
+        memcpy(record + sizeof(RecordHeader), _buffer_ch1, _size_ch1);
+    if (_size_ch2 > 0)
+        memcpy(record + sizeof(RecordHeader) + _size_ch1, _buffer_ch2, _size_ch2);
+    m_head += need;
+    m_count++;
+    return true;
+}
+
+void CBlackBox::forEach(const Callback &_func) const{
+    if (m_count == 0)
+        return;
+    size_t pos = m_tail;
+    size_t end = m_wrapped ? m_wrap : m_head;
+    for (int part = 0; part < (m_wrapped ? 2 : 1); ++part) {
+        while (pos < end) {
+            const uint8_t *record = m_buffer.data() + pos;
+            auto header = reinterpret_cast<const RecordHeader*>(record);
+            const uint8_t *ch1 = record + sizeof(RecordHeader);
+            _func(header->info, ch1, header->size_ch1, ch1 + header->size_ch1, header->size_ch2);
+            pos += header->size;
+        }
+        pos = 0;
+        end = m_head;
+    }
+}
@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include "rpsa/server/core/Decimator.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#define CIC_MAX_FACTOR 2048 // DECIMATOR_CIC_ORDER * log2(factor) + 16 bits must fit in 64
+
+namespace {
+    uint32_t gcd(uint32_t _a, uint32_t _b){
+        while (_b != 0) {
+            uint32_t t = _a % _b;
+            _a = _b;
+            _b = t;
+        }
+        return _a;
+    }
+
+    // Modified Bessel function of the first kind, order 0
+    double besselI0(double _x){
+        double sum = 1.0;
+        double term = 1.0;
+        for (int k = 1; k < 50; ++k) {
+            term *= (_x / (2.0 * k)) * (_x / (2.0 * k));
+            sum += term;
+            if (term < sum * 1e-12)
+                break;
+        }
+        return sum;
+    }
+
+    // _n is a multiple of 8
+    inline int32_t dot(const int16_t *_a, const int16_t *_b, size_t _n){
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+        int32x4_t acc0 = vdupq_n_s32(0);
+        int32x4_t acc1 = vdupq_n_s32(0);
+        for (size_t i = 0; i < _n; i += 8) {
+            int16x8_t a = vld1q_s16(_a + i);
+            int16x8_t b = vld1q_s16(_b + i);
+            acc0 = vmlal_s16(acc0, vget_low_s16(a), vget_low_s16(b));
+            acc1 = vmlal_s16(acc1, vget_high_s16(a), vget_high_s16(b));
+        }
+        int32x4_t acc = vaddq_s32(acc0, acc1);
+        int32x2_t sum = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+        return vget_lane_s32(vpadd_s32(sum, sum), 0);
+#else
+        int32_t acc = 0;
+        for (size_t i = 0; i < _n; ++i)
+            acc += static_cast<int32_t>(_a[i]) * _b[i];
+        return acc;
+#endif
+    }
+
+    inline int16_t saturate16(int64_t _value){
+        return static_cast<int16_t>(std::max<int64_t>(INT16_MIN, std::min<int64_t>(INT16_MAX, _value)));
+    }
+
+    // Reduces the ratio, false with a message if it is not supported
+    bool reduceRatio(uint32_t &_up, uint32_t &_down){
+        if (_up == 0 || _down == 0) {
+            std::cerr << "Error: CDecimator zero rate factor\n";
+            return false;
+        }
+        uint32_t g = gcd(_up, _down);
+        _up /= g;
+        _down /= g;
+        if (_up > _down || _up > DECIMATOR_MAX_UP) {
+            std::cerr << "Error: CDecimator unsupported ratio " << _up << "/" << _down << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Taps of DesignLowpass()
+    size_t designLength(uint32_t _up, uint32_t _down, double _attenuation){
+        double transition = 0.2 / std::max(_up, _down);
+        size_t length = static_cast<size_t>(ceil((_attenuation - 7.95) / (14.36 * transition))) + 1;
+        return (length + _up - 1) / _up * _up;
+    }
+
+    // CIC in front of a designed filter, 1 - none
+    uint32_t designCicFactor(uint32_t _up, uint32_t _down){
+        if (_up == 1 && _down >= DECIMATOR_CIC_MIN_FACTOR) {
+            // Smallest FIR factor from 4 that divides the rate and leaves the CIC in range
+            for (uint32_t k = 4; k <= _down / 2; ++k) {
+                if (_down % k == 0 && _down / k <= CIC_MAX_FACTOR)
+                    return _down / k;
+            }
+        }
+        return 1;
+    }
+}
+
+std::vector<float> CDecimator::DesignLowpass(uint32_t _up, uint32_t _down, double _attenuation, uint32_t _cicFactor){
+    // Normalized to the rate _up times the input rate: the output Nyquist frequency is 0.5 / _down.
+    // Pass band to 0.4 and stop band from 0.6 of the output rate, what folds back lands above 0.4.
+    uint32_t ratio = std::max(_up, _down);
+    double cutoff = 0.5 / ratio;
+    double beta = _attenuation > 50 ? 0.1102 * (_attenuation - 8.7)
+                                    : (_attenuation > 21 ? 0.5842 * pow(_attenuation - 21, 0.4) + 0.07886 * (_attenuation - 21) : 0);
+    size_t length = designLength(_up, _down, _attenuation);
+
+    std::vector<float> taps(length);
+    double center = (length - 1) / 2.0;
+    double sum = 0;
+    for (size_t i = 0; i < length; ++i) {
+        double t = i - center;
+        double ideal = 0;
+        if (_cicFactor > 1) {
+            // Pass band shaped by the inverse CIC response, integrated numerically
+            const int steps = 512;
+            for (int k = 0; k < steps; ++k) {
+                double f = cutoff * (k + 0.5) / steps;
+                double cic = sin(M_PI * f) / (_cicFactor * sin(M_PI * f / _cicFactor));
+                ideal += cos(2 * M_PI * f * t) / pow(cic, DECIMATOR_CIC_ORDER);
+            }
+            ideal *= 2 * cutoff / steps;
+        } else {
+            ideal = (t == 0) ? 2 * cutoff : sin(2 * M_PI * cutoff * t) / (M_PI * t);
+        }
+        double r = (length > 1) ? 2.0 * i / (length - 1) - 1.0 : 0;
+        double window = besselI0(beta * sqrt(std::max(0.0, 1.0 - r * r))) / besselI0(beta);
+        taps[i] = static_cast<float>(ideal * window);
+        sum += taps[i];
+    }
+    for (auto &tap : taps)
+        tap = static_cast<float>(tap * _up / sum);
+    return taps;
+}
+
+bool CDecimator::Supported(uint32_t _up, uint32_t _down){
+    if (!reduceRatio(_up, _down))
+        return false;
+    uint32_t cicFactor = designCicFactor(_up, _down);
+    size_t length = designLength(_up, _down / cicFactor, DECIMATOR_ATTENUATION);
+    if (length > DECIMATOR_MAX_TAPS) {
+        std::cerr << "Error: CDecimator " << _up << "/" << _down << " needs " << length << " taps, more than "
+                  << DECIMATOR_MAX_TAPS << ". Use a ratio whose factors after the CIC are " << DECIMATOR_MAX_FIR_FACTOR << " or less\n";
+        return false;
+    }
+    return true;
+}
+
+CDecimator::Ptr CDecimator::Create(uint32_t _up, uint32_t _down, const std::vector<float> &_taps){
+    if (!reduceRatio(_up, _down))
+        return CDecimator::Ptr();
+
+    uint32_t cicFactor = 1;
+    std::vector<float> taps = _taps;
+    if (taps.empty()) {
+        if (!Supported(_up, _down))
+            return CDecimator::Ptr();
+        cicFactor = designCicFactor(_up, _down);
+        taps = DesignLowpass(_up, _down / cicFactor, DECIMATOR_ATTENUATION, cicFactor);
+    } else {
+        double sum = 0;
+        for (auto tap : taps)
+            sum += tap;
+        if (fabs(sum) < 1e-9) {
+            std::cerr << "Error: CDecimator::Create() taps have no DC gain\n";
+            return CDecimator::Ptr();
+        }
+        for (auto &tap : taps)
+            tap = static_cast<float>(tap * _up / sum);
+    }
+    if (taps.size() > DECIMATOR_MAX_TAPS) {
+        std::cerr << "Error: CDecimator::Create() " << taps.size() << " taps, more than " << DECIMATOR_MAX_TAPS << "\n";
+        return CDecimator::Ptr();
+    }
+
+    // Largest coefficient scale that keeps every phase sum below 2^15 in 32 bit accumulators
+    double worst = 0;
+    for (uint32_t p = 0; p < _up; ++p) {
+        double sum = 0;
+        for (size_t i = p; i < taps.size(); i += _up)
+            sum += fabs(taps[i]);
+        worst = std::max(worst, sum);
+    }
+    int shift = static_cast<int>(floor(log2(32767.0 / worst)));
+    if (shift < 0) {
+        std::cerr << "Error: CDecimator::Create() taps out of range\n";
+        return CDecimator::Ptr();
+    }
+    shift = std::min(shift, 15);
+    return std::make_shared<CDecimator>(_up, _down, cicFactor, taps, shift);
+}
+
+CDecimator::CDecimator(uint32_t _up, uint32_t _down, uint32_t _cicFactor, const std::vector<float> &_taps, int _shift) :
+    m_up(_up),
+    m_down(_down),
+    m_firDown(_down / _cicFactor),
+    m_cicFactor(_cicFactor),
+    m_tapsPerPhase(0),
+    m_shift(_shift),
+    m_firLength(_taps.size()),
+    m_position(0),
+    m_cicCount(0),
+    m_cicGain(1.0 / pow(static_cast<double>(_cicFactor), DECIMATOR_CIC_ORDER))
+{
+    size_t perPhase = (_taps.size() + _up - 1) / _up;
+    m_tapsPerPhase = static_cast<uint32_t>((perPhase + 7) & ~static_cast<size_t>(7));
+    m_coeffs.assign(static_cast<size_t>(m_tapsPerPhase) * _up, 0);
+    // Phase p uses taps p, p + up, ... against the newest input first, the
+    // reversed order makes it a plain dot product over the work buffer
+    for (uint32_t p = 0; p < _up; ++p) {
+        int16_t *phase = m_coeffs.data() + static_cast<size_t>(p) * m_tapsPerPhase;
+        for (uint32_t k = 0; k < m_tapsPerPhase; ++k) {
+            size_t tap = p + static_cast<size_t>(k) * _up;
+            if (tap < _taps.size())
+                phase[m_tapsPerPhase - 1 - k] = saturate16(llround(_taps[tap] * (1 << m_shift)));
+        }
+    }
+    reset();
+}
+
+void CDecimator::reset(){
+    m_work.assign(m_tapsPerPhase - 1, 0);
+    m_position = 0;
+    m_cicCount = 0;
+    memset(m_cicInt, 0, sizeof(m_cicInt));
+    memset(m_cicComb, 0, sizeof(m_cicComb));
+}
+
+size_t CDecimator::maxOutput(size_t _count) const{
+    size_t firInput = _count / m_cicFactor + 1;
+    return (firInput * m_up) / m_firDown + 1;
+}
+
+double CDecimator::delay() const{
+    double cic = m_cicFactor > 1 ? DECIMATOR_CIC_ORDER * (m_cicFactor - 1) / 2.0 : 0;
+    return cic + m_cicFactor * (m_firLength - 1) / (2.0 * m_up);
+}
+
+size_t CDecimator::cic(const int16_t *_in, size_t _count, int16_t *_out){
+    size_t n = 0;
+    for (size_t i = 0; i < _count; ++i) {
+        uint64_t v = static_cast<uint64_t>(static_cast<int64_t>(_in[i]));
+        for (int k = 0; k < DECIMATOR_CIC_ORDER; ++k) {
+            m_cicInt[k] += v;
+            v = m_cicInt[k];
+        }
+        if (++m_cicCount == m_cicFactor) {
+            m_cicCount = 0;
+            for (int k = 0; k < DECIMATOR_CIC_ORDER; ++k) {
+                uint64_t prev = m_cicComb[k];
+                m_cicComb[k] = v;
+                v -= prev;
+            }
+            _out[n++] = saturate16(llround(static_cast<int64_t>(v) * m_cicGain));
+        }
+    }
+    return n;
+}
+
+size_t CDecimator::fir(const int16_t *_in, size_t _count, int16_t *_out){
+    size_t history = m_tapsPerPhase - 1;
+    if (m_work.size() < history + _count)
+        m_work.resize(history + _count);
+    memcpy(m_work.data() + history, _in, _count * sizeof(int16_t));
+
+    size_t n = 0;
+    int64_t round = m_shift > 0 ? (1 << (m_shift - 1)) : 0;
+    const uint64_t end = static_cast<uint64_t>(_count) * m_up;
+    while (m_position < end) {
+        size_t index = m_position / m_up;
+        size_t phase = m_position % m_up;
+        int32_t acc = dot(m_coeffs.data() + phase * m_tapsPerPhase, m_work.data() + index, m_tapsPerPhase);
+        _out[n++] = saturate16((acc + round) >> m_shift);
+        m_position += m_firDown;
+    }
+    m_position -= end;
+    memmove(m_work.data(), m_work.data() + _count, history * sizeof(int16_t));
+    return n;
+}
+
+size_t CDecimator::process(const int16_t *_in, size_t _count, int16_t *_out){
+    if (m_cicFactor > 1) {
+        if (m_scratch.size() < _count / m_cicFactor + 1)
+            m_scratch.resize(_count / m_cicFactor + 1);
+        size_t n = cic(_in, _count, m_scratch.data());
+        return fir(m_scratch.data(), n, _out);
+    }
+    return fir(_in, _count, _out);
+}
+
+size_t CDecimator::process(const int8_t *_in, size_t _count, int8_t *_out){
+    if (m_wide.size() < _count)
+        m_wide.resize(_count);
+    for (size_t i = 0; i < _count; ++i)
+        m_wide[i] = static_cast<int16_t>(_in[i] * 256);
+    size_t n = process(m_wide.data(), _count, m_wide.data());
+    for (size_t i = 0; i < n; ++i)
+        _out[i] = static_cast<int8_t>(std::max(-128, std::min(127, (m_wide[i] + 128) >> 8)));
+    return n;
+}
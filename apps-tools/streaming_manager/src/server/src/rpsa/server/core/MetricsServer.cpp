@@ -0,0 +1,166 @@
+#include <iostream>
+#include <unistd.h>
+#include "rpsa/server/core/MetricsServer.h"
+
+namespace {
+    // One request: read up to the end of the headers, answer, close.
+    // A client idle for METRICS_IDLE_TIMEOUT is closed by the timer.
+    template <typename Socket>
+    struct Session {
+        Socket             socket;
+        asio::steady_timer timer;
+        char               request[METRICS_REQUEST_SIZE];
+        size_t             size;
+        std::string        answer;
+
+        Session(asio::io_service &_io): socket(_io), timer(_io), size(0) {}
+    };
+}
+
+CMetricsServer::Ptr CMetricsServer::Create(CMetrics::Ptr _metrics, const std::string &_endpoint){
+    auto server = std::make_shared<CMetricsServer>(_metrics);
+    bool ok = false;
+    if (_endpoint.compare(0, 5, "unix:") == 0) {
+        ok = server->listenUnix(_endpoint.substr(5));
+    } else {
+        auto colon = _endpoint.rfind(':');
+        if (colon != std::string::npos)
+            ok = server->listenTcp(_endpoint.substr(0, colon), _endpoint.substr(colon + 1));
+    }
+    if (!ok) {
+        std::cerr << "Error: CMetricsServer::Create() can't listen on " << _endpoint << "\n";
+        return Ptr();
+    }
+    CMetricsServer *self = server.get();
+    server->m_thread = std::thread([self](){ self->m_io.run(); });
+    return server;
+}
+
+CMetricsServer::CMetricsServer(CMetrics::Ptr _metrics):
+    m_metrics(_metrics),
+    m_io()
+{
+}
+
+CMetricsServer::~CMetricsServer(){
+    stop();
+}
+
+void CMetricsServer::stop(){
+    m_io.stop();
+    if (m_thread.joinable())
+        m_thread.join();
+    if (!m_unixPath.empty()) {
+        unlink(m_unixPath.c_str());
+        m_unixPath.clear();
+    }
+}
+
+bool CMetricsServer::listenUnix(const std::string &_path){
+    asio::error_code error;
+    unlink(_path.c_str()); // Left over by a previous process
+    m_unixAcceptor.reset(new asio::local::stream_protocol::acceptor(m_io));
+    asio::local::stream_protocol::endpoint endpoint(_path);
+    m_unixAcceptor->open(endpoint.protocol(), error);
+    if (!error)
+        m_unixAcceptor->bind(endpoint, error);
+    if (!error)
+        m_unixAcceptor->listen(asio::socket_base::max_connections, error);
+    if (error)
+        return false;
+    m_unixPath = _path;
+    accept(*m_unixAcceptor);
+    return true;
+}
+
+bool CMetricsServer::listenTcp(const std::string &_host, const std::string &_port){
+    asio::error_code error;
+    asio::ip::tcp::resolver resolver(m_io);
+    auto iter = resolver.resolve(asio::ip::tcp::resolver::query(_host, _port), error);
+    if (error || iter == asio::ip::tcp::resolver::iterator())
+        return false;
+    asio::ip::tcp::endpoint endpoint = *iter;
+    m_tcpAcceptor.reset(new asio::ip::tcp::acceptor(m_io));
+    m_tcpAcceptor->open(endpoint.protocol(), error);
+    if (!error)
+        m_tcpAcceptor->set_option(asio::ip::tcp::acceptor::reuse_address(true), error);
+    if (!error)
+        m_tcpAcceptor->bind(endpoint, error);
+    if (!error)
+        m_tcpAcceptor->listen(asio::socket_base::max_connections, error);
+    if (error)
+        return false;
+    accept(*m_tcpAcceptor);
+    return true;
+}
+
+template <typename Acceptor>
+void CMetricsServer::accept(Acceptor &_acceptor){
+    typedef Session<typename Acceptor::protocol_type::socket> SessionT;
+    auto session = std::make_shared<SessionT>(m_io);
+    _acceptor.async_accept(session->socket, [this, &_acceptor, session](const asio::error_code &_error){
+        if (_error == asio::error::operation_aborted)
+            return;
+        accept(_acceptor);
+        if (_error)
+            return;
+        session->timer.expires_from_now(std::chrono::milliseconds(METRICS_IDLE_TIMEOUT));
+        session->timer.async_wait([session](const asio::error_code &_error){
+            if (_error == asio::error::operation_aborted)
+                return;
+            asio::error_code ignored;
+            session->socket.close(ignored);
+        });
+        read(session);
+    });
+}
+
+template <typename Session>
+void CMetricsServer::read(std::shared_ptr<Session> _session){
+    auto buffer = asio::buffer(_session->request + _session->size, METRICS_REQUEST_SIZE - _session->size);
+    _session->socket.async_read_some(buffer, [this, _session](const asio::error_code &_error, size_t _bytes){
+        _session->size += _bytes;
+        std::string request(_session->request, _session->size);
+        bool complete = request.find("\r\n\r\n") != std::string::npos || request.find("\n\n") != std::string::npos;
+        if (!_error && !complete && _session->size < METRICS_REQUEST_SIZE) {
+            read(_session);
+            return;
+        }
+        if (_error && _session->size == 0) {
+            _session->timer.cancel();
+            return;
+        }
+        _session->answer = response(request);
+        asio::async_write(_session->socket, asio::buffer(_session->answer), [_session](const asio::error_code &, size_t){
+            asio::error_code ignored;
+            _session->timer.cancel(ignored);
+            _session->socket.close(ignored);
+        });
+    });
+}
+
+std::string CMetricsServer::response(const std::string &_request){
+    // Request line: GET <path> HTTP/1.x
+    auto end = _request.find_first_of("\r\n");
+    auto line = _request.substr(0, end);
+    auto first = line.find(' ');
+    auto second = first == std::string::npos ? std::string::npos : line.find(' ', first + 1);
+    std::string method = line.substr(0, first);
+    std::string path = first == std::string::npos ? "" : line.substr(first + 1, second - first - 1);
+    path = path.substr(0, path.find('?'));
+
+    std::string status = "200 OK";
+    std::string body;
+    if (method != "GET" && method != "HEAD") {
+        status = "405 Method Not Allowed";
+    } else if (path != "/metrics" && path != "/") {
+        status = "404 Not Found";
+    } else {
+        body = m_metrics->render();
+    }
+    // HEAD gets the headers of the GET answer, Content-Length included, without the body
+    return "HTTP/1.0 " + status + "\r\n"
+           "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+           "Connection: close\r\n\r\n" + (method == "HEAD" ? std::string() : body);
+}
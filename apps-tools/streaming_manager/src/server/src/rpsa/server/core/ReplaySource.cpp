@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <iostream>
+#include "rpsa/server/core/ReplaySource.h"
+#include "rpsa/server/core/Oscilloscope.h"
+
+namespace {
+    // Opens _path and counts its samples, nullptr on failure
+    FILE *openSamples(const std::string &_path, uint64_t &_samples){
+        _samples = 0;
+        FILE *file = fopen(_path.c_str(), "rb");
+        if (file == nullptr) {
+            std::cerr << "Error: CReplaySource::Create() can't open " << _path << "\n";
+            return nullptr;
+        }
+        if (fseeko(file, 0, SEEK_END) == 0)
+            _samples = ftello(file) / sizeof(int16_t);
+        if (_samples == 0) {
+            std::cerr << "Error: CReplaySource::Create() " << _path << " has no samples\n";
+            fclose(file);
+            return nullptr;
+        }
+        fseeko(file, 0, SEEK_SET);
+        return file;
+    }
+}
+
+CReplaySource::Ptr CReplaySource::Create(const std::string &_fileCh1, const std::string &_fileCh2, double _sampleRate){
+    uint64_t samples_ch1 = 0;
+    uint64_t samples_ch2 = 0;
+    FILE *ch1 = nullptr;
+    FILE *ch2 = nullptr;
+    if (!_fileCh1.empty() && (ch1 = openSamples(_fileCh1, samples_ch1)) == nullptr)
+        return Ptr();
+    if (!_fileCh2.empty() && (ch2 = openSamples(_fileCh2, samples_ch2)) == nullptr) {
+        if (ch1 != nullptr)
+            fclose(ch1);
+        return Ptr();
+    }
+    return std::make_shared<CReplaySource>(ch1, samples_ch1, ch2, samples_ch2, _sampleRate);
+}
+
+CReplaySource::CReplaySource(FILE *_ch1, uint64_t _samplesCh1, FILE *_ch2, uint64_t _samplesCh2, double _sampleRate):
+    CTimedSource(_ch1 != nullptr, _ch2 != nullptr, _sampleRate, osc_buf_size / sizeof(int16_t)),
+    m_file{_ch1, _ch2},
+    m_samples{_samplesCh1, _samplesCh2},
+    m_position(0)
+{
+    for (int ch = 0; ch < 2; ++ch) {
+        if (m_file[ch] != nullptr)
+            setvbuf(m_file[ch], nullptr, _IOFBF, osc_buf_size * 4);
+    }
+}
+
+CReplaySource::~CReplaySource(){
+    for (int ch = 0; ch < 2; ++ch) {
+        if (m_file[ch] != nullptr)
+            fclose(m_file[ch]);
+    }
+}
+
+void CReplaySource::prepare(){
+    CTimedSource::prepare();
+    m_position = UINT64_MAX; // The first fill() seeks
+}
+
+void CReplaySource::read(int _channel, int16_t *_dst, size_t _samples, uint64_t _firstSample){
+    FILE    *file = m_file[_channel];
+    uint64_t pos = _firstSample % m_samples[_channel];
+    if (_firstSample != m_position)
+        fseeko(file, pos * sizeof(int16_t), SEEK_SET);
+    while (_samples > 0) {
+        size_t n = (size_t)std::min<uint64_t>(_samples, m_samples[_channel] - pos);
+        size_t done = fread(_dst, sizeof(int16_t), n, file);
+        if (done < n)
+            std::fill(_dst + done, _dst + n, 0); // The file got shorter
+        _dst += n;
+        _samples -= n;
+        pos += n;
+        if (pos == m_samples[_channel]) {
+            fseeko(file, 0, SEEK_SET);
+            pos = 0;
+        }
+    }
+}
+
+void CReplaySource::fill(int16_t *_ch1, int16_t *_ch2, size_t _samples, uint64_t _firstSample){
+    if (_ch1 != nullptr)
+        read(0, _ch1, _samples, _firstSample);
+    if (_ch2 != nullptr)
+        read(1, _ch2, _samples, _firstSample);
+    m_position = _firstSample + _samples;
+}
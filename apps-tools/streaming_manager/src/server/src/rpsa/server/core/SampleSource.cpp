@@ -0,0 +1,76 @@
+#include <cmath>
+#include <time.h>
+#include "rpsa/server/core/SampleSource.h"
+
+namespace {
+    uint64_t monotonicNs(){
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+    void sleepUntil(uint64_t _ns){
+        struct timespec ts;
+        ts.tv_sec = _ns / 1000000000ull;
+        ts.tv_nsec = _ns % 1000000000ull;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) != 0) {}
+    }
+}
+
+CTimedSource::CTimedSource(bool _channel1Enable, bool _channel2Enable, double _sampleRate, size_t _bufferSamples):
+    m_Channel1(_channel1Enable),
+    m_Channel2(_channel2Enable),
+    m_periodNs(_sampleRate > 0 ? 1e9 * _bufferSamples / _sampleRate : 0),
+    m_bufferSamples(_bufferSamples),
+    m_bufferNumber(0),
+    m_start(0),
+    m_nextBuffer(0),
+    m_lostBuffers(0),
+    m_skipBuffers(0)
+{
+    for (int ch = 0; ch < 2; ++ch) {
+        if ((ch == 0 && m_Channel1) || (ch == 1 && m_Channel2)) {
+            m_buffer[ch][0].resize(m_bufferSamples);
+            m_buffer[ch][1].resize(m_bufferSamples);
+        }
+    }
+}
+
+void CTimedSource::prepare(){
+    m_bufferNumber = 0;
+    m_nextBuffer = 0;
+    m_lostBuffers = 0;
+    m_skipBuffers = 0;
+    m_start = monotonicNs();
+}
+
+bool CTimedSource::next(uint8_t *&_buffer1, uint8_t *&_buffer2, size_t &_size, bool &_overFlow1, bool &_overFlow2){
+    uint64_t lost = m_skipBuffers;
+    m_skipBuffers = 0;
+    if (m_periodNs > 0) {
+        // Buffer k is complete at m_start + (k + 1) periods and overwritten one period later
+        uint64_t due = m_start + (uint64_t)llround((m_nextBuffer + lost + 1) * m_periodNs);
+        uint64_t now = monotonicNs();
+        if (now > due) {
+            uint64_t late = (uint64_t)((now - due) / m_periodNs);
+            lost += late;
+            due += (uint64_t)llround(late * m_periodNs);
+        }
+        sleepUntil(due);
+    }
+    m_nextBuffer += lost;
+    m_lostBuffers += lost;
+
+    m_bufferNumber ^= 1;
+    int16_t *ch1 = m_Channel1 ? m_buffer[0][m_bufferNumber].data() : nullptr;
+    int16_t *ch2 = m_Channel2 ? m_buffer[1][m_bufferNumber].data() : nullptr;
+    fill(ch1, ch2, m_bufferSamples, m_nextBuffer * m_bufferSamples);
+    m_nextBuffer++;
+
+    _buffer1 = reinterpret_cast<uint8_t*>(ch1);
+    _buffer2 = reinterpret_cast<uint8_t*>(ch2);
+    _size = (m_Channel1 || m_Channel2) ? m_bufferSamples * sizeof(int16_t) : 0;
+    _overFlow1 = lost > 0 && m_Channel1;
+    _overFlow2 = lost > 0 && m_Channel2;
+    return true;
+}
@@ -0,0 +1,211 @@
+#include <algorithm>
+#include <cstring>
+#include "rpsa/server/core/StreamReceiver.h"
+#include "rpsa/common/core/sample_pack.h"
+#include "rpsa/common/core/sample_codec.h"
+#include "rpsa/common/core/sample_kernels.h"
+
+namespace {
+
+    const size_t HALF_BLOCK = RECEIVER_BLOCK_SIZE / 2;
+
+    // One channel of a pack into _dst (HALF_BLOCK bytes). _out is _src when nothing had to be done.
+    bool decodeChannel(const uint8_t *_src, size_t _size, uint32_t _flags, uint32_t &_resolution, uint8_t *_dst, bool _copy, const uint8_t *&_out, size_t &_outSize){
+        _out = _src;
+        _outSize = _size;
+        if (_size == 0)
+            return true;
+        if (_flags & PACK_FLAG_COMPRESSED) {
+            size_t   samples = 0;
+            unsigned bits = 0;
+            if (!codecInfo(_src, _size, samples, bits) || !codecDecode(_src, _size, _dst, HALF_BLOCK, samples))
+                return false;
+            _resolution = bits;
+            _out = _dst;
+            _outSize = samples * (bits / 8);
+            return true;
+        }
+        if (_resolution == 14) {
+            size_t samples = samplesInBytes(_size, 14);
+            if (samples * sizeof(int16_t) > HALF_BLOCK)
+                return false;
+            unpack14(_src, samples, reinterpret_cast<int16_t*>(_dst));
+            _out = _dst;
+            _outSize = samples * sizeof(int16_t);
+            return true;
+        }
+        if (_resolution != 8 && _resolution != 16)
+            return false;
+        if (_copy) {
+            if (_size > HALF_BLOCK)
+                return false;
+            kernelCopy(_dst, _src, _size);
+            _out = _dst;
+        }
+        return true;
+    }
+
+    void add(CStreamReceiver::Stats &_to, const CStreamReceiver::Stats &_value, bool _subtract = false){
+        auto to = reinterpret_cast<uint64_t*>(&_to);
+        auto value = reinterpret_cast<const uint64_t*>(&_value);
+        for (size_t i = 0; i < sizeof(CStreamReceiver::Stats) / sizeof(uint64_t); ++i)
+            to[i] = _subtract ? to[i] - value[i] : to[i] + value[i];
+    }
+}
+
+CStreamReceiver::Ptr CStreamReceiver::Create(asionet::CAsioNet::Ptr _net, CBufferPool::Ptr _pool){
+    if (!_net) {
+        std::cerr << "Error: CStreamReceiver::Create() no client\n";
+        return Ptr();
+    }
+    if (_pool && _pool->blockSize() < RECEIVER_BLOCK_SIZE) {
+        std::cerr << "Error: CStreamReceiver::Create() pool blocks must hold " << RECEIVER_BLOCK_SIZE << " bytes\n";
+        return Ptr();
+    }
+    auto receiver = std::make_shared<CStreamReceiver>(_net, _pool);
+    CStreamReceiver *self = receiver.get();
+    _net->addCallReceived([self](std::error_code, uint8_t *_buffer, size_t _size){
+        self->received(_buffer, _size);
+    });
+    return receiver;
+}
+
+CStreamReceiver::CStreamReceiver(asionet::CAsioNet::Ptr _net, CBufferPool::Ptr _pool):
+    m_net(_net),
+    m_pool(_pool),
+    m_queue(_pool ? _pool->count() : 1),
+    m_callback(),
+    m_scratch(_pool ? 0 : RECEIVER_BLOCK_SIZE),
+    m_spare(nullptr),
+    m_hasPack(false),
+    m_nextId(0),
+    m_nextSampleIndex(0),
+    m_total(),
+    m_taken()
+{
+}
+
+bool CStreamReceiver::decodePack(const uint8_t *_pack, size_t _size, uint8_t *_dst, bool _copy, Block &_block, bool *_compressed){
+    const uint8_t *ch1 = nullptr;
+    const uint8_t *ch2 = nullptr;
+    size_t size_ch1 = 0;
+    size_t size_ch2 = 0;
+    if (!asionet::CAsioNet::ParsePack(_pack, _size, _block.info, ch1, size_ch1, ch2, size_ch2))
+        return false;
+    uint32_t resolution_ch1 = _block.info.resolution;
+    uint32_t resolution_ch2 = _block.info.resolution;
+    if (!decodeChannel(ch1, size_ch1, _block.info.flags, resolution_ch1, _dst, _copy, _block.ch1, _block.size_ch1) ||
+        !decodeChannel(ch2, size_ch2, _block.info.flags, resolution_ch2, _dst + HALF_BLOCK, _copy, _block.ch2, _block.size_ch2))
+        return false;
+    if (size_ch1 > 0 && size_ch2 > 0 && resolution_ch1 != resolution_ch2)
+        return false;
+    _block.info.resolution = size_ch1 > 0 ? resolution_ch1 : resolution_ch2;
+    if (_block.info.resolution != 8 && _block.info.resolution != 16)
+        _block.info.resolution = 16; // Channels without data
+    if (_compressed != nullptr)
+        *_compressed = (_block.info.flags & PACK_FLAG_COMPRESSED) != 0;
+    _block.info.flags &= ~PACK_FLAG_COMPRESSED;
+    return true;
+}
+
+void CStreamReceiver::countGap(Block &_block, Stats &_delta, Stats &_recovered){
+    const asionet::PackInfo &info = _block.info;
+    _block.lostPacks = 0;
+    _block.lostSamples = 0;
+    uint64_t samples = std::max(_block.size_ch1, _block.size_ch2) / (info.resolution / 8);
+    if (m_hasPack && info.id < m_nextId) {
+        // Counted as lost when the gap was seen, taken off again
+        _delta.recoveredPacks++;
+        _recovered.lostPacks = 1;
+        if (!(info.flags & PACK_FLAG_TRIGGERED) && info.version >= 2)
+            _recovered.lostSamples = samples;
+        return;
+    }
+    if (m_hasPack && info.id > m_nextId)
+        _block.lostPacks = info.id - m_nextId;
+    m_nextId = info.id + 1;
+    m_hasPack = true;
+
+    if (info.flags & PACK_FLAG_TRIGGERED) {
+        // Trigger window records, the gaps between them were not sent on purpose
+        if (info.flags & PACK_FLAG_RECORD_START)
+            _delta.records++;
+    } else if (info.version >= 2) {
+        // Samples lost on the board are reported, the rest of a gap was lost in the network
+        _block.lostSamples = info.droppedSamples;
+        if (m_nextSampleIndex != 0 && info.sampleIndex > m_nextSampleIndex + info.droppedSamples)
+            _block.lostSamples += info.sampleIndex - m_nextSampleIndex - info.droppedSamples;
+        m_nextSampleIndex = info.sampleIndex + samples;
+    }
+    _delta.lostPacks += _block.lostPacks;
+    _delta.lostSamples += _block.lostSamples;
+}
+
+void CStreamReceiver::received(const uint8_t *_pack, size_t _size){
+    Stats delta = Stats();
+    Stats recovered = Stats();
+    delta.bytes = _size;
+    Block block;
+    bool  compressed = false;
+    block.data = m_spare != nullptr ? m_spare : (m_pool ? m_pool->borrow() : nullptr);
+    m_spare = nullptr;
+    uint8_t *dst = m_pool ? block.data : m_scratch.data();
+    if (dst == nullptr) {
+        // The consumer does not keep up, the gap shows up in the next pack
+        delta.overruns++;
+    } else if (!decodePack(_pack, _size, dst, m_pool != nullptr, block, &compressed)) {
+        delta.badPacks++;
+        m_spare = block.data; // Only the consumer releases blocks to the pool
+    } else {
+        delta.packs++;
+        delta.compressedPacks = compressed ? 1 : 0;
+        delta.decodedBytes = block.size_ch1 + block.size_ch2;
+        delta.samples_ch1 = block.size_ch1 / (block.info.resolution / 8);
+        delta.samples_ch2 = block.size_ch2 / (block.info.resolution / 8);
+        delta.lostRate = block.info.lostRate;
+        countGap(block, delta, recovered);
+        if (block.data == nullptr) {
+            if (m_callback)
+                m_callback(block);
+        } else {
+            m_queue.push(block); // Never full, it has a slot for every pool block
+            if (m_callback)
+                m_callback(block);
+        }
+    }
+    std::lock_guard<std::mutex> lock(m_statsLock);
+    add(m_total, delta);
+    m_total.lostPacks -= std::min(m_total.lostPacks, recovered.lostPacks);
+    m_total.lostSamples -= std::min(m_total.lostSamples, recovered.lostSamples);
+}
+
+bool CStreamReceiver::pop(Block &_block){
+    return m_queue.pop(_block);
+}
+
+void CStreamReceiver::release(const Block &_block){
+    if (_block.data != nullptr)
+        m_pool->release(_block.data);
+}
+
+CStreamReceiver::Stats CStreamReceiver::getStats() const{
+    std::lock_guard<std::mutex> lock(m_statsLock);
+    return m_total;
+}
+
+CStreamReceiver::Stats CStreamReceiver::takeStats(){
+    std::lock_guard<std::mutex> lock(m_statsLock);
+    Stats delta = m_total;
+    add(delta, m_taken, true);
+    // Packs recovered after their gap was taken offset the next gaps
+    uint64_t takenPacks = std::max(m_taken.lostPacks, m_total.lostPacks);
+    uint64_t takenSamples = std::max(m_taken.lostSamples, m_total.lostSamples);
+    if (m_total.lostPacks < m_taken.lostPacks)
+        delta.lostPacks = 0;
+    if (m_total.lostSamples < m_taken.lostSamples)
+        delta.lostSamples = 0;
+    m_taken = m_total;
+    m_taken.lostPacks = takenPacks;
+    m_taken.lostSamples = takenSamples;
+    return delta;
+}
@@ -3,8 +3,13 @@
 #include <fstream>
 #include <functional>
 #include <cstdlib>
+#include <cmath>
+#include <time.h>
 #include "rpsa/server/core/StreamingApplication.h"
 #include "AsioNet.h"
+#include "rpsa/common/core/thread_sched.h"
+#include "rpsa/common/core/sample_pack.h"
+#include "rpsa/common/core/sample_kernels.h"
 
 #define CH1 1
 #define CH2 2
@@ -13,6 +18,10 @@
 #   include "rpsa/common/core/aligned_alloc.h"
 #endif // OS_MACOS
 
+#ifdef __linux__
+#include <sys/timex.h>
+#endif
+
 
 #ifdef DEBUG_OUT
 #define PrintDebugInFile(X) PrintDebugLogInFile(X);
@@ -28,7 +37,7 @@ void PrintDebugLogInFile(const char *message){
 	fs.close();
 }
 
-CStreamingApplication::CStreamingApplication(CStreamingManager::Ptr _StreamingManager,COscilloscope::Ptr _osc_ch, unsigned short _resolution,int _oscRate,int _channels) :
+CStreamingApplication::CStreamingApplication(CStreamingManager::Ptr _StreamingManager,CSampleSource::Ptr _osc_ch, unsigned short _resolution,int _oscRate,int _channels) :
     m_StreamingManager(_StreamingManager),
     m_Osc_ch(_osc_ch),
     m_OscThread(),
@@ -36,24 +45,44 @@ CStreamingApplication::CStreamingApplication(CStreamingManager::Ptr _StreamingMa
     m_Ios(),
     m_WriteBuffer_ch1(nullptr),
     m_WriteBuffer_ch2(nullptr),
+    m_PackBuffer_ch1(nullptr),
+    m_PackBuffer_ch2(nullptr),
     m_Timer(m_Ios),
     m_BytesCount(0),
     m_Resolution(_resolution),
     m_isRun(false),
     m_oscRate(_oscRate),
     m_channels(_channels),
-    mtx()
+    mtx(),
+    m_policy(SchedPolicy::NORMAL),
+    m_priority(OSC_THREAD_PRIORITY),
+    m_oscCpu(OSC_THREAD_CPU),
+    m_ioCpu(IO_THREAD_CPU),
+    m_startDelay(0),
+    m_wakeTime(0),
+    m_decimator_ch1(nullptr),
+    m_decimator_ch2(nullptr),
+    m_trigger(nullptr),
+    m_blackBox(nullptr),
+    m_blackBoxPost(0),
+    m_dumpRequest(false),
+    m_dumpState(DUMP_IDLE)
 {
     
-    assert(this->m_Resolution == 8 || this->m_Resolution == 16);
+    assert(this->m_Resolution == 8 || this->m_Resolution == 14 || this->m_Resolution == 16);
 
     m_size_ch1 = 0;
     m_size_ch2 = 0;
     
     m_WriteBuffer_ch1 = aligned_alloc(64, osc_buf_size);
     m_WriteBuffer_ch2 = aligned_alloc(64, osc_buf_size);
+    if (m_Resolution == 14) {
+        m_PackBuffer_ch1 = aligned_alloc(64, osc_buf_size);
+        m_PackBuffer_ch2 = aligned_alloc(64, osc_buf_size);
+    }
 
     m_OscThreadRun.test_and_set();
+    resetStats();
 }
 
 CStreamingApplication::~CStreamingApplication()
@@ -65,6 +94,12 @@ CStreamingApplication::~CStreamingApplication()
 
     free(m_WriteBuffer_ch2);
     m_WriteBuffer_ch2 = nullptr;
+
+    free(m_PackBuffer_ch1);
+    m_PackBuffer_ch1 = nullptr;
+
+    free(m_PackBuffer_ch2);
+    m_PackBuffer_ch2 = nullptr;
 }
 
 void CStreamingApplication::run()
@@ -76,12 +111,23 @@ void CStreamingApplication::run()
     m_OscThread = std::thread(&CStreamingApplication::oscWorker, this);
 
     try {
+        m_StreamingManager->setCpuAffinity(m_policy == SchedPolicy::REALTIME ? m_ioCpu : -1);
+        if (!m_blackBox)
+            m_StreamingManager->run();
 
-        m_StreamingManager->run();
-
-        // OS signal handler
+        // OS signal handler, SIGUSR1 dumps the black box
         asio::signal_set signalSet(m_Ios, SIGINT, SIGTERM);
-        signalSet.async_wait(std::bind(&CStreamingApplication::signalHandler, this, std::placeholders::_1, std::placeholders::_2));
+        if (m_blackBox)
+            signalSet.add(SIGUSR1);
+        std::function<void(const asio::error_code &, int)> onSignal = [&](const asio::error_code &_error, int _signalNumber){
+            if (!_error && _signalNumber == SIGUSR1) {
+                triggerDump();
+                signalSet.async_wait(onSignal);
+                return;
+            }
+            signalHandler(_error, _signalNumber);
+        };
+        signalSet.async_wait(onSignal);
 
         asio::io_service::work idle(m_Ios);
         m_Ios.run();
@@ -101,7 +147,9 @@ void CStreamingApplication::runNonBlock(){
     m_size_ch2 = 0;
     m_isRun = true;    
     try {
-        m_StreamingManager->run(); // MUST BE INIT FIRST for thread logic
+        m_StreamingManager->setCpuAffinity(m_policy == SchedPolicy::REALTIME ? m_ioCpu : -1);
+        if (!m_blackBox)
+            m_StreamingManager->run(); // MUST BE INIT FIRST for thread logic
         m_OscThread = std::thread(&CStreamingApplication::oscWorker, this);
         
     }
@@ -117,6 +165,8 @@ bool CStreamingApplication::stop(){
     if (m_isRun){
         m_OscThreadRun.clear();
         m_OscThread.join();
+        if (m_dumpThread.joinable())
+            m_dumpThread.join();
         m_StreamingManager->stop();
         m_Ios.stop();
         m_Osc_ch->stop();
@@ -127,25 +177,176 @@ bool CStreamingApplication::stop(){
     return false;
 }
 
+void CStreamingApplication::setSchedPolicy(SchedPolicy _policy, int _priority){
+    m_policy = _policy;
+    m_priority = _priority;
+}
+
+void CStreamingApplication::setCpuAffinity(int _oscCpu, int _ioCpu){
+    m_oscCpu = _oscCpu;
+    m_ioCpu = _ioCpu;
+}
+
+bool CStreamingApplication::setDecimator(uint32_t _up, uint32_t _down, const std::vector<float> &_taps){
+    if (_up == _down && _taps.empty()) {
+        m_decimator_ch1 = nullptr;
+        m_decimator_ch2 = nullptr;
+        return true;
+    }
+    auto ch1 = CDecimator::Create(_up, _down, _taps);
+    auto ch2 = CDecimator::Create(_up, _down, _taps);
+    if (!ch1 || !ch2)
+        return false;
+    m_decimator_ch1 = ch1;
+    m_decimator_ch2 = ch2;
+    return true;
+}
+
+bool CStreamingApplication::setTrigger(const TriggerSettings &_settings){
+    // The gate sees the samples before they are packed
+    auto trigger = CTriggerGate::Create(_settings, m_Resolution == 8 ? 8 : 16, osc_buf_size);
+    if (!trigger)
+        return false;
+    m_trigger = trigger;
+    return true;
+}
+
+bool CStreamingApplication::setBlackBox(size_t _bytes, uint32_t _postMs){
+    m_blackBox = nullptr;
+    m_blackBoxPost = _postMs;
+    if (_bytes == 0)
+        return true;
+    try {
+        m_blackBox = CBlackBox::Create(_bytes);
+    }
+    catch (const std::bad_alloc &)
+    {
+        std::cerr << "Error: CStreamingApplication::setBlackBox() can't allocate " << _bytes << " bytes\n";
+        return false;
+    }
+    return true;
+}
+
+CStreamingApplication::Stats CStreamingApplication::getStats(){
+    Stats stats = {};
+    stats.buffers = m_statBuffers;
+    stats.overflows = m_statOverflows;
+    stats.droppedSamples = m_statDropped;
+    stats.lastProcessNs = m_statLastProcess;
+    stats.maxProcessNs = m_statMaxProcess;
+    stats.avgProcessNs = stats.buffers > 0 ? m_statSumProcess / stats.buffers : 0;
+    stats.maxPeriodNs = m_statMaxPeriod;
+    stats.dumps = m_statDumps;
+    auto trigger = m_trigger;
+    if (trigger) {
+        stats.records = trigger->records();
+        stats.discardedRecords = trigger->discarded();
+    }
+    return stats;
+}
+
+void CStreamingApplication::resetStats(){
+    m_statBuffers = 0;
+    m_statOverflows = 0;
+    m_statDropped = 0;
+    m_statLastProcess = 0;
+    m_statMaxProcess = 0;
+    m_statSumProcess = 0;
+    m_statMaxPeriod = 0;
+    m_statDumps = 0;
+}
+
+void CStreamingApplication::setMetrics(CMetrics::Ptr _metrics){
+    m_StreamingManager->setMetrics(_metrics);
+    if (!_metrics) {
+        m_metricBytes = nullptr;
+        m_metricBuffers = nullptr;
+        m_metricOverflows = nullptr;
+        m_metricDropped = nullptr;
+        m_metricProcess = nullptr;
+        return;
+    }
+    m_metricBytes = _metrics->counter("rpsa_stage_bytes_total", "stage=\"acquire\"", "Bytes that passed a stage of the stream");
+    m_metricBuffers = _metrics->counter("rpsa_stage_buffers_total", "stage=\"acquire\"", "Buffers that passed a stage of the stream");
+    m_metricOverflows = _metrics->counter("rpsa_overflows_total", "", "Buffers with the DMA overflow flag");
+    m_metricDropped = _metrics->counter("rpsa_dropped_samples_total", "stage=\"acquire\"", "Samples per channel overwritten by the DMA before the worker took them");
+    m_metricProcess = _metrics->histogram("rpsa_process_seconds", "", "Time from the end of the acquisition of a buffer until the worker has passed it on");
+}
+
+void CStreamingApplication::applySchedPolicy(){
+    if (m_policy == SchedPolicy::REALTIME) {
+        if (m_oscCpu >= 0 && !pinCurrentThread(m_oscCpu))
+            std::cerr << "Warning: can't pin the oscilloscope thread to CPU " << m_oscCpu << "\n";
+        if (!setCurrentThreadFifo(m_priority))
+            std::cerr << "Warning: can't set SCHED_FIFO priority " << m_priority << " for the oscilloscope thread\n";
+    } else {
+        setCurrentThreadNormal();
+    }
+}
+
+namespace {
+    uint64_t clockNs(clockid_t _clock){
+        struct timespec ts;
+        clock_gettime(_clock, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+    // True when NTP or phc2sys/ptp4l keeps CLOCK_REALTIME in sync
+    bool isClockSynced(){
+#ifdef __linux__
+        struct timex tx = {};
+        return adjtimex(&tx) != TIME_ERROR && !(tx.status & STA_UNSYNC);
+#else
+        return false;
+#endif
+    }
+}
+
 void CStreamingApplication::oscWorker()
 {
-    sleep(1); // The delay is necessary for the web interface of the application to update
+    applySchedPolicy();
+    if (m_startDelay > 0)
+        usleep(m_startDelay * 1000);
     m_Osc_ch->prepare();
-    auto timeNow = std::chrono::system_clock::now();
-    auto curTime = std::chrono::time_point_cast<std::chrono::milliseconds >(timeNow);
-    auto value = curTime.time_since_epoch();
 
-    long long int timeBegin = value.count();
     uintmax_t counter = 0;
     m_lostRate = 0;
-    uintmax_t passCounter = 0;
     int dropFirstNBuffer = 2;
+    double   sampleNs = 1e9 * (m_oscRate > 0 ? m_oscRate : 1) / ADC_SAMPLE_RATE;
+    double   sampleRate = ADC_SAMPLE_RATE / (m_oscRate > 0 ? m_oscRate : 1);
+    uint32_t oscRate = m_oscRate;
+    uint64_t delayNs = 0;
+    if (m_decimator_ch1) {
+        m_decimator_ch1->reset();
+        m_decimator_ch2->reset();
+        delayNs = (uint64_t)llround(m_decimator_ch1->delay() * sampleNs);
+        oscRate = (uint32_t)llround((double)m_oscRate * m_decimator_ch1->down() / m_decimator_ch1->up());
+        sampleNs = sampleNs * m_decimator_ch1->down() / m_decimator_ch1->up();
+        sampleRate = sampleRate * m_decimator_ch1->up() / m_decimator_ch1->down();
+    }
+    m_StreamingManager->setSampleRate(sampleRate);
+    uint64_t sampleIndex = 0;
+    uint64_t lastBufferTime = 0;
+    uint64_t lastWakeTime = 0;
+    uint64_t clockCheckTime = clockNs(CLOCK_MONOTONIC);
+    uint32_t clockFlags = isClockSynced() ? PACK_FLAG_CLOCK_SYNC : 0;
+    CTriggerGate::Callback passRecord = [this](const asionet::PackInfo &_info, const void *_buffer_ch1, size_t _size_ch1, const void *_buffer_ch2, size_t _size_ch2){
+        passOn(_info, _buffer_ch1, _size_ch1, _buffer_ch2, _size_ch2);
+    };
+    if (m_trigger)
+        m_trigger->reset();
+    uint64_t dumpTime = 0;
+    if (m_blackBox) {
+        m_blackBox->clear();
+        m_dumpState = DUMP_IDLE;
+    }
 try{
     while (m_OscThreadRun.test_and_set())
     {
 #ifndef DISABLE_OSC
         m_size_ch1 = 0;
         m_size_ch2 = 0;
+        // Blocks until the DMA interrupt
         bool overFlow = this->passCh(m_size_ch1,m_size_ch2);
         if (dropFirstNBuffer > 0 && (m_size_ch1 > 0 || m_size_ch2 > 0)) {
             m_size_ch1 = 0;
@@ -155,34 +356,91 @@ try{
         }
         if (overFlow) {
             m_lostRate = 1;
-            ++passCounter;
+            ++m_statOverflows;
+            if (m_metricOverflows)
+                m_metricOverflows->add();
         }
-
+        if (m_decimator_ch1) {
+            m_size_ch1 = decimate(m_decimator_ch1, m_WriteBuffer_ch1, m_size_ch1);
+            m_size_ch2 = decimate(m_decimator_ch2, m_WriteBuffer_ch2, m_size_ch2);
+        }
+#else
+        usleep(10);
+        m_wakeTime = clockNs(CLOCK_MONOTONIC);
 #endif
-        oscNotify(m_lostRate, m_oscRate, m_WriteBuffer_ch1, m_size_ch1, m_WriteBuffer_ch2, m_size_ch2);
+        asionet::PackInfo info = {};
+        info.lostRate = m_lostRate;
+        info.oscRate = oscRate;
+        info.resolution = m_Resolution;
+        info.channels = (m_size_ch1 > 0 ? 1 : 0) | (m_size_ch2 > 0 ? 2 : 0);
+        info.flags = clockFlags;
+        info.id = counter;
+
+        uint64_t samples = MAX(m_size_ch1, m_size_ch2) / (m_Resolution == 8 ? 1 : 2);
+        uint64_t bufferTime = m_wakeTime;
+        if (samples > 0) {
+            // The overflow flag says the DMA overwrote at least one buffer, the time since
+            // the previous buffer gives the number of buffers that were lost
+            if (m_lostRate && lastBufferTime != 0) {
+                double  elapsed = (bufferTime - lastBufferTime) / sampleNs;
+                int64_t lost = llround(elapsed / samples) - 1;
+                info.droppedSamples = MAX(lost, 1) * samples;
+            }
+            info.sampleIndex = sampleIndex + info.droppedSamples;
+            info.timestamp = clockNs(CLOCK_REALTIME) - (uint64_t)llround(samples * sampleNs) - delayNs;
+            sampleIndex = info.sampleIndex + samples;
+            lastBufferTime = bufferTime;
+        }
+
+        if (m_trigger) {
+            m_trigger->process(info, sampleNs, m_WriteBuffer_ch1, m_size_ch1, m_WriteBuffer_ch2, m_size_ch2, passRecord);
+        } else {
+            passOn(info, m_WriteBuffer_ch1, m_size_ch1, m_WriteBuffer_ch2, m_size_ch2);
+        }
         m_lostRate = 0;
         ++counter;
 
-        timeNow = std::chrono::system_clock::now();
-        curTime = std::chrono::time_point_cast<std::chrono::milliseconds >(timeNow);
-        value = curTime.time_since_epoch();
+        uint64_t doneTime = clockNs(CLOCK_MONOTONIC);
+        uint64_t process = doneTime - m_wakeTime;
+        m_statLastProcess = process;
+        m_statSumProcess += process;
+        if (process > m_statMaxProcess)
+            m_statMaxProcess = process;
+        if (lastWakeTime != 0 && m_wakeTime - lastWakeTime > m_statMaxPeriod)
+            m_statMaxPeriod = m_wakeTime - lastWakeTime;
+        lastWakeTime = m_wakeTime;
+        m_statDropped += info.droppedSamples;
+        ++m_statBuffers;
+        if (m_metricBuffers) {
+            m_metricBuffers->add();
+            m_metricBytes->add(m_size_ch1 + m_size_ch2);
+            m_metricDropped->add(info.droppedSamples);
+            m_metricProcess->observe(process);
+        }
 
-          
-        if ((value.count() - timeBegin) >= 5000) {
-            std::cout << "Lost rate: " << passCounter << " / " << counter << " (" << (100. * static_cast<double>(passCounter) / counter) << " %)\n";
-            counter = 0;
-            passCounter = 0;
-            timeBegin = value.count();
+        if (doneTime - clockCheckTime >= 5000000000ull) {
+            clockFlags = isClockSynced() ? PACK_FLAG_CLOCK_SYNC : 0;
+            clockCheckTime = doneTime;
         }
 
-        if (!m_StreamingManager->isFileThreadWork()){
+        if (m_blackBox) {
+            if (m_dumpRequest && m_dumpState == DUMP_IDLE) {
+                m_dumpRequest = false;
+                m_dumpState = DUMP_POST;
+                dumpTime = doneTime + m_blackBoxPost * 1000000ull;
+            }
+            if (m_dumpState == DUMP_POST && doneTime >= dumpTime) {
+                m_dumpState = DUMP_WRITING;
+                if (m_dumpThread.joinable())
+                    m_dumpThread.join(); // Finished already, it set DUMP_IDLE last
+                m_dumpThread = std::thread(&CStreamingApplication::dumpWorker, this);
+            }
+        } else if (!m_StreamingManager->isFileThreadWork()){
             if (m_StreamingManager->notifyStop){
                 m_StreamingManager->notifyStop(0);
                 m_StreamingManager->notifyStop = nullptr;                
             }
         }
-
-        usleep(10);
     }
     
 }catch (std::exception& e)
@@ -203,6 +461,7 @@ try{
     bool  overFlow2 = false;
     
     success = m_Osc_ch->next(buffer_ch1, buffer_ch2, size , overFlow1 , overFlow2);
+    m_wakeTime = clockNs(CLOCK_MONOTONIC);
 
     if (!success) {
         std::cerr << "Error: m_Osc->next()" << std::endl;
@@ -217,11 +476,12 @@ try{
         switch (m_Resolution)
         {
             case 8:
-                memcpy_stride_8bit_neon(((void**)m_WriteBuffer_ch1), buffer_ch1, _size1);
                 _size1 /= 2;
+                kernelHigh8(static_cast<int8_t*>(m_WriteBuffer_ch1), reinterpret_cast<const int16_t*>(buffer_ch1), _size1);
                 break;
+            case 14:
             case 16:
-                memcpy_neon(((void**)m_WriteBuffer_ch1), buffer_ch1, _size1);
+                kernelCopy(m_WriteBuffer_ch1, buffer_ch1, _size1);
                 break;
             default:
                 break;
@@ -235,11 +495,12 @@ try{
         switch (m_Resolution)
         {
             case 8:
-                memcpy_stride_8bit_neon(((void**)m_WriteBuffer_ch2), buffer_ch2, _size2);
                 _size2 /= 2;
+                kernelHigh8(static_cast<int8_t*>(m_WriteBuffer_ch2), reinterpret_cast<const int16_t*>(buffer_ch2), _size2);
                 break;
+            case 14:
             case 16:
-                memcpy_neon(((void**)m_WriteBuffer_ch2), buffer_ch2, _size2);
+                kernelCopy(m_WriteBuffer_ch2, buffer_ch2, _size2);
                 break;
             default:
                 break;
@@ -264,9 +525,63 @@ try{
 }
 
 
-int CStreamingApplication::oscNotify(uint64_t _lostRate, uint32_t _oscRate,const void *_buffer_ch1, size_t _size_ch1,const void *_buffer_ch2, size_t _size_ch2)
+size_t CStreamingApplication::decimate(CDecimator::Ptr &_decimator, void *_buffer, size_t _size){
+    if (_size == 0)
+        return 0;
+    if (m_Resolution != 8)
+        return _decimator->process((const int16_t*)_buffer, _size / 2, (int16_t*)_buffer) * 2;
+    return _decimator->process((const int8_t*)_buffer, _size, (int8_t*)_buffer);
+}
+
+void CStreamingApplication::passOn(const asionet::PackInfo &_info, const void *_buffer_ch1, size_t _size_ch1, const void *_buffer_ch2, size_t _size_ch2){
+    if (m_blackBox && m_dumpState == DUMP_WRITING)
+        return;
+    asionet::PackInfo info = _info;
+    if (m_Resolution == 14) {
+        // TDMS and WAV have no 14 bit type, files get the 16 bit samples. Compression drops
+        // the unused bits anyway.
+        if (m_StreamingManager->isLocalFile() || m_StreamingManager->getCompression()) {
+            info.resolution = 16;
+        } else {
+            if (_size_ch1 > 0) {
+                pack14((const int16_t*)_buffer_ch1, _size_ch1 / 2, (uint8_t*)m_PackBuffer_ch1);
+                _buffer_ch1 = m_PackBuffer_ch1;
+                _size_ch1 = bytesForSamples(_size_ch1 / 2, 14);
+            }
+            if (_size_ch2 > 0) {
+                pack14((const int16_t*)_buffer_ch2, _size_ch2 / 2, (uint8_t*)m_PackBuffer_ch2);
+                _buffer_ch2 = m_PackBuffer_ch2;
+                _size_ch2 = bytesForSamples(_size_ch2 / 2, 14);
+            }
+        }
+    }
+    if (!m_blackBox) {
+        oscNotify(info, _buffer_ch1, _size_ch1, _buffer_ch2, _size_ch2, m_wakeTime);
+    } else {
+        m_blackBox->push(info, _buffer_ch1, _size_ch1, _buffer_ch2, _size_ch2);
+    }
+}
+
+void CStreamingApplication::dumpWorker(){
+    // Started by the worker, do not inherit its real time priority
+    setCurrentThreadNormal();
+    if (m_policy == SchedPolicy::REALTIME && m_ioCpu >= 0)
+        pinCurrentThread(m_ioCpu);
+    m_StreamingManager->setFileBackpressure(true);
+    m_StreamingManager->run();
+    m_blackBox->forEach([this](const asionet::PackInfo &_info, const void *_buffer_ch1, size_t _size_ch1, const void *_buffer_ch2, size_t _size_ch2){
+        oscNotify(_info, _buffer_ch1, _size_ch1, _buffer_ch2, _size_ch2, 0); // Latency would be the black box age
+    });
+    m_StreamingManager->stop(true);
+    std::cout << "Black box: " << m_blackBox->records() << " buffers, " << m_blackBox->used() / (1024 * 1024) << " MiB written\n";
+    m_blackBox->clear();
+    ++m_statDumps;
+    m_dumpState = DUMP_IDLE;
+}
+
+int CStreamingApplication::oscNotify(const asionet::PackInfo &_info, const void *_buffer_ch1, size_t _size_ch1,const void *_buffer_ch2, size_t _size_ch2, uint64_t _readyNs)
 {
-    return m_StreamingManager->passBuffers(_lostRate,_oscRate, _buffer_ch1,_size_ch1,_buffer_ch2,_size_ch2,m_Resolution, 0);
+    return m_StreamingManager->passBuffers(_info, _buffer_ch1,_size_ch1,_buffer_ch2,_size_ch2, _readyNs);
 }
 
 void CStreamingApplication::performanceCounterHandler(const asio::error_code &_error)
@@ -4,7 +4,11 @@
 #include <time.h>
 #include <functional>
 #include <cstdlib>
+#include <cmath>
+#include <thread>
 #include "rpsa/server/core/StreamingManager.h"
+#include "rpsa/common/core/sample_pack.h"
+#include "rpsa/common/core/sample_codec.h"
 
 #ifdef _WIN32
 #include <dir.h>
@@ -52,7 +56,7 @@ std::string getNewFileName(Stream_FileType _fileType,string _filePath)
     time_t now = time(nullptr);
     timenow = gmtime(&now);
     strftime(time_str, sizeof(time_str), "%Y-%m-%d_%H-%M-%S", timenow);
-    std::string filename = _filePath  + "/" + std::string("data_file_") + time_str+"." + (_fileType == Stream_FileType::TDMS_TYPE ? "tdms":"wav");
+    std::string filename = _filePath  + "/" + std::string("data_file_") + time_str+"." + (_fileType == Stream_FileType::TDMS_TYPE ? "tdms" : (_fileType == Stream_FileType::RAW_TYPE ? "bin" : "wav"));
     return filename;
 }
 
@@ -68,15 +72,32 @@ CStreamingManager::Ptr CStreamingManager::Create(Stream_FileType _fileType,std::
 }
 
 CStreamingManager::CStreamingManager(Stream_FileType _fileType,std::string _filePath) :
-    m_use_local_file(true),
     notifyPassData(nullptr),
+    notifyStop(nullptr),
     m_file_manager(nullptr),
-    m_fileType(_fileType),
-    m_asionet(nullptr),
     m_filePath(_filePath),
+    m_asionet(nullptr),
+    m_udpBufferLimit(UDP_BUFFER_LIMIT),
+    m_retransmitWindow(0),
+    m_dropPolicy(asionet::DropPolicy::DROP_OLDEST),
+    m_clientQueue(TCP_CLIENT_QUEUE),
     m_index_of_message(0),
-    notifyStop(nullptr)
+    m_packVersion(PACK_VERSION),
+    m_packCrc(false),
+    m_sampleIndex(0),
+    m_cpu(-1),
+    m_fileBackpressure(false),
+    m_fileDropped(0),
+    m_segmentBytes(0),
+    m_segmentSeconds(0),
+    m_sampleRate(0),
+    m_compress(false),
+    m_droppedPacks(0),
+    m_use_local_file(true),
+    m_fileType(_fileType)
 {
+    setCalibration(1, 1, 0);
+    setCalibration(2, 1, 0);
     
     if (m_use_local_file){
         
@@ -90,18 +111,35 @@ CStreamingManager::Ptr CStreamingManager::Create(string _host, string _port, asi
 }
 
 CStreamingManager::CStreamingManager(string _host, string _port, asionet::Protocol _protocol):
-        m_use_local_file(false),
         notifyPassData(nullptr),
+        notifyStop(nullptr),
         m_file_manager(nullptr),
         m_waveWriter(nullptr),
         m_host(_host),
         m_port(_port),
+        m_filePath(""),
         m_protocol(_protocol),
         m_asionet(nullptr),
-        m_filePath(""),
+        m_udpBufferLimit(UDP_BUFFER_LIMIT),
+        m_retransmitWindow(0),
+        m_dropPolicy(asionet::DropPolicy::DROP_OLDEST),
+        m_clientQueue(TCP_CLIENT_QUEUE),
         m_index_of_message(0),
-        notifyStop(nullptr)
+        m_packVersion(PACK_VERSION),
+        m_packCrc(false),
+        m_sampleIndex(0),
+        m_cpu(-1),
+        m_fileBackpressure(false),
+        m_fileDropped(0),
+        m_segmentBytes(0),
+        m_segmentSeconds(0),
+        m_sampleRate(0),
+        m_compress(false),
+        m_droppedPacks(0),
+        m_use_local_file(false)
 {
+    setCalibration(1, 1, 0);
+    setCalibration(2, 1, 0);
 
 }
 
@@ -131,9 +169,18 @@ void CStreamingManager::startServer(){
         m_asionet = nullptr;
     }
     m_index_of_message = 0;
+    m_sampleIndex = 0;
     m_SendData = 0 ;
     m_ReadyToPass = 0;
+    uint32_t split_size = (m_protocol == asionet::Protocol::TCP ? TCP_BUFFER_LIMIT : m_udpBufferLimit);
+    size_t max_packs = (osc_buf_size + split_size - 1) / split_size;
+    m_headerPool = CBufferPool::Create(PACK_HEADER_STRIDE * max_packs, PACK_HEADER_POOL, CACHE_LINE_SIZE);
+    m_packs.reserve(max_packs);
     m_asionet = new asionet::CAsioNet(asionet::Mode::SERVER, m_protocol, m_host, m_port);
+    m_asionet->SetDropPolicy(m_dropPolicy, m_clientQueue);
+    m_asionet->SetCpuAffinity(m_cpu);
+    if (m_protocol == asionet::Protocol::UDP)
+        m_asionet->SetRetransmitWindow(m_retransmitWindow, asionet::CAsioNet::PackHeaderSize() + 2 * split_size);
     m_asionet->addCallServer_Connect([](std::string host)
                                      {
                                          std::cout << "Connected " << host << '\n';
@@ -154,6 +201,8 @@ void CStreamingManager::startServer(){
                                 }
                             });
     m_asionet->Start();
+    if (m_metricQueueSize)
+        m_metricQueueSize->set(m_asionet->GetQueueCapacity());
 }
 
 void CStreamingManager::stopServer(){
@@ -174,23 +223,56 @@ bool CStreamingManager::isFileThreadWork(){
     return false;
 }
 
+void CStreamingManager::setupMetrics(){
+    m_metricBytes = nullptr;
+    m_metricBuffers = nullptr;
+    m_metricDropped = nullptr;
+    m_metricDroppedPacks = nullptr;
+    m_metricQueueUsed = nullptr;
+    m_metricQueueSize = nullptr;
+    m_metricLatency = nullptr;
+    m_droppedPacks = 0;
+    if (m_use_local_file) {
+        // Bytes, blocks and latency are counted by the write thread
+        m_file_manager->SetMetrics(m_metrics);
+        if (m_metrics)
+            m_metricDropped = m_metrics->counter("rpsa_dropped_buffers_total", "stage=\"file_queue\"", "Buffers lost before a stage because its queue was full or the output was not ready");
+        return;
+    }
+    if (!m_metrics)
+        return;
+    m_metricBytes = m_metrics->counter("rpsa_stage_bytes_total", "stage=\"send\"", "Bytes that passed a stage of the stream");
+    m_metricBuffers = m_metrics->counter("rpsa_stage_buffers_total", "stage=\"send\"", "Buffers that passed a stage of the stream");
+    m_metricDropped = m_metrics->counter("rpsa_dropped_buffers_total", "stage=\"send\"", "Buffers lost before a stage because its queue was full or the output was not ready");
+    m_metricLatency = m_metrics->histogram("rpsa_dma_to_send_seconds", "", "Time from the end of the acquisition of a buffer until the socket (UDP) or the subscriber queues (TCP) have taken it");
+    if (m_protocol == asionet::Protocol::TCP) {
+        m_metricDroppedPacks = m_metrics->counter("rpsa_dropped_packs_total", "stage=\"tcp_queue\"", "Packs the TCP subscribers did not get because they could not keep up");
+        m_metricQueueUsed = m_metrics->gauge("rpsa_queue_used", "queue=\"tcp\"", "Blocks held in a queue between two stages");
+        m_metricQueueSize = m_metrics->gauge("rpsa_queue_size", "queue=\"tcp\"", "Capacity of a queue between two stages", false);
+    }
+}
+
 void CStreamingManager::run()
 {
+    setupMetrics();
     if (m_use_local_file){
         m_file_out = getNewFileName(m_fileType, m_filePath);      
+        m_fileDropped = 0;
         m_fileLogger = CFileLogger::Create(m_file_out + ".log"); 
         std::cout << m_file_out << "\n"; 
+        m_file_manager->SetRotation(m_segmentBytes, m_segmentSeconds);
         m_file_manager->OpenFile(m_file_out, false);
-        m_file_manager->StartWrite(m_fileType);
+        m_file_manager->SetCpuAffinity(m_cpu);
+        m_file_manager->StartWrite(m_fileType, FILE_BLOCK_HEADER + osc_buf_size * 2);
     }
     else
         this->startServer();
 }
 
-void CStreamingManager::stop(){
+void CStreamingManager::stop(bool _waitAllWrite){
     if (m_use_local_file){
         if (m_file_manager != nullptr) {
-            m_file_manager->StopWrite(false);
+            m_file_manager->StopWrite(_waitAllWrite);
         }
     } else{
         this->stopServer();
@@ -198,107 +280,286 @@ void CStreamingManager::stop(){
 }
 
 
+uint32_t CStreamingManager::maxUdpBufferLimit(){
+    return ((UDP_MAX_DATAGRAM - asionet::CAsioNet::PackHeaderSize()) / 2) & ~7u;
+}
+
+void CStreamingManager::setUdpBufferLimit(uint32_t _size){
+    m_udpBufferLimit = MAX(MIN(_size, maxUdpBufferLimit()), UDP_MIN_BUFFER_LIMIT) & ~7u;
+}
+
+void CStreamingManager::setUdpRetransmitWindow(uint32_t _window_ms){
+    m_retransmitWindow = _window_ms;
+}
+
+asionet::RetransmitStats CStreamingManager::getRetransmitStats(){
+    if (m_asionet)
+        return m_asionet->GetRetransmitStats();
+    return asionet::RetransmitStats();
+}
+
+void CStreamingManager::setTcpDropPolicy(asionet::DropPolicy _policy, size_t _max_queue){
+    m_dropPolicy = _policy;
+    m_clientQueue = _max_queue;
+}
+
+void CStreamingManager::setPackVersion(uint32_t _version){
+    m_packVersion = (_version == 1 ? 1 : 2);
+}
+
+void CStreamingManager::setPackCrc(bool _enable){
+    m_packCrc = _enable;
+}
+
+void CStreamingManager::setCalibration(int _channel, double _gain, double _offset){
+    if (_channel < 1 || _channel > 2)
+        return;
+    m_gain[_channel - 1] = _gain;
+    m_offset[_channel - 1] = _offset;
+}
+
 int CStreamingManager::passBuffers(uint64_t _lostRate, uint32_t _oscRate, const void *_buffer_ch1, uint32_t _size_ch1,const void *_buffer_ch2, uint32_t _size_ch2, unsigned short _resolution, uint64_t _id){
+    asionet::PackInfo info = {};
+    info.id = _id;
+    info.lostRate = _lostRate;
+    info.oscRate = _oscRate;
+    info.resolution = _resolution;
+    info.sampleIndex = m_sampleIndex;
+    info.channels = (_size_ch1 > 0 ? 1 : 0) | (_size_ch2 > 0 ? 2 : 0);
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    info.timestamp = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    m_sampleIndex += samplesInBytes(MAX(_size_ch1, _size_ch2), _resolution);
+    return passBuffers(info, _buffer_ch1, _size_ch1, _buffer_ch2, _size_ch2);
+}
+
+int CStreamingManager::passBuffers(const asionet::PackInfo &_info, const void *_buffer_ch1, uint32_t _size_ch1,const void *_buffer_ch2, uint32_t _size_ch2, uint64_t _readyNs){
 
     ASIO_ASSERT(!(_size_ch1 != _size_ch2 && _size_ch1 != 0 && _size_ch2 != 0));
-    uint8_t *buff_ch1 = nullptr;
-    uint8_t *buff_ch2 = nullptr;
+    uint64_t _lostRate = _info.lostRate;
+    uint32_t _oscRate = _info.oscRate;
+    unsigned short _resolution = _info.resolution;
 
     if (m_use_local_file){
 
-        if (_size_ch1>0){ 
-            buff_ch1 = new uint8_t[_size_ch1];
-            memcpy_neon(buff_ch1, _buffer_ch1, _size_ch1);
+        FileBlockInfo block_info = {_readyNs, _info.sampleIndex, samplesInBytes(MAX(_size_ch1, _size_ch2), _resolution), _info.timestamp};
+        if (_resolution == 14) {
+            // Packed samples from the network, the files hold them as 16 bit
+            size_t samples = samplesInBytes(MAX(_size_ch1, _size_ch2), 14);
+            if (m_unpack_ch1.size() < samples) {
+                m_unpack_ch1.resize(samples);
+                m_unpack_ch2.resize(samples);
+            }
+            if (_size_ch1 > 0) {
+                unpack14((const uint8_t*)_buffer_ch1, samples, m_unpack_ch1.data());
+                _buffer_ch1 = m_unpack_ch1.data();
+                _size_ch1 = samples * 2;
+            }
+            if (_size_ch2 > 0) {
+                unpack14((const uint8_t*)_buffer_ch2, samples, m_unpack_ch2.data());
+                _buffer_ch2 = m_unpack_ch2.data();
+                _size_ch2 = samples * 2;
+            }
+            _resolution = 16;
         }
 
-        if (_size_ch2>0){ 
-            buff_ch2 = new uint8_t[_size_ch2];
-            memcpy_neon(buff_ch2, _buffer_ch2, _size_ch2);
+        bool compressed = false;
+        if (m_compress && m_fileType == TDMS_TYPE && (_resolution == 8 || _resolution == 16)) {
+            size_t samples = samplesInBytes(MAX(_size_ch1, _size_ch2), _resolution);
+            size_t capacity = codecMaxSize(samples);
+            if (m_codec_ch1.size() < capacity) {
+                m_codec_ch1.resize(capacity);
+                m_codec_ch2.resize(capacity);
+            }
+            size_t size_ch1 = _size_ch1 > 0 ? codecEncode(_buffer_ch1, samples, _resolution, m_codec_ch1.data(), capacity) : 0;
+            size_t size_ch2 = _size_ch2 > 0 ? codecEncode(_buffer_ch2, samples, _resolution, m_codec_ch2.data(), capacity) : 0;
+            // Samples that do not compress are written as they are
+            if (size_ch1 + size_ch2 < _size_ch1 + _size_ch2) {
+                _buffer_ch1 = m_codec_ch1.data();
+                _buffer_ch2 = m_codec_ch2.data();
+                _size_ch1 = size_ch1;
+                _size_ch2 = size_ch2;
+                compressed = true;
+            }
         }
 
         if (_size_ch1 + _size_ch2 > 0){
-            if (m_fileType == TDMS_TYPE){
-                auto stream_data = m_file_manager->BuildTDMSStream(buff_ch1, _size_ch1, buff_ch2, _size_ch2,_resolution);
-                if (!m_file_manager->AddBufferToWrite(stream_data))
-                {
-                    m_fileLogger->AddMetric(CFileLogger::Metric::FILESYSTEM_RATE,1);
+            m_file_manager->RotateIfNeeded(_size_ch1 + _size_ch2, _info.timestamp);
+            // Until a block of the segment is queued, the next one has to start the file again
+            if (m_fileType == WAV_TYPE && m_file_manager->IsSegmentStart())
+                m_waveWriter->resetHeaderInit();
+            if (m_fileType == RAW_TYPE && m_file_manager->IsSegmentStart()) {
+                RawIndexHeader header = {};
+                header.resolution = _resolution;
+                header.channels = (_size_ch1 > 0 ? 1 : 0) | (_size_ch2 > 0 ? 2 : 0);
+                header.sampleRate = m_sampleRate > 0 ? m_sampleRate : (double)ADC_SAMPLE_RATE / MAX(_oscRate, 1u);
+                for (int ch = 0; ch < 2; ++ch) {
+                    header.gain[ch] = m_gain[ch];
+                    header.offset[ch] = m_offset[ch];
                 }
+                m_file_manager->SetRawInfo(header);
             }
+            auto block = m_file_manager->GetFreeBlock();
+            while (block == nullptr && m_fileBackpressure && m_file_manager->IsWork()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                block = m_file_manager->GetFreeBlock();
+            }
+            size_t block_size = 0;
+            if (block != nullptr){
+                if (m_fileType == TDMS_TYPE){
+                    block_size = m_file_manager->BuildTDMSBlock(block, (const uint8_t*)_buffer_ch1, _size_ch1, (const uint8_t*)_buffer_ch2, _size_ch2,_resolution,compressed);
+                }
 
+                if (m_fileType == WAV_TYPE){
+                    block_size = m_waveWriter->BuildWAVBlock(block, m_file_manager->GetBlockSize(), (const uint8_t*)_buffer_ch1, _size_ch1, (const uint8_t*)_buffer_ch2, _size_ch2,_resolution);
+                }
 
-            if (m_fileType == WAV_TYPE){
-                auto stream_data = m_waveWriter->BuildWAVStream(buff_ch1, _size_ch1, buff_ch2, _size_ch2,_resolution);
-                if (!m_file_manager->AddBufferToWrite(stream_data))
-                {
-                    m_fileLogger->AddMetric(CFileLogger::Metric::FILESYSTEM_RATE,1);
+                if (m_fileType == RAW_TYPE){
+                    block_size = m_file_manager->BuildRawBlock(block, (const uint8_t*)_buffer_ch1, _size_ch1, (const uint8_t*)_buffer_ch2, _size_ch2,_resolution);
                 }
-                delete [] buff_ch1;
-                delete [] buff_ch2;
             }
-        
 
-        
+            bool queued = block != nullptr && m_file_manager->AddBufferToWrite(block, block_size, block_info);
+            while (!queued && block != nullptr && block_size > 0 && m_fileBackpressure && m_file_manager->IsWork()) {
+                // The block stays with the producer and comes back from GetFreeBlock unchanged
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                block = m_file_manager->GetFreeBlock();
+                queued = block != nullptr && m_file_manager->AddBufferToWrite(block, block_size, block_info);
+            }
+            if (!queued)
+            {
+                ++m_fileDropped;
+                m_fileLogger->AddMetric(CFileLogger::Metric::FILESYSTEM_RATE,1);
+                if (m_metricDropped)
+                    m_metricDropped->add();
+            }
+
             m_fileLogger->AddMetric(CFileLogger::Metric::RECIVE_DATE, _size_ch1 + _size_ch2);      
             m_fileLogger->AddMetric(CFileLogger::Metric::RECIVE_DATA_CH1,_size_ch1);
             m_fileLogger->AddMetric(CFileLogger::Metric::RECIVE_DATA_CH2,_size_ch2);            
             m_fileLogger->AddMetric(CFileLogger::Metric::OSC_RATE_LOST,_lostRate);        
             m_fileLogger->AddMetric(CFileLogger::Metric::OSC_RATE,_oscRate);       
-            m_fileLogger->AddMetricId(_id);         
+            m_fileLogger->AddMetricId(_info.id);         
         }
 
         if (notifyPassData)
             notifyPassData(_size_ch1 + _size_ch2);
         return 1;
-    }else{
-        if (m_asionet){
-            if (m_asionet->IsConnected()) {
-                int m_ReadyToPass = 0;
-                uint32_t frame_offset = 0;
-                uint32_t buffer_size = MAX(_size_ch1, _size_ch2);
-                uint32_t split_size = (m_asionet->GetProtocol() == asionet::Protocol::TCP ? TCP_BUFFER_LIMIT
-                                                                                          : UDP_BUFFER_LIMIT);
-                size_t full_send_size = 0;
-                buff_ch1 = (uint8_t *) _buffer_ch1;
-                buff_ch2 = (uint8_t *) _buffer_ch2;
-                uint32_t counter = 0;
-
-                while ((frame_offset + split_size) <= buffer_size) {
-                    if (frame_offset + split_size > buffer_size)
-                        split_size = buffer_size - frame_offset;
-
-                    size_t new_buff_size = 0;
-                    auto buffer = asionet::CAsioNet::BuildPack(m_index_of_message++, _lostRate, _oscRate,  _resolution,
-                                                               (&*buff_ch1 + frame_offset),
-                                                               (_size_ch1 == 0 ? 0 : split_size),
-                                                               (&*buff_ch2 + frame_offset),
-                                                               (_size_ch2 == 0 ? 0 : split_size),
-                                                               new_buff_size);
-
-                    ++m_ReadyToPass;
-                    if(m_ReadyToPass > 0)
-                        _lostRate = 0; // Send rate only first pack
-
-                    if (!m_asionet->SendData(false, buffer, new_buff_size)) {
-                        m_ReadyToPass--;
-                    }
-                    delete buffer;
-                    frame_offset += split_size;
-                    counter++;
-                }
-
-                if (m_ReadyToPass > 0)
-                    return 1;
-                else
-                    return 0;
-            }else{
-                return 0;
-            }
+    }
 
+    int sent = sendBuffers(_info, _buffer_ch1, _size_ch1, _buffer_ch2, _size_ch2, _readyNs);
+    if (m_metricDropped) {
+        if (!sent)
+            m_metricDropped->add();
+        if (m_metricQueueUsed && m_asionet) {
+            // TCP subscriber queues, counted by the io thread
+            uint64_t dropped = m_asionet->GetDroppedPacks();
+            m_metricDroppedPacks->add(dropped - m_droppedPacks);
+            m_droppedPacks = dropped;
+            m_metricQueueUsed->set(m_asionet->GetQueuedPacks());
         }
     }
-
+    return sent;
 }
 
+int CStreamingManager::sendBuffers(const asionet::PackInfo &_info, const void *_buffer_ch1, uint32_t _size_ch1, const void *_buffer_ch2, uint32_t _size_ch2, uint64_t _readyNs){
+    if (!m_asionet || !m_asionet->IsConnected())
+        return 0;
 
+    uint8_t *buff_ch1 = nullptr;
+    uint8_t *buff_ch2 = nullptr;
+    uint64_t _lostRate = _info.lostRate;
+    uint32_t _oscRate = _info.oscRate;
+    unsigned short _resolution = _info.resolution;
+
+    uint32_t buffer_size = MAX(_size_ch1, _size_ch2);
+    uint32_t split_size = (m_asionet->GetProtocol() == asionet::Protocol::TCP ? TCP_BUFFER_LIMIT
+                                                                              : m_udpBufferLimit);
+    if (_resolution == 14)
+        split_size -= split_size % PACK14_GROUP_BYTES; // Packs start with a whole sample
+    buff_ch1 = (uint8_t *) _buffer_ch1;
+    buff_ch2 = (uint8_t *) _buffer_ch2;
+
+    size_t packs_count = (buffer_size + split_size - 1) / split_size;
+    if (packs_count * PACK_HEADER_STRIDE > m_headerPool->blockSize())
+        return 0;
+    auto headers = m_headerPool->borrow();
+    if (headers == nullptr)
+        return 0;
+
+    m_packs.resize(packs_count);
+    bool   compress = m_compress && m_packVersion != 1 && (_resolution == 8 || _resolution == 16);
+    size_t codec_stride = codecMaxSize(samplesInBytes(split_size, _resolution));
+    if (compress && m_codec_ch1.size() < packs_count * codec_stride) {
+        m_codec_ch1.resize(packs_count * codec_stride);
+        m_codec_ch2.resize(packs_count * codec_stride);
+    }
+    asionet::PackInfo info = _info;
+    if (m_packCrc)
+        info.flags |= PACK_FLAG_CRC32C;
+    double   sample_ns = 1e9 * MAX(_oscRate, 1u) / ADC_SAMPLE_RATE;
+    uint32_t frame_offset = 0;
+    for (size_t i = 0; i < packs_count; ++i) {
+        uint32_t frame_size = MIN(split_size, buffer_size - frame_offset);
+        size_t size_ch1 = (_size_ch1 == 0 ? 0 : frame_size);
+        size_t size_ch2 = (_size_ch2 == 0 ? 0 : frame_size);
+        const uint8_t *data_ch1 = buff_ch1 + frame_offset;
+        const uint8_t *data_ch2 = buff_ch2 + frame_offset;
+        info.flags &= ~PACK_FLAG_COMPRESSED;
+        if (compress) {
+            // Every pack is a stream of its own, so a lost UDP pack does not take others with it
+            size_t samples = samplesInBytes(frame_size, _resolution);
+            uint8_t *codec_ch1 = m_codec_ch1.data() + i * codec_stride;
+            uint8_t *codec_ch2 = m_codec_ch2.data() + i * codec_stride;
+            size_t enc_ch1 = size_ch1 > 0 ? codecEncode(data_ch1, samples, _resolution, codec_ch1, codec_stride) : 0;
+            size_t enc_ch2 = size_ch2 > 0 ? codecEncode(data_ch2, samples, _resolution, codec_ch2, codec_stride) : 0;
+            if (enc_ch1 + enc_ch2 < size_ch1 + size_ch2) {
+                data_ch1 = codec_ch1;
+                data_ch2 = codec_ch2;
+                size_ch1 = enc_ch1;
+                size_ch2 = enc_ch2;
+                info.flags |= PACK_FLAG_COMPRESSED;
+            }
+        }
+        auto header = headers + i * PACK_HEADER_STRIDE;
+        size_t header_size = 0;
+        if (m_packVersion == 1) {
+            header_size = asionet::CAsioNet::BuildPackHeader(header, m_index_of_message++, _lostRate, _oscRate, _resolution, size_ch1, size_ch2);
+        } else {
+            uint32_t samples = samplesInBytes(frame_offset, _resolution);
+            info.id = m_index_of_message++;
+            info.lostRate = _lostRate;
+            info.sampleIndex = _info.sampleIndex + samples;
+            info.timestamp = _info.timestamp + (uint64_t)llround(samples * sample_ns);
+            header_size = asionet::CAsioNet::BuildPackHeader(header, info, data_ch1, size_ch1, data_ch2, size_ch2);
+            info.droppedSamples = 0; // Gap is reported by the first pack only
+            info.flags &= ~PACK_FLAG_RECORD_START;
+        }
+        _lostRate = 0; // Send rate only first pack
+
+        m_packs[i] = {{
+            asio::buffer(header, header_size),
+            asio::buffer(data_ch1, size_ch1),
+            asio::buffer(data_ch2, size_ch2)
+        }};
+        frame_offset += frame_size;
+    }
 
-
+    // Counted down by the send callback, notifyPassData fires when the buffer is out.
+    // TCP only copies the packs to the subscriber queues here, it never waits for a client.
+    m_ReadyToPass = packs_count;
+    m_SendData = 0;
+    bool sent = m_asionet->SendPacks(m_packs.data(), packs_count);
+    m_headerPool->release(headers);
+
+    if (sent && m_metricBytes) {
+        size_t bytes = 0;
+        for (auto &pack : m_packs)
+            bytes += asio::buffer_size(pack);
+        m_metricBytes->add(bytes);
+        m_metricBuffers->add();
+        if (_readyNs != 0)
+            m_metricLatency->observe(metricsNowNs() - _readyNs);
+    }
+    return sent ? 1 : 0;
+}
@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include "rpsa/server/core/SyntheticSource.h"
+#include "rpsa/server/core/Oscilloscope.h"
+
+#define SYNTHETIC_TABLE_SAMPLES 98304 // Three buffers, so consecutive buffers differ
+
+SyntheticSettings CSyntheticSource::defaultSettings(){
+    SyntheticSettings settings;
+    settings.channel1 = true;
+    settings.channel2 = true;
+    settings.sampleRate = 0;
+    settings.wave = SyntheticWave::SINE_NOISE;
+    settings.frequency = 0;
+    settings.amplitude = 4096;
+    settings.noise = 16;
+    settings.overflowEvery = 0;
+    settings.overflowBuffers = 1;
+    return settings;
+}
+
+CSyntheticSource::Ptr CSyntheticSource::Create(const SyntheticSettings &_settings){
+    if (_settings.sampleRate < 0 || _settings.frequency < 0 ||
+        (_settings.sampleRate > 0 && _settings.frequency > _settings.sampleRate / 2)) {
+        std::cerr << "Error: CSyntheticSource::Create() frequency " << _settings.frequency << " Hz at " << _settings.sampleRate << " samples/s\n";
+        return Ptr();
+    }
+    return std::make_shared<CSyntheticSource>(_settings);
+}
+
+CSyntheticSource::CSyntheticSource(const SyntheticSettings &_settings):
+    CTimedSource(_settings.channel1, _settings.channel2, _settings.sampleRate, osc_buf_size / sizeof(int16_t)),
+    m_settings(_settings),
+    m_table(SYNTHETIC_TABLE_SAMPLES),
+    m_quarter(0),
+    m_buffers(0)
+{
+    // Whole periods in the table, at least one. Without a rate the frequency is taken
+    // per sample of a 125 MS/s stream.
+    double rate = _settings.sampleRate > 0 ? _settings.sampleRate : 125e6;
+    double periods = std::round(_settings.frequency * SYNTHETIC_TABLE_SAMPLES / rate);
+    if (periods < 1)
+        periods = 1;
+    m_quarter = (size_t)std::llround(SYNTHETIC_TABLE_SAMPLES / periods / 4);
+
+    bool sine = _settings.wave != SyntheticWave::NOISE;
+    bool noise = _settings.wave != SyntheticWave::SINE;
+    std::mt19937 random(1);
+    std::uniform_int_distribution<int> distribution(-_settings.noise, _settings.noise);
+    for (size_t i = 0; i < m_table.size(); ++i) {
+        double value = 0;
+        if (sine)
+            value += _settings.amplitude * std::sin(2 * M_PI * periods * i / SYNTHETIC_TABLE_SAMPLES);
+        if (noise && _settings.noise > 0)
+            value += distribution(random);
+        m_table[i] = (int16_t)std::max(-32768.0, std::min(32767.0, std::round(value)));
+    }
+}
+
+void CSyntheticSource::copyFrom(int16_t *_dst, size_t _samples, uint64_t _position) const{
+    size_t pos = _position % m_table.size();
+    while (_samples > 0) {
+        size_t n = std::min(_samples, m_table.size() - pos);
+        memcpy(_dst, m_table.data() + pos, n * sizeof(int16_t));
+        _dst += n;
+        _samples -= n;
+        pos = 0;
+    }
+}
+
+void CSyntheticSource::fill(int16_t *_ch1, int16_t *_ch2, size_t _samples, uint64_t _firstSample){
+    if (_ch1 != nullptr)
+        copyFrom(_ch1, _samples, _firstSample);
+    if (_ch2 != nullptr)
+        copyFrom(_ch2, _samples, _firstSample + m_quarter);
+    if (m_settings.overflowEvery > 0 && ++m_buffers % m_settings.overflowEvery == 0)
+        simulateOverflow(m_settings.overflowBuffers);
+}
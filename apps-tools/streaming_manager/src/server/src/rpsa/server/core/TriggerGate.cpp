@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include "rpsa/server/core/TriggerGate.h"
+
+CTriggerGate::Ptr CTriggerGate::Create(const TriggerSettings &_settings, unsigned short _resolution, size_t _maxBytes){
+    size_t bytesPerSample = (_resolution == 16 ? 2 : 1);
+    if (_settings.channel != 1 && _settings.channel != 2) {
+        std::cerr << "Error: CTriggerGate::Create() bad trigger channel " << _settings.channel << "\n";
+        return CTriggerGate::Ptr();
+    }
+    if (_settings.postSamples == 0 || (static_cast<size_t>(_settings.preSamples) + _settings.postSamples) * bytesPerSample > _maxBytes) {
+        std::cerr << "Error: CTriggerGate::Create() window must be 1.." << _maxBytes / bytesPerSample << " samples\n";
+        return CTriggerGate::Ptr();
+    }
+    return std::make_shared<CTriggerGate>(_settings, _resolution);
+}
+
+CTriggerGate::CTriggerGate(const TriggerSettings &_settings, unsigned short _resolution) :
+    m_settings(_settings),
+    m_bytesPerSample(_resolution == 16 ? 2 : 1),
+    m_historySamples(0),
+    m_recordFill(0),
+    m_remaining(0),
+    m_recordIndex(0),
+    m_recordTimestamp(0),
+    m_recordFlags(0),
+    m_armedRise(false),
+    m_armedFall(false),
+    m_records(0),
+    m_discarded(0)
+{
+    for (int ch = 0; ch < 2; ++ch) {
+        m_history[ch].assign(m_settings.preSamples * m_bytesPerSample, 0);
+        m_record[ch].assign((static_cast<size_t>(m_settings.preSamples) + m_settings.postSamples) * m_bytesPerSample, 0);
+        m_recordChannel[ch] = false;
+    }
+}
+
+void CTriggerGate::reset(){
+    m_historySamples = 0;
+    m_recordFill = 0;
+    m_remaining = 0;
+    m_armedRise = false;
+    m_armedFall = false;
+}
+
+template<typename T>
+size_t CTriggerGate::find(const T *_samples, size_t _from, size_t _to){
+    const int32_t level = m_settings.level;
+    const int32_t hysteresis = m_settings.hysteresis;
+    const bool rise = m_settings.edge != TriggerEdge::FALLING;
+    const bool fall = m_settings.edge != TriggerEdge::RISING;
+    for (size_t i = _from; i < _to; ++i) {
+        int32_t x = _samples[i];
+        if (rise) {
+            if (!m_armedRise) {
+                m_armedRise = x < level - hysteresis;
+            } else if (x >= level) {
+                m_armedRise = m_armedFall = false;
+                return i;
+            }
+        }
+        if (fall) {
+            if (!m_armedFall) {
+                m_armedFall = x > level + hysteresis;
+            } else if (x <= level) {
+                m_armedRise = m_armedFall = false;
+                return i;
+            }
+        }
+    }
+    return _to;
+}
+
+void CTriggerGate::updateHistory(const uint8_t *_buffers[2], size_t _samples){
+    size_t pre = m_settings.preSamples;
+    if (pre == 0)
+        return;
+    for (int ch = 0; ch < 2; ++ch) {
+        if (_buffers[ch] == nullptr)
+            continue;
+        uint8_t *history = m_history[ch].data();
+        if (_samples >= pre) {
+            memcpy(history, _buffers[ch] + (_samples - pre) * m_bytesPerSample, pre * m_bytesPerSample);
+        } else {
+            memmove(history, history + _samples * m_bytesPerSample, (pre - _samples) * m_bytesPerSample);
+            memcpy(history + (pre - _samples) * m_bytesPerSample, _buffers[ch], _samples * m_bytesPerSample);
+        }
+    }
+    m_historySamples = std::min(pre, m_historySamples + _samples);
+}
+
+void CTriggerGate::process(const asionet::PackInfo &_info, double _sampleNs, const void *_buffer_ch1, size_t _size_ch1, const void *_buffer_ch2, size_t _size_ch2, const Callback &_emit){
+    const uint8_t *buffers[2] = {
+        _size_ch1 > 0 ? static_cast<const uint8_t*>(_buffer_ch1) : nullptr,
+        _size_ch2 > 0 ? static_cast<const uint8_t*>(_buffer_ch2) : nullptr
+    };
+    size_t samples = std::max(_size_ch1, _size_ch2) / m_bytesPerSample;
+    if (samples == 0)
+        return;
+    if (_info.droppedSamples > 0) {
+        // Neither the history nor a started record continue into this block
+        if (m_remaining > 0) {
+            m_remaining = 0;
+            ++m_discarded;
+        }
+        m_historySamples = 0;
+    }
+
+    const size_t pre = m_settings.preSamples;
+    const uint8_t *trigger = buffers[m_settings.channel - 1];
+    size_t pos = 0;
+    while (pos < samples) {
+        if (m_remaining > 0) {
+            size_t take = std::min(m_remaining, samples - pos);
+            for (int ch = 0; ch < 2; ++ch) {
+                if (m_recordChannel[ch] && buffers[ch] != nullptr)
+                    memcpy(m_record[ch].data() + m_recordFill * m_bytesPerSample, buffers[ch] + pos * m_bytesPerSample, take * m_bytesPerSample);
+            }
+            m_recordFill += take;
+            m_remaining -= take;
+            pos += take;
+            if (m_remaining == 0) {
+                asionet::PackInfo info = {};
+                info.id = m_records++;
+                info.oscRate = _info.oscRate;
+                info.resolution = _info.resolution;
+                info.sampleIndex = m_recordIndex;
+                info.timestamp = m_recordTimestamp;
+                info.channels = (m_recordChannel[0] ? 1 : 0) | (m_recordChannel[1] ? 2 : 0);
+                info.flags = m_recordFlags | PACK_FLAG_TRIGGERED | PACK_FLAG_RECORD_START;
+                size_t size = m_recordFill * m_bytesPerSample;
+                _emit(info,
+                      m_record[0].data(), m_recordChannel[0] ? size : 0,
+                      m_record[1].data(), m_recordChannel[1] ? size : 0);
+            }
+            continue;
+        }
+
+        if (trigger == nullptr)
+            break;
+        size_t t = (m_bytesPerSample == 2) ? find(reinterpret_cast<const int16_t*>(trigger), pos, samples)
+                                           : find(reinterpret_cast<const int8_t*>(trigger), pos, samples);
+        if (t == samples)
+            break;
+        if (m_historySamples + t < pre) {
+            // Not enough samples before the trigger yet
+            pos = t + 1;
+            continue;
+        }
+
+        // Pre trigger part: the end of the history followed by the block up to the trigger
+        size_t fromHistory = (pre > t) ? pre - t : 0;
+        for (int ch = 0; ch < 2; ++ch) {
+            m_recordChannel[ch] = buffers[ch] != nullptr;
+            if (!m_recordChannel[ch])
+                continue;
+            uint8_t *record = m_record[ch].data();
+            memcpy(record, m_history[ch].data() + (pre - fromHistory) * m_bytesPerSample, fromHistory * m_bytesPerSample);
+            memcpy(record + fromHistory * m_bytesPerSample, buffers[ch] + (t - (pre - fromHistory)) * m_bytesPerSample, (pre - fromHistory) * m_bytesPerSample);
+        }
+        m_recordFill = pre;
+        m_remaining = m_settings.postSamples;
+        m_recordIndex = _info.sampleIndex + t - pre;
+        m_recordTimestamp = _info.timestamp + static_cast<int64_t>(llround((static_cast<double>(t) - pre) * _sampleNs));
+        m_recordFlags = _info.flags & ~(PACK_FLAG_CRC32C | PACK_FLAG_RECORD_START);
+        pos = t;
+    }
+    updateHistory(buffers, samples);
+}
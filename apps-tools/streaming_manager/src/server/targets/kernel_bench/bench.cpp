@@ -0,0 +1,235 @@
+// Sample kernel benchmark. Every ISA that is compiled in and supported by the CPU is first checked
+// against the scalar kernels on odd counts and unaligned pointers, then timed on a buffer of the
+// size the streaming path uses. Exits with 1 when an ISA gives a different result.
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "rpsa/common/core/sample_kernels.h"
+
+#define BENCH_SAMPLES  (1024 * 1024) // Per channel
+#define BENCH_MIN_TIME 0.2           // Seconds per kernel
+#define CHECK_MAX      300           // Checked counts are 0 .. CHECK_MAX and a few large ones
+#define CHECK_PAD      64            // Bytes around every buffer that must stay untouched
+
+const KernelIsa g_isas[] = {KernelIsa::SCALAR, KernelIsa::SSE2, KernelIsa::AVX2, KernelIsa::NEON};
+
+char* getCmdOption(char ** begin, char ** end, const std::string & option)
+{
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+bool cmdOptionExists(char** begin, char** end, const std::string& option)
+{
+    return std::find(begin, end, option) != end;
+}
+
+void UsingArgs(char const* progName){
+    std::cout << "Usage: " << progName << "\n";
+    std::cout << "\t-n Samples per channel (default " << BENCH_SAMPLES << ")\n";
+    std::cout << "\t-c Only check the kernels\n";
+}
+
+// Random bytes with CHECK_PAD guard bytes on both sides
+struct Buffer {
+    std::vector<uint8_t> bytes;
+
+    Buffer(size_t _size, std::mt19937 &_random) : bytes(_size + 2 * CHECK_PAD) {
+        for (auto &b : bytes)
+            b = (uint8_t)_random();
+    }
+    uint8_t* at(size_t _offset) { return bytes.data() + CHECK_PAD + _offset; }
+};
+
+// Runs _kernel with the current ISA and with the scalar one on copies of the same buffers
+bool same(const char *_name, size_t _count, std::vector<Buffer> _buffers, std::function<void(std::vector<Buffer>&)> _kernel){
+    auto isa = kernelIsa();
+    auto expected = _buffers;
+    kernelSetIsa(KernelIsa::SCALAR);
+    _kernel(expected);
+    kernelSetIsa(isa);
+    _kernel(_buffers);
+    for (size_t i = 0; i < _buffers.size(); ++i) {
+        if (_buffers[i].bytes != expected[i].bytes) {
+            std::cerr << "Error: " << kernelIsaName(isa) << " " << _name << " differs from scalar at " << _count << " samples\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool check(){
+    std::mt19937 random(1);
+    std::vector<size_t> counts;
+    for (size_t n = 0; n <= CHECK_MAX; ++n)
+        counts.push_back(n);
+    counts.push_back(4093);
+    counts.push_back(65536);
+    bool good = true;
+    for (auto n : counts) {
+        // Offsets of 1 and 3 bytes keep every pointer off the vector alignment
+        for (size_t shift : {0, 1, 3}) {
+            auto make = [&](std::initializer_list<size_t> _sizes){
+                std::vector<Buffer> buffers;
+                for (auto size : _sizes)
+                    buffers.emplace_back(size + shift, random);
+                return buffers;
+            };
+            good &= same("copy", n, make({n, n}), [&](std::vector<Buffer> &b){
+                kernelCopy(b[0].at(shift), b[1].at(shift), n);
+            });
+            good &= same("high8", n, make({n, n * 2}), [&](std::vector<Buffer> &b){
+                kernelHigh8((int8_t*)b[0].at(shift), (const int16_t*)b[1].at(shift), n);
+            });
+            good &= same("interleave8", n, make({n * 2, n, n}), [&](std::vector<Buffer> &b){
+                kernelInterleave8((int8_t*)b[0].at(shift), (const int8_t*)b[1].at(shift), (const int8_t*)b[2].at(shift), n);
+            });
+            good &= same("interleave16", n, make({n * 4, n * 2, n * 2}), [&](std::vector<Buffer> &b){
+                kernelInterleave16((int16_t*)b[0].at(shift), (const int16_t*)b[1].at(shift), (const int16_t*)b[2].at(shift), n);
+            });
+            good &= same("deinterleave8", n, make({n, n, n * 2}), [&](std::vector<Buffer> &b){
+                kernelDeinterleave8((int8_t*)b[0].at(shift), (int8_t*)b[1].at(shift), (const int8_t*)b[2].at(shift), n);
+            });
+            good &= same("deinterleave16", n, make({n * 2, n * 2, n * 4}), [&](std::vector<Buffer> &b){
+                kernelDeinterleave16((int16_t*)b[0].at(shift), (int16_t*)b[1].at(shift), (const int16_t*)b[2].at(shift), n);
+            });
+            good &= same("toFloat8", n, make({n * 4, n}), [&](std::vector<Buffer> &b){
+                kernelToFloat8((float*)b[0].at(shift), (const int8_t*)b[1].at(shift), n, 1.f / 127, 0.25f);
+            });
+            good &= same("toFloat16", n, make({n * 4, n * 2}), [&](std::vector<Buffer> &b){
+                kernelToFloat16((float*)b[0].at(shift), (const int16_t*)b[1].at(shift), n, 1.f / 32767, -0.5f);
+            });
+        }
+    }
+    // Values the shifts and packs could get wrong
+    int16_t edges[] = {-32768, -32767, -257, -256, -255, -129, -128, -1, 0, 1, 127, 128, 255, 256, 32767,
+                       -32768, -1, 0, 1, 255, 256, -256, 32767, -32768, 127, -128, 0x7F80, -0x7F80, 42, -42, 1000, -1000};
+    size_t count = sizeof(edges) / sizeof(edges[0]);
+    int8_t high[sizeof(edges) / sizeof(edges[0])];
+    kernelHigh8(high, edges, count);
+    for (size_t i = 0; i < count; ++i) {
+        if (high[i] != (int8_t)(edges[i] >> 8)) {
+            std::cerr << "Error: " << kernelIsaName(kernelIsa()) << " high8 of " << edges[i] << " is " << (int)high[i] << "\n";
+            good = false;
+        }
+    }
+    int16_t a[sizeof(edges) / sizeof(edges[0]) / 2];
+    int16_t b[sizeof(edges) / sizeof(edges[0]) / 2];
+    kernelDeinterleave16(a, b, edges, count / 2);
+    for (size_t i = 0; i < count / 2; ++i) {
+        if (a[i] != edges[i * 2] || b[i] != edges[i * 2 + 1]) {
+            std::cerr << "Error: " << kernelIsaName(kernelIsa()) << " deinterleave16 changes " << edges[i * 2] << ", " << edges[i * 2 + 1] << "\n";
+            good = false;
+        }
+    }
+    return good;
+}
+
+// GB/s of the bytes _kernel reads and writes per call
+double measure(size_t _bytes, std::function<void()> _kernel){
+    _kernel();
+    size_t calls = 0;
+    auto start = std::chrono::steady_clock::now();
+    double seconds = 0;
+    while (seconds < BENCH_MIN_TIME) {
+        _kernel();
+        ++calls;
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    return (double)_bytes * calls / seconds / 1e9;
+}
+
+int main(int argc, char* argv[])
+{
+    if (cmdOptionExists(argv, argv + argc, "-h")) {
+        UsingArgs(argv[0]);
+        return 0;
+    }
+    size_t n = BENCH_SAMPLES;
+    if (char *value = getCmdOption(argv, argv + argc, "-n"))
+        n = std::max(1L, atol(value));
+    bool checkOnly = cmdOptionExists(argv, argv + argc, "-c");
+
+    auto best = kernelIsa();
+    std::vector<KernelIsa> isas;
+    for (auto isa : g_isas) {
+        if (kernelSetIsa(isa))
+            isas.push_back(isa);
+    }
+    std::cout << "Kernels: ";
+    for (auto isa : isas)
+        std::cout << kernelIsaName(isa) << (isa == best ? " (default) " : " ");
+    std::cout << "\n";
+
+    bool good = true;
+    for (auto isa : isas) {
+        kernelSetIsa(isa);
+        bool ok = check();
+        std::cout << "Check " << kernelIsaName(isa) << ": " << (ok ? "ok" : "FAILED") << "\n";
+        good &= ok;
+    }
+    if (!good || checkOnly) {
+        kernelSetIsa(best);
+        return good ? 0 : 1;
+    }
+
+    std::vector<int8_t>  a8(n), b8(n), i8(n * 2);
+    std::vector<int16_t> a16(n), b16(n), i16(n * 2);
+    std::vector<float>   f(n);
+    std::mt19937 random(2);
+    for (size_t i = 0; i < n; ++i) {
+        a16[i] = (int16_t)random();
+        b16[i] = (int16_t)random();
+        a8[i] = (int8_t)a16[i];
+        b8[i] = (int8_t)b16[i];
+    }
+    kernelSetIsa(KernelIsa::SCALAR);
+    kernelInterleave8(i8.data(), a8.data(), b8.data(), n);
+    kernelInterleave16(i16.data(), a16.data(), b16.data(), n);
+
+    struct Case {
+        const char            *name;
+        size_t                 bytes;
+        std::function<void()>  run;
+    };
+    std::vector<Case> cases = {
+        {"copy",           n * 4,  [&]{ kernelCopy(i16.data(), a16.data(), n * 2); }},
+        {"high8",          n * 3,  [&]{ kernelHigh8(a8.data(), a16.data(), n); }},
+        {"interleave8",    n * 4,  [&]{ kernelInterleave8(i8.data(), a8.data(), b8.data(), n); }},
+        {"interleave16",   n * 8,  [&]{ kernelInterleave16(i16.data(), a16.data(), b16.data(), n); }},
+        {"deinterleave8",  n * 4,  [&]{ kernelDeinterleave8(a8.data(), b8.data(), i8.data(), n); }},
+        {"deinterleave16", n * 8,  [&]{ kernelDeinterleave16(a16.data(), b16.data(), i16.data(), n); }},
+        {"toFloat8",       n * 5,  [&]{ kernelToFloat8(f.data(), a8.data(), n, 1.f / 127, 0); }},
+        {"toFloat16",      n * 6,  [&]{ kernelToFloat16(f.data(), a16.data(), n, 1.f / 32767, 0); }},
+    };
+
+    std::cout << "\n" << n << " samples per channel, GB/s of memory read and written\n";
+    std::cout << std::setw(16) << "kernel";
+    for (auto isa : isas)
+        std::cout << std::setw(10) << kernelIsaName(isa);
+    std::cout << std::setw(10) << "memcpy" << "\n";
+    double memcpyRate = measure(n * 4, [&]{ memcpy(i16.data(), a16.data(), n * 2); });
+    std::cout << std::fixed << std::setprecision(2);
+    for (auto &c : cases) {
+        std::cout << std::setw(16) << c.name;
+        for (auto isa : isas) {
+            kernelSetIsa(isa);
+            std::cout << std::setw(10) << measure(c.bytes, c.run);
+        }
+        std::cout << std::setw(10) << memcpyRate << "\n";
+    }
+    kernelSetIsa(best);
+    return 0;
+}
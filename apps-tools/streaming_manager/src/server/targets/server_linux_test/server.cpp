@@ -67,6 +67,7 @@ int main()
 
     // Run application
     CStreamingApplication app(s_manger,osc0, 16 , Decimation, 3);
+    app.setSchedPolicy(CStreamingApplication::SchedPolicy::REALTIME);
     app.run();
 
     return 0;
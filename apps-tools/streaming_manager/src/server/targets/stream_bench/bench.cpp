@@ -0,0 +1,303 @@
+// End-to-end streaming benchmark without hardware. A synthetic source feeds CStreamingApplication
+// at increasing rates into a TDMS file, a TCP and a UDP server; the network streams are taken
+// back on loopback by CStreamReceiver. Every run reports the sustained throughput, the share of
+// generated samples that did not arrive and the latency of the stages.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <time.h>
+
+#include "rpsa/server/core/MetricsServer.h"
+#include "rpsa/server/core/StreamingApplication.h"
+#include "rpsa/server/core/StreamingManager.h"
+#include "rpsa/server/core/StreamReceiver.h"
+#include "rpsa/server/core/SyntheticSource.h"
+
+#define BENCH_PORT        "18990"
+#define BENCH_START_DELAY 300 // ms for the client to connect before the first buffer
+
+enum class Output {
+    FILE,
+    TCP,
+    UDP
+};
+
+struct Options {
+    std::vector<Output>   outputs;
+    std::vector<uint32_t> decimations; // 0 - free running source
+    double                seconds;
+    unsigned short        resolution;
+    bool                  compression;
+    uint32_t              overflowEvery;
+    std::string           filePath;
+    Stream_FileType       fileType;
+    uint64_t              segmentBytes;
+    uint32_t              segmentSeconds;
+    bool                  keepFiles;
+    CMetrics::Ptr         metrics;
+};
+
+struct Result {
+    double   seconds;
+    uint64_t generated;     // Samples per channel
+    uint64_t delivered;
+    double   processAvgUs;  // Buffer ready to passBuffers done
+    double   processMaxUs;
+    double   deliverAvgUs;  // Last sample of a pack to the pack decoded by the client
+    double   deliverMaxUs;
+};
+
+char* getCmdOption(char ** begin, char ** end, const std::string & option)
+{
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+bool cmdOptionExists(char** begin, char** end, const std::string& option)
+{
+    return std::find(begin, end, option) != end;
+}
+
+void UsingArgs(char const* progName){
+    std::cout << "Usage: " << progName << "\n";
+    std::cout << "\t-o Outputs, comma separated: file,tcp,udp (default all)\n";
+    std::cout << "\t-r Decimations, comma separated, 0 - as fast as possible (default 64,32,16,8,4,0)\n";
+    std::cout << "\t-d Seconds per run (default 3)\n";
+    std::cout << "\t-b Resolution 8, 14 or 16 (default 16)\n";
+    std::cout << "\t-z Compression\n";
+    std::cout << "\t-x Simulated DMA overflow every n buffers (default off)\n";
+    std::cout << "\t-f Directory for the file output (default /tmp)\n";
+    std::cout << "\t-w Format of the file output: tdms, wav or bin (default tdms)\n";
+    std::cout << "\t-s Split the file output into segments of n MB\n";
+    std::cout << "\t-t Split the file output into segments of n seconds\n";
+    std::cout << "\t-k Keep the files of the file output\n";
+    std::cout << "\t-m Serve the metrics of all runs while they run, unix:/path or host:port\n";
+}
+
+std::vector<std::string> split(const std::string &_value){
+    std::vector<std::string> items;
+    std::stringstream stream(_value);
+    std::string item;
+    while (std::getline(stream, item, ','))
+        items.push_back(item);
+    return items;
+}
+
+uint64_t realtimeNs(){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+Result runOne(const Options &_options, Output _output, uint32_t _decimation){
+    Result result = {};
+    uint32_t oscRate = _decimation > 0 ? _decimation : 1;
+    double   sampleNs = 1e9 * oscRate / ADC_SAMPLE_RATE;
+
+    CStreamingManager::Ptr manager;
+    if (_output == Output::FILE) {
+        manager = CStreamingManager::Create(_options.fileType, _options.filePath);
+    } else {
+        manager = CStreamingManager::Create("127.0.0.1", BENCH_PORT, _output == Output::TCP ? asionet::Protocol::TCP : asionet::Protocol::UDP);
+    }
+    manager->setCompression(_options.compression);
+    manager->setFileRotation(_options.segmentBytes, _options.segmentSeconds);
+
+    SyntheticSettings settings = CSyntheticSource::defaultSettings();
+    settings.sampleRate = _decimation > 0 ? ADC_SAMPLE_RATE / _decimation : 0;
+    settings.frequency = _decimation > 0 ? settings.sampleRate / 100 : 1e6;
+    settings.overflowEvery = _options.overflowEvery;
+    auto source = CSyntheticSource::Create(settings);
+
+    CStreamingApplication app(manager, source, _options.resolution, oscRate, 3);
+    app.setStartDelay(BENCH_START_DELAY);
+    app.setMetrics(_options.metrics);
+
+    asionet::CAsioNet::Ptr client;
+    CStreamReceiver::Ptr   receiver;
+    std::atomic<bool>      consume(true);
+    std::thread            consumer;
+    uint64_t               latencySum = 0;
+    uint64_t               latencyMax = 0;
+    uint64_t               latencyCount = 0;
+
+    app.runNonBlock();
+    if (_output != Output::FILE) {
+        client = asionet::CAsioNet::Create(asionet::Mode::CLIENT, _output == Output::TCP ? asionet::Protocol::TCP : asionet::Protocol::UDP, "127.0.0.1", BENCH_PORT);
+        receiver = CStreamReceiver::Create(client, CBufferPool::Create(RECEIVER_BLOCK_SIZE, RECEIVER_BLOCK_COUNT));
+        consumer = std::thread([&](){
+            CStreamReceiver::Block block;
+            while (consume) {
+                if (!receiver->pop(block)) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+                    continue;
+                }
+                uint64_t samples = std::max(block.size_ch1, block.size_ch2) / (block.info.resolution / 8);
+                uint64_t last = block.info.timestamp + (uint64_t)(samples * sampleNs);
+                uint64_t now = realtimeNs();
+                uint64_t latency = now > last ? now - last : 0;
+                latencySum += latency;
+                latencyMax = std::max(latencyMax, latency);
+                latencyCount++;
+                receiver->release(block);
+            }
+        });
+        client->Start();
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(BENCH_START_DELAY + (int)(_options.seconds * 1000)));
+    app.stop();
+    auto end = std::chrono::steady_clock::now();
+    auto stats = app.getStats();
+    uint64_t spb = osc_buf_size / sizeof(int16_t); // Samples per channel in one source buffer
+
+    if (receiver) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200)); // Packs still on the way
+        consume = false;
+        consumer.join();
+        client->Stop();
+        result.delivered = receiver->getStats().samples_ch1;
+        result.deliverAvgUs = latencyCount > 0 ? latencySum / 1000.0 / latencyCount : 0;
+        result.deliverMaxUs = latencyMax / 1000.0;
+    } else {
+        uint64_t dropped = std::min<uint64_t>(manager->getFileDropped(), stats.buffers);
+        result.delivered = (stats.buffers - dropped) * spb;
+        auto name = manager->getFileName();
+        if (_options.keepFiles) {
+            std::cout << "File output: " << name << "\n";
+        } else if (_options.segmentBytes > 0 || _options.segmentSeconds > 0) {
+            auto dot = name.rfind('.');
+            auto stem = name.substr(0, dot);
+            for (int i = 0; ; ++i) {
+                std::stringstream segment;
+                segment << stem << "_" << std::setw(5) << std::setfill('0') << i << name.substr(dot);
+                if (remove(segment.str().c_str()) != 0)
+                    break;
+                remove((segment.str() + ".idx").c_str());
+                remove((segment.str() + ".json").c_str());
+            }
+            remove((stem + ".manifest.json").c_str());
+        } else {
+            remove(name.c_str());
+            remove((name + ".idx").c_str());
+            remove((name + ".json").c_str());
+        }
+        if (!_options.keepFiles)
+            remove((name + ".log").c_str());
+    }
+    result.seconds = std::chrono::duration<double>(end - begin).count() - BENCH_START_DELAY / 1000.0;
+    result.generated = stats.buffers * spb + stats.droppedSamples;
+    result.processAvgUs = stats.avgProcessNs / 1000.0;
+    result.processMaxUs = stats.maxProcessNs / 1000.0;
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    if (cmdOptionExists(argv, argv + argc, "-h")) {
+        UsingArgs(argv[0]);
+        return 0;
+    }
+
+    Options options;
+    char * outputs = getCmdOption(argv, argv + argc, "-o");
+    char * rates = getCmdOption(argv, argv + argc, "-r");
+    char * seconds = getCmdOption(argv, argv + argc, "-d");
+    char * resolution = getCmdOption(argv, argv + argc, "-b");
+    char * overflow = getCmdOption(argv, argv + argc, "-x");
+    char * filepath = getCmdOption(argv, argv + argc, "-f");
+    char * metrics = getCmdOption(argv, argv + argc, "-m");
+    char * format = getCmdOption(argv, argv + argc, "-w");
+    char * segmentSize = getCmdOption(argv, argv + argc, "-s");
+    char * segmentTime = getCmdOption(argv, argv + argc, "-t");
+
+    for (auto &name : split(outputs != nullptr ? outputs : "file,tcp,udp")) {
+        if (name == "file") {
+            options.outputs.push_back(Output::FILE);
+        } else if (name == "tcp") {
+            options.outputs.push_back(Output::TCP);
+        } else if (name == "udp") {
+            options.outputs.push_back(Output::UDP);
+        } else {
+            std::cout << "Error: unknown output " << name << "\n";
+            UsingArgs(argv[0]);
+            return -1;
+        }
+    }
+    for (auto &value : split(rates != nullptr ? rates : "64,32,16,8,4,0"))
+        options.decimations.push_back(atoi(value.c_str()));
+    options.seconds = seconds != nullptr ? atof(seconds) : 3;
+    options.resolution = resolution != nullptr ? atoi(resolution) : 16;
+    options.compression = cmdOptionExists(argv, argv + argc, "-z");
+    options.overflowEvery = overflow != nullptr ? atoi(overflow) : 0;
+    options.filePath = filepath != nullptr ? filepath : "/tmp";
+    std::string formatName = format != nullptr ? format : "tdms";
+    if (formatName == "tdms") {
+        options.fileType = Stream_FileType::TDMS_TYPE;
+    } else if (formatName == "wav") {
+        options.fileType = Stream_FileType::WAV_TYPE;
+    } else if (formatName == "bin") {
+        options.fileType = Stream_FileType::RAW_TYPE;
+    } else {
+        std::cout << "Error: unknown file format " << formatName << "\n";
+        UsingArgs(argv[0]);
+        return -1;
+    }
+    options.segmentBytes = segmentSize != nullptr ? atof(segmentSize) * 1024 * 1024 : 0;
+    options.segmentSeconds = segmentTime != nullptr ? atoi(segmentTime) : 0;
+    options.keepFiles = cmdOptionExists(argv, argv + argc, "-k");
+    if (options.resolution != 8 && options.resolution != 14 && options.resolution != 16) {
+        std::cout << "Error: resolution must be 8, 14 or 16\n";
+        return -1;
+    }
+
+    CMetricsServer::Ptr metricsServer;
+    if (metrics != nullptr) {
+        options.metrics = CMetrics::Create();
+        metricsServer = CMetricsServer::Create(options.metrics, metrics);
+        if (!metricsServer)
+            return -1;
+    }
+
+    std::vector<std::string> lines;
+    for (auto output : options.outputs) {
+        for (auto decimation : options.decimations) {
+            Result result = runOne(options, output, decimation);
+            double bytesPerSample = options.resolution == 8 ? 1 : 2;
+            double mbs = result.delivered * 2 * bytesPerSample / result.seconds / 1e6;
+            double drop = result.generated > 0 ? 100.0 * (1.0 - std::min(1.0, (double)result.delivered / result.generated)) : 0;
+
+            std::stringstream line;
+            line << std::fixed << std::setprecision(1)
+                 << std::setw(5) << (output == Output::FILE ? "file" : (output == Output::TCP ? "tcp" : "udp"))
+                 << std::setw(10) << (decimation > 0 ? ADC_SAMPLE_RATE / decimation / 1e6 : 0)
+                 << std::setw(10) << mbs
+                 << std::setw(9) << std::setprecision(2) << drop
+                 << std::setw(11) << std::setprecision(0) << result.processAvgUs
+                 << std::setw(11) << result.processMaxUs;
+            if (output != Output::FILE)
+                line << std::setw(11) << result.deliverAvgUs << std::setw(11) << result.deliverMaxUs;
+            lines.push_back(line.str());
+        }
+    }
+
+    std::cout << "\nResolution " << options.resolution << " bit, 2 channels, " << options.seconds << " s per run"
+              << (options.compression ? ", compression" : "") << "\n";
+    std::cout << "  out  MS/s/ch      MB/s   drop %  proc avg  proc max  deliv avg  deliv max (us)\n";
+    std::cout << "  (MS/s 0 - free running source)\n";
+    for (auto &line : lines)
+        std::cout << line << "\n";
+    return 0;
+}
@@ -0,0 +1,689 @@
+// Offline converter for the recordings of the streaming manager. TDMS files are read through
+// TDMS::MappedReader, WAV and RAW_TYPE .bin files with positional reads. The input is cut into
+// pieces along its segments, the pieces are scaled and formatted on all cores and written in
+// order through a bounded ring of output buffers, so the memory use does not depend on the size
+// of the recording.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "rpsa/common/core/DataType.h"
+#include "rpsa/common/core/MappedReader.h"
+#include "rpsa/common/core/raw_file.h"
+#include "rpsa/common/core/sample_kernels.h"
+#include "rpsa/common/core/wavWriter.h"
+
+#define CONVERT_PIECE_SAMPLES (256 * 1024) // Samples per channel a piece is grown to
+#define CONVERT_SLOTS_PER_JOB 2            // Output buffers in flight per worker
+#define CONVERT_CSV_DIGITS    6            // Decimals of scaled samples in csv
+
+enum class Format {
+    CSV, // One line per sample, channels separated by commas
+    F32, // float32 little endian, channels interleaved
+    WAV  // PCM as recorded, channels interleaved
+};
+
+struct Options {
+    std::string         input;
+    std::string         output;
+    std::string         inputType;
+    Format              format;
+    std::vector<std::string> channels;
+    unsigned            jobs;
+    std::vector<double> gains;
+    std::vector<double> offsets;
+    int                 digits;      // -1 - 0 for samples as they are, CONVERT_CSV_DIGITS otherwise
+    double              sampleRate;  // 0 - from the input
+    bool                indexCache;
+};
+
+// Samples of one channel: sample i at data + i * stride
+struct Run {
+    const uint8_t *data;
+    uint64_t       count;
+    uint32_t       stride;
+};
+
+// Sample range converted by one worker, the same for all channels
+struct Piece {
+    uint64_t first;
+    uint64_t count;
+};
+
+struct Channel {
+    std::string name;
+    uint8_t     sampleSize; // 1 - int8, 2 - int16
+    double      gain;       // Value = sample * gain + offset
+    double      offset;
+};
+
+class Input {
+public:
+    virtual ~Input() {}
+    // Fills _runs[i] with the samples of channel _selected[i], _scratch belongs to the calling worker
+    virtual bool load(const Piece &_piece, const std::vector<int> &_selected, std::vector<std::vector<Run>> &_runs, std::vector<uint8_t> &_scratch) = 0;
+
+    std::vector<Channel> channels;
+    std::vector<Piece>   pieces;
+    uint64_t             samples = 0;
+    double               sampleRate = 0; // 0 - unknown
+};
+
+class TdmsInput : public Input {
+public:
+    static std::unique_ptr<Input> Open(const std::string &_fileName, bool _cache){
+        auto reader = TDMS::MappedReader::Open(_fileName, _cache);
+        if (!reader)
+            return nullptr;
+        std::unique_ptr<TdmsInput> input(new TdmsInput());
+        input->m_reader = reader;
+        int first = -1;
+        for (size_t i = 0; i < reader->channels().size(); ++i) {
+            auto &info = reader->channels()[i];
+            if (info.dataType != TDMS::DataType::Integer8 && info.dataType != TDMS::DataType::Integer16) {
+                std::cout << "Skip " << info.path << ": not 8 or 16 bit samples\n";
+                continue;
+            }
+            input->channels.push_back({info.name, (uint8_t)TDMS::DataType::GetLength(info.dataType), 1, 0});
+            input->m_index.push_back(i);
+            input->samples = first < 0 ? info.samples : std::min(input->samples, info.samples);
+            if (first < 0)
+                first = i;
+        }
+        if (first < 0)
+            return std::unique_ptr<Input>(std::move(input));
+
+        // Whole segments, so a piece is a run of chunks of the file
+        Piece piece = {0, 0};
+        for (uint32_t segment = 0; segment < reader->segments(); ++segment) {
+            uint64_t begin = 0, count = 0;
+            if (!reader->segmentRange(first, segment, begin, count))
+                continue;
+            piece.count = std::min(begin + count, input->samples) - piece.first;
+            if (piece.count >= CONVERT_PIECE_SAMPLES) {
+                input->pieces.push_back(piece);
+                piece = {piece.first + piece.count, 0};
+            }
+        }
+        if (piece.first < input->samples) {
+            piece.count = input->samples - piece.first;
+            input->pieces.push_back(piece);
+        }
+        return std::unique_ptr<Input>(std::move(input));
+    }
+
+    bool load(const Piece &_piece, const std::vector<int> &_selected, std::vector<std::vector<Run>> &_runs, std::vector<uint8_t> &_scratch) override{
+        thread_local std::vector<TDMS::MappedReader::View<int8_t>> views8;
+        thread_local std::vector<TDMS::MappedReader::View<int16_t>> views16;
+        std::vector<int> copied;
+        for (size_t i = 0; i < _selected.size(); ++i) {
+            int channel = m_index[_selected[i]];
+            _runs[i].clear();
+            // Zero copy unless the chunks are compressed
+            if (channels[_selected[i]].sampleSize == 1 && m_reader->view(channel, _piece.first, _piece.count, views8)) {
+                for (auto &view : views8)
+                    _runs[i].push_back({view.data, view.count, view.stride});
+            } else if (channels[_selected[i]].sampleSize == 2 && m_reader->view(channel, _piece.first, _piece.count, views16)) {
+                for (auto &view : views16)
+                    _runs[i].push_back({view.data, view.count, view.stride});
+            } else {
+                copied.push_back(i);
+            }
+        }
+        if (copied.empty())
+            return true;
+
+        size_t size = 0;
+        for (auto i : copied)
+            size += _piece.count * channels[_selected[i]].sampleSize;
+        _scratch.resize(size);
+        auto dst = _scratch.data();
+        for (auto i : copied) {
+            auto sampleSize = channels[_selected[i]].sampleSize;
+            if (!m_reader->read(m_index[_selected[i]], _piece.first, _piece.count, dst))
+                return false;
+            _runs[i].push_back({dst, _piece.count, sampleSize});
+            dst += _piece.count * sampleSize;
+        }
+        return true;
+    }
+
+private:
+    TDMS::MappedReader::Ptr m_reader;
+    std::vector<int>        m_index; // Reader channel of each channel
+};
+
+// Channels interleaved in frames of a fixed size after a header: WAV and RAW_TYPE
+class FrameInput : public Input {
+public:
+    ~FrameInput(){
+        if (m_fd >= 0)
+            close(m_fd);
+    }
+
+    // Samples of 8 bit files are signed, as CWaveWriter and FileQueueManager write them
+    static std::unique_ptr<Input> OpenWav(const std::string &_fileName){
+        std::unique_ptr<FrameInput> input(new FrameInput());
+        if (!input->open(_fileName))
+            return nullptr;
+        uint8_t riff[12];
+        if (!input->readAt(0, riff, sizeof(riff)) || (memcmp(riff, "RIFF", 4) != 0 && memcmp(riff, "RF64", 4) != 0) || memcmp(riff + 8, "WAVE", 4) != 0) {
+            std::cout << "Error: " << _fileName << " is not a WAV file\n";
+            return nullptr;
+        }
+        uint64_t position = 12;
+        uint64_t ds64Size = 0;
+        uint16_t channels = 0, bits = 0, format = 0;
+        uint32_t rate = 0;
+        while (position + 8 <= input->m_size) {
+            uint8_t chunk[36] = {};
+            input->readAt(position, chunk, std::min<uint64_t>(sizeof(chunk), input->m_size - position));
+            uint32_t size = get<uint32_t>(chunk + 4);
+            if (memcmp(chunk, "ds64", 4) == 0) {
+                ds64Size = get<uint64_t>(chunk + 16);
+            } else if (memcmp(chunk, "fmt ", 4) == 0) {
+                format = get<uint16_t>(chunk + 8);
+                channels = get<uint16_t>(chunk + 10);
+                rate = get<uint32_t>(chunk + 12);
+                bits = get<uint16_t>(chunk + 22);
+            } else if (memcmp(chunk, "data", 4) == 0) {
+                input->m_dataOffset = position + 8;
+                uint64_t dataSize = size == UINT32_MAX ? ds64Size : size;
+                // A recording that is still open has the size of the last checkpoint
+                input->m_dataSize = std::max(dataSize, input->m_size - input->m_dataOffset);
+                break;
+            }
+            position += 8 + size + (size & 1);
+        }
+        if (input->m_dataOffset == 0 || format != 1 || (bits != 8 && bits != 16) || channels == 0) {
+            std::cout << "Error: " << _fileName << " is not 8 or 16 bit PCM\n";
+            return nullptr;
+        }
+        for (uint16_t i = 0; i < channels; ++i)
+            input->channels.push_back({"ch" + std::to_string(i + 1), (uint8_t)(bits / 8), 1, 0});
+        input->sampleRate = rate;
+        input->setFrames(channels * bits / 8);
+        return std::unique_ptr<Input>(std::move(input));
+    }
+
+    static std::unique_ptr<Input> OpenRaw(const std::string &_fileName){
+        std::unique_ptr<FrameInput> input(new FrameInput());
+        if (!input->open(_fileName))
+            return nullptr;
+        RawIndexHeader header = {};
+        FILE *index = fopen((_fileName + ".idx").c_str(), "rb");
+        bool good = index != nullptr && fread(&header, sizeof(header), 1, index) == 1 && header.magic == RAW_INDEX_MAGIC;
+        if (index != nullptr)
+            fclose(index);
+        if (!good || CRawIndexWriter::frameSize(header) == 0) {
+            std::cout << "Error: can't read the index " << _fileName << ".idx\n";
+            return nullptr;
+        }
+        for (int ch = 0; ch < 2; ++ch) {
+            if (header.channels & (1 << ch))
+                input->channels.push_back({"ch" + std::to_string(ch + 1), (uint8_t)(header.resolution / 8), header.gain[ch], header.offset[ch]});
+        }
+        input->sampleRate = header.sampleRate;
+        input->m_dataSize = input->m_size;
+        input->setFrames(CRawIndexWriter::frameSize(header));
+        return std::unique_ptr<Input>(std::move(input));
+    }
+
+    bool load(const Piece &_piece, const std::vector<int> &_selected, std::vector<std::vector<Run>> &_runs, std::vector<uint8_t> &_scratch) override{
+        _scratch.resize(_piece.count * m_frameSize);
+        if (!readAt(m_dataOffset + _piece.first * m_frameSize, _scratch.data(), _scratch.size()))
+            return false;
+        for (size_t i = 0; i < _selected.size(); ++i) {
+            uint32_t position = 0;
+            for (int ch = 0; ch < _selected[i]; ++ch)
+                position += channels[ch].sampleSize;
+            _runs[i].assign(1, {_scratch.data() + position, _piece.count, m_frameSize});
+        }
+        return true;
+    }
+
+private:
+    template<typename T>
+    static T get(const uint8_t *_data){
+        T value;
+        memcpy(&value, _data, sizeof(T));
+        return value;
+    }
+
+    bool open(const std::string &_fileName){
+        struct stat info;
+        m_fd = ::open(_fileName.c_str(), O_RDONLY);
+        if (m_fd < 0 || fstat(m_fd, &info) != 0) {
+            std::cout << "Error: can't open " << _fileName << "\n";
+            return false;
+        }
+        m_size = info.st_size;
+        return true;
+    }
+
+    bool readAt(uint64_t _offset, uint8_t *_data, size_t _size){
+        while (_size > 0) {
+            ssize_t done = pread(m_fd, _data, _size, _offset);
+            if (done <= 0)
+                return false;
+            _data += done;
+            _offset += done;
+            _size -= done;
+        }
+        return true;
+    }
+
+    void setFrames(uint32_t _frameSize){
+        m_frameSize = _frameSize;
+        samples = std::min(m_dataSize, m_size - m_dataOffset) / m_frameSize;
+        for (uint64_t first = 0; first < samples; first += CONVERT_PIECE_SAMPLES)
+            pieces.push_back({first, std::min<uint64_t>(CONVERT_PIECE_SAMPLES, samples - first)});
+    }
+
+    int      m_fd = -1;
+    uint64_t m_size = 0;
+    uint64_t m_dataOffset = 0;
+    uint64_t m_dataSize = 0;
+    uint32_t m_frameSize = 0;
+};
+
+void toFloat(const int8_t *_src, size_t _count, float _gain, float _offset, float *_dst){
+    kernelToFloat8(_dst, _src, _count, _gain, _offset);
+}
+
+void toFloat(const int16_t *_src, size_t _count, float _gain, float _offset, float *_dst){
+    kernelToFloat16(_dst, _src, _count, _gain, _offset);
+}
+
+// Value = sample * gain + offset into every _dstStride-th float. The dense case goes to the
+// SIMD kernels.
+template<typename T>
+void scaleRun(const Run &_run, float _gain, float _offset, float *_dst, size_t _dstStride){
+    if (_run.stride == sizeof(T) && _dstStride == 1) {
+        toFloat((const T*)_run.data, _run.count, _gain, _offset, _dst);
+        return;
+    }
+    for (uint64_t i = 0; i < _run.count; ++i) {
+        T value;
+        memcpy(&value, _run.data + i * _run.stride, sizeof(T));
+        _dst[i * _dstStride] = value * _gain + _offset;
+    }
+}
+
+void scale(const std::vector<Run> &_runs, uint8_t _sampleSize, float _gain, float _offset, float *_dst, size_t _dstStride){
+    for (auto &run : _runs) {
+        if (_sampleSize == 1)
+            scaleRun<int8_t>(run, _gain, _offset, _dst, _dstStride);
+        else
+            scaleRun<int16_t>(run, _gain, _offset, _dst, _dstStride);
+        _dst += run.count * _dstStride;
+    }
+}
+
+// Fixed point text of _value, the caller reserves 24 + _digits bytes
+char* putFixed(char *_dst, float _value, int _digits, int64_t _scale){
+    int64_t value = llround((double)_value * _scale);
+    if (value < 0) {
+        *_dst++ = '-';
+        value = -value;
+    }
+    char digits[24];
+    int count = 0;
+    for (int i = 0; i < _digits || value > 0 || count <= _digits; ++i) {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    }
+    while (count > 0) {
+        if (count == _digits)
+            *_dst++ = '.';
+        *_dst++ = digits[--count];
+    }
+    return _dst;
+}
+
+// Per worker state, reused for every piece
+struct Worker {
+    std::vector<std::vector<Run>> runs;
+    std::vector<uint8_t>          scratch;
+    std::vector<uint8_t>          gather[2];
+    std::vector<float>            values;
+    CWaveWriter                   wav;
+};
+
+bool convertPiece(const Options &_options, Input &_input, const std::vector<int> &_selected, size_t _index, Worker &_worker, std::vector<uint8_t> &_out){
+    auto &piece = _input.pieces[_index];
+    size_t count = piece.count;
+    size_t channels = _selected.size();
+    _worker.runs.resize(channels);
+    if (!_input.load(piece, _selected, _worker.runs, _worker.scratch))
+        return false;
+
+    if (_options.format == Format::F32) {
+        _out.resize(count * channels * sizeof(float));
+        for (size_t i = 0; i < channels; ++i) {
+            auto &channel = _input.channels[_selected[i]];
+            scale(_worker.runs[i], channel.sampleSize, channel.gain, channel.offset, (float*)_out.data() + i, channels);
+        }
+        return true;
+    }
+
+    if (_options.format == Format::CSV) {
+        _worker.values.resize(count * channels);
+        for (size_t i = 0; i < channels; ++i) {
+            auto &channel = _input.channels[_selected[i]];
+            scale(_worker.runs[i], channel.sampleSize, channel.gain, channel.offset, _worker.values.data() + i * count, 1);
+        }
+        int64_t digitScale = 1;
+        for (int i = 0; i < _options.digits; ++i)
+            digitScale *= 10;
+        _out.resize(count * channels * (24 + _options.digits + 1));
+        auto dst = (char*)_out.data();
+        for (size_t s = 0; s < count; ++s) {
+            for (size_t i = 0; i < channels; ++i) {
+                dst = putFixed(dst, _worker.values[i * count + s], _options.digits, digitScale);
+                *dst++ = i + 1 < channels ? ',' : '\n';
+            }
+        }
+        _out.resize(dst - (char*)_out.data());
+        return true;
+    }
+
+    // WAV: CWaveWriter interleaves whole channel buffers
+    const uint8_t *buffers[2] = {nullptr, nullptr};
+    size_t sizes[2] = {0, 0};
+    auto sampleSize = _input.channels[_selected[0]].sampleSize;
+    for (size_t i = 0; i < channels; ++i) {
+        auto &runs = _worker.runs[i];
+        sizes[i] = count * sampleSize;
+        if (runs.size() == 1 && runs[0].stride == sampleSize) {
+            buffers[i] = runs[0].data;
+            continue;
+        }
+        auto &gather = _worker.gather[i];
+        gather.resize(sizes[i]);
+        auto dst = gather.data();
+        for (auto &run : runs) {
+            for (uint64_t s = 0; s < run.count; ++s, dst += sampleSize)
+                memcpy(dst, run.data + s * run.stride, sampleSize);
+        }
+        buffers[i] = gather.data();
+    }
+    _out.resize(CWaveWriter::headerSize() + sizes[0] + sizes[1]);
+    _worker.wav.resetHeaderInit(_index == 0);
+    size_t size = _worker.wav.BuildWAVBlock(_out.data(), _out.size(), buffers[0], sizes[0], buffers[1], sizes[1], sampleSize * 8);
+    _out.resize(size);
+    return size > 0;
+}
+
+char* getCmdOption(char ** begin, char ** end, const std::string & option)
+{
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+bool cmdOptionExists(char** begin, char** end, const std::string& option)
+{
+    return std::find(begin, end, option) != end;
+}
+
+void UsingArgs(char const* progName){
+    std::cout << "Usage: " << progName << "\n";
+    std::cout << "\t-i Input file, a tdms, wav or bin recording (required)\n";
+    std::cout << "\t-o Output file (default the input with the extension of the format)\n";
+    std::cout << "\t-f Output format: csv, f32 (float32 interleaved) or wav (default csv)\n";
+    std::cout << "\t-t Input type: tdms, wav or bin (default from the extension)\n";
+    std::cout << "\t-c Channels, comma separated names (default all)\n";
+    std::cout << "\t-j Worker threads (default all cores)\n";
+    std::cout << "\t-g Gains of the channels, comma separated (default 1, or from the bin index)\n";
+    std::cout << "\t-b Offsets of the channels, comma separated (default 0, or from the bin index)\n";
+    std::cout << "\t-p Decimals of csv (default 0 for samples as they are, " << CONVERT_CSV_DIGITS << " for scaled ones)\n";
+    std::cout << "\t-r Sample rate for the wav header (default from the input)\n";
+    std::cout << "\t-x Use and keep the index of tdms inputs next to the file\n";
+}
+
+std::vector<std::string> split(const std::string &_value){
+    std::vector<std::string> items;
+    std::stringstream stream(_value);
+    std::string item;
+    while (std::getline(stream, item, ','))
+        items.push_back(item);
+    return items;
+}
+
+std::string extension(const std::string &_fileName){
+    auto dot = _fileName.rfind('.');
+    auto slash = _fileName.find_last_of("\\/");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return "";
+    return _fileName.substr(dot + 1);
+}
+
+int main(int argc, char* argv[])
+{
+    if (cmdOptionExists(argv, argv + argc, "-h") || argc == 1) {
+        UsingArgs(argv[0]);
+        return 0;
+    }
+
+    Options options;
+    char * input = getCmdOption(argv, argv + argc, "-i");
+    char * output = getCmdOption(argv, argv + argc, "-o");
+    char * format = getCmdOption(argv, argv + argc, "-f");
+    char * type = getCmdOption(argv, argv + argc, "-t");
+    char * channels = getCmdOption(argv, argv + argc, "-c");
+    char * jobs = getCmdOption(argv, argv + argc, "-j");
+    char * gains = getCmdOption(argv, argv + argc, "-g");
+    char * offsets = getCmdOption(argv, argv + argc, "-b");
+    char * digits = getCmdOption(argv, argv + argc, "-p");
+    char * rate = getCmdOption(argv, argv + argc, "-r");
+
+    if (input == nullptr) {
+        std::cout << "Missing parameters: input file\n";
+        UsingArgs(argv[0]);
+        return -1;
+    }
+    options.input = input;
+    std::string formatName = format != nullptr ? format : "csv";
+    if (formatName == "csv") {
+        options.format = Format::CSV;
+    } else if (formatName == "f32") {
+        options.format = Format::F32;
+    } else if (formatName == "wav") {
+        options.format = Format::WAV;
+    } else {
+        std::cout << "Error: unknown output format " << formatName << "\n";
+        UsingArgs(argv[0]);
+        return -1;
+    }
+    options.inputType = type != nullptr ? type : extension(options.input);
+    options.output = output != nullptr ? output : options.input.substr(0, options.input.size() - extension(options.input).size()) + formatName;
+    if (output == nullptr && extension(options.input).empty())
+        options.output = options.input + "." + formatName;
+    if (channels != nullptr)
+        options.channels = split(channels);
+    options.jobs = jobs != nullptr ? atoi(jobs) : std::thread::hardware_concurrency();
+    options.jobs = std::max(options.jobs, 1u);
+    for (auto &value : split(gains != nullptr ? gains : ""))
+        options.gains.push_back(atof(value.c_str()));
+    for (auto &value : split(offsets != nullptr ? offsets : ""))
+        options.offsets.push_back(atof(value.c_str()));
+    options.digits = digits != nullptr ? std::min(std::max(atoi(digits), 0), 12) : -1;
+    options.sampleRate = rate != nullptr ? atof(rate) : 0;
+    options.indexCache = cmdOptionExists(argv, argv + argc, "-x");
+    if (options.output == options.input) {
+        std::cout << "Error: the output would overwrite the input\n";
+        return -1;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    std::unique_ptr<Input> source;
+    if (options.inputType == "tdms") {
+        source = TdmsInput::Open(options.input, options.indexCache);
+    } else if (options.inputType == "wav") {
+        source = FrameInput::OpenWav(options.input);
+    } else if (options.inputType == "bin") {
+        source = FrameInput::OpenRaw(options.input);
+    } else {
+        std::cout << "Error: unknown input type " << options.inputType << ", use -t\n";
+        return -1;
+    }
+    if (!source)
+        return -1;
+
+    std::vector<int> selected;
+    if (options.channels.empty()) {
+        for (size_t i = 0; i < source->channels.size(); ++i)
+            selected.push_back(i);
+    }
+    for (auto &name : options.channels) {
+        auto found = std::find_if(source->channels.begin(), source->channels.end(), [&](const Channel &_channel){ return _channel.name == name; });
+        if (found == source->channels.end()) {
+            std::cout << "Error: no channel " << name << " in " << options.input << "\n";
+            return -1;
+        }
+        selected.push_back(found - source->channels.begin());
+    }
+    if (selected.empty()) {
+        std::cout << "Error: no channels to convert\n";
+        return -1;
+    }
+    bool scaled = false;
+    for (size_t i = 0; i < selected.size(); ++i) {
+        auto &channel = source->channels[selected[i]];
+        if (i < options.gains.size())
+            channel.gain = options.gains[i];
+        if (i < options.offsets.size())
+            channel.offset = options.offsets[i];
+        scaled |= channel.gain != 1 || channel.offset != 0;
+    }
+    if (options.digits < 0)
+        options.digits = scaled ? CONVERT_CSV_DIGITS : 0;
+    if (options.format == Format::WAV) {
+        bool sameSize = std::all_of(selected.begin(), selected.end(), [&](int _channel){ return source->channels[_channel].sampleSize == source->channels[selected[0]].sampleSize; });
+        if (selected.size() > 2 || !sameSize) {
+            std::cout << "Error: wav takes one or two channels of the same resolution\n";
+            return -1;
+        }
+        if (scaled)
+            std::cout << "Gains and offsets do not apply to wav, the samples are written as they are\n";
+    }
+    if (options.sampleRate == 0)
+        options.sampleRate = source->sampleRate;
+
+    FILE *out = fopen(options.output.c_str(), "wb");
+    if (out == nullptr) {
+        std::cout << "Error: can't create " << options.output << "\n";
+        return -1;
+    }
+    if (options.format == Format::CSV) {
+        for (size_t i = 0; i < selected.size(); ++i)
+            fprintf(out, "%s%c", source->channels[selected[i]].name.c_str(), i + 1 < selected.size() ? ',' : '\n');
+    }
+
+    // Bounded pipeline: piece k is converted into slot k % slots and only after piece k - slots
+    // has been written from it
+    struct Slot {
+        std::vector<uint8_t> data;
+        bool                 ready = false;
+        bool                 good = false;
+    };
+    size_t pieces = source->pieces.size();
+    std::vector<Slot> slots(options.jobs * CONVERT_SLOTS_PER_JOB);
+    std::mutex lock;
+    std::condition_variable changed;
+    size_t nextPiece = 0;
+    size_t written = 0;
+    bool failed = false;
+
+    std::vector<std::thread> workers;
+    for (unsigned j = 0; j < options.jobs; ++j) {
+        workers.emplace_back([&](){
+            Worker worker;
+            while (true) {
+                size_t index;
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    changed.wait(guard, [&](){ return failed || nextPiece >= pieces || nextPiece < written + slots.size(); });
+                    if (failed || nextPiece >= pieces)
+                        return;
+                    index = nextPiece++;
+                }
+                auto &slot = slots[index % slots.size()];
+                bool good = convertPiece(options, *source, selected, index, worker, slot.data);
+                std::lock_guard<std::mutex> guard(lock);
+                slot.good = good;
+                slot.ready = true;
+                changed.notify_all();
+            }
+        });
+    }
+
+    std::vector<uint8_t> wavHeader;
+    uint64_t bytes = 0;
+    for (size_t index = 0; index < pieces && !failed; ++index) {
+        auto &slot = slots[index % slots.size()];
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            changed.wait(guard, [&](){ return slot.ready; });
+        }
+        bool good = slot.good;
+        if (!good) {
+            std::cout << "Error: can't read the samples " << source->pieces[index].first << " to "
+                      << source->pieces[index].first + source->pieces[index].count << "\n";
+        } else if (fwrite(slot.data.data(), 1, slot.data.size(), out) != slot.data.size()) {
+            std::cout << "Error: can't write " << options.output << "\n";
+            good = false;
+        }
+        if (index == 0 && options.format == Format::WAV)
+            wavHeader.assign(slot.data.begin(), slot.data.begin() + std::min(slot.data.size(), CWaveWriter::headerSize()));
+        bytes += slot.data.size();
+        std::lock_guard<std::mutex> guard(lock);
+        failed = !good;
+        slot.ready = false;
+        ++written;
+        changed.notify_all();
+    }
+    for (auto &worker : workers)
+        worker.join();
+
+    if (options.format == Format::WAV && wavHeader.size() == CWaveWriter::headerSize()) {
+        CWaveWriter::UpdateHeaderSizes(wavHeader.data(), bytes - wavHeader.size());
+        if (options.sampleRate > 0)
+            CWaveWriter::UpdateSampleRate(wavHeader.data(), (uint32_t)options.sampleRate);
+        else
+            std::cout << "The sample rate is unknown, set it with -r\n";
+        fseek(out, 0, SEEK_SET);
+        fwrite(wavHeader.data(), 1, wavHeader.size(), out);
+    }
+    if (fclose(out) != 0 || failed) {
+        std::cout << "Error: " << options.output << " is incomplete\n";
+        return -1;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    uint64_t inputBytes = 0;
+    for (auto channel : selected)
+        inputBytes += source->samples * source->channels[channel].sampleSize;
+    std::cout << options.output << ": " << source->samples << " samples of " << selected.size() << " channels, "
+              << pieces << " pieces on " << options.jobs << " threads in " << seconds << " s ("
+              << inputBytes / seconds / 1e6 << " MB/s of samples, " << bytes / seconds / 1e6 << " MB/s written)\n";
+    return 0;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <iostream>
+
+// Checks of the unit tests. A failed check is printed and the test goes on,
+// main returns checkResult().
+
+static int g_checkFailures = 0;
+
+#define CHECK(_cond) \
+    do { \
+        if (!(_cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #_cond ") failed\n"; \
+            ++g_checkFailures; \
+        } \
+    } while (0)
+
+// As CHECK, prints both values
+#define CHECK_EQ(_a, _b) \
+    do { \
+        if (!((_a) == (_b))) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK_EQ(" #_a ", " #_b ") failed: " \
+                      << (_a) << " != " << (_b) << "\n"; \
+            ++g_checkFailures; \
+        } \
+    } while (0)
+
+inline int checkResult(){
+    if (g_checkFailures > 0) {
+        std::cerr << g_checkFailures << " checks failed\n";
+        return 1;
+    }
+    return 0;
+}
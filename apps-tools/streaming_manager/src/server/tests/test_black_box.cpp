@@ -0,0 +1,168 @@
+// BlackBox.h: the ring keeps the newest records and dumps them oldest first. Filled many times
+// over with records of varying sizes, also of one channel or none, with exact eviction checked
+// for equal sizes.
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "rpsa/server/core/BlackBox.h"
+#include "check.h"
+
+#define RING_BYTES   (256 * 1024)
+#define MAX_CHANNEL  12000 // Bytes per channel of the largest record
+
+namespace {
+
+    // Sizes and contents follow from the record id, so a dump can be checked on its own
+    struct Content {
+        std::vector<uint8_t> ch1;
+        std::vector<uint8_t> ch2;
+    };
+
+    Content content(uint64_t _id, size_t _size1, size_t _size2){
+        Content c;
+        for (size_t k = 0; k < _size1; ++k)
+            c.ch1.push_back(static_cast<uint8_t>(_id * 31 + k));
+        for (size_t k = 0; k < _size2; ++k)
+            c.ch2.push_back(static_cast<uint8_t>(_id * 17 + k * 3));
+        return c;
+    }
+
+    bool push(CBlackBox &_box, uint64_t _id, size_t _size1, size_t _size2){
+        asionet::PackInfo info = {};
+        info.id = _id;
+        info.sampleIndex = _id * 1000;
+        info.channels = (_size1 > 0 ? 1 : 0) | (_size2 > 0 ? 2 : 0);
+        auto c = content(_id, _size1, _size2);
+        return _box.push(info, c.ch1.data(), _size1, c.ch2.data(), _size2);
+    }
+
+    // Ring bytes of a record without samples
+    size_t header(){
+        CBlackBox box(1024);
+        push(box, 0, 0, 0);
+        return box.used();
+    }
+
+    struct Dumped {
+        uint64_t id;
+        size_t   size1;
+        size_t   size2;
+    };
+
+    // Record ids in dump order, the contents are checked against content()
+    std::vector<Dumped> dump(const CBlackBox &_box){
+        std::vector<Dumped> out;
+        _box.forEach([&out](const asionet::PackInfo &_info, const void *_ch1, size_t _size1, const void *_ch2, size_t _size2){
+            auto expected = content(_info.id, _size1, _size2);
+            CHECK_EQ(_info.sampleIndex, _info.id * 1000);
+            CHECK(std::equal(expected.ch1.begin(), expected.ch1.end(), static_cast<const uint8_t*>(_ch1)));
+            CHECK(std::equal(expected.ch2.begin(), expected.ch2.end(), static_cast<const uint8_t*>(_ch2)));
+            out.push_back({_info.id, _size1, _size2});
+        });
+        CHECK_EQ(out.size(), _box.records());
+        return out;
+    }
+
+    // Equal records: the ring holds exactly capacity / record size of them
+    void testEqualSizes(){
+        size_t record = header() + 2000;
+        const size_t slots = 10;
+
+        auto box = CBlackBox::Create(record * slots);
+        CHECK_EQ(box->capacity(), record * slots);
+        for (uint64_t id = 0; id < slots; ++id)
+            CHECK(push(*box, id, 1000, 1000));
+        CHECK_EQ(box->records(), slots);
+        CHECK_EQ(box->used(), box->capacity());
+
+        for (uint64_t id = slots; id < 3 * slots + 3; ++id) {
+            CHECK(push(*box, id, 1000, 1000));
+            CHECK_EQ(box->records(), slots);
+            auto records = dump(*box);
+            for (size_t i = 0; i < records.size(); ++i)
+                CHECK_EQ(records[i].id, id + 1 - slots + i);
+        }
+
+        // A record of two slots takes the space of the two oldest ones, the head is at slot 3
+        CHECK(push(*box, 100, 2 * record - header() - 1000, 1000));
+        auto records = dump(*box);
+        CHECK(!records.empty());
+        CHECK_EQ(records.front().id, 3 * slots + 3 - slots + 2);
+        CHECK_EQ(records.back().id, 100u);
+    }
+
+    void testVariableSizes(){
+        auto box = CBlackBox::Create(RING_BYTES + 5); // Rounded down to 8 bytes
+        CHECK_EQ(box->capacity(), size_t(RING_BYTES));
+        std::mt19937 random(1);
+        std::uniform_int_distribution<size_t> size(0, MAX_CHANNEL);
+        std::uniform_int_distribution<int> channels(0, 3);
+        size_t maxRecord = 2 * MAX_CHANNEL + 256;
+
+        std::vector<Dumped> pushed;
+        for (uint64_t id = 0; id < 2000; ++id) {
+            int ch = channels(random);
+            size_t size1 = ch & 1 ? size(random) : 0;
+            size_t size2 = ch & 2 ? size(random) : 0;
+            CHECK(push(*box, id, size1, size2));
+            pushed.push_back({id, size1, size2});
+
+            // The newest records in push order, the oldest are gone, no more than needed
+            auto records = dump(*box);
+            CHECK(!records.empty());
+            if (records.empty())
+                continue;
+            CHECK_EQ(records.back().id, id);
+            size_t first = records.front().id;
+            for (size_t i = 0; i < records.size(); ++i) {
+                if (records[i].id != first + i || records[i].size1 != pushed[first + i].size1 || records[i].size2 != pushed[first + i].size2) {
+                    std::cerr << "push " << id << " record " << i << " is " << records[i].id << "\n";
+                    CHECK(false);
+                    break;
+                }
+            }
+            CHECK(box->used() <= box->capacity());
+            // Space is lost only at the end of the ring and in front of the record just written
+            if (pushed.size() > records.size())
+                CHECK(box->used() + 3 * maxRecord > box->capacity());
+        }
+    }
+
+    void testLimits(){
+        auto box = CBlackBox::Create(64 * 1024);
+        CHECK(push(*box, 1, 100, 100));
+        CHECK(push(*box, 2, 0, 0));
+        // Larger than the ring, nothing changes
+        CHECK(!push(*box, 3, 64 * 1024, 0));
+        auto records = dump(*box);
+        CHECK_EQ(records.size(), 2u);
+
+        // The whole ring in one record
+        CHECK(push(*box, 4, 64 * 1024 - header(), 0));
+        records = dump(*box);
+        CHECK_EQ(records.size(), 1u);
+        CHECK_EQ(box->used(), box->capacity());
+        CHECK(push(*box, 5, 10, 10));
+        records = dump(*box);
+        CHECK_EQ(records.size(), 1u);
+        if (!records.empty())
+            CHECK_EQ(records.front().id, 5u);
+
+        box->clear();
+        CHECK_EQ(box->records(), 0u);
+        CHECK_EQ(box->used(), 0u);
+        CHECK(dump(*box).empty());
+        CHECK(push(*box, 6, 1, 2));
+        CHECK_EQ(dump(*box).size(), 1u);
+    }
+}
+
+int main(){
+    testEqualSizes();
+    testVariableSizes();
+    testLimits();
+    return checkResult();
+}
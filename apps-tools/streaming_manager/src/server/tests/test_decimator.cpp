@@ -0,0 +1,178 @@
+// Decimator.h: DC and pass band gain, stop band rejection and output rate of designed filters
+// for plain, CIC and rational factors, chunked processing and the supported ratios.
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "rpsa/server/core/Decimator.h"
+#include "check.h"
+
+#define AMPLITUDE         16000.0
+#define PASS_TOLERANCE_DB 0.1     // Pass band ripple, CIC droop compensation and fixed point
+#define STOP_DB           55.0    // Designed for DECIMATOR_ATTENUATION, less the fixed point noise
+
+namespace {
+
+    struct Ratio {
+        uint32_t up;
+        uint32_t down;
+    };
+
+    const Ratio g_ratios[] = {{1, 2}, {1, 5}, {1, 8}, {3, 8}, {2, 3}, {1, 64}, {1, 1000}};
+
+    // _frequency in cycles per input sample
+    std::vector<int16_t> tone(size_t _samples, double _frequency, double _amplitude){
+        std::vector<int16_t> in(_samples);
+        for (size_t i = 0; i < _samples; ++i)
+            in[i] = static_cast<int16_t>(lround(_amplitude * sin(2 * M_PI * _frequency * i)));
+        return in;
+    }
+
+    std::vector<int16_t> run(CDecimator &_decimator, const std::vector<int16_t> &_in){
+        std::vector<int16_t> out(_decimator.maxOutput(_in.size()));
+        out.resize(_decimator.process(_in.data(), _in.size(), out.data()));
+        return out;
+    }
+
+    // Amplitude of the _frequency (cycles per output sample) part of _out after _skip samples
+    double amplitude(const std::vector<int16_t> &_out, size_t _skip, double _frequency){
+        double i = 0;
+        double q = 0;
+        size_t n = 0;
+        for (size_t k = _skip; k < _out.size(); ++k, ++n) {
+            i += _out[k] * cos(2 * M_PI * _frequency * k);
+            q += _out[k] * sin(2 * M_PI * _frequency * k);
+        }
+        return n > 0 ? 2 * sqrt(i * i + q * q) / n : 0;
+    }
+
+    double db(double _ratio){
+        return 20 * log10(_ratio);
+    }
+
+    // Output samples until the filter is filled, twice the group delay
+    size_t settled(const CDecimator &_decimator){
+        return static_cast<size_t>(2 * _decimator.delay() * _decimator.up() / _decimator.down()) + 2;
+    }
+
+    // Input samples for _outputs settled output samples
+    size_t inputFor(const CDecimator &_decimator, size_t _outputs){
+        return (settled(_decimator) + _outputs) * _decimator.down() / _decimator.up();
+    }
+
+    void testResponse(const Ratio &_ratio){
+        auto decimator = CDecimator::Create(_ratio.up, _ratio.down);
+        CHECK(decimator != nullptr);
+        if (!decimator)
+            return;
+        double outRate = static_cast<double>(_ratio.up) / _ratio.down;
+        size_t outputs = 4000;
+
+        // DC
+        std::vector<int16_t> dc(inputFor(*decimator, outputs), 10000);
+        auto out = run(*decimator, dc);
+        CHECK(out.size() >= settled(*decimator) + outputs - 1);
+        for (size_t k = settled(*decimator); k < out.size(); ++k) {
+            if (std::abs(out[k] - 10000) > 10) {
+                CHECK_EQ(out[k], 10000);
+                break;
+            }
+        }
+
+        // Pass band tone at 0.2 of the output rate
+        decimator->reset();
+        out = run(*decimator, tone(inputFor(*decimator, outputs), 0.2 * outRate, AMPLITUDE));
+        double pass = db(amplitude(out, settled(*decimator), 0.2) / AMPLITUDE);
+        if (fabs(pass) > PASS_TOLERANCE_DB) {
+            std::cerr << _ratio.up << "/" << _ratio.down << " pass band gain " << pass << " dB\n";
+            CHECK(fabs(pass) <= PASS_TOLERANCE_DB);
+        }
+
+        // Stop band tone at 0.75 of the output rate, folds back to 0.25
+        if (0.75 * outRate < 0.5) {
+            decimator->reset();
+            out = run(*decimator, tone(inputFor(*decimator, outputs), 0.75 * outRate, AMPLITUDE));
+            double stop = db(amplitude(out, settled(*decimator), 0.25) / AMPLITUDE);
+            if (stop > -STOP_DB) {
+                std::cerr << _ratio.up << "/" << _ratio.down << " stop band " << stop << " dB\n";
+                CHECK(stop <= -STOP_DB);
+            }
+        }
+    }
+
+    // Consecutive buffers of any size are filtered as one stream
+    void testChunks(const Ratio &_ratio){
+        auto whole = CDecimator::Create(_ratio.up, _ratio.down);
+        auto chunked = CDecimator::Create(_ratio.up, _ratio.down);
+        CHECK(whole && chunked);
+        if (!whole || !chunked)
+            return;
+        auto in = tone(20011, 0.01, AMPLITUDE);
+        auto expected = run(*whole, in);
+        double rate = static_cast<double>(in.size()) * _ratio.up / _ratio.down;
+        CHECK(fabs(expected.size() - rate) <= 1);
+
+        std::vector<int16_t> out;
+        size_t sizes[] = {1, 7, 333, 64, 1021, 2};
+        for (size_t offset = 0, n = 0; offset < in.size(); ++n) {
+            size_t count = std::min(sizes[n % 6], in.size() - offset);
+            std::vector<int16_t> buffer(in.begin() + offset, in.begin() + offset + count);
+            buffer.resize(std::max(buffer.size(), chunked->maxOutput(count)));
+            // In place, as the streaming path uses it
+            size_t produced = chunked->process(buffer.data(), count, buffer.data());
+            CHECK(produced <= chunked->maxOutput(count));
+            out.insert(out.end(), buffer.begin(), buffer.begin() + produced);
+            offset += count;
+        }
+        CHECK(out == expected);
+    }
+
+    void test8Bit(){
+        auto decimator = CDecimator::Create(1, 4);
+        CHECK(decimator != nullptr);
+        if (!decimator)
+            return;
+        std::vector<int8_t> in(4000, -100);
+        std::vector<int8_t> out(decimator->maxOutput(in.size()));
+        out.resize(decimator->process(in.data(), in.size(), out.data()));
+        CHECK_EQ(out.size(), 1000u);
+        for (size_t k = settled(*decimator); k < out.size(); ++k)
+            CHECK_EQ(static_cast<int>(out[k]), -100);
+    }
+
+    void testSupported(){
+        CHECK(CDecimator::Supported(1, 1));
+        CHECK(CDecimator::Supported(1, 2));
+        CHECK(CDecimator::Supported(3, 8));
+        CHECK(CDecimator::Supported(2, 4));
+        CHECK(CDecimator::Supported(1, DECIMATOR_MAX_FIR_FACTOR));
+        CHECK(CDecimator::Supported(1, 223));            // Prime, FIR only
+        CHECK(CDecimator::Supported(1, 4 * 1031));       // CIC 1031
+        CHECK(CDecimator::Supported(1, 65536));
+        CHECK(CDecimator::Supported(DECIMATOR_MAX_UP, 3 * DECIMATOR_MAX_UP + 1));
+
+        CHECK(!CDecimator::Supported(0, 1));
+        CHECK(!CDecimator::Supported(1, 0));
+        CHECK(!CDecimator::Supported(2, 1));
+        CHECK(!CDecimator::Supported(DECIMATOR_MAX_UP + 1, 1024));
+        CHECK(!CDecimator::Supported(1, 227));           // Prime
+        CHECK(!CDecimator::Supported(1, 229));
+        CHECK(!CDecimator::Supported(1, 2 * 229));       // No FIR factor from 4 below 229
+        CHECK(!CDecimator::Supported(2, 229));
+        // Create() agrees
+        CHECK(!CDecimator::Create(1, 229));
+        CHECK(CDecimator::Create(1, 223) != nullptr);
+    }
+}
+
+int main(){
+    for (auto &ratio : g_ratios) {
+        testResponse(ratio);
+        testChunks(ratio);
+    }
+    test8Bit();
+    testSupported();
+    return checkResult();
+}
@@ -0,0 +1,292 @@
+// MappedReader.h: files written by StreamWriter read back mapped and with pread. Raw segments
+// that reuse the object list, layout changes, codec chunks mixed with raw ones, a last segment
+// cut short, and the .tdmsidx cache, which must be used only while it matches the file.
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "rpsa/common/core/MappedReader.h"
+#include "rpsa/common/core/Writer.h"
+#include "rpsa/common/core/sample_codec.h"
+#include "check.h"
+
+namespace {
+
+    std::string g_dir;
+
+    // Sample i of a channel, channel 2 runs the other way
+    int16_t sample(int _channel, uint64_t _index){
+        return static_cast<int16_t>(_channel == 0 ? _index * 7 : 30000 - _index * 3);
+    }
+
+    struct Block {
+        uint64_t samples;
+        bool     compressed;
+    };
+
+    // Blocks of both channels as FileQueueManager writes them, _cut bytes are missing at the end
+    std::vector<uint8_t> build(const std::vector<Block> &_blocks, size_t _cut = 0){
+        TDMS::StreamWriter writer;
+        std::vector<uint8_t> file;
+        uint64_t first = 0;
+        for (auto &block : _blocks) {
+            std::vector<int16_t> data[2];
+            std::vector<uint8_t> streams[2];
+            TDMS::MemoryWriter::Channel channels[2];
+            const char *names[2] = {"ch1", "ch2"};
+            for (int ch = 0; ch < 2; ++ch) {
+                for (uint64_t i = 0; i < block.samples; ++i)
+                    data[ch].push_back(sample(ch, first + i));
+                if (block.compressed) {
+                    streams[ch].resize(codecMaxSize(block.samples));
+                    streams[ch].resize(codecEncode(data[ch].data(), block.samples, 16, streams[ch].data(), streams[ch].size()));
+                    channels[ch] = {names[ch], TDMS::DataType::UnsignedInteger8, streams[ch].data(), streams[ch].size(), CODEC_NAME};
+                } else {
+                    channels[ch] = {names[ch], TDMS::DataType::Integer16, data[ch].data(), block.samples * 2, nullptr};
+                }
+            }
+            std::vector<uint8_t> segment(1024 * 1024);
+            size_t size = writer.WriteSegment(segment.data(), segment.size(), "Group", channels, 2);
+            CHECK(size > 0);
+            file.insert(file.end(), segment.begin(), segment.begin() + size);
+            first += block.samples;
+        }
+        file.resize(file.size() - _cut);
+        return file;
+    }
+
+    std::string writeFile(const std::string &_name, const std::vector<uint8_t> &_data){
+        auto path = g_dir + "/" + _name;
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(_data.data()), _data.size());
+        CHECK(out.good());
+        std::remove((path + TDMS_INDEX_SUFFIX).c_str());
+        return path;
+    }
+
+    uint64_t total(const std::vector<Block> &_blocks){
+        uint64_t samples = 0;
+        for (auto &block : _blocks)
+            samples += block.samples;
+        return samples;
+    }
+
+    // Whole channels and ranges across chunk boundaries
+    void checkRead(const TDMS::MappedReader &_reader, uint64_t _samples){
+        CHECK_EQ(_reader.channels().size(), 2u);
+        if (_reader.channels().size() != 2)
+            return;
+        std::mt19937 random(1);
+        for (int ch = 0; ch < 2; ++ch) {
+            auto &info = _reader.channels()[ch];
+            CHECK_EQ(info.name, std::string(ch == 0 ? "ch1" : "ch2"));
+            CHECK_EQ(info.path, std::string(ch == 0 ? "/'Group'/'ch1'" : "/'Group'/'ch2'"));
+            CHECK_EQ(info.dataType, uint32_t(TDMS::DataType::Integer16));
+            CHECK_EQ(info.samples, _samples);
+            CHECK_EQ(_reader.findChannel(info.name), ch);
+
+            std::vector<int16_t> all(_samples);
+            CHECK(_reader.read(ch, 0, _samples, all.data()));
+            for (uint64_t i = 0; i < _samples; ++i) {
+                if (all[i] != sample(ch, i)) {
+                    std::cerr << "channel " << ch << " sample " << i << "\n";
+                    CHECK(false);
+                    break;
+                }
+            }
+
+            std::uniform_int_distribution<uint64_t> position(0, _samples);
+            for (int n = 0; n < 200; ++n) {
+                uint64_t a = position(random);
+                uint64_t b = position(random);
+                uint64_t first = std::min(a, b);
+                uint64_t count = std::max(a, b) - first;
+                std::vector<int16_t> part(count + 1, 0x5A5A);
+                CHECK(_reader.read(ch, first, count, part.data()));
+                CHECK(std::equal(all.begin() + first, all.begin() + first + count, part.begin()));
+                CHECK_EQ(part[count], 0x5A5A);
+            }
+            int16_t one;
+            CHECK(!_reader.read(ch, _samples, 1, &one));
+            CHECK(!_reader.read(ch, 0, _samples + 1, all.data()));
+        }
+        CHECK(!_reader.read(2, 0, 1, nullptr));
+    }
+
+    // Views cover the range exactly where there are no codec chunks
+    void checkViews(const TDMS::MappedReader &_reader, const std::vector<Block> &_blocks){
+        uint64_t first = 0;
+        for (auto &block : _blocks) {
+            std::vector<TDMS::MappedReader::View<int16_t>> views;
+            bool ok = _reader.view(1, first, block.samples, views);
+            CHECK_EQ(ok, _reader.mapped() && !block.compressed);
+            if (ok) {
+                uint64_t count = 0;
+                for (auto &view : views) {
+                    CHECK(view.contiguous() != nullptr);
+                    for (uint64_t i = 0; i < view.count; ++i)
+                        CHECK_EQ(view[i], sample(1, first + count + i));
+                    count += view.count;
+                }
+                CHECK_EQ(count, block.samples);
+            }
+            first += block.samples;
+        }
+        std::vector<TDMS::MappedReader::View<int8_t>> bytes;
+        CHECK(!_reader.view(0, 0, 1, bytes));
+    }
+
+    void checkSegments(const TDMS::MappedReader &_reader, const std::vector<Block> &_blocks){
+        CHECK_EQ(_reader.segments(), _blocks.size());
+        uint64_t first = 0;
+        for (uint32_t segment = 0; segment < _blocks.size(); ++segment) {
+            uint64_t begin = 0, count = 0;
+            CHECK(_reader.segmentRange(0, segment, begin, count));
+            CHECK_EQ(begin, first);
+            CHECK_EQ(count, _blocks[segment].samples);
+            first += _blocks[segment].samples;
+        }
+        uint64_t begin = 0, count = 0;
+        CHECK(!_reader.segmentRange(0, _blocks.size(), begin, count));
+    }
+
+    void checkFile(const std::string &_path, const std::vector<Block> &_blocks){
+        for (bool map : {true, false}) {
+            auto reader = TDMS::MappedReader::Open(_path, false, map);
+            CHECK(reader != nullptr);
+            if (!reader)
+                continue;
+            CHECK_EQ(reader->mapped(), map);
+            checkRead(*reader, total(_blocks));
+            checkViews(*reader, _blocks);
+            checkSegments(*reader, _blocks);
+        }
+    }
+
+    void testRaw(){
+        // Equal blocks reuse the object list, a new size writes it again
+        std::vector<Block> blocks = {{1000, false}, {1000, false}, {1000, false}, {333, false}, {333, false}, {1000, false}, {1, false}};
+        checkFile(writeFile("raw.tdms", build(blocks)), blocks);
+    }
+
+    void testCodec(){
+        std::vector<Block> blocks = {{1000, true}, {1000, true}, {4096, false}, {4096, false}, {777, true}, {129, true}, {4096, false}};
+        auto path = writeFile("codec.tdms", build(blocks));
+        checkFile(path, blocks);
+        auto reader = TDMS::MappedReader::Open(path);
+        CHECK(reader && reader->channels().size() == 2 && reader->channels()[0].compressed);
+    }
+
+    // A file that is still being written ends inside a segment
+    void testCut(){
+        std::vector<Block> blocks = {{1000, false}, {1000, true}, {1000, false}, {1000, false}};
+        auto file = build(blocks);
+        checkFile(writeFile("cut.tdms", build(blocks, 100)), {{1000, false}, {1000, true}, {1000, false}});
+        // Not even a lead-in: a TDMS file without channels yet
+        for (bool map : {true, false}) {
+            auto reader = TDMS::MappedReader::Open(writeFile("cut.tdms", std::vector<uint8_t>(file.begin(), file.begin() + 10)), false, map);
+            CHECK(reader != nullptr);
+            if (reader) {
+                CHECK(reader->channels().empty());
+                CHECK_EQ(reader->segments(), 0u);
+            }
+        }
+    }
+
+    void setTime(const std::string &_path, time_t _time){
+        struct utimbuf times = {_time, _time};
+        CHECK(utime(_path.c_str(), &times) == 0);
+    }
+
+    void testCache(){
+        std::vector<Block> blocks = {{1000, false}, {1000, true}, {2000, false}};
+        auto path = writeFile("cache.tdms", build(blocks));
+        auto index = path + TDMS_INDEX_SUFFIX;
+        setTime(path, 1500000000);
+
+        auto reader = TDMS::MappedReader::Open(path, true);
+        CHECK(reader != nullptr);
+        struct stat info;
+        CHECK(stat(index.c_str(), &info) == 0);
+
+        // Break the lead-in without changing size and time: only the index can describe the file now
+        auto file = build(blocks);
+        file[0] = 'X';
+        std::ofstream out(path, std::ios::binary | std::ios::in);
+        out.write(reinterpret_cast<const char*>(file.data()), 1);
+        out.close();
+        setTime(path, 1500000000);
+        CHECK(!TDMS::MappedReader::Open(path, false));
+        for (bool map : {true, false}) {
+            reader = TDMS::MappedReader::Open(path, true, map);
+            CHECK(reader != nullptr);
+            if (reader) {
+                checkRead(*reader, total(blocks));
+                checkSegments(*reader, blocks);
+            }
+        }
+
+        // Another modification time, the index does not belong to the file any more
+        setTime(path, 1500000001);
+        CHECK(!TDMS::MappedReader::Open(path, true));
+
+        // More segments: the size changed, the index is built again and rewritten
+        blocks.push_back({500, true});
+        blocks.push_back({500, false});
+        file = build(blocks);
+        std::ofstream whole(path, std::ios::binary | std::ios::trunc);
+        whole.write(reinterpret_cast<const char*>(file.data()), file.size());
+        whole.close();
+        setTime(path, 1500000000);
+        reader = TDMS::MappedReader::Open(path, true);
+        CHECK(reader != nullptr);
+        if (reader)
+            checkRead(*reader, total(blocks));
+        struct stat rebuilt;
+        CHECK(stat(index.c_str(), &rebuilt) == 0);
+        CHECK(rebuilt.st_size > info.st_size);
+        // A damaged index is not used
+        std::ofstream damaged(index, std::ios::binary | std::ios::trunc);
+        damaged << "TDSI";
+        damaged.close();
+        reader = TDMS::MappedReader::Open(path, true);
+        CHECK(reader != nullptr);
+        if (reader)
+            checkRead(*reader, total(blocks));
+    }
+
+    void testNotTdms(){
+        auto path = writeFile("text.tdms", std::vector<uint8_t>(100, 'a'));
+        CHECK(!TDMS::MappedReader::Open(path));
+        CHECK(!TDMS::MappedReader::Open(path, false, false));
+        CHECK(!TDMS::MappedReader::Open(g_dir + "/missing.tdms"));
+    }
+}
+
+int main(){
+    char dir[] = "/tmp/test_mapped_reader.XXXXXX";
+    if (mkdtemp(dir) == nullptr) {
+        std::cerr << "Can't create a directory in /tmp\n";
+        return 1;
+    }
+    g_dir = dir;
+    testRaw();
+    testCodec();
+    testCut();
+    testCache();
+    testNotTdms();
+    for (auto name : {"raw.tdms", "codec.tdms", "cut.tdms", "cache.tdms", "text.tdms"}) {
+        std::remove((g_dir + "/" + name).c_str());
+        std::remove((g_dir + "/" + name + TDMS_INDEX_SUFFIX).c_str());
+    }
+    rmdir(dir);
+    return checkResult();
+}
@@ -0,0 +1,206 @@
+// sample_codec.h: round trip of typical and worst case signals at both resolutions and
+// block boundary counts, damaged and truncated streams must be rejected.
+
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "rpsa/common/core/sample_codec.h"
+#include "check.h"
+
+namespace {
+
+    const size_t g_counts[] = {0, 1, 2, 3, 127, 128, 129, 255, 256, 1000, 4096, 10007};
+
+    std::mt19937 g_random(1);
+
+    // Samples in the range of _resolution, stored as int8 or int16
+    std::vector<uint8_t> makeSignal(const std::string &_kind, size_t _samples, unsigned _resolution){
+        int32_t min = _resolution == 8 ? INT8_MIN : INT16_MIN;
+        int32_t max = _resolution == 8 ? INT8_MAX : INT16_MAX;
+        std::uniform_int_distribution<int32_t> full(min, max);
+        std::uniform_int_distribution<int32_t> noise(-2, 2);
+        std::vector<uint8_t> buffer(_samples * (_resolution / 8));
+        for (size_t i = 0; i < _samples; ++i) {
+            int32_t x = 0;
+            if (_kind == "random") {
+                x = full(g_random);
+            } else if (_kind == "constant") {
+                x = max / 3;
+            } else if (_kind == "ramp") {
+                x = min + static_cast<int32_t>(i % (max - min + 1));
+            } else if (_kind == "alternating") {
+                x = i % 2 ? max : min;
+            } else if (_kind == "escape") {
+                // Rice coded blocks with rare residuals that need the escape code
+                x = i % 61 == 7 ? (i % 2 ? max : min) : noise(g_random);
+            }
+            if (_resolution == 8)
+                reinterpret_cast<int8_t*>(buffer.data())[i] = static_cast<int8_t>(x);
+            else
+                reinterpret_cast<int16_t*>(buffer.data())[i] = static_cast<int16_t>(x);
+        }
+        return buffer;
+    }
+
+    std::vector<uint8_t> encode(const std::vector<uint8_t> &_signal, size_t _samples, unsigned _resolution){
+        std::vector<uint8_t> stream(codecMaxSize(_samples));
+        size_t size = codecEncode(_signal.data(), _samples, _resolution, stream.data(), stream.size());
+        stream.resize(size);
+        return stream;
+    }
+
+    bool decode(const std::vector<uint8_t> &_stream, std::vector<uint8_t> &_out, size_t &_samples){
+        return codecDecode(_stream.data(), _stream.size(), _out.data(), _out.size(), _samples);
+    }
+
+    void testRoundTrip(){
+        const char *kinds[] = {"random", "constant", "ramp", "alternating", "escape"};
+        for (unsigned resolution : {8u, 16u}) {
+            for (auto kind : kinds) {
+                for (size_t count : g_counts) {
+                    auto signal = makeSignal(kind, count, resolution);
+                    auto stream = encode(signal, count, resolution);
+                    CHECK(stream.size() >= CODEC_HEADER_SIZE);
+                    CHECK(stream.size() <= codecMaxSize(count));
+
+                    size_t samples = 0;
+                    unsigned infoResolution = 0;
+                    CHECK(codecInfo(stream.data(), stream.size(), samples, infoResolution));
+                    CHECK_EQ(samples, count);
+                    CHECK_EQ(infoResolution, resolution);
+
+                    std::vector<uint8_t> out(signal.size() + 1, 0xA5);
+                    samples = 0;
+                    CHECK(decode(stream, out, samples));
+                    CHECK_EQ(samples, count);
+                    CHECK(memcmp(out.data(), signal.data(), signal.size()) == 0);
+                    CHECK_EQ(out.back(), 0xA5);
+                }
+            }
+        }
+    }
+
+    // The encoder must pick the cheap representations
+    void testSize(){
+        auto constant = makeSignal("constant", 4096, 16);
+        // The first block pays for the step from 0, the others are a header byte each
+        CHECK(encode(constant, 4096, 16).size() < 256);
+    }
+
+    void testTruncated(){
+        for (unsigned resolution : {8u, 16u}) {
+            for (auto kind : {"random", "constant", "escape"}) {
+                auto signal = makeSignal(kind, 1000, resolution);
+                auto stream = encode(signal, 1000, resolution);
+                std::vector<uint8_t> out(signal.size());
+                for (size_t size = 0; size < stream.size(); ++size) {
+                    std::vector<uint8_t> cut(stream.begin(), stream.begin() + size);
+                    size_t samples = 0;
+                    CHECK(!decode(cut, out, samples));
+                }
+            }
+        }
+    }
+
+    // Little endian bit stream as the codec writes it
+    struct Bits {
+        std::vector<uint8_t> bytes;
+        unsigned used = 0;
+
+        void put(uint32_t _value, unsigned _bits){
+            for (unsigned i = 0; i < _bits; ++i) {
+                if (used % 8 == 0)
+                    bytes.push_back(0);
+                bytes.back() |= ((_value >> i) & 1) << (used % 8);
+                ++used;
+            }
+        }
+    };
+
+    std::vector<uint8_t> header(uint32_t _samples, uint8_t _resolution){
+        std::vector<uint8_t> stream(CODEC_HEADER_SIZE, 0);
+        memcpy(stream.data(), &_samples, sizeof(_samples));
+        stream[4] = _resolution;
+        stream[5] = CODEC_VERSION;
+        return stream;
+    }
+
+    void testCorrupt(){
+        auto signal = makeSignal("random", 1000, 16);
+        auto stream = encode(signal, 1000, 16);
+        std::vector<uint8_t> out(signal.size());
+        size_t samples = 0;
+
+        auto damaged = stream;
+        damaged[5] = CODEC_VERSION + 1;
+        CHECK(!decode(damaged, out, samples));
+        damaged = stream;
+        damaged[4] = 12;
+        CHECK(!decode(damaged, out, samples));
+        // More samples than the blocks in the stream
+        damaged = stream;
+        uint32_t more = 2000;
+        memcpy(damaged.data(), &more, sizeof(more));
+        std::vector<uint8_t> large(4000);
+        CHECK(!decode(damaged, large, samples));
+        // Short output buffer
+        std::vector<uint8_t> small(signal.size() - 2);
+        CHECK(!decode(stream, small, samples));
+
+        // Unknown predictor order
+        auto bad = header(1, 16);
+        Bits bits;
+        bits.put(3, 8);
+        bad.insert(bad.end(), bits.bytes.begin(), bits.bytes.end());
+        CHECK(!decode(bad, out, samples));
+
+        // Width above CODEC_MAX_BITS
+        bad = header(1, 16);
+        bits = Bits();
+        bits.put(19 << 3, 8);
+        bits.put(0, 19);
+        bad.insert(bad.end(), bits.bytes.begin(), bits.bytes.end());
+        CHECK(!decode(bad, out, samples));
+
+        // Valid fields, but the first order history runs out of the 16 bit range and,
+        // if nothing stopped it, past the int32 range
+        bad = header(CODEC_BLOCK_SAMPLES, 16);
+        bits = Bits();
+        bits.put(1 | 18 << 3, 8);
+        for (int i = 0; i < CODEC_BLOCK_SAMPLES; ++i)
+            bits.put(0x3FFFE, 18);
+        bad.insert(bad.end(), bits.bytes.begin(), bits.bytes.end());
+        CHECK(!decode(bad, out, samples));
+
+        // Second order history of 8 bit samples
+        bad = header(CODEC_BLOCK_SAMPLES, 8);
+        bits = Bits();
+        bits.put(2 | 4 << 3, 8);
+        for (int i = 0; i < CODEC_BLOCK_SAMPLES; ++i)
+            bits.put(14, 4);
+        bad.insert(bad.end(), bits.bytes.begin(), bits.bytes.end());
+        CHECK(!decode(bad, out, samples));
+
+        // Random payloads behind a valid header only have to be handled without harm
+        std::uniform_int_distribution<int> byte(0, 255);
+        for (int n = 0; n < 2000; ++n) {
+            auto noise = header(300, n % 2 ? 16 : 8);
+            for (int i = 0; i < 200; ++i)
+                noise.push_back(static_cast<uint8_t>(byte(g_random)));
+            std::vector<uint8_t> buffer(600);
+            samples = 0;
+            if (decode(noise, buffer, samples))
+                CHECK_EQ(samples, 300u);
+        }
+    }
+}
+
+int main(){
+    testRoundTrip();
+    testSize();
+    testTruncated();
+    testCorrupt();
+    return checkResult();
+}
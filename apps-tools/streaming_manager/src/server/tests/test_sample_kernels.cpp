@@ -0,0 +1,154 @@
+// sample_kernels.h: every kernel against hand computed results, once per ISA that is compiled in
+// and supported by the CPU. The patterns are repeated over counts that reach the vector loops and
+// the scalar tails, with unaligned pointers and guard elements behind every output.
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "rpsa/common/core/sample_kernels.h"
+#include "check.h"
+
+#define PAD 8 // Elements after every output that must stay untouched
+
+namespace {
+
+    const KernelIsa g_isas[] = {KernelIsa::SCALAR, KernelIsa::SSE2, KernelIsa::AVX2, KernelIsa::NEON};
+
+    // _count elements of _pattern repeated, _shift unused elements in front
+    template<typename T>
+    std::vector<T> tile(const std::vector<T> &_pattern, size_t _count, size_t _shift){
+        std::vector<T> out(_shift + _count + PAD);
+        for (size_t i = 0; i < _count; ++i)
+            out[_shift + i] = _pattern[i % _pattern.size()];
+        return out;
+    }
+
+    // An output of _count elements after _shift, the rest holds _guard
+    template<typename T>
+    std::vector<T> output(size_t _count, size_t _shift, T _guard){
+        return std::vector<T>(_shift + _count + PAD, _guard);
+    }
+
+    template<typename T>
+    bool same(const char *_name, size_t _count, const std::vector<T> &_out, const std::vector<T> &_expected, size_t _shift, T _guard){
+        for (size_t i = 0; i < _count; ++i) {
+            if (!(_out[_shift + i] == _expected[_shift + i])) {
+                std::cerr << kernelIsaName(kernelIsa()) << " " << _name << " of " << _count << " samples, element " << i << ": "
+                          << +_out[_shift + i] << " != " << +_expected[_shift + i] << "\n";
+                return false;
+            }
+        }
+        for (size_t i = 0; i < _shift; ++i) {
+            if (!(_out[i] == _guard))
+                return false;
+        }
+        for (size_t i = _shift + _count; i < _out.size(); ++i) {
+            if (!(_out[i] == _guard)) {
+                std::cerr << kernelIsaName(kernelIsa()) << " " << _name << " of " << _count << " samples writes past the end\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void testCopy(size_t _n, size_t _shift){
+        std::vector<uint8_t> pattern = {0x00, 0xFF, 0x12, 0x80, 0x7F, 0x01, 0xA5};
+        auto src = tile(pattern, _n, _shift);
+        auto dst = output<uint8_t>(_n, _shift, 0xEE);
+        kernelCopy(dst.data() + _shift, src.data() + _shift, _n);
+        CHECK(same("copy", _n, dst, src, _shift, uint8_t(0xEE)));
+    }
+
+    void testHigh8(size_t _n, size_t _shift){
+        // Arithmetic shift: the high byte keeps the sign, the low byte never rounds
+        auto src = tile<int16_t>({-32768, -257, -256, -255, -1, 0, 255, 256, 32767, 0x1234, -0x1234}, _n, _shift);
+        auto expected = tile<int8_t>({-128, -2, -1, -1, -1, 0, 0, 1, 127, 0x12, -0x13}, _n, _shift);
+        auto dst = output<int8_t>(_n, _shift, 0x55);
+        kernelHigh8(dst.data() + _shift, src.data() + _shift, _n);
+        CHECK(same("high8", _n, dst, expected, _shift, int8_t(0x55)));
+    }
+
+    void testInterleave(size_t _n, size_t _shift){
+        auto a8 = tile<int8_t>({1, 2, 3, -128, 127}, _n, _shift);
+        auto b8 = tile<int8_t>({-1, -2, -3, 0, 64}, _n, _shift);
+        auto expected8 = tile<int8_t>({1, -1, 2, -2, 3, -3, -128, 0, 127, 64}, _n * 2, _shift);
+        auto dst8 = output<int8_t>(_n * 2, _shift, 0x55);
+        kernelInterleave8(dst8.data() + _shift, a8.data() + _shift, b8.data() + _shift, _n);
+        CHECK(same("interleave8", _n * 2, dst8, expected8, _shift, int8_t(0x55)));
+
+        auto a16 = tile<int16_t>({100, -32768, 7}, _n, _shift);
+        auto b16 = tile<int16_t>({32767, -1, 0}, _n, _shift);
+        auto expected16 = tile<int16_t>({100, 32767, -32768, -1, 7, 0}, _n * 2, _shift);
+        auto dst16 = output<int16_t>(_n * 2, _shift, 0x5555);
+        kernelInterleave16(dst16.data() + _shift, a16.data() + _shift, b16.data() + _shift, _n);
+        CHECK(same("interleave16", _n * 2, dst16, expected16, _shift, int16_t(0x5555)));
+    }
+
+    void testDeinterleave(size_t _n, size_t _shift){
+        auto src8 = tile<int8_t>({10, -10, -128, 127, 0, -1, 1, 0x40, -0x40, 5}, _n * 2, _shift);
+        auto expectedA8 = tile<int8_t>({10, -128, 0, 1, -0x40}, _n, _shift);
+        auto expectedB8 = tile<int8_t>({-10, 127, -1, 0x40, 5}, _n, _shift);
+        auto a8 = output<int8_t>(_n, _shift, 0x55);
+        auto b8 = output<int8_t>(_n, _shift, 0x55);
+        kernelDeinterleave8(a8.data() + _shift, b8.data() + _shift, src8.data() + _shift, _n);
+        CHECK(same("deinterleave8 a", _n, a8, expectedA8, _shift, int8_t(0x55)));
+        CHECK(same("deinterleave8 b", _n, b8, expectedB8, _shift, int8_t(0x55)));
+
+        // Packing the halves back must not saturate
+        auto src16 = tile<int16_t>({-32768, 32767, -1, 0, 0x7F80, -0x7F80, 256, -256, 1, -2}, _n * 2, _shift);
+        auto expectedA16 = tile<int16_t>({-32768, -1, 0x7F80, 256, 1}, _n, _shift);
+        auto expectedB16 = tile<int16_t>({32767, 0, -0x7F80, -256, -2}, _n, _shift);
+        auto a16 = output<int16_t>(_n, _shift, 0x5555);
+        auto b16 = output<int16_t>(_n, _shift, 0x5555);
+        kernelDeinterleave16(a16.data() + _shift, b16.data() + _shift, src16.data() + _shift, _n);
+        CHECK(same("deinterleave16 a", _n, a16, expectedA16, _shift, int16_t(0x5555)));
+        CHECK(same("deinterleave16 b", _n, b16, expectedB16, _shift, int16_t(0x5555)));
+    }
+
+    void testToFloat(size_t _n, size_t _shift){
+        // Gains and offsets with exact products and sums
+        auto src8 = tile<int8_t>({-128, -1, 0, 1, 127, 3, -3}, _n, _shift);
+        auto expected8 = tile<float>({-63.f, 0.5f, 1.f, 1.5f, 64.5f, 2.5f, -0.5f}, _n, _shift);
+        auto dst8 = output<float>(_n, _shift, -99.f);
+        kernelToFloat8(dst8.data() + _shift, src8.data() + _shift, _n, 0.5f, 1.f);
+        CHECK(same("toFloat8", _n, dst8, expected8, _shift, -99.f));
+
+        auto src16 = tile<int16_t>({-32768, -1, 0, 3, 32767}, _n, _shift);
+        auto expected16 = tile<float>({-8194.f, -2.25f, -2.f, -1.25f, 8189.75f}, _n, _shift);
+        auto dst16 = output<float>(_n, _shift, -99.f);
+        kernelToFloat16(dst16.data() + _shift, src16.data() + _shift, _n, 0.25f, -2.f);
+        CHECK(same("toFloat16", _n, dst16, expected16, _shift, -99.f));
+    }
+
+    void testIsa(){
+        std::vector<size_t> counts;
+        for (size_t n = 0; n <= 70; ++n)
+            counts.push_back(n);
+        counts.push_back(1000);
+        counts.push_back(4099);
+        for (size_t n : counts) {
+            for (size_t shift : {0, 1}) {
+                testCopy(n, shift);
+                testHigh8(n, shift);
+                testInterleave(n, shift);
+                testDeinterleave(n, shift);
+                testToFloat(n, shift);
+            }
+        }
+    }
+}
+
+int main(){
+    auto best = kernelIsa();
+    CHECK(kernelSetIsa(KernelIsa::SCALAR));
+    for (auto isa : g_isas) {
+        if (!kernelSetIsa(isa))
+            continue;
+        CHECK(kernelIsa() == isa);
+        std::cout << "Kernels " << kernelIsaName(isa) << "\n";
+        testIsa();
+    }
+    CHECK(kernelSetIsa(best));
+    return checkResult();
+}
@@ -0,0 +1,110 @@
+// sample_pack.h: the 14 bit layout against a bit by bit reference, round trips of
+// partial and full groups, saturation and the byte and sample count conversions.
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "rpsa/common/core/sample_pack.h"
+#include "check.h"
+
+#define PAD 16 // Bytes after every buffer that must stay untouched
+
+namespace {
+
+    std::mt19937 g_random(1);
+
+    // Sample i at bits 14*i .. 14*i+13 of a little endian bit stream
+    std::vector<uint8_t> reference(const std::vector<int16_t> &_samples){
+        std::vector<uint8_t> out(bytesForSamples(_samples.size(), 14), 0);
+        for (size_t i = 0; i < _samples.size(); ++i) {
+            int v = _samples[i] < PACK14_MIN ? PACK14_MIN : (_samples[i] > PACK14_MAX ? PACK14_MAX : _samples[i]);
+            for (int b = 0; b < 14; ++b) {
+                size_t bit = i * 14 + b;
+                out[bit / 8] |= ((v >> b) & 1) << (bit % 8);
+            }
+        }
+        return out;
+    }
+
+    std::vector<int16_t> makeSamples(size_t _count){
+        std::uniform_int_distribution<int> value(PACK14_MIN, PACK14_MAX);
+        std::vector<int16_t> samples(_count);
+        for (size_t i = 0; i < _count; ++i)
+            samples[i] = static_cast<int16_t>(value(g_random));
+        // Both extremes in every buffer of two or more samples
+        if (_count > 0)
+            samples[_count / 3] = PACK14_MIN;
+        if (_count > 1)
+            samples[_count - 1] = PACK14_MAX;
+        return samples;
+    }
+
+    void roundTrip(const std::vector<int16_t> &_samples, const std::vector<int16_t> &_expected){
+        size_t count = _samples.size();
+        size_t bytes = bytesForSamples(count, 14);
+        std::vector<uint8_t> packed(bytes + PAD, 0xA5);
+        pack14(_samples.data(), count, packed.data());
+        auto layout = reference(_samples);
+        CHECK(std::equal(layout.begin(), layout.end(), packed.begin()));
+        for (size_t i = bytes; i < packed.size(); ++i)
+            CHECK_EQ(packed[i], 0xA5);
+
+        std::vector<int16_t> unpacked(count + PAD, 0x5A5A);
+        unpack14(packed.data(), count, unpacked.data());
+        CHECK(std::equal(_expected.begin(), _expected.end(), unpacked.begin()));
+        for (size_t i = count; i < unpacked.size(); ++i)
+            CHECK_EQ(unpacked[i], 0x5A5A);
+    }
+
+    void testCounts(){
+        std::vector<size_t> counts;
+        for (size_t count = 0; count <= 17; ++count)
+            counts.push_back(count);
+        for (size_t count : {63, 64, 65, 1000, 4095, 4096, 4097, 8191})
+            counts.push_back(count);
+        for (size_t count : counts) {
+            auto samples = makeSamples(count);
+            roundTrip(samples, samples);
+        }
+    }
+
+    void testExtremes(){
+        // Every group position holds each extreme once
+        std::vector<int16_t> samples;
+        for (int i = 0; i < 3 * PACK14_GROUP_SAMPLES; ++i)
+            samples.push_back(i % 3 == 0 ? PACK14_MIN : (i % 3 == 1 ? PACK14_MAX : -1));
+        roundTrip(samples, samples);
+    }
+
+    void testSaturation(){
+        std::vector<int16_t> samples = {INT16_MIN, PACK14_MIN - 1, -9000, PACK14_MAX + 1, 9000, INT16_MAX, 0, 1, -1};
+        std::vector<int16_t> expected = {PACK14_MIN, PACK14_MIN, PACK14_MIN, PACK14_MAX, PACK14_MAX, PACK14_MAX, 0, 1, -1};
+        roundTrip(samples, expected);
+    }
+
+    void testSizes(){
+        for (size_t samples = 0; samples <= 1000; ++samples) {
+            CHECK_EQ(bytesForSamples(samples, 8), samples);
+            CHECK_EQ(bytesForSamples(samples, 16), samples * 2);
+            CHECK_EQ(bytesForSamples(samples, 14), (samples * 14 + 7) / 8);
+            CHECK_EQ(samplesInBytes(bytesForSamples(samples, 8), 8), samples);
+            CHECK_EQ(samplesInBytes(bytesForSamples(samples, 14), 14), samples);
+            CHECK_EQ(samplesInBytes(bytesForSamples(samples, 16), 16), samples);
+        }
+        CHECK_EQ(bytesForSamples(PACK14_GROUP_SAMPLES, 14), size_t(PACK14_GROUP_BYTES));
+        CHECK_EQ(samplesInBytes(PACK14_GROUP_BYTES, 14), size_t(PACK14_GROUP_SAMPLES));
+        // Bytes that do not complete a sample hold no sample
+        CHECK_EQ(samplesInBytes(1, 14), 0u);
+        CHECK_EQ(samplesInBytes(13, 14), 7u);
+        CHECK_EQ(samplesInBytes(3, 16), 1u);
+    }
+}
+
+int main(){
+    testCounts();
+    testExtremes();
+    testSaturation();
+    testSizes();
+    return checkResult();
+}
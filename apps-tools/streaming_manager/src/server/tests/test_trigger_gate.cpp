@@ -0,0 +1,245 @@
+// TriggerGate.h: records cut around synthetic edges. Rising, falling and both edges, re-arming
+// through the hysteresis, pre trigger windows that reach into earlier blocks, gaps in the stream
+// and the record PackInfo. Every signal is fed in blocks of several sizes with the same result.
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "rpsa/server/core/TriggerGate.h"
+#include "check.h"
+
+#define SAMPLE_NS  8.0
+#define START_TIME 1000000000ull
+
+namespace {
+
+    const size_t g_blockSizes[] = {1, 7, 97, 1000, 100000};
+
+    struct Record {
+        asionet::PackInfo    info;
+        std::vector<int16_t> ch1;
+        std::vector<int16_t> ch2;
+    };
+
+    TriggerSettings settings(TriggerEdge _edge, uint32_t _pre, uint32_t _post){
+        TriggerSettings trigger;
+        trigger.channel = 1;
+        trigger.level = 0;
+        trigger.hysteresis = 100;
+        trigger.edge = _edge;
+        trigger.preSamples = _pre;
+        trigger.postSamples = _post;
+        return trigger;
+    }
+
+    // -1000 with +1000 from each _starts[i] for _length samples
+    std::vector<int16_t> pulses(size_t _samples, const std::vector<size_t> &_starts, size_t _length){
+        std::vector<int16_t> signal(_samples, -1000);
+        for (size_t start : _starts) {
+            for (size_t i = start; i < start + _length && i < _samples; ++i)
+                signal[i] = 1000;
+        }
+        return signal;
+    }
+
+    // Channel 2 is the sample index, so records show where they were cut
+    std::vector<int16_t> indexSignal(size_t _samples){
+        std::vector<int16_t> signal(_samples);
+        for (size_t i = 0; i < _samples; ++i)
+            signal[i] = static_cast<int16_t>(i);
+        return signal;
+    }
+
+    // Feeds _signal in blocks of _block samples. Samples [_gapFrom, _gapTo) are not sent,
+    // the next block reports them as dropped.
+    std::vector<Record> run(CTriggerGate &_gate, const std::vector<int16_t> &_signal, size_t _block, size_t _gapFrom = 0, size_t _gapTo = 0){
+        auto index = indexSignal(_signal.size());
+        std::vector<Record> records;
+        auto emit = [&records](const asionet::PackInfo &_info, const void *_ch1, size_t _size1, const void *_ch2, size_t _size2){
+            Record record;
+            record.info = _info;
+            record.ch1.assign(static_cast<const int16_t*>(_ch1), static_cast<const int16_t*>(_ch1) + _size1 / 2);
+            record.ch2.assign(static_cast<const int16_t*>(_ch2), static_cast<const int16_t*>(_ch2) + _size2 / 2);
+            records.push_back(record);
+        };
+        uint64_t dropped = 0;
+        for (size_t pos = 0; pos < _signal.size();) {
+            if (pos == _gapFrom && _gapTo > _gapFrom) {
+                dropped = _gapTo - _gapFrom;
+                pos = _gapTo;
+                continue;
+            }
+            size_t end = std::min(pos + _block, _signal.size());
+            if (pos < _gapFrom && end > _gapFrom)
+                end = _gapFrom;
+            asionet::PackInfo info = {};
+            info.version = 2;
+            info.id = pos;
+            info.resolution = 16;
+            info.sampleIndex = pos;
+            info.timestamp = START_TIME + static_cast<uint64_t>(pos * SAMPLE_NS);
+            info.droppedSamples = dropped;
+            info.channels = 3;
+            info.flags = PACK_FLAG_CRC32C | PACK_FLAG_CLOCK_SYNC;
+            size_t bytes = (end - pos) * 2;
+            _gate.process(info, SAMPLE_NS, _signal.data() + pos, bytes, index.data() + pos, bytes, emit);
+            dropped = 0;
+            pos = end;
+        }
+        return records;
+    }
+
+    // Records start at _triggers[i] - pre and hold pre + post samples of the input
+    void checkRecords(const std::vector<Record> &_records, const std::vector<int16_t> &_signal, const std::vector<size_t> &_triggers, const TriggerSettings &_settings, size_t _block){
+        CHECK_EQ(_records.size(), _triggers.size());
+        if (_records.size() != _triggers.size()) {
+            std::cerr << "block " << _block << ":";
+            for (auto &record : _records)
+                std::cerr << " " << record.info.sampleIndex + _settings.preSamples;
+            std::cerr << "\n";
+            return;
+        }
+        size_t length = _settings.preSamples + _settings.postSamples;
+        for (size_t i = 0; i < _records.size(); ++i) {
+            auto &record = _records[i];
+            size_t first = _triggers[i] - _settings.preSamples;
+            CHECK_EQ(record.info.id, i);
+            CHECK_EQ(record.info.sampleIndex, first);
+            CHECK_EQ(record.info.timestamp, START_TIME + static_cast<uint64_t>(first * SAMPLE_NS));
+            CHECK_EQ(record.info.channels, 3u);
+            CHECK_EQ(record.info.resolution, 16u);
+            CHECK_EQ(record.info.flags, uint32_t(PACK_FLAG_CLOCK_SYNC | PACK_FLAG_TRIGGERED | PACK_FLAG_RECORD_START));
+            CHECK_EQ(record.ch1.size(), length);
+            CHECK_EQ(record.ch2.size(), length);
+            if (record.ch1.size() != length || record.ch2.size() != length)
+                continue;
+            for (size_t k = 0; k < length; ++k) {
+                if (record.ch1[k] != _signal[first + k] || record.ch2[k] != static_cast<int16_t>(first + k)) {
+                    std::cerr << "block " << _block << " record " << i << " sample " << k << "\n";
+                    CHECK(false);
+                    break;
+                }
+            }
+        }
+    }
+
+    void check(const TriggerSettings &_settings, const std::vector<int16_t> &_signal, const std::vector<size_t> &_triggers){
+        for (size_t block : g_blockSizes) {
+            auto gate = CTriggerGate::Create(_settings, 16, 1 << 20);
+            CHECK(gate != nullptr);
+            if (!gate)
+                return;
+            checkRecords(run(*gate, _signal, block), _signal, _triggers, _settings, block);
+            CHECK_EQ(gate->records(), _triggers.size());
+            CHECK_EQ(gate->discarded(), 0u);
+        }
+    }
+
+    void testEdges(){
+        auto signal = pulses(4000, {500, 1500, 2600}, 200);
+        check(settings(TriggerEdge::RISING, 50, 100), signal, {500, 1500, 2600});
+        check(settings(TriggerEdge::FALLING, 50, 100), signal, {700, 1700, 2800});
+        check(settings(TriggerEdge::BOTH, 50, 100), signal, {500, 700, 1500, 1700, 2600, 2800});
+        // No samples before the trigger
+        check(settings(TriggerEdge::RISING, 0, 10), signal, {500, 1500, 2600});
+    }
+
+    // Crossing the level again without going back through the hysteresis does not trigger
+    void testRearm(){
+        auto signal = pulses(3000, {500}, 200);
+        for (size_t i = 700; i < 800; ++i)
+            signal[i] = -50;                // Above level - hysteresis
+        for (size_t i = 800; i < 900; ++i)
+            signal[i] = 1000;
+        for (size_t i = 1200; i < 1300; ++i)
+            signal[i] = 1000;               // Armed again at 900
+        check(settings(TriggerEdge::RISING, 20, 50), signal, {500, 1200});
+
+        // The trigger is searched for after the end of a window only, the edge at 540 is inside
+        // the window of 500 and the one at 600 is not armed, the low samples before it are
+        // inside the window as well
+        signal = pulses(3000, {500, 540, 600, 1000}, 20);
+        check(settings(TriggerEdge::RISING, 20, 100), signal, {500, 1000});
+        check(settings(TriggerEdge::RISING, 20, 50), signal, {500, 600, 1000});
+    }
+
+    // The pre trigger part needs samples from before the stream started
+    void testStart(){
+        auto signal = pulses(2000, {30, 1000}, 100);
+        check(settings(TriggerEdge::RISING, 50, 100), signal, {1000});
+        check(settings(TriggerEdge::RISING, 30, 100), signal, {30, 1000});
+    }
+
+    // A window longer than a block takes samples from several earlier blocks
+    void testLongWindow(){
+        auto signal = pulses(50000, {20000, 40000}, 5000);
+        check(settings(TriggerEdge::BOTH, 12345, 4000), signal, {20000, 25000, 40000, 45000});
+    }
+
+    void testGap(){
+        auto signal = pulses(6000, {1000, 3000, 4100, 5000}, 200);
+        auto trigger = settings(TriggerEdge::RISING, 100, 300);
+        for (size_t block : g_blockSizes) {
+            // [1100, 1150) is lost while the record of 1000 is captured, its record is dropped.
+            // After the gap the history starts again: the trigger at 3000 has enough samples.
+            auto gate = CTriggerGate::Create(trigger, 16, 1 << 20);
+            auto records = run(*gate, signal, block, 1100, 1150);
+            checkRecords(records, signal, {3000, 4100, 5000}, trigger, block);
+            CHECK_EQ(gate->discarded(), 1u);
+            // A gap in the pre trigger window of 4100
+            gate = CTriggerGate::Create(trigger, 16, 1 << 20);
+            records = run(*gate, signal, block, 4020, 4050);
+            checkRecords(records, signal, {1000, 3000, 5000}, trigger, block);
+            CHECK_EQ(gate->discarded(), 0u);
+        }
+    }
+
+    void test8Bit(){
+        std::vector<int8_t> signal(1000, -100);
+        for (size_t i = 300; i < 400; ++i)
+            signal[i] = 100;
+        auto trigger = settings(TriggerEdge::RISING, 10, 20);
+        trigger.hysteresis = 5;
+        auto gate = CTriggerGate::Create(trigger, 8, 1000);
+        CHECK(gate != nullptr);
+        if (!gate)
+            return;
+        std::vector<std::vector<int8_t>> records;
+        asionet::PackInfo info = {};
+        info.resolution = 8;
+        gate->process(info, SAMPLE_NS, signal.data(), signal.size(), nullptr, 0,
+            [&records](const asionet::PackInfo &_info, const void *_ch1, size_t _size1, const void *, size_t _size2){
+                CHECK_EQ(_info.channels, 1u);
+                CHECK_EQ(_info.sampleIndex, 290u);
+                CHECK_EQ(_size2, 0u);
+                records.emplace_back(static_cast<const int8_t*>(_ch1), static_cast<const int8_t*>(_ch1) + _size1);
+            });
+        CHECK_EQ(records.size(), 1u);
+        if (records.size() == 1)
+            CHECK(records[0] == std::vector<int8_t>(signal.begin() + 290, signal.begin() + 320));
+    }
+
+    void testCreate(){
+        auto trigger = settings(TriggerEdge::RISING, 100, 100);
+        CHECK(CTriggerGate::Create(trigger, 16, 400) != nullptr);
+        CHECK(!CTriggerGate::Create(trigger, 16, 399));
+        CHECK(CTriggerGate::Create(trigger, 8, 200) != nullptr);
+        trigger.postSamples = 0;
+        CHECK(!CTriggerGate::Create(trigger, 16, 400));
+        trigger = settings(TriggerEdge::RISING, 100, 100);
+        trigger.channel = 3;
+        CHECK(!CTriggerGate::Create(trigger, 16, 400));
+    }
+}
+
+int main(){
+    testEdges();
+    testRearm();
+    testStart();
+    testLongWindow();
+    testGap();
+    test8Bit();
+    testCreate();
+    return checkResult();
+}